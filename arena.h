@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for data that lives exactly as long as one compilation,
+// such as the AST. Allocation is a pointer bump; everything is released at
+// once by arena_free.
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* head;
+    size_t bytes_used;     // Sum of all allocations, including alignment padding
+    size_t bytes_reserved; // Sum of all block sizes
+    size_t block_count;
+} Arena;
+
+void arena_init(Arena* arena);
+void* arena_alloc(Arena* arena, size_t size);
+char* arena_strndup(Arena* arena, const char* text, size_t length);
+void arena_free(Arena* arena);
+
+#endif // ARENA_H
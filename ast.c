@@ -1,261 +1,282 @@
-#include <string.h> // For strdup
 #include "ast.h"
+#include <stdio.h>
 #include <stdlib.h>
-// Ensure string.h is definitely at the top or very early
 
-ASTNode* ast_node_new(NodeType type) {
-    ASTNode* node = (ASTNode*)malloc(sizeof(ASTNode));
-    node->type = type;
-    node->next = NULL;
+// The node columns and the extra/scratch arrays are growable heap arrays;
+// the strings nodes own are copied into the compilation's arena. Releasing
+// the tree is a handful of frees plus arena_free.
+
+#define INITIAL_NODE_CAPACITY 1024
+#define INITIAL_EXTRA_CAPACITY 1024
+#define INITIAL_STRING_CAPACITY 64
+#define INITIAL_SCRATCH_CAPACITY 64
+
+static void* resize_array(void* array, uint32_t capacity, size_t element_size) {
+    void* resized = realloc(array, (size_t)capacity * element_size);
+    if (!resized) {
+        fprintf(stderr, "Error: Out of memory growing the AST\n");
+        exit(1);
+    }
+    return resized;
+}
+
+static void* grow_array(void* array, uint32_t* capacity, size_t element_size) {
+    *capacity *= 2;
+    return resize_array(array, *capacity, element_size);
+}
+
+void ast_init(AST* ast, Arena* arena) {
+    ast->node_capacity = INITIAL_NODE_CAPACITY;
+    ast->kinds = (uint8_t*)malloc(ast->node_capacity);
+    ast->operators = (uint8_t*)malloc(ast->node_capacity);
+    ast->lhs = (uint32_t*)malloc(ast->node_capacity * sizeof(uint32_t));
+    ast->rhs = (uint32_t*)malloc(ast->node_capacity * sizeof(uint32_t));
+
+    // Node 0 is the AST_NONE placeholder.
+    ast->kinds[0] = NODE_PROGRAM;
+    ast->operators[0] = 0;
+    ast->lhs[0] = 0;
+    ast->rhs[0] = 0;
+    ast->node_count = 1;
+
+    ast->extra_capacity = INITIAL_EXTRA_CAPACITY;
+    ast->extra = (uint32_t*)malloc(ast->extra_capacity * sizeof(uint32_t));
+    ast->extra_count = 0;
+
+    ast->string_capacity = INITIAL_STRING_CAPACITY;
+    ast->strings = (const char**)malloc(ast->string_capacity * sizeof(const char*));
+    ast->strings[0] = NULL;
+    ast->string_count = 1;
+
+    ast->scratch_capacity = INITIAL_SCRATCH_CAPACITY;
+    ast->scratch = (NodeIndex*)malloc(ast->scratch_capacity * sizeof(NodeIndex));
+    ast->scratch_count = 0;
+
+    ast->arena = arena;
+    ast->root = AST_NONE;
+}
+
+void ast_free(AST* ast) {
+    free(ast->kinds);
+    free(ast->operators);
+    free(ast->lhs);
+    free(ast->rhs);
+    free(ast->extra);
+    free((void*)ast->strings);
+    free(ast->scratch);
+}
+
+size_t ast_memory_used(const AST* ast) {
+    return (size_t)ast->node_count * (2 * sizeof(uint8_t) + 2 * sizeof(uint32_t)) +
+           (size_t)ast->extra_count * sizeof(uint32_t) +
+           (size_t)ast->string_count * sizeof(const char*);
+}
+
+static NodeIndex add_node(AST* ast, NodeType kind, uint32_t lhs, uint32_t rhs) {
+    if (ast->node_count == ast->node_capacity) {
+        ast->node_capacity *= 2;
+        ast->kinds = (uint8_t*)resize_array(ast->kinds, ast->node_capacity, sizeof(uint8_t));
+        ast->operators = (uint8_t*)resize_array(ast->operators, ast->node_capacity, sizeof(uint8_t));
+        ast->lhs = (uint32_t*)resize_array(ast->lhs, ast->node_capacity, sizeof(uint32_t));
+        ast->rhs = (uint32_t*)resize_array(ast->rhs, ast->node_capacity, sizeof(uint32_t));
+    }
+    NodeIndex node = ast->node_count++;
+    ast->kinds[node] = (uint8_t)kind;
+    ast->operators[node] = 0;
+    ast->lhs[node] = lhs;
+    ast->rhs[node] = rhs;
     return node;
 }
 
-Program* program_new() {
-    Program* program = (Program*)malloc(sizeof(Program));
-    program->base.type = NODE_PROGRAM;
-    program->base.next = NULL;
-    program->statements = NULL;
-    return program;
-}
-
-VarDeclaration* var_declaration_new(char* name, ASTNode* size, ASTNode* value) {
-    VarDeclaration* var_decl = (VarDeclaration*)malloc(sizeof(VarDeclaration));
-    var_decl->base.type = NODE_VAR_DECLARATION;
-    var_decl->base.next = NULL;
-    var_decl->name = strdup(name);
-    var_decl->size = size;
-    var_decl->value = value;
-    return var_decl;
-}
-
-FunctionDeclaration* function_declaration_new(char* name, ASTNode* parameters, ASTNode* body) {
-    FunctionDeclaration* func_decl = (FunctionDeclaration*)malloc(sizeof(FunctionDeclaration));
-    func_decl->base.type = NODE_FUNCTION_DECLARATION;
-    func_decl->base.next = NULL;
-    func_decl->name = strdup(name);
-    func_decl->parameters = parameters;
-    func_decl->body = body;
-    return func_decl;
-}
-
-ReturnStatement* return_statement_new(ASTNode* return_value) {
-    ReturnStatement* ret_stmt = (ReturnStatement*)malloc(sizeof(ReturnStatement));
-    ret_stmt->base.type = NODE_RETURN_STATEMENT;
-    ret_stmt->base.next = NULL;
-    ret_stmt->return_value = return_value;
-    return ret_stmt;
-}
-
-ExpressionStatement* expression_statement_new(ASTNode* expression) {
-    ExpressionStatement* expr_stmt = (ExpressionStatement*)malloc(sizeof(ExpressionStatement));
-    expr_stmt->base.type = NODE_EXPRESSION_STATEMENT;
-    expr_stmt->base.next = NULL;
-    expr_stmt->expression = expression;
-    return expr_stmt;
-}
-
-BlockStatement* block_statement_new(ASTNode* statements) {
-    BlockStatement* block_stmt = (BlockStatement*)malloc(sizeof(BlockStatement));
-    block_stmt->base.type = NODE_BLOCK_STATEMENT;
-    block_stmt->base.next = NULL;
-    block_stmt->statements = statements;
-    return block_stmt;
-}
-
-Identifier* identifier_new(char* value) {
-    Identifier* ident = (Identifier*)malloc(sizeof(Identifier));
-    ident->base.type = NODE_IDENTIFIER;
-    ident->base.next = NULL;
-    ident->value = strdup(value);
-    return ident;
-}
-
-NumberLiteral* number_literal_new(char* value) {
-    NumberLiteral* num_lit = (NumberLiteral*)malloc(sizeof(NumberLiteral));
-    num_lit->base.type = NODE_NUMBER_LITERAL;
-    num_lit->base.next = NULL;
-    num_lit->value = strdup(value);
-    return num_lit;
-}
-
-AsciiLiteral* ascii_literal_new(char* value) {
-    AsciiLiteral* ascii_lit = (AsciiLiteral*)malloc(sizeof(AsciiLiteral));
-    ascii_lit->base.type = NODE_ASCII_LITERAL;
-    ascii_lit->base.next = NULL;
-    ascii_lit->value = strdup(value);
-    return ascii_lit;
-}
-
-StringLiteral* string_literal_new(char* value) {
-    StringLiteral* str_lit = (StringLiteral*)malloc(sizeof(StringLiteral));
-    str_lit->base.type = NODE_STRING_LITERAL;
-    str_lit->base.next = NULL;
-    str_lit->value = strdup(value);
-    return str_lit;
-}
-
-AssignExpression* assign_expression_new(ASTNode* name, ASTNode* value) {
-    AssignExpression* assign_expr = (AssignExpression*)malloc(sizeof(AssignExpression));
-    assign_expr->base.type = NODE_ASSIGN_EXPRESSION;
-    assign_expr->base.next = NULL;
-    assign_expr->name = name;
-    assign_expr->value = value;
-    return assign_expr;
-}
-
-CallExpression* call_expression_new(ASTNode* function, ASTNode* arguments) {
-    CallExpression* call_expr = (CallExpression*)malloc(sizeof(CallExpression));
-    call_expr->base.type = NODE_CALL_EXPRESSION;
-    call_expr->base.next = NULL;
-    call_expr->function = function;
-    call_expr->arguments = arguments;
-    return call_expr;
-}
-
-ForLoop* for_loop_new(ASTNode* init, ASTNode* condition, ASTNode* increment, ASTNode* body) {
-    ForLoop* for_loop = (ForLoop*)malloc(sizeof(ForLoop));
-    for_loop->base.type = NODE_FOR_LOOP;
-    for_loop->base.next = NULL;
-    for_loop->init = init;
-    for_loop->condition = condition;
-    for_loop->increment = increment;
-    for_loop->body = body;
-    return for_loop;
-}
-
-WhileLoop* while_loop_new(ASTNode* condition, ASTNode* body) {
-    WhileLoop* while_loop = (WhileLoop*)malloc(sizeof(WhileLoop));
-    while_loop->base.type = NODE_WHILE_LOOP;
-    while_loop->base.next = NULL;
-    while_loop->condition = condition;
-    while_loop->body = body;
-    return while_loop;
-}
-
-ImportStatement* import_statement_new(ImportType import_type, char* path, char* alias, ASTNode* imports) {
-    ImportStatement* import_stmt = (ImportStatement*)malloc(sizeof(ImportStatement));
-    import_stmt->base.type = NODE_IMPORT_STATEMENT;
-    import_stmt->base.next = NULL;
-    import_stmt->import_type = import_type;
-    import_stmt->path = strdup(path);
-    import_stmt->alias = alias ? strdup(alias) : NULL;
-    import_stmt->imports = imports;
-    return import_stmt;
-}
-
-BinaryExpression* binary_expression_new(ASTNode* left, BinaryOperator operator, ASTNode* right) {
-    BinaryExpression* bin_expr = (BinaryExpression*)malloc(sizeof(BinaryExpression));
-    bin_expr->base.type = NODE_BINARY_EXPRESSION;
-    bin_expr->base.next = NULL;
-    bin_expr->left = left;
-    bin_expr->operator = operator;
-    bin_expr->right = right;
-    return bin_expr;
-}
-
-IndexExpression* index_expression_new(ASTNode* array, ASTNode* index) {
-    IndexExpression* index_expr = (IndexExpression*)malloc(sizeof(IndexExpression));
-    index_expr->base.type = NODE_INDEX_EXPRESSION;
-    index_expr->base.next = NULL;
-    index_expr->array = array;
-    index_expr->index = index;
-    return index_expr;
-}
-
-void ast_node_list_free(ASTNode* node_list) {
-    ASTNode* current = node_list;
-    ASTNode* next;
-    while (current != NULL) {
-        next = current->next;
-        ast_node_free(current); // Free the node itself
-        current = next;
+// Appends `count` values to the extra array and returns the first index.
+static uint32_t add_extra(AST* ast, const uint32_t* values, uint32_t count) {
+    while (ast->extra_count + count > ast->extra_capacity) {
+        ast->extra = (uint32_t*)grow_array(ast->extra, &ast->extra_capacity, sizeof(uint32_t));
+    }
+    uint32_t start = ast->extra_count;
+    for (uint32_t i = 0; i < count; i++) {
+        ast->extra[start + i] = values[i];
+    }
+    ast->extra_count += count;
+    return start;
+}
+
+static uint32_t add_string(AST* ast, const char* value, size_t length) {
+    if (ast->string_count == ast->string_capacity) {
+        ast->strings = (const char**)grow_array((void*)ast->strings, &ast->string_capacity, sizeof(const char*));
     }
+    ast->strings[ast->string_count] = arena_strndup(ast->arena, value, length);
+    return ast->string_count++;
 }
 
-void ast_node_free(ASTNode* node) {
-    if (!node) return;
-
-    // Free members specific to each node type
-    // For pointers to other ASTNodes that are NOT part of a list managed by 'next',
-    // call ast_node_free.
-    // For pointers to ASTNode lists (like statements, parameters),
-    // call ast_node_list_free.
-    switch (node->type) {
-        case NODE_PROGRAM:
-            ast_node_list_free(((Program*)node)->statements);
-            break;
-        case NODE_VAR_DECLARATION:
-            free(((VarDeclaration*)node)->name);
-            ast_node_free(((VarDeclaration*)node)->size); // size is a single expression
-            ast_node_free(((VarDeclaration*)node)->value); // value is a single expression
-            break;
-        case NODE_FUNCTION_DECLARATION:
-            free(((FunctionDeclaration*)node)->name);
-            ast_node_list_free(((FunctionDeclaration*)node)->parameters); // parameters is a list
-            ast_node_free(((FunctionDeclaration*)node)->body); // body is a single BlockStatement
-            break;
-        case NODE_RETURN_STATEMENT:
-            ast_node_free(((ReturnStatement*)node)->return_value);
-            break;
-        case NODE_EXPRESSION_STATEMENT:
-            ast_node_free(((ExpressionStatement*)node)->expression);
-            break;
-        case NODE_BLOCK_STATEMENT:
-            ast_node_list_free(((BlockStatement*)node)->statements); // statements is a list
-            break;
-        case NODE_IDENTIFIER:
-            free(((Identifier*)node)->value);
-            break;
-        case NODE_NUMBER_LITERAL:
-            free(((NumberLiteral*)node)->value);
-            break;
-        case NODE_ASCII_LITERAL:
-            free(((AsciiLiteral*)node)->value);
-            break;
-        case NODE_STRING_LITERAL:
-            free(((StringLiteral*)node)->value);
-            break;
-        case NODE_ASSIGN_EXPRESSION:
-            // Note: AssignExpression->name could be an Identifier or IndexExpression.
-            // It's a single node, not a list.
-            ast_node_free(((AssignExpression*)node)->name);
-            ast_node_free(((AssignExpression*)node)->value);
-            break;
-        case NODE_CALL_EXPRESSION:
-            ast_node_free(((CallExpression*)node)->function); // function is a single expression (e.g. identifier)
-            ast_node_list_free(((CallExpression*)node)->arguments); // arguments is a list of expressions
-            break;
-        case NODE_FOR_LOOP:
-            ast_node_free(((ForLoop*)node)->init);
-            ast_node_free(((ForLoop*)node)->condition);
-            ast_node_free(((ForLoop*)node)->increment);
-            ast_node_free(((ForLoop*)node)->body); // body is a single BlockStatement
-            break;
-        case NODE_WHILE_LOOP:
-            ast_node_free(((WhileLoop*)node)->condition);
-            ast_node_free(((WhileLoop*)node)->body); // body is a single BlockStatement
-            break;
-        case NODE_IMPORT_STATEMENT:
-            free(((ImportStatement*)node)->path);
-            if (((ImportStatement*)node)->alias) free(((ImportStatement*)node)->alias);
-            ast_node_list_free(((ImportStatement*)node)->imports); // imports is a list of identifiers
-            break;
-        case NODE_BINARY_EXPRESSION:
-            ast_node_free(((BinaryExpression*)node)->left);
-            ast_node_free(((BinaryExpression*)node)->right);
-            break;
-        case NODE_INDEX_EXPRESSION:
-            ast_node_free(((IndexExpression*)node)->array);
-            ast_node_free(((IndexExpression*)node)->index);
-            break;
-        // No default case needed as all node types should be handled.
-        // If a new node type is added, it must be added here.
+uint32_t ast_list_begin(AST* ast) {
+    return ast->scratch_count;
+}
+
+void ast_list_push(AST* ast, NodeIndex node) {
+    if (ast->scratch_count == ast->scratch_capacity) {
+        ast->scratch = (NodeIndex*)grow_array(ast->scratch, &ast->scratch_capacity, sizeof(NodeIndex));
     }
+    ast->scratch[ast->scratch_count++] = node;
+}
+
+void ast_list_discard(AST* ast, uint32_t mark) {
+    ast->scratch_count = mark;
+}
+
+// Moves the children pushed since `mark` into extra; returns their start.
+// The end of the run is the new extra_count.
+static uint32_t commit_list(AST* ast, uint32_t mark) {
+    uint32_t start = add_extra(ast, ast->scratch + mark, ast->scratch_count - mark);
+    ast->scratch_count = mark;
+    return start;
+}
+
+NodeIndex program_new(AST* ast, uint32_t statements_mark) {
+    uint32_t start = commit_list(ast, statements_mark);
+    return add_node(ast, NODE_PROGRAM, start, ast->extra_count);
+}
 
-    // Free the node itself. The 'next' pointer is handled by ast_node_list_free
-    // for nodes that are part of a list. Individual nodes not in lists will have 'next' as NULL
-    // or it's managed by their parent list structure.
-    free(node);
+NodeIndex var_declaration_new(AST* ast, Symbol name, NodeIndex size, NodeIndex value) {
+    uint32_t operands[2] = { size, value };
+    return add_node(ast, NODE_VAR_DECLARATION, name, add_extra(ast, operands, 2));
 }
 
+NodeIndex function_declaration_new(AST* ast, Symbol name, uint32_t parameters_mark, NodeIndex body) {
+    uint32_t start = commit_list(ast, parameters_mark);
+    uint32_t operands[3] = { start, ast->extra_count, body };
+    return add_node(ast, NODE_FUNCTION_DECLARATION, name, add_extra(ast, operands, 3));
+}
+
+NodeIndex return_statement_new(AST* ast, NodeIndex return_value) {
+    return add_node(ast, NODE_RETURN_STATEMENT, return_value, 0);
+}
 
+NodeIndex expression_statement_new(AST* ast, NodeIndex expression) {
+    return add_node(ast, NODE_EXPRESSION_STATEMENT, expression, 0);
+}
+
+NodeIndex block_statement_new(AST* ast, uint32_t statements_mark) {
+    uint32_t start = commit_list(ast, statements_mark);
+    return add_node(ast, NODE_BLOCK_STATEMENT, start, ast->extra_count);
+}
+
+NodeIndex identifier_new(AST* ast, Symbol name) {
+    return add_node(ast, NODE_IDENTIFIER, name, 0);
+}
+
+// Literal values are split across the two operands: low half in lhs, high
+// half in rhs.
+static NodeIndex add_literal(AST* ast, NodeType kind, int64_t value) {
+    uint64_t bits = (uint64_t)value;
+    return add_node(ast, kind, (uint32_t)bits, (uint32_t)(bits >> 32));
+}
+
+NodeIndex number_literal_new(AST* ast, int64_t value) {
+    return add_literal(ast, NODE_NUMBER_LITERAL, value);
+}
+
+NodeIndex ascii_literal_new(AST* ast, int64_t value) {
+    return add_literal(ast, NODE_ASCII_LITERAL, value);
+}
+
+NodeIndex string_literal_new(AST* ast, const char* value, size_t length) {
+    return add_node(ast, NODE_STRING_LITERAL, add_string(ast, value, length), 0);
+}
+
+NodeIndex assign_expression_new(AST* ast, NodeIndex name, NodeIndex value) {
+    return add_node(ast, NODE_ASSIGN_EXPRESSION, name, value);
+}
+
+NodeIndex call_expression_new(AST* ast, NodeIndex function, uint32_t arguments_mark) {
+    uint32_t start = commit_list(ast, arguments_mark);
+    uint32_t operands[2] = { start, ast->extra_count };
+    return add_node(ast, NODE_CALL_EXPRESSION, function, add_extra(ast, operands, 2));
+}
+
+NodeIndex for_loop_new(AST* ast, NodeIndex init, NodeIndex condition, NodeIndex increment, NodeIndex body) {
+    uint32_t operands[3] = { init, condition, increment };
+    return add_node(ast, NODE_FOR_LOOP, add_extra(ast, operands, 3), body);
+}
+
+NodeIndex while_loop_new(AST* ast, NodeIndex condition, NodeIndex body) {
+    return add_node(ast, NODE_WHILE_LOOP, condition, body);
+}
+
+NodeIndex import_statement_new(AST* ast, ImportType import_type, const char* path, size_t path_length, Symbol alias, uint32_t imports_mark) {
+    uint32_t start = commit_list(ast, imports_mark);
+    uint32_t operands[5] = { import_type, add_string(ast, path, path_length), alias, start, ast->extra_count };
+    return add_node(ast, NODE_IMPORT_STATEMENT, add_extra(ast, operands, 5), 0);
+}
+
+NodeIndex binary_expression_new(AST* ast, NodeIndex left, BinaryOperator operator, NodeIndex right) {
+    NodeIndex node = add_node(ast, NODE_BINARY_EXPRESSION, left, right);
+    ast->operators[node] = (uint8_t)operator;
+    return node;
+}
+
+NodeIndex index_expression_new(AST* ast, NodeIndex array, NodeIndex index) {
+    return add_node(ast, NODE_INDEX_EXPRESSION, array, index);
+}
+
+static NodeList make_list(const AST* ast, uint32_t start, uint32_t end) {
+    NodeList list;
+    list.items = ast->extra + start;
+    list.count = end - start;
+    return list;
+}
+
+NodeList ast_statements(const AST* ast, NodeIndex node) {
+    return make_list(ast, ast->lhs[node], ast->rhs[node]);
+}
+
+NodeIndex ast_var_size(const AST* ast, NodeIndex node) {
+    return ast->extra[ast->rhs[node]];
+}
+
+NodeIndex ast_var_value(const AST* ast, NodeIndex node) {
+    return ast->extra[ast->rhs[node] + 1];
+}
+
+NodeList ast_function_parameters(const AST* ast, NodeIndex node) {
+    const uint32_t* operands = ast->extra + ast->rhs[node];
+    return make_list(ast, operands[0], operands[1]);
+}
+
+NodeIndex ast_function_body(const AST* ast, NodeIndex node) {
+    return ast->extra[ast->rhs[node] + 2];
+}
+
+NodeList ast_call_arguments(const AST* ast, NodeIndex node) {
+    const uint32_t* operands = ast->extra + ast->rhs[node];
+    return make_list(ast, operands[0], operands[1]);
+}
+
+NodeIndex ast_for_init(const AST* ast, NodeIndex node) {
+    return ast->extra[ast->lhs[node]];
+}
+
+NodeIndex ast_for_condition(const AST* ast, NodeIndex node) {
+    return ast->extra[ast->lhs[node] + 1];
+}
+
+NodeIndex ast_for_increment(const AST* ast, NodeIndex node) {
+    return ast->extra[ast->lhs[node] + 2];
+}
+
+ImportType ast_import_type(const AST* ast, NodeIndex node) {
+    return (ImportType)ast->extra[ast->lhs[node]];
+}
+
+const char* ast_import_path(const AST* ast, NodeIndex node) {
+    return ast->strings[ast->extra[ast->lhs[node] + 1]];
+}
+
+Symbol ast_import_alias(const AST* ast, NodeIndex node) {
+    return ast->extra[ast->lhs[node] + 2];
+}
+
+NodeList ast_import_names(const AST* ast, NodeIndex node) {
+    const uint32_t* operands = ast->extra + ast->lhs[node];
+    return make_list(ast, operands[3], operands[4]);
+}
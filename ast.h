@@ -1,6 +1,11 @@
 #ifndef AST_H
 #define AST_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "intern.h"
+
 typedef enum {
     NODE_PROGRAM,
     NODE_VAR_DECLARATION,
@@ -21,105 +26,11 @@ typedef enum {
     NODE_INDEX_EXPRESSION,
 } NodeType;
 
-typedef struct ASTNode {
-    NodeType type;
-    // Common fields for all nodes
-    struct ASTNode* next;
-} ASTNode;
-
-typedef struct {
-    ASTNode base;
-    ASTNode* statements;
-} Program;
-
-typedef struct {
-    ASTNode base;
-    char* name;
-    ASTNode* size;
-    ASTNode* value;
-} VarDeclaration;
-
-typedef struct {
-    ASTNode base;
-    char* name;
-    ASTNode* parameters;
-    ASTNode* body;
-} FunctionDeclaration;
-
-typedef struct {
-    ASTNode base;
-    ASTNode* return_value;
-} ReturnStatement;
-
-typedef struct {
-    ASTNode base;
-    ASTNode* expression;
-} ExpressionStatement;
-
-typedef struct {
-    ASTNode base;
-    ASTNode* statements;
-} BlockStatement;
-
-typedef struct {
-    ASTNode base;
-    char* value;
-} Identifier;
-
-typedef struct {
-    ASTNode base;
-    char* value;
-} NumberLiteral;
-
-typedef struct {
-    ASTNode base;
-    char* value;
-} AsciiLiteral;
-
-typedef struct {
-    ASTNode base;
-    char* value;
-} StringLiteral;
-
-typedef struct {
-    ASTNode base;
-    ASTNode* name;
-    ASTNode* value;
-} AssignExpression;
-
-typedef struct {
-    ASTNode base;
-    ASTNode* function;
-    ASTNode* arguments;
-} CallExpression;
-
-typedef struct {
-    ASTNode base;
-    ASTNode* init;
-    ASTNode* condition;
-    ASTNode* increment;
-    ASTNode* body;
-} ForLoop;
-
-typedef struct {
-    ASTNode base;
-    ASTNode* condition;
-    ASTNode* body;
-} WhileLoop;
-
 typedef enum {
     IMPORT_TYPE_ALIAS,
     IMPORT_TYPE_DESTRUCTURED,
 } ImportType;
 
-typedef struct {
-    ASTNode base;
-    ImportType import_type;
-    char* path;
-    char* alias;
-    ASTNode* imports; // For destructured imports (list of identifiers)
-} ImportStatement;
-
 typedef enum {
     BIN_OP_EQ,
     BIN_OP_NEQ,
@@ -134,43 +45,123 @@ typedef enum {
     BIN_OP_MODULO,
 } BinaryOperator;
 
-typedef struct {
-    ASTNode base;
-    ASTNode* left;
-    BinaryOperator operator;
-    ASTNode* right;
-} BinaryExpression;
-
-
-typedef struct {
-    ASTNode base;
-    ASTNode* array;
-    ASTNode* index;
-} IndexExpression;
-
-// Function prototypes for AST node creation
-ASTNode* ast_node_new(NodeType type);
-Program* program_new();
-VarDeclaration* var_declaration_new(char* name, ASTNode* size, ASTNode* value);
-FunctionDeclaration* function_declaration_new(char* name, ASTNode* parameters, ASTNode* body);
-ReturnStatement* return_statement_new(ASTNode* return_value);
-ExpressionStatement* expression_statement_new(ASTNode* expression);
-BlockStatement* block_statement_new(ASTNode* statements);
-Identifier* identifier_new(char* value);
-NumberLiteral* number_literal_new(char* value);
-AsciiLiteral* ascii_literal_new(char* value);
-StringLiteral* string_literal_new(char* value);
-AssignExpression* assign_expression_new(ASTNode* name, ASTNode* value);
-CallExpression* call_expression_new(ASTNode* function, ASTNode* arguments);
-ForLoop* for_loop_new(ASTNode* init, ASTNode* condition, ASTNode* increment, ASTNode* body);
-WhileLoop* while_loop_new(ASTNode* condition, ASTNode* body);
-ImportStatement* import_statement_new(ImportType import_type, char* path, char* alias, ASTNode* imports);
-BinaryExpression* binary_expression_new(ASTNode* left, BinaryOperator operator, ASTNode* right);
-IndexExpression* index_expression_new(ASTNode* array, ASTNode* index);
-
-void ast_node_free(ASTNode* node);
-void ast_node_list_free(ASTNode* node_list);
+// Nodes are identified by 32-bit indices into the AST's columns. Index 0 is
+// a placeholder, so AST_NONE doubles as "no node" for optional children.
+typedef uint32_t NodeIndex;
+
+#define AST_NONE 0
+
+// A contiguous run of child node indices stored in the AST's extra array.
+typedef struct {
+    const NodeIndex* items;
+    uint32_t count;
+} NodeList;
+
+// The whole tree, stored as parallel arrays (struct-of-arrays). Each node
+// has a kind, an operator byte and two 32-bit operands whose meaning depends
+// on the kind:
+//
+//   kind                   lhs                      rhs
+//   PROGRAM                statements start (extra) statements end (extra)
+//   BLOCK_STATEMENT        statements start (extra) statements end (extra)
+//   VAR_DECLARATION        name (Symbol)            extra: size, value
+//   FUNCTION_DECLARATION   name (Symbol)            extra: params start, params end, body
+//   RETURN_STATEMENT       value or AST_NONE        -
+//   EXPRESSION_STATEMENT   expression               -
+//   IDENTIFIER             name (Symbol)            -
+//   NUMBER/ASCII_LITERAL   value bits 0-31          value bits 32-63
+//   STRING_LITERAL         text (string index)      -
+//   ASSIGN_EXPRESSION      target                   value
+//   CALL_EXPRESSION        callee                   extra: args start, args end
+//   FOR_LOOP               extra: init, cond, step  body
+//   WHILE_LOOP             condition                body
+//   IMPORT_STATEMENT       extra: type, path, alias, imports start, imports end
+//   BINARY_EXPRESSION      left                     right (operator in `operators`)
+//   INDEX_EXPRESSION       array                    index
+//
+// Children are always created before their parents, so a subtree occupies
+// a contiguous index range ending at its root.
+typedef struct {
+    uint8_t* kinds;
+    uint8_t* operators;
+    uint32_t* lhs;
+    uint32_t* rhs;
+    uint32_t node_count;
+    uint32_t node_capacity;
+
+    uint32_t* extra;
+    uint32_t extra_count;
+    uint32_t extra_capacity;
+
+    // String literal text and import paths, copied into `arena`. Index 0 is
+    // unused.
+    const char** strings;
+    uint32_t string_count;
+    uint32_t string_capacity;
+
+    // Children of lists still being parsed; see ast_list_begin.
+    NodeIndex* scratch;
+    uint32_t scratch_count;
+    uint32_t scratch_capacity;
+
+    Arena* arena;
+    NodeIndex root;
+} AST;
+
+void ast_init(AST* ast, Arena* arena);
+void ast_free(AST* ast);
+size_t ast_memory_used(const AST* ast);
+
+// Lists are built on a scratch stack: take a mark with ast_list_begin, push
+// each child as it is parsed, then pass the mark to the constructor, which
+// moves the children into `extra`. Nested lists are committed before their
+// parent pushes its next child, so one stack serves the whole parse.
+// ast_list_discard drops a list abandoned after a parse error.
+uint32_t ast_list_begin(AST* ast);
+void ast_list_push(AST* ast, NodeIndex node);
+void ast_list_discard(AST* ast, uint32_t mark);
+
+// Node constructors. Each returns the index of the new node.
+NodeIndex program_new(AST* ast, uint32_t statements_mark);
+NodeIndex var_declaration_new(AST* ast, Symbol name, NodeIndex size, NodeIndex value);
+NodeIndex function_declaration_new(AST* ast, Symbol name, uint32_t parameters_mark, NodeIndex body);
+NodeIndex return_statement_new(AST* ast, NodeIndex return_value);
+NodeIndex expression_statement_new(AST* ast, NodeIndex expression);
+NodeIndex block_statement_new(AST* ast, uint32_t statements_mark);
+NodeIndex identifier_new(AST* ast, Symbol name);
+NodeIndex number_literal_new(AST* ast, int64_t value);
+NodeIndex ascii_literal_new(AST* ast, int64_t value);
+NodeIndex string_literal_new(AST* ast, const char* value, size_t length);
+NodeIndex assign_expression_new(AST* ast, NodeIndex name, NodeIndex value);
+NodeIndex call_expression_new(AST* ast, NodeIndex function, uint32_t arguments_mark);
+NodeIndex for_loop_new(AST* ast, NodeIndex init, NodeIndex condition, NodeIndex increment, NodeIndex body);
+NodeIndex while_loop_new(AST* ast, NodeIndex condition, NodeIndex body);
+NodeIndex import_statement_new(AST* ast, ImportType import_type, const char* path, size_t path_length, Symbol alias, uint32_t imports_mark);
+NodeIndex binary_expression_new(AST* ast, NodeIndex left, BinaryOperator operator, NodeIndex right);
+NodeIndex index_expression_new(AST* ast, NodeIndex array, NodeIndex index);
+
+// Accessors. Each one is only meaningful for the node kinds it names.
+static inline NodeType ast_kind(const AST* ast, NodeIndex node) { return (NodeType)ast->kinds[node]; }
+static inline uint32_t ast_lhs(const AST* ast, NodeIndex node) { return ast->lhs[node]; }
+static inline uint32_t ast_rhs(const AST* ast, NodeIndex node) { return ast->rhs[node]; }
+static inline BinaryOperator ast_operator(const AST* ast, NodeIndex node) { return (BinaryOperator)ast->operators[node]; }
+static inline const char* ast_string(const AST* ast, NodeIndex node) { return ast->strings[ast->lhs[node]]; }
+static inline int64_t ast_literal_value(const AST* ast, NodeIndex node) { // NUMBER_LITERAL, ASCII_LITERAL
+    return (int64_t)(((uint64_t)ast->rhs[node] << 32) | ast->lhs[node]);
+}
+
+NodeList ast_statements(const AST* ast, NodeIndex node);     // PROGRAM, BLOCK_STATEMENT
+NodeIndex ast_var_size(const AST* ast, NodeIndex node);      // VAR_DECLARATION
+NodeIndex ast_var_value(const AST* ast, NodeIndex node);     // VAR_DECLARATION
+NodeList ast_function_parameters(const AST* ast, NodeIndex node); // FUNCTION_DECLARATION
+NodeIndex ast_function_body(const AST* ast, NodeIndex node); // FUNCTION_DECLARATION
+NodeList ast_call_arguments(const AST* ast, NodeIndex node); // CALL_EXPRESSION
+NodeIndex ast_for_init(const AST* ast, NodeIndex node);      // FOR_LOOP
+NodeIndex ast_for_condition(const AST* ast, NodeIndex node); // FOR_LOOP
+NodeIndex ast_for_increment(const AST* ast, NodeIndex node); // FOR_LOOP
+ImportType ast_import_type(const AST* ast, NodeIndex node);  // IMPORT_STATEMENT
+const char* ast_import_path(const AST* ast, NodeIndex node); // IMPORT_STATEMENT
+Symbol ast_import_alias(const AST* ast, NodeIndex node);     // IMPORT_STATEMENT
+NodeList ast_import_names(const AST* ast, NodeIndex node);   // IMPORT_STATEMENT
 
 #endif // AST_H
-
-
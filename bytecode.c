@@ -0,0 +1,764 @@
+#include "bytecode.h"
+#include "fold.h"
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The compiler follows lower.c: the same names are globals, locals and
+// arrays, expressions are evaluated in the same order, and a whole
+// expression that assigns to a variable inside it copies the locals it
+// reads. Values are computed straight into the register that wants them,
+// comparisons that decide a branch become compare-and-branch instructions,
+// and loops test their condition at the bottom.
+
+#define BYTECODE_MIN_CAPACITY 64
+
+// Operands of each opcode, one letter each: r register, i immediate,
+// k constant, s global slot, a array, f function, n count, t jump target.
+static const struct {
+    const char* name;
+    const char* operands;
+} opcodes[OP_COUNT] = {
+    [OP_EQ] = { "eq", "rrr" },
+    [OP_NE] = { "ne", "rrr" },
+    [OP_LT] = { "lt", "rrr" },
+    [OP_GT] = { "gt", "rrr" },
+    [OP_LE] = { "le", "rrr" },
+    [OP_GE] = { "ge", "rrr" },
+    [OP_ADD] = { "add", "rrr" },
+    [OP_SUB] = { "sub", "rrr" },
+    [OP_MUL] = { "mul", "rrr" },
+    [OP_DIV] = { "div", "rrr" },
+    [OP_MOD] = { "mod", "rrr" },
+    [OP_JEQ] = { "jeq", "rrt" },
+    [OP_JNE] = { "jne", "rrt" },
+    [OP_JLT] = { "jlt", "rrt" },
+    [OP_JGT] = { "jgt", "rrt" },
+    [OP_JLE] = { "jle", "rrt" },
+    [OP_JGE] = { "jge", "rrt" },
+    [OP_JEQI] = { "jeqi", "rit" },
+    [OP_JNEI] = { "jnei", "rit" },
+    [OP_JLTI] = { "jlti", "rit" },
+    [OP_JGTI] = { "jgti", "rit" },
+    [OP_JLEI] = { "jlei", "rit" },
+    [OP_JGEI] = { "jgei", "rit" },
+    [OP_ADDI] = { "addi", "rri" },
+    [OP_SUBI] = { "subi", "rri" },
+    [OP_MULI] = { "muli", "rri" },
+    [OP_MOV] = { "mov", "rr" },
+    [OP_LOADI] = { "loadi", "ri" },
+    [OP_LOADK] = { "loadk", "rk" },
+    [OP_GET] = { "get", "rs" },
+    [OP_SET] = { "set", "sr" },
+    [OP_GETE] = { "gete", "rra" },
+    [OP_SETE] = { "sete", "arr" },
+    [OP_JMP] = { "jmp", "t" },
+    [OP_JZ] = { "jz", "rt" },
+    [OP_JNZ] = { "jnz", "rt" },
+    [OP_CALL] = { "call", "rfrn" },
+    [OP_TAILCALL] = { "tailcall", "frn" },
+    [OP_PRINTLN] = { "println", "rr" },
+    [OP_RET] = { "ret", "r" },
+    [OP_RET0] = { "ret0", "" },
+};
+
+// The comparison that holds exactly when one does not, in BinaryOperator
+// order.
+static const BinaryOperator negated[] = {
+    BIN_OP_NEQ, BIN_OP_EQ, BIN_OP_GE, BIN_OP_LE, BIN_OP_GT, BIN_OP_LT,
+};
+
+// Set in a register's table entry while a local is out of scope for the
+// condition at the bottom of a loop.
+#define HIDDEN 0x80000000u
+
+// State of the compilation; set by bytecode_compile and compile_function.
+static const AST* ast;
+static Bytecode* bytecode;
+static uint8_t* indexed;          // Symbol -> used as an array
+static int64_t* declared_sizes;   // Symbol -> largest declared array size
+static uint32_t* global_index;    // Symbol -> globals index + 1, or 0
+static uint32_t* function_index;  // Symbol -> functions index + 1, or 0
+static uint32_t* local_regs;      // Symbol -> register + 1, or 0
+static Symbol* bound;             // Symbols with a binding, to clear them
+static uint32_t bound_count;
+static int in_entry;
+static uint32_t local_limit;      // Registers below this are parameters and locals
+static uint32_t next_local;
+static uint32_t top;              // First free temporary
+static uint32_t max_top;
+static int copy_local_reads;
+
+static void expression_to(NodeIndex node, uint32_t dst);
+static void statement(NodeIndex node);
+
+static void* reserve(void* array, uint32_t* capacity, uint32_t needed, size_t element_size) {
+    if (needed <= *capacity) return array;
+    uint32_t new_capacity = *capacity ? *capacity : BYTECODE_MIN_CAPACITY;
+    while (new_capacity < needed) new_capacity *= 2;
+    void* resized = realloc(array, (size_t)new_capacity * element_size);
+    if (!resized) {
+        fprintf(stderr, "Error: Out of memory compiling bytecode\n");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return resized;
+}
+
+static void* zeroed(size_t count, size_t element_size) {
+    void* array = calloc(count, element_size);
+    if (!array) {
+        fprintf(stderr, "Error: Out of memory compiling bytecode\n");
+        exit(1);
+    }
+    return array;
+}
+
+// Appends an instruction, taking as many of the operands as it has, and
+// returns its offset.
+static uint32_t emit(Opcode op, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    uint32_t operands[4] = { a, b, c, d };
+    uint32_t count = (uint32_t)strlen(opcodes[op].operands);
+    uint32_t at = bytecode->code_count;
+    bytecode->code = (uint32_t*)reserve(bytecode->code, &bytecode->code_capacity, at + 1 + count, sizeof(uint32_t));
+    bytecode->code[at] = op;
+    memcpy(bytecode->code + at + 1, operands, count * sizeof(uint32_t));
+    bytecode->code_count = at + 1 + count;
+    return at;
+}
+
+static uint32_t emit1(Opcode op, uint32_t a) { return emit(op, a, 0, 0, 0); }
+static uint32_t emit2(Opcode op, uint32_t a, uint32_t b) { return emit(op, a, b, 0, 0); }
+static uint32_t emit3(Opcode op, uint32_t a, uint32_t b, uint32_t c) { return emit(op, a, b, c, 0); }
+
+// Every jump has its target as its last operand.
+static void set_target(uint32_t jump, uint32_t target) {
+    bytecode->code[jump + strlen(opcodes[bytecode->code[jump]].operands)] = target;
+}
+
+static int fits_imm32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static uint32_t imm32(int64_t value) {
+    return (uint32_t)(int32_t)value;
+}
+
+// The value of a number or character literal that fits an immediate.
+static int immediate(NodeIndex node, int64_t* value) {
+    if (ast_kind(ast, node) != NODE_NUMBER_LITERAL && ast_kind(ast, node) != NODE_ASCII_LITERAL) return 0;
+    *value = ast_literal_value(ast, node);
+    return fits_imm32(*value);
+}
+
+static uint32_t add_constant(int64_t value) {
+    bytecode->constants = (int64_t*)reserve(bytecode->constants, &bytecode->constant_capacity,
+                                            bytecode->constant_count + 1, sizeof(int64_t));
+    bytecode->constants[bytecode->constant_count] = value;
+    return bytecode->constant_count++;
+}
+
+static uint32_t new_temp(void) {
+    uint32_t reg = top++;
+    if (top > max_top) max_top = top;
+    return reg;
+}
+
+static Symbol identifier_symbol(NodeIndex node) {
+    if (ast_kind(ast, node) != NODE_IDENTIFIER) {
+        fprintf(stderr, "Error: Expected an identifier, found node type %d\n", ast_kind(ast, node));
+        exit(1);
+    }
+    return ast_lhs(ast, node);
+}
+
+// The local register of `name` plus one, or 0 if it is not a local here.
+static uint32_t local_of(Symbol name) {
+    return local_regs[name] & HIDDEN ? 0 : local_regs[name];
+}
+
+static void bind_local(Symbol name, uint32_t reg) {
+    local_regs[name] = reg + 1;
+    bound[bound_count++] = name;
+}
+
+// Hides or shows again the locals bound since `from`.
+static void hide_locals(uint32_t from, int hide) {
+    for (uint32_t i = from; i < bound_count; i++) {
+        if (hide) {
+            local_regs[bound[i]] |= HIDDEN;
+        } else {
+            local_regs[bound[i]] &= ~HIDDEN;
+        }
+    }
+}
+
+static uint32_t global_of(Symbol name) {
+    if (global_index[name]) return global_index[name] - 1;
+    int64_t size = declared_sizes[name] > 1 ? declared_sizes[name] : 1;
+    if (size > IR_MAX_GLOBAL_ELEMENTS - (int64_t)bytecode->slot_count) {
+        fprintf(stderr, "Error: Array '%s' is too large\n", symbol_name(name));
+        exit(1);
+    }
+    bytecode->globals = (BytecodeGlobal*)reserve(bytecode->globals, &bytecode->global_capacity,
+                                                 bytecode->global_count + 1, sizeof(BytecodeGlobal));
+    BytecodeGlobal* global = &bytecode->globals[bytecode->global_count];
+    global->name = name;
+    global->slot = bytecode->slot_count;
+    global->size = (uint32_t)size;
+    bytecode->slot_count += (uint32_t)size;
+    global_index[name] = ++bytecode->global_count;
+    return bytecode->global_count - 1;
+}
+
+static uint32_t global_slot(Symbol name) {
+    uint32_t index = global_of(name);
+    return bytecode->globals[index].slot;
+}
+
+static void move(uint32_t dst, uint32_t src) {
+    if (dst != src) emit2(OP_MOV, dst, src);
+}
+
+// A subtree's nodes directly precede its root, and the first child of
+// every expression is created first.
+static NodeIndex subtree_start(NodeIndex node) {
+    for (;;) {
+        switch (ast_kind(ast, node)) {
+            case NODE_ASSIGN_EXPRESSION:
+            case NODE_CALL_EXPRESSION:
+            case NODE_BINARY_EXPRESSION:
+            case NODE_INDEX_EXPRESSION:
+                node = ast_lhs(ast, node);
+                break;
+            default:
+                return node;
+        }
+    }
+}
+
+// Starts a whole expression, noting whether an assignment is nested in it.
+// Returns the flag to restore when it is done.
+static int begin_expression(NodeIndex node) {
+    int saved = copy_local_reads;
+    copy_local_reads = 0;
+    if (bound_count) {
+        for (NodeIndex i = subtree_start(node); i < node && !copy_local_reads; i++) {
+            if (ast_kind(ast, i) == NODE_ASSIGN_EXPRESSION) copy_local_reads = 1;
+        }
+    }
+    return saved;
+}
+
+// Returns a register holding the value of `node`: a local's own register
+// when it reads one, otherwise a new temporary, which the caller releases
+// by resetting `top`.
+static uint32_t expression(NodeIndex node) {
+    if (ast_kind(ast, node) == NODE_IDENTIFIER && local_of(ast_lhs(ast, node)) && !copy_local_reads) {
+        return local_of(ast_lhs(ast, node)) - 1;
+    }
+    uint32_t dst = new_temp();
+    expression_to(node, dst);
+    return dst;
+}
+
+static void binary_to(NodeIndex node, uint32_t dst) {
+    BinaryOperator op = ast_operator(ast, node);
+    uint32_t left = expression(ast_lhs(ast, node));
+    int64_t value;
+    if (op >= BIN_OP_PLUS && op <= BIN_OP_MULTIPLY && immediate(ast_rhs(ast, node), &value)) {
+        emit3((Opcode)(OP_ADDI + (op - BIN_OP_PLUS)), dst, left, imm32(value));
+    } else {
+        uint32_t right = expression(ast_rhs(ast, node));
+        // Opcodes share BinaryOperator's numbering.
+        emit3((Opcode)op, dst, left, right);
+    }
+}
+
+static void assign_to(NodeIndex node, uint32_t dst) {
+    NodeIndex target = ast_lhs(ast, node);
+    NodeIndex value = ast_rhs(ast, node);
+    if (ast_kind(ast, target) == NODE_IDENTIFIER && local_of(ast_lhs(ast, target))) {
+        uint32_t local = local_of(ast_lhs(ast, target)) - 1;
+        expression_to(value, local);
+        move(dst, local);
+    } else if (ast_kind(ast, target) == NODE_IDENTIFIER) {
+        expression_to(value, dst);
+        emit2(OP_SET, global_slot(ast_lhs(ast, target)), dst);
+    } else if (ast_kind(ast, target) == NODE_INDEX_EXPRESSION) {
+        uint32_t array = global_of(identifier_symbol(ast_lhs(ast, target)));
+        // The index is evaluated after the value, and may read the local
+        // that receives it.
+        uint32_t result = dst < local_limit ? new_temp() : dst;
+        expression_to(value, result);
+        uint32_t index = expression(ast_rhs(ast, target));
+        emit3(OP_SETE, array, index, result);
+        move(dst, result);
+    } else {
+        fprintf(stderr, "Error: Invalid assignment target (node type %d)\n", ast_kind(ast, target));
+        exit(1);
+    }
+}
+
+// Evaluates the arguments into consecutive temporaries; returns the first.
+static uint32_t arguments(NodeList list) {
+    uint32_t first = top;
+    for (uint32_t i = 0; i < list.count; i++) {
+        expression_to(list.items[i], new_temp());
+    }
+    return first;
+}
+
+static void call_to(NodeIndex node, uint32_t dst) {
+    Symbol callee = identifier_symbol(ast_lhs(ast, node));
+    NodeList list = ast_call_arguments(ast, node);
+    uint32_t first = arguments(list);
+    if (function_index[callee]) {
+        emit(OP_CALL, dst, function_index[callee] - 1, first, list.count);
+        return;
+    }
+    if (runtime_find_builtin(callee) != BUILTIN_PRINTLN) {
+        fprintf(stderr, "Error: Undefined function '%s'\n", symbol_name(callee));
+        exit(1);
+    }
+    if (!list.count) emit2(OP_LOADI, new_temp(), 0);
+    emit2(OP_PRINTLN, dst, first);
+}
+
+// Evaluates `node` into `dst`. Temporaries it takes are released.
+static void expression_to(NodeIndex node, uint32_t dst) {
+    uint32_t saved = top;
+    switch (ast_kind(ast, node)) {
+        case NODE_IDENTIFIER: {
+            Symbol name = ast_lhs(ast, node);
+            if (local_of(name)) {
+                move(dst, local_of(name) - 1);
+            } else {
+                emit2(OP_GET, dst, global_slot(name));
+            }
+            break;
+        }
+        case NODE_NUMBER_LITERAL:
+        case NODE_ASCII_LITERAL: {
+            int64_t value = ast_literal_value(ast, node);
+            if (fits_imm32(value)) {
+                emit2(OP_LOADI, dst, imm32(value));
+            } else {
+                emit2(OP_LOADK, dst, add_constant(value));
+            }
+            break;
+        }
+        case NODE_STRING_LITERAL:
+            emit2(OP_LOADK, dst, add_constant((int64_t)(intptr_t)ast_string(ast, node)));
+            break;
+        case NODE_ASSIGN_EXPRESSION:
+            assign_to(node, dst);
+            break;
+        case NODE_CALL_EXPRESSION:
+            call_to(node, dst);
+            break;
+        case NODE_BINARY_EXPRESSION:
+            binary_to(node, dst);
+            break;
+        case NODE_INDEX_EXPRESSION: {
+            uint32_t array = global_of(identifier_symbol(ast_lhs(ast, node)));
+            uint32_t index = expression(ast_rhs(ast, node));
+            emit3(OP_GETE, dst, index, array);
+            break;
+        }
+        default:
+            fprintf(stderr, "Error: Unknown expression node type %d\n", ast_kind(ast, node));
+            exit(1);
+    }
+    top = saved;
+}
+
+// Evaluates a whole expression for its effects.
+static void effect(NodeIndex node) {
+    int saved = begin_expression(node);
+    NodeIndex target = ast_lhs(ast, node);
+    if (ast_kind(ast, node) == NODE_ASSIGN_EXPRESSION && ast_kind(ast, target) == NODE_IDENTIFIER &&
+        local_of(ast_lhs(ast, target))) {
+        assign_to(node, local_of(ast_lhs(ast, target)) - 1);
+    } else {
+        uint32_t start = top;
+        expression(node);
+        top = start;
+    }
+    copy_local_reads = saved;
+}
+
+// Emits a jump taken when `condition` is true, or when it is false if
+// `if_true` is 0, and returns it for set_target.
+static uint32_t branch(NodeIndex condition, int if_true) {
+    int saved = begin_expression(condition);
+    uint32_t start = top;
+    uint32_t jump;
+    if (ast_kind(ast, condition) == NODE_BINARY_EXPRESSION && ast_operator(ast, condition) <= BIN_OP_GE) {
+        BinaryOperator op = ast_operator(ast, condition);
+        if (!if_true) op = negated[op];
+        uint32_t left = expression(ast_lhs(ast, condition));
+        int64_t value;
+        if (immediate(ast_rhs(ast, condition), &value)) {
+            jump = emit3((Opcode)(OP_JEQI + op), left, imm32(value), 0);
+        } else {
+            uint32_t right = expression(ast_rhs(ast, condition));
+            jump = emit3((Opcode)(OP_JEQ + op), left, right, 0);
+        }
+    } else {
+        jump = emit2(if_true ? OP_JNZ : OP_JZ, expression(condition), 0);
+    }
+    top = start;
+    copy_local_reads = saved;
+    return jump;
+}
+
+static void var_declaration(NodeIndex node) {
+    Symbol name = ast_lhs(ast, node);
+    NodeIndex size = ast_var_size(ast, node);
+    NodeIndex value = ast_var_value(ast, node);
+    // A scalar declared in a function is local to it, and starts at 0. It
+    // is not in scope in its own initializer.
+    if (!in_entry && size == AST_NONE && !indexed[name]) {
+        uint32_t reg = local_of(name) ? local_of(name) - 1 : next_local;
+        if (value != AST_NONE) {
+            int saved = begin_expression(value);
+            expression_to(value, reg);
+            copy_local_reads = saved;
+        } else {
+            emit2(OP_LOADI, reg, 0);
+        }
+        if (!local_of(name)) bind_local(name, next_local++);
+        return;
+    }
+
+    uint32_t slot = global_slot(name);
+    if (value != AST_NONE) {
+        int saved = begin_expression(value);
+        uint32_t start = top;
+        emit2(OP_SET, slot, expression(value));
+        top = start;
+        copy_local_reads = saved;
+    }
+}
+
+static void return_statement(NodeIndex node) {
+    NodeIndex value = ast_lhs(ast, node);
+    if (value == AST_NONE) {
+        emit(OP_RET0, 0, 0, 0, 0);
+        return;
+    }
+    int saved = begin_expression(value);
+    uint32_t start = top;
+    if (!in_entry && ast_kind(ast, value) == NODE_CALL_EXPRESSION &&
+        function_index[identifier_symbol(ast_lhs(ast, value))]) {
+        // The callee's frame replaces this one.
+        NodeList list = ast_call_arguments(ast, value);
+        uint32_t first = arguments(list);
+        emit3(OP_TAILCALL, function_index[ast_lhs(ast, ast_lhs(ast, value))] - 1, first, list.count);
+    } else {
+        emit1(OP_RET, expression(value));
+    }
+    top = start;
+    copy_local_reads = saved;
+}
+
+static void block(NodeIndex node) {
+    NodeList statements = ast_statements(ast, node);
+    for (uint32_t i = 0; i < statements.count; i++) {
+        statement(statements.items[i]);
+    }
+}
+
+// Emits the test at the bottom of a loop, jumping back to `body`. It sees
+// only the locals bound before the loop, as the test at the top does.
+static void bottom_test(NodeIndex condition, uint32_t bound_before, uint32_t body) {
+    hide_locals(bound_before, 1);
+    set_target(branch(condition, 1), body);
+    hide_locals(bound_before, 0);
+}
+
+//   jump exit unless condition
+//   body: ...
+//   jump body if condition
+//   exit:
+static void while_loop(NodeIndex node) {
+    uint32_t bound_before = bound_count;
+    uint32_t guard = branch(ast_lhs(ast, node), 0);
+    uint32_t body = bytecode->code_count;
+    block(ast_rhs(ast, node));
+    bottom_test(ast_lhs(ast, node), bound_before, body);
+    set_target(guard, bytecode->code_count);
+}
+
+//   init
+//   jump exit unless condition
+//   body: ...
+//   increment
+//   jump body if condition   (jump body without a condition)
+//   exit:
+static void for_loop(NodeIndex node) {
+    NodeIndex init = ast_for_init(ast, node);
+    NodeIndex condition = ast_for_condition(ast, node);
+    NodeIndex increment = ast_for_increment(ast, node);
+
+    if (init != AST_NONE) {
+        if (ast_kind(ast, init) == NODE_VAR_DECLARATION) {
+            var_declaration(init);
+        } else {
+            effect(init);
+        }
+    }
+
+    uint32_t bound_before = bound_count;
+    uint32_t guard = condition != AST_NONE ? branch(condition, 0) : 0;
+    uint32_t body = bytecode->code_count;
+    block(ast_rhs(ast, node));
+    if (increment != AST_NONE) effect(increment);
+    if (condition != AST_NONE) {
+        bottom_test(condition, bound_before, body);
+        set_target(guard, bytecode->code_count);
+    } else {
+        emit1(OP_JMP, body);
+    }
+}
+
+static void statement(NodeIndex node) {
+    switch (ast_kind(ast, node)) {
+        case NODE_VAR_DECLARATION:
+            var_declaration(node);
+            break;
+        case NODE_FUNCTION_DECLARATION:
+            // Compiled separately by bytecode_compile
+            break;
+        case NODE_RETURN_STATEMENT:
+            return_statement(node);
+            break;
+        case NODE_EXPRESSION_STATEMENT:
+            effect(ast_lhs(ast, node));
+            break;
+        case NODE_BLOCK_STATEMENT:
+            block(node);
+            break;
+        case NODE_FOR_LOOP:
+            for_loop(node);
+            break;
+        case NODE_WHILE_LOOP:
+            while_loop(node);
+            break;
+        case NODE_IMPORT_STATEMENT:
+            // Imports are not implemented; they produce no code.
+            break;
+        default:
+            fprintf(stderr, "Error: Unknown statement node type %d\n", ast_kind(ast, node));
+            exit(1);
+    }
+}
+
+// An upper bound on the locals a function body declares, not counting
+// nested functions.
+static uint32_t count_declarations(NodeIndex node) {
+    if (node == AST_NONE) return 0;
+    switch (ast_kind(ast, node)) {
+        case NODE_VAR_DECLARATION:
+            return 1;
+        case NODE_PROGRAM:
+        case NODE_BLOCK_STATEMENT: {
+            NodeList statements = ast_statements(ast, node);
+            uint32_t count = 0;
+            for (uint32_t i = 0; i < statements.count; i++) {
+                count += count_declarations(statements.items[i]);
+            }
+            return count;
+        }
+        case NODE_WHILE_LOOP:
+            return count_declarations(ast_rhs(ast, node));
+        case NODE_FOR_LOOP:
+            return count_declarations(ast_for_init(ast, node)) + count_declarations(ast_rhs(ast, node));
+        default:
+            return 0;
+    }
+}
+
+// Compiles function `index` from `declaration`, or the top-level code if
+// it is AST_NONE. Locals get the registers after the parameters, in the
+// order they are declared; temporaries come after all of them.
+static void compile_function(uint32_t index, NodeIndex declaration) {
+    in_entry = declaration == AST_NONE;
+    NodeIndex body = in_entry ? ast->root : ast_function_body(ast, declaration);
+    NodeList parameters = { NULL, 0 };
+    if (!in_entry) parameters = ast_function_parameters(ast, declaration);
+
+    bytecode->functions[index].entry = bytecode->code_count;
+    bytecode->functions[index].param_count = parameters.count;
+    local_limit = parameters.count + (in_entry ? 0 : count_declarations(body));
+    next_local = parameters.count;
+    top = local_limit;
+    max_top = top;
+
+    for (uint32_t i = 0; i < parameters.count; i++) {
+        Symbol name = ast_lhs(ast, parameters.items[i]);
+        if (indexed[name]) {
+            // A name used as an array anywhere stays a global
+            emit2(OP_SET, global_slot(name), i);
+        } else if (local_of(name)) {
+            move(local_of(name) - 1, i);
+        } else {
+            bind_local(name, i);
+        }
+    }
+    if (body != AST_NONE) block(body);
+    emit(OP_RET0, 0, 0, 0, 0);
+    bytecode->functions[index].frame_size = max_top;
+
+    for (uint32_t i = 0; i < bound_count; i++) local_regs[bound[i]] = 0;
+    bound_count = 0;
+}
+
+void bytecode_compile(const AST* tree, Bytecode* output) {
+    ast = tree;
+    bytecode = output;
+    memset(bytecode, 0, sizeof(*bytecode));
+
+    size_t table_size = (size_t)symbol_count() + 1;
+    indexed = (uint8_t*)zeroed(table_size, sizeof(uint8_t));
+    declared_sizes = (int64_t*)zeroed(table_size, sizeof(int64_t));
+    global_index = (uint32_t*)zeroed(table_size, sizeof(uint32_t));
+    function_index = (uint32_t*)zeroed(table_size, sizeof(uint32_t));
+    local_regs = (uint32_t*)zeroed(table_size, sizeof(uint32_t));
+    bound = (Symbol*)zeroed(table_size, sizeof(Symbol));
+
+    uint32_t declarations = 0;
+    for (NodeIndex node = 1; node < ast->node_count; node++) {
+        NodeType kind = ast_kind(ast, node);
+        if (kind == NODE_INDEX_EXPRESSION && ast_kind(ast, ast_lhs(ast, node)) == NODE_IDENTIFIER) {
+            indexed[ast_lhs(ast, ast_lhs(ast, node))] = 1;
+        } else if (kind == NODE_VAR_DECLARATION && ast_var_size(ast, node) != AST_NONE) {
+            Symbol name = ast_lhs(ast, node);
+            int64_t size = fold_array_size(ast, node);
+            if (size > declared_sizes[name]) declared_sizes[name] = size;
+        } else if (kind == NODE_FUNCTION_DECLARATION) {
+            declarations++;
+        }
+    }
+
+    // Function 0 is the top-level code. Children precede parents in the
+    // node columns, so this finds nested declarations too; a redefinition
+    // keeps the first function's name binding, as in the IR.
+    bytecode->functions = (BytecodeFunction*)zeroed(declarations + 1, sizeof(BytecodeFunction));
+    bytecode->function_count = 1;
+    for (NodeIndex node = 1; node < ast->node_count; node++) {
+        if (ast_kind(ast, node) != NODE_FUNCTION_DECLARATION) continue;
+        Symbol name = ast_lhs(ast, node);
+        bytecode->functions[bytecode->function_count++].name = name;
+        if (!function_index[name]) function_index[name] = bytecode->function_count;
+    }
+
+    compile_function(0, AST_NONE);
+    uint32_t index = 1;
+    for (NodeIndex node = 1; node < ast->node_count; node++) {
+        if (ast_kind(ast, node) == NODE_FUNCTION_DECLARATION) compile_function(index++, node);
+    }
+
+    free(indexed);
+    free(declared_sizes);
+    free(global_index);
+    free(function_index);
+    free(local_regs);
+    free(bound);
+    indexed = NULL;
+    declared_sizes = NULL;
+    global_index = NULL;
+    function_index = NULL;
+    local_regs = NULL;
+    bound = NULL;
+    bytecode = NULL;
+}
+
+void bytecode_free(Bytecode* bytecode) {
+    free(bytecode->code);
+    free(bytecode->constants);
+    free(bytecode->functions);
+    free(bytecode->globals);
+    memset(bytecode, 0, sizeof(*bytecode));
+}
+
+static const char* global_name(const Bytecode* bytecode, uint32_t slot) {
+    for (uint32_t i = 0; i < bytecode->global_count; i++) {
+        if (bytecode->globals[i].slot == slot) return symbol_name(bytecode->globals[i].name);
+    }
+    return "?";
+}
+
+static void print_instruction(const Bytecode* bytecode, uint32_t at, Emitter* out) {
+    const uint32_t* instr = bytecode->code + at;
+    const char* operands = opcodes[instr[0]].operands;
+    emit_text(out, "  ");
+    emit_int(out, at);
+    emit_text(out, ": ");
+    emit_text(out, opcodes[instr[0]].name);
+    for (uint32_t i = 0; operands[i]; i++) {
+        uint32_t operand = instr[1 + i];
+        emit_text(out, i ? ", " : " ");
+        switch (operands[i]) {
+            case 'r':
+                emit_char(out, 'r');
+                emit_int(out, operand);
+                break;
+            case 'i':
+                emit_int(out, (int32_t)operand);
+                break;
+            case 'k':
+                emit_int(out, bytecode->constants[operand]);
+                break;
+            case 's':
+                emit_char(out, '@');
+                emit_text(out, global_name(bytecode, operand));
+                break;
+            case 'a':
+                emit_char(out, '@');
+                emit_text(out, symbol_name(bytecode->globals[operand].name));
+                emit_text(out, "[]");
+                break;
+            case 'f':
+                emit_text(out, symbol_name(bytecode->functions[operand].name));
+                break;
+            case 't':
+                emit_text(out, "-> ");
+                emit_int(out, operand);
+                break;
+            default:
+                emit_int(out, operand);
+                break;
+        }
+    }
+    emit_char(out, '\n');
+}
+
+void bytecode_print(const Bytecode* bytecode, Emitter* out) {
+    for (uint32_t i = 0; i < bytecode->global_count; i++) {
+        emit_text(out, "global @");
+        emit_text(out, symbol_name(bytecode->globals[i].name));
+        if (bytecode->globals[i].size > 1) {
+            emit_char(out, '[');
+            emit_int(out, bytecode->globals[i].size);
+            emit_char(out, ']');
+        }
+        emit_char(out, '\n');
+    }
+    for (uint32_t f = 0; f < bytecode->function_count; f++) {
+        const BytecodeFunction* function = &bytecode->functions[f];
+        emit_text(out, f ? "\nfunc " : "\nentry");
+        if (f) emit_text(out, symbol_name(function->name));
+        emit_text(out, " (");
+        emit_int(out, function->param_count);
+        emit_text(out, " params, ");
+        emit_int(out, function->frame_size);
+        emit_text(out, " registers)\n");
+        uint32_t end = f + 1 < bytecode->function_count ? bytecode->functions[f + 1].entry : bytecode->code_count;
+        for (uint32_t at = function->entry; at < end; at += 1 + (uint32_t)strlen(opcodes[bytecode->code[at]].operands)) {
+            print_instruction(bytecode, at, out);
+        }
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stdint.h>
+#include "ast.h"
+#include "emit.h"
+
+// Register-based bytecode, compiled straight from the AST for programs that
+// run too briefly to be worth compiling to machine code. An instruction is
+// an opcode word followed by its operands, one 32-bit word each. Operands
+// are registers of the current frame (rN), 32-bit immediates, constant pool
+// indices, global slots, array and function indices, and jump targets as
+// word offsets into `code`.
+//
+// A function's parameters are its first registers, its local variables
+// come next, then temporaries. A call passes its arguments in consecutive
+// registers of the caller, which become the callee's first registers.
+
+typedef enum {
+    // a = b op c, in BinaryOperator order
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_GT,
+    OP_LE,
+    OP_GE,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    // Jump to c if a op b, in the same order
+    OP_JEQ,
+    OP_JNE,
+    OP_JLT,
+    OP_JGT,
+    OP_JLE,
+    OP_JGE,
+    // Jump to c if a op immediate b
+    OP_JEQI,
+    OP_JNEI,
+    OP_JLTI,
+    OP_JGTI,
+    OP_JLEI,
+    OP_JGEI,
+    OP_ADDI,     // a = b + immediate c
+    OP_SUBI,
+    OP_MULI,
+    OP_MOV,      // a = b
+    OP_LOADI,    // a = immediate b
+    OP_LOADK,    // a = constants[b]
+    OP_GET,      // a = global slot b
+    OP_SET,      // global slot a = b
+    OP_GETE,     // a = element b of array c
+    OP_SETE,     // element b of array a = c
+    OP_JMP,      // Jump to a
+    OP_JZ,       // Jump to b if a == 0
+    OP_JNZ,      // Jump to b if a != 0
+    OP_CALL,     // a = function b (registers c .. c + d - 1)
+    OP_TAILCALL, // Return function a (registers b .. b + c - 1)
+    OP_PRINTLN,  // println(b); a = 0
+    OP_RET,      // Return a
+    OP_RET0,     // Return 0
+    OP_COUNT,
+} Opcode;
+
+typedef struct {
+    Symbol name;
+    uint32_t entry;       // Offset of the first instruction in `code`
+    uint32_t param_count;
+    uint32_t frame_size;  // Registers used
+} BytecodeFunction;
+
+typedef struct {
+    Symbol name;
+    uint32_t slot;        // First slot of the global
+    uint32_t size;        // In slots; indices are checked against it
+} BytecodeGlobal;
+
+typedef struct {
+    uint32_t* code;
+    uint32_t code_count;
+    uint32_t code_capacity;
+
+    // Values too wide for an immediate, and string addresses. Strings point
+    // into the AST, which must outlive the bytecode.
+    int64_t* constants;
+    uint32_t constant_count;
+    uint32_t constant_capacity;
+
+    // Function 0 is the top-level code, which returns the exit status.
+    BytecodeFunction* functions;
+    uint32_t function_count;
+
+    BytecodeGlobal* globals;
+    uint32_t global_count;
+    uint32_t global_capacity;
+    uint32_t slot_count;
+} Bytecode;
+
+// Compiles the whole tree. Top-level variables, arrays and names used as
+// arrays are globals; scalars declared in functions and parameters are
+// registers, as in lower.c.
+void bytecode_compile(const AST* ast, Bytecode* bytecode);
+void bytecode_free(Bytecode* bytecode);
+
+// Writes a listing of the bytecode, one instruction per line.
+void bytecode_print(const Bytecode* bytecode, Emitter* out);
+
+#endif // BYTECODE_H
@@ -1,442 +1,949 @@
-#include <string.h> // For strlen, strdup, strndup
 #include "codegen.h"
+#include "regalloc.h"
+#include "machine.h"
+#include "peephole.h"
+#include "runtime.h"
+#include "encode.h"
 #include <stdio.h>
 #include <stdlib.h>
-// Ensure string.h is definitely at the top or very early
+#include <string.h>
+
+// The backend walks the IR one function at a time. Virtual registers are
+// mapped to machine registers by the linear-scan allocator; the rest live in
+// stack slots below the saved registers. rax and rdx are reserved for
+// division, return values and memory-to-memory moves, and r11 is a scratch
+// register for operands that have to be in a register. Each function is
+// built as a list of machine instructions, which the peephole optimizer
+// rewrites before it is printed.
+//
+// Calls follow the System V AMD64 convention: the first six arguments go in
+// rdi, rsi, rdx, rcx, r8 and r9, the rest on the stack, and the result comes
+// back in rax. Leaf functions with few spill slots keep them in the red
+// zone below rsp and set up no frame pointer.
+
+// The allocator's pool: caller-saved registers first, then the callee-saved
+// ones given to values that live across calls.
+static const MachineReg registers[] = {
+    REG_RCX, REG_RSI, REG_RDI, REG_R8, REG_R9, REG_R10,
+    REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+#define REGISTER_COUNT ((uint32_t)(sizeof(registers) / sizeof(registers[0])))
+
+static const RegisterPool register_pool = {
+    REGISTER_COUNT,
+    { 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1 },
+};
+
+#define SCRATCH REG_R11
+
+static const MachineReg argument_registers[] = { REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9 };
+
+#define ARGUMENT_REGISTER_COUNT 6
+
+// The red zone is the 128 bytes below rsp that a function may use without
+// moving rsp, as long as it calls nothing.
+#define RED_ZONE_SLOTS 16
+
+#define NO_LABEL UINT32_MAX
+
+// The program and function being compiled, the instruction list being built
+// and the buffer receiving the assembly, or the object file receiving the
+// machine code; set by generate_assembly or generate_object and
+// generate_function.
+static const IrProgram* program;
+static const IrFunction* function;
+static MachineFunction code;
+static Allocation allocation;
+static uint32_t* use_counts;  // Reads of each virtual register
+static uint32_t saved_count;  // Callee-saved registers pushed by the prologue
+static int frameless;         // No rbp frame; spill slots are in the red zone
+static Emitter* out;
+static ObjectFile* object;
+static int optimize_level;
+static int uses_runtime;      // The program calls a builtin or checks an index; see runtime.h
+static uint32_t bounds_label; // Calls RUNTIME_INDEX_ERROR, or NO_LABEL
+
+// The register defined by a load that was folded into the next instruction
+// as a memory operand, and the global it reads.
+static IrReg folded_reg;
+static Symbol folded_symbol;
+
+static int fits_imm32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
 
-static int label_count = 0;
-
-static void generate_expression(ASTNode* node, FILE* output_file);
-static void generate_statement(ASTNode* node, FILE* output_file);
+// Spill slots sit below rbp and the callee-saved registers, or below rsp
+// in a frameless function.
+static MOperand location_operand(IrReg reg) {
+    const Location* location = &allocation.locations[reg];
+    if (location->reg >= 0) return mreg64(registers[location->reg]);
+    if (frameless) return mstack(REG_RSP, -8 * ((int64_t)location->slot + 1));
+    return mstack(REG_RBP, -8 * ((int64_t)saved_count + location->slot + 1));
+}
 
-static void generate_label(FILE* output_file, const char* prefix) {
-    fprintf(output_file, "%s%d:\n", prefix, label_count++);
+// Where the caller left parameter `index`: an argument register, or the
+// stack above the return address.
+static MOperand parameter_operand(uint32_t index) {
+    if (index < ARGUMENT_REGISTER_COUNT) return mreg64(argument_registers[index]);
+    int64_t offset = 8 * (int64_t)(index - ARGUMENT_REGISTER_COUNT);
+    if (frameless) return mstack(REG_RSP, 8 * ((int64_t)saved_count + 1) + offset);
+    return mstack(REG_RBP, 16 + offset);
 }
 
-// Helper to switch to .data section if not already there (conceptual)
-// In practice, we'll manage data segment accumulation separately or ensure it's written first.
-// For now, we will ensure .data section directives are appropriately placed.
-
-static void generate_var_declaration_data(VarDeclaration* var_decl, FILE* output_file) {
-    // This function is intended to be called when accumulating .data section parts.
-    // For now, we assume it's called appropriately before .text section generation.
-    fprintf(output_file, "section .data\n");
-    fprintf(output_file, "global %s\n", var_decl->name); // Make variable accessible globally for now
-    fprintf(output_file, "%s: dq 0 ; Default to 0, initialized later if value provided\n", var_decl->name);
-}
-
-static void generate_var_declaration_init(VarDeclaration* var_decl, FILE* output_file) {
-    // This function generates the code to initialize the variable in .text section
-    if (var_decl->value) {
-        fprintf(output_file, "; Initialize Variable: %s\n", var_decl->name);
-        generate_expression(var_decl->value, output_file);
-        fprintf(output_file, "  pop rax\n");
-        fprintf(output_file, "  mov [rel %s], rax\n", var_decl->name);
-    }
-}
-
-
-static void generate_println_function(FILE* output_file) {
-    fprintf(output_file, "section .text\n");
-    fprintf(output_file, "global println\n");
-    fprintf(output_file, "println:\n");
-    fprintf(output_file, "  push rbp\n");
-    fprintf(output_file, "  mov rbp, rsp\n");
-    fprintf(output_file, "  sub rsp, 64   ; Allocate space for buffer and locals (e.g., 16 for buffer, rest for alignment/other locals)\n");
-
-    // Assume integer to print is in RDI (first argument by x64 convention)
-    // Convert integer to string (simplified version, handles positive numbers and zero)
-    fprintf(output_file, "  mov rax, rdi       ; RAX = number to print\n");
-    fprintf(output_file, "  lea rsi, [rbp-16] ; RSI = buffer address (16 bytes on stack)\n");
-    fprintf(output_file, "  add rsi, 15      ; Point to the end of the buffer\n");
-    fprintf(output_file, "  mov byte [rsi], 0  ; Null terminator\n");
-    fprintf(output_file, "  dec rsi\n");
-    fprintf(output_file, "  mov rcx, 10        ; Divisor\n");
-
-    fprintf(output_file, ".Lprintln_d2s_loop:\n");
-    fprintf(output_file, "  xor rdx, rdx\n");
-    fprintf(output_file, "  div rcx            ; RAX = RAX / 10, RDX = RAX %% 10\n");
-    fprintf(output_file, "  add rdx, '0'       ; Convert digit to ASCII\n");
-    fprintf(output_file, "  mov [rsi], dl      ; Store digit\n");
-    fprintf(output_file, "  dec rsi\n");
-    fprintf(output_file, "  test rax, rax\n");
-    fprintf(output_file, "  jnz .Lprintln_d2s_loop\n");
-
-    // Handle zero case (if loop didn't run)
-    fprintf(output_file, "  cmp rsi, [rbp-16+14] ; Check if anything was written (rsi moved from end-1)\n");
-    fprintf(output_file, "  jle .Lprintln_d2s_not_zero\n");
-    fprintf(output_file, "  mov byte [rsi], '0'\n");
-    fprintf(output_file, "  dec rsi\n");
-    fprintf(output_file, ".Lprintln_d2s_not_zero:\n");
-
-    fprintf(output_file, "  inc rsi            ; Point to start of the string\n");
-
-    // Calculate length of the string
-    fprintf(output_file, "  lea rdx, [rbp-16+15]\n"); // End of buffer (null terminator position)
-    fprintf(output_file, "  sub rdx, rsi         ; RDX = length\n");
-
-    // Syscall write
-    fprintf(output_file, "  mov rax, 1         ; syscall number for write\n");
-    fprintf(output_file, "  mov rdi, 1         ; stdout file descriptor\n");
-    // RSI already has string address
-    // RDX already has length
-    fprintf(output_file, "  syscall\n");
-
-    // Print newline
-    fprintf(output_file, "  mov rax, 1\n");
-    fprintf(output_file, "  mov rdi, 1\n");
-    fprintf(output_file, "  lea rsi, [rel .Lprintln_newline]\n");
-    fprintf(output_file, "  mov rdx, 1\n");
-    fprintf(output_file, "  syscall\n");
-
-    fprintf(output_file, "  mov rsp, rbp\n");
-    fprintf(output_file, "  pop rbp\n");
-    fprintf(output_file, "  ret\n");
-
-    fprintf(output_file, "section .data\n");
-    fprintf(output_file, ".Lprintln_newline: db 0x0a\n");
-}
-
-
-static void generate_function_declaration(FunctionDeclaration* func_decl, FILE* output_file) {
-    fprintf(output_file, "; Function Declaration: %s\n", func_decl->name);
-    fprintf(output_file, "section .text\n"); // Ensure we are in .text section for function code
-    fprintf(output_file, "global %s\n", func_decl->name);
-    fprintf(output_file, "%s:\n", func_decl->name);
-
-    // Function prologue
-    fprintf(output_file, "  push rbp\n");
-    fprintf(output_file, "  mov rbp, rsp\n");
-
-    // Handle parameters (for now, just a placeholder)
-    // In x86_64, parameters are passed in registers (RDI, RSI, RDX, RCX, R8, R9) then stack
-
-    if (func_decl->body) {
-        BlockStatement* block = (BlockStatement*)func_decl->body;
-        ASTNode* current_stmt = block->statements;
-        while (current_stmt) {
-            generate_statement(current_stmt, output_file);
-            current_stmt = current_stmt->next;
-        }
+// Where an IR operand lives at the point it is read: a register, an
+// immediate, a spill slot or, for a load folded into its user, a global.
+static MOperand operand_location(IrOperand operand) {
+    if (operand.kind == IR_OPERAND_REG && folded_reg != IR_NO_REG && (IrReg)operand.value == folded_reg) {
+        return mglobal(folded_symbol, REG_NONE);
     }
+    if (operand.kind == IR_OPERAND_REG) return location_operand((IrReg)operand.value);
+    return mimm(operand.value);
+}
 
-    // Function epilogue (if no explicit return)
-    fprintf(output_file, "  mov rsp, rbp\n");
-    fprintf(output_file, "  pop rbp\n");
-    fprintf(output_file, "  ret\n");
+// Loads a constant into a register with the shortest encoding: xor for zero,
+// a zero-extending 32-bit mov for small positive values, a sign-extended
+// imm32 for small negative ones and the full 64-bit immediate otherwise.
+static void generate_load_immediate(MachineReg reg, int64_t value) {
+    if (value == 0) {
+        machine_emit2(&code, M_XOR, mreg(reg, 4), mreg(reg, 4));
+    } else if (value > 0 && value <= UINT32_MAX) {
+        machine_emit2(&code, M_MOV, mreg(reg, 4), mimm(value));
+    } else {
+        machine_emit2(&code, M_MOV, mreg64(reg), mimm(value));
+    }
 }
 
-static void generate_return_statement(ReturnStatement* ret_stmt, FILE* output_file) {
-    fprintf(output_file, "; Return Statement\n");
-    if (ret_stmt->return_value) {
-        generate_expression(ret_stmt->return_value, output_file);
-        fprintf(output_file, "  pop rax\n"); // Return value in RAX
+static void generate_load(MachineReg reg, const MOperand* value) {
+    if (value->kind == MOPERAND_IMM) {
+        generate_load_immediate(reg, value->value);
+    } else if (!moperand_is_reg(value, reg)) {
+        machine_emit2(&code, M_MOV, mreg64(reg), *value);
     }
-    fprintf(output_file, "  mov rsp, rbp\n");
-    fprintf(output_file, "  pop rbp\n");
-    fprintf(output_file, "  ret\n");
 }
 
-static void generate_expression_statement(ExpressionStatement* expr_stmt, FILE* output_file) {
-    fprintf(output_file, "; Expression Statement\n");
-    generate_expression(expr_stmt->expression, output_file);
+// The register an instruction computes its result in: the destination's
+// own register, or the scratch register when the destination is spilled.
+static MachineReg result_register(IrReg dst) {
+    const Location* location = &allocation.locations[dst];
+    return location->reg >= 0 ? registers[location->reg] : SCRATCH;
 }
 
-static void generate_block_statement(BlockStatement* block_stmt, FILE* output_file) {
-    fprintf(output_file, "; Block Statement\n");
-    ASTNode* current_stmt = block_stmt->statements;
-    while (current_stmt) {
-        generate_statement(current_stmt, output_file);
-        current_stmt = current_stmt->next;
+// Moves a result computed in `reg` to the destination's location.
+static void generate_store_result(IrReg dst, MachineReg reg) {
+    MOperand destination = location_operand(dst);
+    if (!moperand_is_reg(&destination, reg)) machine_emit2(&code, M_MOV, destination, mreg64(reg));
+}
+
+// Makes `value` usable as the source operand of an ALU instruction, which
+// takes a register, a memory operand or a sign-extended imm32.
+static MOperand source_operand(MOperand value, MachineReg via) {
+    if (value.kind == MOPERAND_IMM && !fits_imm32(value.value)) {
+        generate_load_immediate(via, value.value);
+        return mreg64(via);
     }
+    return value;
 }
 
-static void generate_identifier(Identifier* ident, FILE* output_file) {
-    fprintf(output_file, "; Identifier: %s\n", ident->value);
-    // For now, assume identifiers are variables and load their value
-    fprintf(output_file, "  push qword [rel %s]\n", ident->value);
+// The condition under which a comparison opcode holds.
+static int comparison_condition(IrOp op, Condition* cond) {
+    static const Condition conditions[] = {
+        [IR_EQ] = COND_E, [IR_NE] = COND_NE, [IR_LT] = COND_L,
+        [IR_GT] = COND_G, [IR_LE] = COND_LE, [IR_GE] = COND_GE,
+    };
+    if (op > IR_GE) return 0;
+    *cond = conditions[op];
+    return 1;
 }
 
-static void generate_number_literal(NumberLiteral* num_lit, FILE* output_file) {
-    fprintf(output_file, "; Number Literal: %s\n", num_lit->value);
-    fprintf(output_file, "  push %s\n", num_lit->value);
+// Emits "cmp a, b" for a comparison instruction. The left operand of cmp
+// must be a register or memory, and at most one side may be memory.
+static void generate_compare(const IrInstr* instr) {
+    MOperand left = operand_location(instr->a);
+    MOperand right = source_operand(operand_location(instr->b), REG_RAX);
+    if (left.kind == MOPERAND_IMM || (moperand_is_memory(&left) && moperand_is_memory(&right))) {
+        generate_load(SCRATCH, &left);
+        left = mreg64(SCRATCH);
+    }
+    machine_emit2(&code, M_CMP, left, right);
 }
 
-static void generate_ascii_literal(AsciiLiteral* ascii_lit, FILE* output_file) {
-    fprintf(output_file, "; ASCII Literal: %s\n", ascii_lit->value);
-    char* val_str = strdup(ascii_lit->value);
-    val_str[strlen(val_str) - 1] = '\0'; // Remove the 'a'
-    int ascii_val = atoi(val_str);
-    free(val_str);
-    fprintf(output_file, "  push %d\n", ascii_val);
+static void generate_comparison(const IrInstr* instr) {
+    Condition cond;
+    comparison_condition((IrOp)instr->op, &cond);
+    generate_compare(instr);
+    MachineReg result = result_register(instr->dst);
+    machine_setcc(&code, cond, result);
+    machine_emit2(&code, M_MOVZX, mreg(result, 4), mreg(result, 1)); // Zero-extend to the full register
+    generate_store_result(instr->dst, result);
 }
 
-static void generate_string_literal(StringLiteral* str_lit, FILE* output_file) {
-    fprintf(output_file, "; String Literal: %s\n", str_lit->value);
-    // For now, just push the address of the string data
-    // In a real transpiler, this would involve defining the string in .data section
-    fprintf(output_file, "section .data\n");
-    fprintf(output_file, "str_%d: db \"%s\", 0\n", label_count, str_lit->value);
-    fprintf(output_file, "section .text\n");
-    fprintf(output_file, "  push str_%d\n", label_count++);
+// Signed division by a constant d (|d| >= 2, not a power of two) as a
+// multiplication by a "magic" reciprocal, following Granlund and
+// Montgomery (Hacker's Delight, 10-1): q = (mulhi(x, M) [+/- x]) >> shift,
+// plus one if that is negative, to truncate towards zero.
+static void division_magic(int64_t divisor, int64_t* multiplier, int* shift) {
+    const uint64_t two63 = (uint64_t)1 << 63;
+    uint64_t ad = divisor < 0 ? 0 - (uint64_t)divisor : (uint64_t)divisor;
+    uint64_t t = two63 + ((uint64_t)divisor >> 63);
+    uint64_t anc = t - 1 - t % ad; // Absolute value of nc
+    int p = 63;
+    uint64_t q1 = two63 / anc, r1 = two63 - q1 * anc;
+    uint64_t q2 = two63 / ad, r2 = two63 - q2 * ad;
+    uint64_t delta;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    *multiplier = (int64_t)(q2 + 1);
+    if (divisor < 0) *multiplier = (int64_t)(0 - (uint64_t)*multiplier);
+    *shift = p - 64;
+}
+
+// Returns k if |value| is 2^k with 1 <= k <= 62, else 0.
+static int power_of_two(int64_t value) {
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    if (magnitude < 2 || (magnitude & (magnitude - 1)) || magnitude > ((uint64_t)1 << 62)) return 0;
+    int k = 0;
+    while (magnitude >>= 1) k++;
+    return k;
 }
 
-static void generate_assign_expression(AssignExpression* assign_expr, FILE* output_file) {
-    fprintf(output_file, "; Assignment Expression\n");
-    generate_expression(assign_expr->value, output_file);
-    fprintf(output_file, "  pop rax\n");
-    // Assuming assignment to an identifier (variable)
-    if (assign_expr->name->type == NODE_IDENTIFIER) {
-        Identifier* ident = (Identifier*)assign_expr->name;
-        fprintf(output_file, "  mov [rel %s], rax\n", ident->value);
-    } else if (assign_expr->name->type == NODE_INDEX_EXPRESSION) {
-        IndexExpression* index_expr = (IndexExpression*)assign_expr->name;
-        generate_expression(index_expr->index, output_file);
-        fprintf(output_file, "  pop rbx\n"); // index
-        // Assuming array is an identifier
-        Identifier* array_ident = (Identifier*)index_expr->array;
-        fprintf(output_file, "  mov [rel %s + rbx*8], rax\n", array_ident->value); // Assuming 8-byte elements
+// Division and remainder by a power of two 2^k. Shifting rounds towards
+// negative infinity, so negative dividends are first biased by 2^k - 1,
+// taken from their sign bits: bias = (x >> 63) >>> (64 - k).
+static void generate_division_by_power_of_two(const IrInstr* instr, const MOperand* left, int k) {
+    int64_t divisor = instr->b.value;
+    generate_load(REG_RAX, left);
+    machine_emit2(&code, M_MOV, mreg64(REG_RDX), mreg64(REG_RAX));
+    if (k > 1) machine_emit2(&code, M_SAR, mreg64(REG_RDX), mimm(63));
+    machine_emit2(&code, M_SHR, mreg64(REG_RDX), mimm(64 - k));
+    machine_emit2(&code, M_ADD, mreg64(REG_RAX), mreg64(REG_RDX));
+    if (instr->op == IR_DIV) {
+        machine_emit2(&code, M_SAR, mreg64(REG_RAX), mimm(k));
+        if (divisor < 0) machine_emit1(&code, M_NEG, mreg64(REG_RAX));
+    } else {
+        // The remainder takes the dividend's sign: ((x + bias) & (2^k - 1)) - bias
+        int64_t mask = ((int64_t)1 << k) - 1;
+        if (fits_imm32(mask)) {
+            machine_emit2(&code, M_AND, mreg64(REG_RAX), mimm(mask));
+        } else {
+            generate_load_immediate(SCRATCH, mask);
+            machine_emit2(&code, M_AND, mreg64(REG_RAX), mreg64(SCRATCH));
+        }
+        machine_emit2(&code, M_SUB, mreg64(REG_RAX), mreg64(REG_RDX));
     }
+    generate_store_result(instr->dst, REG_RAX);
 }
 
-static void generate_call_expression(CallExpression* call_expr, FILE* output_file) {
-    fprintf(output_file, "; Call Expression\n");
-    // Push arguments onto stack or into registers (x86_64 calling convention)
-    // For simplicity, assume no arguments for now, or push them onto stack in reverse order
-    // This needs proper argument handling based on x86_64 calling convention
+static void generate_division_by_constant(const IrInstr* instr, MOperand left) {
+    int64_t divisor = instr->b.value;
+    int64_t multiplier;
+    int shift;
+    division_magic(divisor, &multiplier, &shift);
+    // The one-operand imul needs the dividend in a register or memory.
+    if (left.kind == MOPERAND_IMM) {
+        generate_load_immediate(SCRATCH, left.value);
+        left = mreg64(SCRATCH);
+    }
+    generate_load_immediate(REG_RAX, multiplier);
+    machine_emit1(&code, M_IMUL, left); // rdx = high 64 bits of x * M
+    if (divisor > 0 && multiplier < 0) machine_emit2(&code, M_ADD, mreg64(REG_RDX), left);
+    if (divisor < 0 && multiplier > 0) machine_emit2(&code, M_SUB, mreg64(REG_RDX), left);
+    if (shift) machine_emit2(&code, M_SAR, mreg64(REG_RDX), mimm(shift));
+    machine_emit2(&code, M_MOV, mreg64(REG_RAX), mreg64(REG_RDX));
+    machine_emit2(&code, M_SHR, mreg64(REG_RAX), mimm(63));
+    machine_emit2(&code, M_ADD, mreg64(REG_RDX), mreg64(REG_RAX)); // Quotient
+    if (instr->op == IR_DIV) {
+        generate_store_result(instr->dst, REG_RDX);
+        return;
+    }
+    // x - q * d
+    if (fits_imm32(divisor)) {
+        machine_emit3(&code, M_IMUL, mreg64(REG_RDX), mreg64(REG_RDX), mimm(divisor));
+    } else {
+        generate_load_immediate(REG_RAX, divisor);
+        machine_emit2(&code, M_IMUL, mreg64(REG_RDX), mreg64(REG_RAX));
+    }
+    generate_load(REG_RAX, &left);
+    machine_emit2(&code, M_SUB, mreg64(REG_RAX), mreg64(REG_RDX));
+    generate_store_result(instr->dst, REG_RAX);
+}
 
-    if (call_expr->function->type == NODE_IDENTIFIER) {
-        Identifier* func_ident = (Identifier*)call_expr->function;
-        fprintf(output_file, "  call %s\n", func_ident->value);
-        fprintf(output_file, "  push rax\n"); // Push return value (RAX) onto stack
+static void generate_division(const IrInstr* instr) {
+    MOperand left = operand_location(instr->a);
+    MOperand right = operand_location(instr->b);
+    if (optimize_level >= 1 && right.kind == MOPERAND_IMM) {
+        // Dividing by 0 or -1 can trap and is left to idiv; fold.c has
+        // already turned x / 1 into x and x % 1 into 0.
+        int k = power_of_two(right.value);
+        if (k) {
+            generate_division_by_power_of_two(instr, &left, k);
+            return;
+        }
+        if (right.value != 0 && right.value != -1 && right.value != 1 && right.value != INT64_MIN) {
+            generate_division_by_constant(instr, left);
+            return;
+        }
+    }
+    generate_load(REG_RAX, &left);
+    // idiv has no immediate form
+    if (right.kind == MOPERAND_IMM) {
+        generate_load_immediate(SCRATCH, right.value);
+        right = mreg64(SCRATCH);
+    }
+    machine_emit0(&code, M_CQO); // Sign-extend RAX into RDX
+    machine_emit1(&code, M_IDIV, right);
+    // Quotient is in RAX, remainder in RDX
+    generate_store_result(instr->dst, instr->op == IR_DIV ? REG_RAX : REG_RDX);
+}
+
+// Multiplication by a constant with cheaper instructions: neg for -1, a
+// shift for powers of two and lea for 3, 5 and 9. Returns 0 if none fits.
+static int generate_multiply_by_constant(IrReg dst, MachineReg result, const MOperand* left, int64_t multiplier) {
+    int k = multiplier > 0 ? power_of_two(multiplier) : 0;
+    if (multiplier == -1 || k) {
+        generate_load(result, left);
+        if (k) {
+            machine_emit2(&code, M_SHL, mreg64(result), mimm(k));
+        } else {
+            machine_emit1(&code, M_NEG, mreg64(result));
+        }
+    } else if (multiplier == 3 || multiplier == 5 || multiplier == 9) {
+        MachineReg source = result;
+        if (left->kind == MOPERAND_REG) {
+            source = (MachineReg)left->reg;
+        } else {
+            generate_load(result, left);
+        }
+        machine_emit2(&code, M_LEA, mreg64(result), maddress(source, source, (int)multiplier - 1, 0));
+    } else {
+        return 0;
     }
+    generate_store_result(dst, result);
+    return 1;
 }
 
-static void generate_for_loop(ForLoop* for_loop, FILE* output_file) {
-    fprintf(output_file, "; For Loop\n");
-    int loop_label = label_count++;
-    int end_label = label_count++;
+// add, sub and imul are two-address: the left operand is copied into the
+// result register, which the right operand is then combined into.
+static void generate_arithmetic(const IrInstr* instr) {
+    MachineReg result = result_register(instr->dst);
+    MOperand left = operand_location(instr->a);
+    MOperand right = operand_location(instr->b);
+
+    if (moperand_is_reg(&right, result) && !moperand_is_reg(&left, result)) {
+        if (instr->op == IR_ADD || instr->op == IR_MUL) {
+            MOperand swapped = left;
+            left = right;
+            right = swapped;
+        } else {
+            // Copying the left operand in would overwrite the right one
+            machine_emit2(&code, M_MOV, mreg64(REG_RAX), mreg64(result));
+            right = mreg64(REG_RAX);
+        }
+    }
+
+    if (instr->op == IR_MUL && right.kind == MOPERAND_IMM && fits_imm32(right.value) &&
+        left.kind != MOPERAND_IMM) {
+        if (optimize_level >= 1 && generate_multiply_by_constant(instr->dst, result, &left, right.value)) return;
+        // Three-operand form: result = left * imm
+        machine_emit3(&code, M_IMUL, mreg64(result), left, right);
+        generate_store_result(instr->dst, result);
+        return;
+    }
 
-    // Initialization
-    if (for_loop->init) {
-        generate_expression(for_loop->init, output_file);
-        fprintf(output_file, "  pop rax\n"); // Consume result of init expression
+    right = source_operand(right, REG_RAX);
+    generate_load(result, &left);
+    static const MOpcode opcodes[] = { [IR_ADD] = M_ADD, [IR_SUB] = M_SUB, [IR_MUL] = M_IMUL };
+    machine_emit2(&code, opcodes[instr->op], mreg64(result), right);
+    generate_store_result(instr->dst, result);
+}
+
+// Copies a value to a register or memory. Memory-to-memory moves and
+// 64-bit immediates into memory go through `via`.
+static void generate_copy(MOperand destination, MOperand value, MachineReg via) {
+    if (destination.kind == MOPERAND_REG) {
+        generate_load((MachineReg)destination.reg, &value);
+        return;
     }
+    if (moperand_equal(&value, &destination)) return;
+    if (moperand_is_memory(&value) || (value.kind == MOPERAND_IMM && !fits_imm32(value.value))) {
+        generate_load(via, &value);
+        value = mreg64(via);
+    }
+    machine_emit2(&code, M_MOV, destination, value);
+}
 
-    fprintf(output_file, "_for_loop_%d:\n", loop_label);
+static void generate_move(IrReg dst, MOperand value) {
+    generate_copy(location_operand(dst), value, REG_RAX);
+}
 
-    // Condition
-    if (for_loop->condition) {
-        generate_expression(for_loop->condition, output_file);
-        fprintf(output_file, "  pop rax\n");
-        fprintf(output_file, "  cmp rax, 0\n"); // Compare with 0 (false)
-        fprintf(output_file, "  je _for_end_%d\n", end_label);
+typedef struct {
+    MOperand destination;
+    MOperand source;
+} Move;
+
+// Performs moves as if all sources were read before any destination is
+// written, which passing arguments and receiving parameters need: their
+// registers overlap the allocator's. A move is made once no other pending
+// move reads its destination; when only cycles are left, one destination
+// is saved in rax and read from there instead. Destinations are distinct,
+// and only registers can be both a source and a destination.
+static void generate_parallel_move(Move* moves, uint32_t count) {
+    while (count) {
+        uint32_t ready = count;
+        for (uint32_t i = 0; i < count && ready == count; i++) {
+            int blocked = 0;
+            for (uint32_t j = 0; j < count && !blocked; j++) {
+                blocked = j != i && moperand_equal(&moves[j].source, &moves[i].destination);
+            }
+            if (!blocked) ready = i;
+        }
+        if (ready == count) {
+            MOperand saved = moves[0].destination;
+            machine_emit2(&code, M_MOV, mreg64(REG_RAX), saved);
+            for (uint32_t j = 0; j < count; j++) {
+                if (moperand_equal(&moves[j].source, &saved)) moves[j].source = mreg64(REG_RAX);
+            }
+            ready = 0;
+        }
+        generate_copy(moves[ready].destination, moves[ready].source, SCRATCH);
+        moves[ready] = moves[--count];
     }
+}
 
-    // Body
-    if (for_loop->body) {
-        generate_block_statement((BlockStatement*)for_loop->body, output_file);
+// Stack arguments are pushed right to left, with padding first if needed
+// to keep rsp 16-byte aligned at the call; register arguments are moved in
+// last so the pushes can still read them.
+static void generate_call(const IrInstr* instr) {
+    const IrOperand* args = &function->args[instr->target];
+    uint32_t count = instr->other;
+    uint32_t stack_args = count > ARGUMENT_REGISTER_COUNT ? count - ARGUMENT_REGISTER_COUNT : 0;
+    int64_t pushed = 8 * ((int64_t)stack_args + (stack_args % 2));
+    if (stack_args % 2) machine_emit2(&code, M_SUB, mreg64(REG_RSP), mimm(8));
+    for (uint32_t i = count; i-- > ARGUMENT_REGISTER_COUNT;) {
+        MOperand value = operand_location(args[i]);
+        if (value.kind == MOPERAND_IMM && !fits_imm32(value.value)) {
+            generate_load_immediate(SCRATCH, value.value);
+            value = mreg64(SCRATCH);
+        }
+        machine_emit1(&code, M_PUSH, value);
     }
 
-    // Increment
-    if (for_loop->increment) {
-        generate_expression(for_loop->increment, output_file);
-        fprintf(output_file, "  pop rax\n"); // Consume result of increment expression
+    Move moves[ARGUMENT_REGISTER_COUNT];
+    uint32_t move_count = 0;
+    for (uint32_t i = 0; i < count && i < ARGUMENT_REGISTER_COUNT; i++) {
+        moves[move_count].destination = mreg64(argument_registers[i]);
+        moves[move_count].source = operand_location(args[i]);
+        move_count++;
     }
+    generate_parallel_move(moves, move_count);
 
-    fprintf(output_file, "  jmp _for_loop_%d\n", loop_label);
-    fprintf(output_file, "_for_end_%d:\n", end_label);
+    machine_emit1(&code, M_CALL, mfunction(instr->symbol));
+    if (pushed) machine_emit2(&code, M_ADD, mreg64(REG_RSP), mimm(pushed));
+    generate_store_result(instr->dst, REG_RAX); // Return value is in RAX
 }
 
-static void generate_while_loop(WhileLoop* while_loop, FILE* output_file) {
-    fprintf(output_file, "; While Loop\n");
-    int loop_label = label_count++;
-    int end_label = label_count++;
+// Moves the leading PARAM instructions' values from where the caller put
+// them; returns how many there are.
+static uint32_t generate_parameters(const IrBlock* block) {
+    uint32_t count = 0;
+    while (count < block->count && block->instrs[count].op == IR_PARAM) count++;
+    if (!count) return 0;
+    Move* moves = (Move*)malloc(count * sizeof(Move));
+    if (!moves) {
+        fprintf(stderr, "Error: Out of memory receiving parameters\n");
+        exit(1);
+    }
+    uint32_t move_count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const IrInstr* instr = &block->instrs[i];
+        // An unused parameter may share its register with another
+        if (!use_counts[instr->dst]) continue;
+        moves[move_count].destination = location_operand(instr->dst);
+        moves[move_count].source = parameter_operand(instr->target);
+        move_count++;
+    }
+    generate_parallel_move(moves, move_count);
+    free(moves);
+    return count;
+}
 
-    fprintf(output_file, "_while_loop_%d:\n", loop_label);
+// Index operands of element accesses have to be registers.
+static MachineReg index_register(IrOperand operand, MachineReg via) {
+    MOperand index = operand_location(operand);
+    if (index.kind == MOPERAND_REG) return (MachineReg)index.reg;
+    generate_load(via, &index);
+    return via;
+}
 
-    // Condition
-    if (while_loop->condition) {
-        generate_expression(while_loop->condition, output_file);
-        fprintf(output_file, "  pop rax\n");
-        fprintf(output_file, "  cmp rax, 0\n"); // Compare with 0 (false)
-        fprintf(output_file, "  je _while_end_%d\n", end_label);
+// Jumps to the function's bounds_label unless `index` is within the
+// array. The comparison is unsigned, so negative indexes fail too.
+static void generate_bounds_check(const IrInstr* instr, MachineReg index) {
+    if (ir_index_in_bounds(program, instr)) return;
+    MOperand size = mimm(ir_find_global(program, instr->symbol)->size);
+    if (!fits_imm32(size.value)) {
+        generate_load_immediate(SCRATCH, size.value);
+        size = mreg64(SCRATCH);
     }
+    machine_emit2(&code, M_CMP, mreg64(index), size);
+    if (bounds_label == NO_LABEL) bounds_label = machine_new_label(&code);
+    machine_jcc(&code, COND_AE, bounds_label);
+}
 
-    // Body
-    if (while_loop->body) {
-        generate_block_statement((BlockStatement*)while_loop->body, output_file);
+// "mov [rel name + index*8], value"; `index` may be REG_NONE.
+static void generate_store(const IrInstr* instr, MachineReg index) {
+    MOperand value = operand_location(instr->op == IR_STORE ? instr->a : instr->b);
+    if (moperand_is_memory(&value) || (value.kind == MOPERAND_IMM && !fits_imm32(value.value))) {
+        generate_load(SCRATCH, &value);
+        value = mreg64(SCRATCH);
     }
+    machine_emit2(&code, M_MOV, mglobal(instr->symbol, index), value);
+}
 
-    fprintf(output_file, "  jmp _while_loop_%d\n", loop_label);
-    fprintf(output_file, "_while_end_%d:\n", end_label);
+// Restores the callee-saved registers and the caller's rsp and rbp, leaving
+// the return address on top of the stack.
+static void generate_frame_exit(void) {
+    if (frameless) {
+        for (uint32_t r = REGISTER_COUNT; r-- > 0;) {
+            if (register_pool.callee_saved[r] && (allocation.used_registers & (1u << r))) {
+                machine_emit1(&code, M_POP, mreg64(registers[r]));
+            }
+        }
+        return;
+    }
+    if (saved_count) {
+        machine_emit2(&code, M_LEA, mreg64(REG_RSP), mstack(REG_RBP, -8 * (int64_t)saved_count));
+        for (uint32_t r = REGISTER_COUNT; r-- > 0;) {
+            if (register_pool.callee_saved[r] && (allocation.used_registers & (1u << r))) {
+                machine_emit1(&code, M_POP, mreg64(registers[r]));
+            }
+        }
+    } else {
+        machine_emit2(&code, M_MOV, mreg64(REG_RSP), mreg64(REG_RBP));
+    }
+    machine_emit1(&code, M_POP, mreg64(REG_RBP));
 }
 
-static void generate_import_statement(ImportStatement* import_stmt, FILE* output_file) {
-    fprintf(output_file, "; Import Statement: %s\n", import_stmt->path);
-    // For now, imports are not directly translated to assembly.
-    // In a full transpiler, this would involve linking with external object files
-    // or inlining code from imported modules.
+static void generate_epilogue(void) {
+    generate_frame_exit();
+    machine_emit0(&code, M_RET);
 }
 
-static void generate_binary_expression(BinaryExpression* bin_expr, FILE* output_file) {
-    fprintf(output_file, "; Binary Expression\n");
-    generate_expression(bin_expr->left, output_file);
-    generate_expression(bin_expr->right, output_file);
+// A call in a function other than the entry whose result is returned right
+// away. At -O1 it becomes a jump made after the frame is torn down, so the
+// callee reuses the stack the caller was called with and returns straight
+// to it. Calls needing stack arguments are kept, as the arguments would
+// have to overwrite the caller's own.
+static int is_tail_call(const IrBlock* block, uint32_t i) {
+    const IrInstr* call = &block->instrs[i];
+    if (optimize_level < 1 || function->is_entry || call->op != IR_CALL || i + 2 != block->count) return 0;
+    const IrInstr* ret = &block->instrs[i + 1];
+    if (ret->op != IR_RET) return 0;
+    if (ret->a.kind != IR_OPERAND_NONE && !(ret->a.kind == IR_OPERAND_REG && (IrReg)ret->a.value == call->dst)) {
+        return 0;
+    }
+    const IrFunction* callee = ir_find_function(program, call->symbol);
+    return call->other <= ARGUMENT_REGISTER_COUNT && (!callee || callee->param_count <= ARGUMENT_REGISTER_COUNT);
+}
 
-    fprintf(output_file, "  pop rbx\n"); // Right operand
-    fprintf(output_file, "  pop rax\n"); // Left operand
+// Arguments are moved into their registers before the frame is torn down,
+// while their sources can still be read; restoring the callee-saved
+// registers leaves the argument registers alone.
+static void generate_tail_call(const IrInstr* instr) {
+    const IrOperand* args = &function->args[instr->target];
+    Move moves[ARGUMENT_REGISTER_COUNT];
+    for (uint32_t i = 0; i < instr->other; i++) {
+        moves[i].destination = mreg64(argument_registers[i]);
+        moves[i].source = operand_location(args[i]);
+    }
+    generate_parallel_move(moves, instr->other);
+    generate_frame_exit();
+    machine_emit1(&code, M_JMP, mfunction(instr->symbol));
+}
 
-    switch (bin_expr->operator) {
-        case BIN_OP_PLUS:
-            fprintf(output_file, "  add rax, rbx\n");
-            break;
-        case BIN_OP_MINUS:
-            fprintf(output_file, "  sub rax, rbx\n");
-            break;
-        case BIN_OP_MULTIPLY:
-            fprintf(output_file, "  imul rax, rbx\n");
-            break;
-        case BIN_OP_DIVIDE:
-            fprintf(output_file, "  xor rdx, rdx\n"); // Clear RDX for division
-            fprintf(output_file, "  idiv rbx\n");
-            break;
-        case BIN_OP_MODULO:
-            fprintf(output_file, "  xor rdx, rdx\n"); // Clear RDX for division
-            fprintf(output_file, "  idiv rbx\n");
-            fprintf(output_file, "  mov rax, rdx\n"); // Remainder is in RDX
-            break;
-        case BIN_OP_EQ:
-            fprintf(output_file, "  cmp rax, rbx\n");
-            fprintf(output_file, "  sete al\n"); // Set AL to 1 if equal, 0 otherwise
-            fprintf(output_file, "  movzx rax, al\n"); // Zero-extend AL to RAX
-            break;
-        case BIN_OP_NEQ:
-            fprintf(output_file, "  cmp rax, rbx\n");
-            fprintf(output_file, "  setne al\n");
-            fprintf(output_file, "  movzx rax, al\n");
-            break;
-        case BIN_OP_LT:
-            fprintf(output_file, "  cmp rax, rbx\n");
-            fprintf(output_file, "  setl al\n");
-            fprintf(output_file, "  movzx rax, al\n");
-            break;
-        case BIN_OP_GT:
-            fprintf(output_file, "  cmp rax, rbx\n");
-            fprintf(output_file, "  setg al\n");
-            fprintf(output_file, "  movzx rax, al\n");
-            break;
-        case BIN_OP_LE:
-            fprintf(output_file, "  cmp rax, rbx\n");
-            fprintf(output_file, "  setle al\n");
-            fprintf(output_file, "  movzx rax, al\n");
-            break;
-        case BIN_OP_GE:
-            fprintf(output_file, "  cmp rax, rbx\n");
-            fprintf(output_file, "  setge al\n");
-            fprintf(output_file, "  movzx rax, al\n");
-            break;
+// Returning from the entry function exits the process with the returned
+// value as its status, through the runtime if it may have output to flush.
+static void generate_return(const IrInstr* instr) {
+    MOperand value = operand_location(instr->a);
+    if (!function->is_entry) {
+        if (instr->a.kind != IR_OPERAND_NONE) generate_load(REG_RAX, &value);
+        generate_epilogue();
+        return;
+    }
+    if (instr->a.kind != IR_OPERAND_NONE) {
+        machine_emit2(&code, M_MOV, mreg64(REG_RDI), value)->note = "exit code";
+    } else {
+        machine_emit2(&code, M_XOR, mreg(REG_RDI, 4), mreg(REG_RDI, 4))->note = "exit code 0";
     }
-    fprintf(output_file, "  push rax\n");
+    if (uses_runtime) {
+        machine_emit1(&code, M_CALL, mfunction(symbol_intern(RUNTIME_EXIT, sizeof(RUNTIME_EXIT) - 1)));
+        return;
+    }
+    machine_emit2(&code, M_MOV, mreg(REG_RAX, 4), mimm(60))->note = "syscall number for exit";
+    machine_emit0(&code, M_SYSCALL);
 }
 
-static void generate_index_expression(IndexExpression* index_expr, FILE* output_file) {
-    fprintf(output_file, "; Index Expression\n");
-    generate_expression(index_expr->index, output_file);
-    fprintf(output_file, "  pop rbx\n"); // index
-    // Assuming array is an identifier
-    Identifier* array_ident = (Identifier*)index_expr->array;
-    fprintf(output_file, "  push qword [rel %s + rbx*8]\n", array_ident->value); // Assuming 8-byte elements
+// Jumps to `if_true` when `cond` holds and to `if_false` otherwise, falling
+// through to `next` where possible.
+static void generate_branch_to(Condition cond, uint32_t if_true, uint32_t if_false, uint32_t next) {
+    if (if_true == if_false) {
+        if (if_true != next) machine_emit1(&code, M_JMP, mlabel(if_true));
+    } else if (if_false == next) {
+        machine_jcc(&code, cond, if_true);
+    } else if (if_true == next) {
+        machine_jcc(&code, CONDITION_NEGATE(cond), if_false);
+    } else {
+        machine_jcc(&code, cond, if_true);
+        machine_emit1(&code, M_JMP, mlabel(if_false));
+    }
 }
 
-static void generate_expression(ASTNode* node, FILE* output_file) {
-    if (!node) return;
+static void generate_branch(const IrInstr* instr, uint32_t next) {
+    MOperand condition = operand_location(instr->a);
+    if (condition.kind == MOPERAND_IMM) {
+        uint32_t target = condition.value ? instr->target : instr->other;
+        if (target != next) machine_emit1(&code, M_JMP, mlabel(target));
+        return;
+    }
+    if (condition.kind == MOPERAND_REG) {
+        machine_emit2(&code, M_TEST, condition, condition);
+    } else {
+        machine_emit2(&code, M_CMP, condition, mimm(0));
+    }
+    generate_branch_to(COND_NE, instr->target, instr->other, next);
+}
 
-    switch (node->type) {
-        case NODE_IDENTIFIER:
-            generate_identifier((Identifier*)node, output_file);
-            break;
-        case NODE_NUMBER_LITERAL:
-            generate_number_literal((NumberLiteral*)node, output_file);
-            break;
-        case NODE_ASCII_LITERAL:
-            generate_ascii_literal((AsciiLiteral*)node, output_file);
+static void generate_instruction(const IrInstr* instr, uint32_t next) {
+    switch (instr->op) {
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_GT:
+        case IR_LE:
+        case IR_GE:
+            generate_comparison(instr);
             break;
-        case NODE_STRING_LITERAL:
-            generate_string_literal((StringLiteral*)node, output_file);
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+            generate_arithmetic(instr);
             break;
-        case NODE_ASSIGN_EXPRESSION:
-            generate_assign_expression((AssignExpression*)node, output_file);
+        case IR_DIV:
+        case IR_MOD:
+            generate_division(instr);
             break;
-        case NODE_CALL_EXPRESSION:
-            generate_call_expression((CallExpression*)node, output_file);
+        case IR_MOV:
+            generate_move(instr->dst, operand_location(instr->a));
             break;
-        case NODE_BINARY_EXPRESSION:
-            generate_binary_expression((BinaryExpression*)node, output_file);
+        case IR_LOAD: {
+            MachineReg result = result_register(instr->dst);
+            machine_emit2(&code, M_MOV, mreg64(result), mglobal(instr->symbol, REG_NONE));
+            generate_store_result(instr->dst, result);
             break;
-        case NODE_INDEX_EXPRESSION:
-            generate_index_expression((IndexExpression*)node, output_file);
-            break;
-        default:
-            fprintf(stderr, "Error: Unknown expression node type %d\n", node->type);
-            exit(1);
-    }
-}
-
-static void generate_statement(ASTNode* node, FILE* output_file) {
-    if (!node) return;
-
-    switch (node->type) {
-        case NODE_VAR_DECLARATION:
-            // Var declaration is now split into data and init parts
-            // Data part should be emitted globally. Init part is a statement.
-            generate_var_declaration_init((VarDeclaration*)node, output_file);
+        }
+        case IR_STORE:
+            generate_store(instr, REG_NONE);
             break;
-        case NODE_FUNCTION_DECLARATION:
-            // Function declarations are handled when iterating top-level statements,
-            // or should be if they are not top-level (which this language might not support yet)
-            generate_function_declaration((FunctionDeclaration*)node, output_file);
+        case IR_LOAD_ELEM: {
+            MachineReg result = result_register(instr->dst);
+            MachineReg index = index_register(instr->a, REG_RAX);
+            generate_bounds_check(instr, index);
+            machine_emit2(&code, M_MOV, mreg64(result), mglobal(instr->symbol, index)); // 8-byte elements
+            generate_store_result(instr->dst, result);
             break;
-        case NODE_RETURN_STATEMENT:
-            generate_return_statement((ReturnStatement*)node, output_file);
+        }
+        case IR_STORE_ELEM: {
+            MachineReg index = index_register(instr->a, REG_RAX);
+            generate_bounds_check(instr, index);
+            generate_store(instr, index);
             break;
-        case NODE_EXPRESSION_STATEMENT:
-            generate_expression_statement((ExpressionStatement*)node, output_file);
+        }
+        case IR_ADDR: {
+            MachineReg result = result_register(instr->dst);
+            machine_emit2(&code, M_LEA, mreg64(result), mstring(instr->target));
+            generate_store_result(instr->dst, result);
             break;
-        case NODE_BLOCK_STATEMENT:
-            generate_block_statement((BlockStatement*)node, output_file);
+        }
+        case IR_CALL:
+            generate_call(instr);
             break;
-        case NODE_FOR_LOOP:
-            generate_for_loop((ForLoop*)node, output_file);
+        case IR_JUMP:
+            if (instr->target != next) machine_emit1(&code, M_JMP, mlabel(instr->target));
             break;
-        case NODE_WHILE_LOOP:
-            generate_while_loop((WhileLoop*)node, output_file);
+        case IR_BRANCH:
+            generate_branch(instr, next);
             break;
-        case NODE_IMPORT_STATEMENT:
-            generate_import_statement((ImportStatement*)node, output_file);
+        case IR_RET:
+            generate_return(instr);
             break;
         default:
-            fprintf(stderr, "Error: Unknown statement node type %d\n", node->type);
+            fprintf(stderr, "Error: Unknown IR opcode %d\n", instr->op);
             exit(1);
     }
 }
 
-void generate_assembly(Program* program, FILE* output_file) {
-    fprintf(output_file, "; Transpiled Assembly Code\n");
-    fprintf(output_file, "section .text\n");
-    fprintf(output_file, "global _start\n");
-    fprintf(output_file, "_start:\n");
+// A comparison whose only use is the branch right after it sets the flags
+// the branch jumps on instead of materializing a 0/1 value.
+static int fuses_with_branch(const IrBlock* block, uint32_t i) {
+    const IrInstr* instr = &block->instrs[i];
+    Condition cond;
+    if (!comparison_condition((IrOp)instr->op, &cond) || i + 2 != block->count) return 0;
+    const IrInstr* branch = &block->instrs[i + 1];
+    return branch->op == IR_BRANCH && branch->a.kind == IR_OPERAND_REG &&
+           (IrReg)branch->a.value == instr->dst && use_counts[instr->dst] == 1;
+}
+
+// A load read only as the right operand of the next ALU instruction is
+// folded into it as a memory operand.
+static int folds_into_next(const IrBlock* block, uint32_t i) {
+    const IrInstr* instr = &block->instrs[i];
+    if (instr->op != IR_LOAD || i + 1 >= block->count || use_counts[instr->dst] != 1) return 0;
+    const IrInstr* user = &block->instrs[i + 1];
+    if (user->op > IR_MOD) return 0;
+    return user->b.kind == IR_OPERAND_REG && (IrReg)user->b.value == instr->dst &&
+           !(user->a.kind == IR_OPERAND_REG && (IrReg)user->a.value == instr->dst);
+}
+
+static void generate_block(uint32_t b) {
+    const IrBlock* block = &function->blocks[b];
+    uint32_t next = b + 1;
+    machine_label(&code, b);
+    for (uint32_t i = b == 0 ? generate_parameters(block) : 0; i < block->count; i++) {
+        const IrInstr* instr = &block->instrs[i];
+        if (folds_into_next(block, i)) {
+            folded_reg = instr->dst;
+            folded_symbol = instr->symbol;
+            continue;
+        }
+        if (is_tail_call(block, i)) {
+            generate_tail_call(instr);
+            folded_reg = IR_NO_REG;
+            return;
+        }
+        Condition cond;
+        if (fuses_with_branch(block, i) && comparison_condition((IrOp)instr->op, &cond)) {
+            const IrInstr* branch = &block->instrs[i + 1];
+            generate_compare(instr);
+            generate_branch_to(cond, branch->target, branch->other, next);
+            folded_reg = IR_NO_REG;
+            return;
+        }
+        generate_instruction(instr, next);
+        folded_reg = IR_NO_REG;
+    }
+}
+
+static void count_use(IrReg reg, void* context) {
+    (void)context;
+    use_counts[reg]++;
+}
+
+static int makes_calls(void) {
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        const IrBlock* block = &function->blocks[b];
+        for (uint32_t i = 0; i < block->count; i++) {
+            if (block->instrs[i].op == IR_CALL && !is_tail_call(block, i)) return 1;
+        }
+    }
+    return 0;
+}
+
+// Frame layout: saved rbp, the callee-saved registers in use, then the
+// spill slots, padded so calls are made with rsp 16-byte aligned. The
+// entry function starts aligned and has nothing to preserve. A frameless
+// leaf function only pushes callee-saved registers.
+static void generate_prologue(void) {
+    saved_count = 0;
+    frameless = !function->is_entry && allocation.spill_slots <= RED_ZONE_SLOTS && !makes_calls();
+    if (!frameless) {
+        machine_emit1(&code, M_PUSH, mreg64(REG_RBP));
+        machine_emit2(&code, M_MOV, mreg64(REG_RBP), mreg64(REG_RSP));
+    }
+    if (!function->is_entry) {
+        for (uint32_t r = 0; r < REGISTER_COUNT; r++) {
+            if (register_pool.callee_saved[r] && (allocation.used_registers & (1u << r))) {
+                machine_emit1(&code, M_PUSH, mreg64(registers[r]));
+                saved_count++;
+            }
+        }
+    }
+    if (frameless) return;
+    uint64_t frame = 8 * (uint64_t)allocation.spill_slots;
+    // rsp is 16-byte aligned after pushing rbp in a called function, and 8
+    // bytes off in the entry function, which was not called.
+    uint64_t pushed = 8 * (uint64_t)saved_count + (function->is_entry ? 8 : 0);
+    if ((pushed + frame) % 16) frame += 8;
+    if (frame) machine_emit2(&code, M_SUB, mreg64(REG_RSP), mimm((int64_t)frame));
+}
+
+static void generate_function(const IrFunction* target, int optimize) {
+    function = target;
+    regalloc_linear_scan(function, &register_pool, &allocation);
 
-    ASTNode* current_stmt = program->statements;
-    while (current_stmt) {
-        generate_statement(current_stmt, output_file);
-        current_stmt = current_stmt->next;
+    use_counts = (uint32_t*)calloc(function->reg_count, sizeof(uint32_t));
+    if (!use_counts) {
+        fprintf(stderr, "Error: Out of memory counting register uses\n");
+        exit(1);
+    }
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        const IrBlock* block = &function->blocks[b];
+        for (uint32_t i = 0; i < block->count; i++) {
+            ir_for_each_use(function, &block->instrs[i], count_use, NULL);
+        }
     }
 
-    // Exit system call (for simple programs)
-    fprintf(output_file, "  mov rax, 60  ; syscall number for exit\n");
-    fprintf(output_file, "  xor rdi, rdi ; exit code 0\n");
-    fprintf(output_file, "  syscall\n");
+    // Block b is local label b.
+    machine_init(&code, function->name, function->is_entry, function->block_count);
+    bounds_label = NO_LABEL;
+    generate_prologue();
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        generate_block(b);
+    }
+    if (bounds_label != NO_LABEL) {
+        // rsp may be unaligned in a frameless function, and under --run the
+        // call reaches C code; it never returns, so the stack can be given up.
+        machine_label(&code, bounds_label);
+        machine_emit2(&code, M_AND, mreg64(REG_RSP), mimm(-16));
+        machine_emit1(&code, M_CALL, mfunction(symbol_intern(RUNTIME_INDEX_ERROR, sizeof(RUNTIME_INDEX_ERROR) - 1)));
+    }
+    if (optimize >= 1) peephole_optimize(&code);
+
+    if (object) {
+        encode_function(object, &code);
+    } else {
+        if (function->is_entry) {
+            emit_comment(out, "Entry point", NULL);
+        } else {
+            emit_comment(out, "Function: ", symbol_name(function->name));
+        }
+        machine_print(&code, out);
+    }
+
+    machine_free(&code);
+    free(use_counts);
+    use_counts = NULL;
+    regalloc_free(&allocation);
+    function = NULL;
 }
 
+// Writes a string literal as NASM db data: printable runs in quotes, other
+// bytes (including the quote itself) as numbers, then a terminating zero.
+static void generate_string_data(uint32_t index, const char* text) {
+    emit_text(out, "str_");
+    emit_int(out, index);
+    emit_text(out, ": db ");
+    int quoted = 0;
+    for (const unsigned char* c = (const unsigned char*)text; *c; c++) {
+        int printable = *c >= 32 && *c < 127 && *c != '"';
+        if (printable && !quoted) {
+            emit_char(out, '"');
+            quoted = 1;
+        } else if (!printable && quoted) {
+            emit_text(out, "\", ");
+            quoted = 0;
+        }
+        if (printable) {
+            emit_char(out, (char)*c);
+        } else {
+            emit_int(out, *c);
+            emit_text(out, ", ");
+        }
+    }
+    if (quoted) emit_text(out, "\", ");
+    emit_text(out, "0\n");
+}
 
+// Marks the builtins called by the program; returns
+// whether the program needs the runtime, which it also does to report an
+// index out of bounds.
+static int find_builtins(uint8_t used[BUILTIN_COUNT]) {
+    int any = 0;
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        const IrFunction* caller = &program->functions[f];
+        for (uint32_t b = 0; b < caller->block_count; b++) {
+            const IrBlock* block = &caller->blocks[b];
+            for (uint32_t i = 0; i < block->count; i++) {
+                const IrInstr* instr = &block->instrs[i];
+                if ((instr->op == IR_LOAD_ELEM || instr->op == IR_STORE_ELEM) && !ir_index_in_bounds(program, instr)) {
+                    any = 1;
+                }
+                if (instr->op != IR_CALL) continue;
+                int builtin = runtime_find_builtin_symbol(instr->symbol);
+                if (builtin < 0) continue;
+                used[builtin] = 1;
+                any = 1;
+            }
+        }
+    }
+    return any;
+}
+
+void generate_assembly(const IrProgram* ir, Emitter* emitter, int optimize) {
+    program = ir;
+    out = emitter;
+    optimize_level = optimize;
+    uint8_t builtins[BUILTIN_COUNT] = { 0 };
+    uses_runtime = find_builtins(builtins);
+    emit_comment(out, "Transpiled Assembly Code", NULL);
+
+    if (program->global_count) {
+        emit_directive(out, "section", ".bss");
+        for (uint32_t i = 0; i < program->global_count; i++) {
+            emit_text(out, symbol_name(program->globals[i].name));
+            emit_text(out, ": resq ");
+            emit_int(out, program->globals[i].size);
+            emit_char(out, '\n');
+        }
+    }
+    if (program->string_count) {
+        emit_directive(out, "section", ".data");
+        for (uint32_t i = 0; i < program->string_count; i++) {
+            generate_string_data(i, program->strings[i]);
+        }
+    }
+
+    emit_directive(out, "section", ".text");
+    if (uses_runtime) runtime_declare(out, builtins);
+    for (uint32_t i = 0; i < program->function_count; i++) {
+        generate_function(&program->functions[i], optimize);
+    }
+    program = NULL;
+}
+
+void generate_object(const IrProgram* ir, ObjectFile* file, int optimize, int link_runtime) {
+    program = ir;
+    object = file;
+    optimize_level = optimize;
+    uint8_t builtins[BUILTIN_COUNT] = { 0 };
+    uses_runtime = find_builtins(builtins);
+
+    for (uint32_t i = 0; i < program->global_count; i++) {
+        object_define(object, program->globals[i].name, SECTION_BSS, 8 * program->globals[i].size, 0);
+    }
+    for (uint32_t i = 0; i < program->string_count; i++) {
+        const char* text = program->strings[i];
+        size_t length = strlen(text) + 1;
+        object_define(object, encode_string_name(i), SECTION_DATA, length, 0);
+        object_append(object, SECTION_DATA, text, length);
+    }
+
+    for (uint32_t i = 0; i < program->function_count; i++) {
+        generate_function(&program->functions[i], optimize);
+    }
+    if (uses_runtime && link_runtime) runtime_encode(object, builtins);
+    object = NULL;
+    program = NULL;
+}
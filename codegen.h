@@ -1,13 +1,17 @@
-
-
 #ifndef CODEGEN_H
 #define CODEGEN_H
 
-#include "ast.h"
-#include <stdio.h>
+#include "ir.h"
+#include "emit.h"
+#include "object.h"
 
-void generate_assembly(Program* program, FILE* output_file);
-
-#endif // CODEGEN_H
+// Writes the program as NASM assembly. At optimize >= 1 each function's
+// instructions go through the peephole optimizer first.
+void generate_assembly(const IrProgram* program, Emitter* emitter, int optimize);
 
+// Encodes the same code into `object` as machine code. With `link_runtime`
+// the builtins the program calls are encoded too, so the object needs no
+// library; otherwise they are left undefined.
+void generate_object(const IrProgram* program, ObjectFile* object, int optimize, int link_runtime);
 
+#endif // CODEGEN_H
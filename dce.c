@@ -0,0 +1,297 @@
+#include "dce.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Dead code elimination in three steps:
+//
+// 1. Reachability: functions are kept if the entry function reaches them
+//    through calls, and blocks if their function's entry block reaches them.
+// 2. Dead stores: a store is dead if its global is never loaded anywhere,
+//    or if, later in the same block, the global is stored again before any
+//    load or call could read it. Returning from the entry function exits the
+//    process, so in blocks ending that way every global is dead at the end.
+// 3. Dead computations: instructions without side effects whose result is
+//    never read, deleted until none is left; removing them can make loads,
+//    and through them more stores, dead, so steps 2 and 3 repeat.
+//
+// Calls are kept even if their result is unused, and so are divisions that
+// may trap and element accesses that may be out of bounds. Calls to
+// functions outside the program cannot read the globals, which are never
+// exported, but calls within it are assumed to read all of them.
+
+static void* allocate(size_t count, size_t size) {
+    void* memory = calloc(count ? count : 1, size);
+    if (!memory) {
+        fprintf(stderr, "Error: Out of memory during dead code elimination\n");
+        exit(1);
+    }
+    return memory;
+}
+
+static IrProgram* program;
+static uint8_t* read_globals;  // Globals some load reads
+static uint32_t* overwritten;  // Global -> stamp if stored later in the block
+static uint32_t* loaded;       // Global -> stamp if loaded later in the block
+static uint32_t stamp;
+static uint32_t* use_counts;
+
+static uint32_t global_id(Symbol name) {
+    return (uint32_t)(ir_find_global(program, name) - program->globals);
+}
+
+static int is_entry_exit(const IrFunction* function, const IrBlock* block) {
+    return function->is_entry && block->count && block->instrs[block->count - 1].op == IR_RET;
+}
+
+static uint32_t remove_unreachable_functions(void) {
+    uint8_t* reachable = (uint8_t*)allocate(program->function_count, sizeof(uint8_t));
+    uint32_t* worklist = (uint32_t*)allocate(program->function_count, sizeof(uint32_t));
+    uint32_t pending = 0;
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        if (program->functions[f].is_entry) {
+            reachable[f] = 1;
+            worklist[pending++] = f;
+        }
+    }
+    while (pending) {
+        const IrFunction* function = &program->functions[worklist[--pending]];
+        for (uint32_t b = 0; b < function->block_count; b++) {
+            const IrBlock* block = &function->blocks[b];
+            for (uint32_t i = 0; i < block->count; i++) {
+                if (block->instrs[i].op != IR_CALL) continue;
+                IrFunction* callee = ir_find_function(program, block->instrs[i].symbol);
+                if (!callee) continue;
+                uint32_t index = (uint32_t)(callee - program->functions);
+                if (!reachable[index]) {
+                    reachable[index] = 1;
+                    worklist[pending++] = index;
+                }
+            }
+        }
+    }
+    uint32_t removed = ir_retain_functions(program, reachable);
+    free(reachable);
+    free(worklist);
+    return removed;
+}
+
+static uint32_t remove_unreachable_blocks(IrFunction* function) {
+    if (!function->block_count) return 0;
+    uint8_t* reachable = (uint8_t*)allocate(function->block_count, sizeof(uint8_t));
+    uint32_t* worklist = (uint32_t*)allocate(function->block_count, sizeof(uint32_t));
+    uint32_t pending = 0;
+    reachable[0] = 1;
+    worklist[pending++] = 0;
+    while (pending) {
+        uint32_t succs[2];
+        uint32_t count = ir_successors(&function->blocks[worklist[--pending]], succs);
+        for (uint32_t s = 0; s < count; s++) {
+            if (!reachable[succs[s]]) {
+                reachable[succs[s]] = 1;
+                worklist[pending++] = succs[s];
+            }
+        }
+    }
+    uint32_t removed = 0;
+    for (uint32_t b = 0; b < function->block_count && !removed; b++) {
+        if (!reachable[b]) removed = 1;
+    }
+    if (removed) removed = ir_retain_blocks(function, reachable);
+    free(reachable);
+    free(worklist);
+    return removed;
+}
+
+static void find_read_globals(void) {
+    memset(read_globals, 0, program->global_count ? program->global_count : 1);
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        const IrFunction* function = &program->functions[f];
+        for (uint32_t b = 0; b < function->block_count; b++) {
+            const IrBlock* block = &function->blocks[b];
+            for (uint32_t i = 0; i < block->count; i++) {
+                const IrInstr* instr = &block->instrs[i];
+                if (instr->op == IR_LOAD || instr->op == IR_LOAD_ELEM) read_globals[global_id(instr->symbol)] = 1;
+            }
+        }
+    }
+}
+
+// Scans each block backwards, tracking which globals are certain to be
+// overwritten (or, in an exiting block, never read) before being read.
+static uint32_t remove_dead_stores(IrFunction* function) {
+    uint32_t removed = 0;
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        IrBlock* block = &function->blocks[b];
+        int exits = is_entry_exit(function, block);
+        stamp++;
+        uint32_t kept = block->count;
+        for (uint32_t i = block->count; i-- > 0;) {
+            IrInstr instr = block->instrs[i];
+            if (instr.op == IR_STORE || instr.op == IR_STORE_ELEM || instr.op == IR_LOAD || instr.op == IR_LOAD_ELEM) {
+                uint32_t global = global_id(instr.symbol);
+                int stored = instr.op == IR_STORE || instr.op == IR_STORE_ELEM;
+                // A scalar store writes element 0 only, so it never makes
+                // an element store dead.
+                int dead = (instr.op == IR_STORE && overwritten[global] == stamp) || (exits && loaded[global] != stamp);
+                int checked = instr.op == IR_STORE_ELEM && !ir_index_in_bounds(program, &instr);
+                if (stored && !checked && (!read_globals[global] || dead)) {
+                    removed++;
+                    continue;
+                }
+                if (instr.op == IR_STORE) {
+                    overwritten[global] = stamp;
+                    loaded[global] = 0;
+                } else if (!stored) {
+                    overwritten[global] = 0;
+                    loaded[global] = stamp;
+                }
+            } else if (instr.op == IR_CALL && ir_find_function(program, instr.symbol)) {
+                // The callee may read any global.
+                stamp++;
+                exits = 0;
+            }
+            block->instrs[--kept] = instr;
+        }
+        memmove(block->instrs, block->instrs + kept, (block->count - kept) * sizeof(IrInstr));
+        block->count -= kept;
+    }
+    return removed;
+}
+
+static int has_side_effects(const IrInstr* instr) {
+    switch (instr->op) {
+        case IR_DIV:
+        case IR_MOD:
+            // idiv traps on zero and on INT64_MIN / -1
+            return instr->b.kind != IR_OPERAND_IMM || instr->b.value == 0 || instr->b.value == -1;
+        case IR_LOAD_ELEM:
+            // An index out of bounds ends the program
+            return !ir_index_in_bounds(program, instr);
+        case IR_CALL:
+        case IR_STORE:
+        case IR_STORE_ELEM:
+        case IR_JUMP:
+        case IR_BRANCH:
+        case IR_RET:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void count_use(IrReg reg, void* context) {
+    (void)context;
+    use_counts[reg]++;
+}
+
+static void uncount_use(IrReg reg, void* context) {
+    (void)context;
+    use_counts[reg]--;
+}
+
+static uint32_t remove_dead_instructions(IrFunction* function) {
+    use_counts = (uint32_t*)allocate(function->reg_count, sizeof(uint32_t));
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        const IrBlock* block = &function->blocks[b];
+        for (uint32_t i = 0; i < block->count; i++) {
+            ir_for_each_use(function, &block->instrs[i], count_use, NULL);
+        }
+    }
+    // Going backwards deletes a chain of dead computations in one sweep
+    // unless it crosses blocks against their order.
+    uint32_t removed = 0;
+    uint32_t removed_before;
+    do {
+        removed_before = removed;
+        for (uint32_t b = function->block_count; b-- > 0;) {
+            IrBlock* block = &function->blocks[b];
+            uint32_t kept = block->count;
+            for (uint32_t i = block->count; i-- > 0;) {
+                IrInstr instr = block->instrs[i];
+                if (!has_side_effects(&instr) && use_counts[instr.dst] == 0) {
+                    ir_for_each_use(function, &instr, uncount_use, NULL);
+                    removed++;
+                    continue;
+                }
+                block->instrs[--kept] = instr;
+            }
+            memmove(block->instrs, block->instrs + kept, (block->count - kept) * sizeof(IrInstr));
+            block->count -= kept;
+        }
+    } while (removed != removed_before);
+    free(use_counts);
+    use_counts = NULL;
+    return removed;
+}
+
+// Drops globals and string literals that nothing refers to, renumbering
+// the string references.
+static void remove_unused_data(void) {
+    uint8_t* used_globals = (uint8_t*)allocate(program->global_count, sizeof(uint8_t));
+    uint32_t* string_number = (uint32_t*)allocate(program->string_count, sizeof(uint32_t));
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        const IrFunction* function = &program->functions[f];
+        for (uint32_t b = 0; b < function->block_count; b++) {
+            const IrBlock* block = &function->blocks[b];
+            for (uint32_t i = 0; i < block->count; i++) {
+                const IrInstr* instr = &block->instrs[i];
+                if (instr->op >= IR_LOAD && instr->op <= IR_STORE_ELEM) used_globals[global_id(instr->symbol)] = 1;
+                if (instr->op == IR_ADDR) string_number[instr->target] = 1;
+            }
+        }
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t s = 0; s < program->string_count; s++) {
+        if (!string_number[s]) continue;
+        program->strings[kept] = program->strings[s];
+        string_number[s] = kept++;
+    }
+    if (kept != program->string_count) {
+        program->string_count = kept;
+        for (uint32_t f = 0; f < program->function_count; f++) {
+            IrFunction* function = &program->functions[f];
+            for (uint32_t b = 0; b < function->block_count; b++) {
+                IrBlock* block = &function->blocks[b];
+                for (uint32_t i = 0; i < block->count; i++) {
+                    if (block->instrs[i].op == IR_ADDR) block->instrs[i].target = string_number[block->instrs[i].target];
+                }
+            }
+        }
+    }
+    ir_retain_globals(program, used_globals);
+    free(used_globals);
+    free(string_number);
+}
+
+void eliminate_dead_code(IrProgram* ir, DeadCodeStats* stats) {
+    program = ir;
+    stats->functions += remove_unreachable_functions();
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        stats->blocks += remove_unreachable_blocks(&program->functions[f]);
+    }
+
+    read_globals = (uint8_t*)allocate(program->global_count, sizeof(uint8_t));
+    overwritten = (uint32_t*)allocate(program->global_count, sizeof(uint32_t));
+    loaded = (uint32_t*)allocate(program->global_count, sizeof(uint32_t));
+    stamp = 0;
+    uint32_t removed;
+    do {
+        removed = 0;
+        find_read_globals();
+        for (uint32_t f = 0; f < program->function_count; f++) {
+            uint32_t stores = remove_dead_stores(&program->functions[f]);
+            uint32_t instructions = remove_dead_instructions(&program->functions[f]);
+            stats->stores += stores;
+            stats->instructions += instructions;
+            removed += stores + instructions;
+        }
+    } while (removed);
+    free(read_globals);
+    free(overwritten);
+    free(loaded);
+
+    remove_unused_data();
+    program = NULL;
+}
@@ -0,0 +1,21 @@
+#ifndef DCE_H
+#define DCE_H
+
+#include <stdint.h>
+#include "ir.h"
+
+typedef struct {
+    uint32_t functions;
+    uint32_t blocks;
+    uint32_t stores;
+    uint32_t instructions; // Other instructions whose result is unused
+} DeadCodeStats;
+
+// Removes what cannot affect the program's behavior: functions not
+// reachable by calls from the entry function, blocks not reachable from
+// their function's entry, stores to globals that are never read again and
+// computations whose result is unused. Globals and string literals nothing
+// refers to any more are dropped as well. Adds the counts to `stats`.
+void eliminate_dead_code(IrProgram* program, DeadCodeStats* stats);
+
+#endif // DCE_H
@@ -0,0 +1,300 @@
+#include "elf64.h"
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Both kinds of file have .text, .data and .bss as sections 1 to 3, and a
+// symbol table with the symbols of the object. An object adds relocations
+// for .text; an executable has them applied instead, and is loaded as a
+// read-only executable segment holding the headers and .text and a
+// writable one holding .data and .bss.
+
+#define EXECUTABLE_BASE 0x400000
+#define PAGE_SIZE 0x1000
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// Pads the output with zeros up to file offset `offset`.
+static void pad_to(Emitter* out, uint64_t* position, uint64_t offset) {
+    static const char zeros[16] = { 0 };
+    while (*position < offset) {
+        uint64_t count = offset - *position < sizeof(zeros) ? offset - *position : sizeof(zeros);
+        emit_bytes(out, zeros, (size_t)count);
+        *position += count;
+    }
+}
+
+static void put(Emitter* out, uint64_t* position, const void* bytes, uint64_t count) {
+    if (count) emit_bytes(out, (const char*)bytes, (size_t)count);
+    *position += count;
+}
+
+// Appends a NUL-terminated string to a table; returns its offset.
+static uint32_t add_string(Emitter* table, const char* text) {
+    uint32_t offset = (uint32_t)table->length;
+    emit_bytes(table, text, strlen(text) + 1);
+    return offset;
+}
+
+typedef struct {
+    Elf64_Sym* entries;
+    uint32_t count;
+    uint32_t first_global;
+    uint32_t* index;  // Object symbol -> symbol table index
+    Emitter names;    // .strtab
+} SymbolTable;
+
+// Locals come first, as ELF requires. Symbol values are `bases[section]`
+// plus the symbol's offset.
+static void build_symbol_table(const ObjectFile* object, const uint64_t bases[SECTION_COUNT], SymbolTable* table) {
+    table->entries = (Elf64_Sym*)calloc(object->symbol_count + 1, sizeof(Elf64_Sym));
+    table->index = (uint32_t*)calloc(object->symbol_count + 1, sizeof(uint32_t));
+    if (!table->entries || !table->index) {
+        fprintf(stderr, "Error: Out of memory writing the symbol table\n");
+        exit(1);
+    }
+    emit_init(&table->names, -1);
+    emit_char(&table->names, '\0');
+    table->count = 1;
+    for (int global = 0; global <= 1; global++) {
+        if (global) table->first_global = table->count;
+        for (uint32_t i = 0; i < object->symbol_count; i++) {
+            const ObjectSymbol* symbol = &object->symbols[i];
+            if (symbol->global != global) continue;
+            Elf64_Sym* entry = &table->entries[table->count];
+            entry->st_name = add_string(&table->names, symbol_name(symbol->name));
+            int type = symbol->section == SECTION_UNDEFINED ? STT_NOTYPE : (symbol->function ? STT_FUNC : STT_OBJECT);
+            entry->st_info = (unsigned char)ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL, type);
+            if (symbol->section == SECTION_UNDEFINED) {
+                entry->st_shndx = SHN_UNDEF;
+            } else {
+                entry->st_shndx = (Elf64_Section)(symbol->section + 1);
+                entry->st_value = bases[symbol->section] + symbol->offset;
+                entry->st_size = symbol->size;
+            }
+            table->index[i] = table->count++;
+        }
+    }
+}
+
+static void free_symbol_table(SymbolTable* table) {
+    free(table->entries);
+    free(table->index);
+    emit_free(&table->names);
+}
+
+static void init_header(Elf64_Ehdr* header, uint16_t type) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->e_ident, ELFMAG, SELFMAG);
+    header->e_ident[EI_CLASS] = ELFCLASS64;
+    header->e_ident[EI_DATA] = ELFDATA2LSB;
+    header->e_ident[EI_VERSION] = EV_CURRENT;
+    header->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header->e_type = type;
+    header->e_machine = EM_X86_64;
+    header->e_version = EV_CURRENT;
+    header->e_ehsize = sizeof(Elf64_Ehdr);
+    header->e_shentsize = sizeof(Elf64_Shdr);
+}
+
+static Elf64_Shdr section_header(uint32_t name, uint32_t type, uint64_t flags, uint64_t address, uint64_t offset,
+                                 uint64_t size, uint64_t alignment) {
+    Elf64_Shdr header;
+    memset(&header, 0, sizeof(header));
+    header.sh_name = name;
+    header.sh_type = type;
+    header.sh_flags = flags;
+    header.sh_addr = address;
+    header.sh_offset = offset;
+    header.sh_size = size;
+    header.sh_addralign = alignment;
+    return header;
+}
+
+// Adds the headers of .text, .data and .bss to `headers`, after the null
+// one.
+static void add_program_sections(Elf64_Shdr* headers, Emitter* names, const ObjectFile* object,
+                                 const uint64_t bases[SECTION_COUNT], uint64_t text_offset, uint64_t data_offset) {
+    headers[1] = section_header(add_string(names, ".text"), SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+                                bases[SECTION_TEXT], text_offset, object->text_size, 16);
+    headers[2] = section_header(add_string(names, ".data"), SHT_PROGBITS, SHF_ALLOC | SHF_WRITE,
+                                bases[SECTION_DATA], data_offset, object->data_size, 8);
+    headers[3] = section_header(add_string(names, ".bss"), SHT_NOBITS, SHF_ALLOC | SHF_WRITE, bases[SECTION_BSS],
+                                data_offset + object->data_size, object->bss_size, 8);
+}
+
+void elf_write_object(const ObjectFile* object, Emitter* out) {
+    static const uint64_t bases[SECTION_COUNT] = { 0, 0, 0 };
+    SymbolTable symbols;
+    build_symbol_table(object, bases, &symbols);
+
+    enum { TEXT = 1, DATA, BSS, RELA, SYMTAB, STRTAB, SHSTRTAB, NOTE, SECTION_HEADERS };
+    Elf64_Shdr headers[SECTION_HEADERS];
+    memset(headers, 0, sizeof(headers));
+    Emitter names;
+    emit_init(&names, -1);
+    emit_char(&names, '\0');
+
+    uint64_t text_offset = sizeof(Elf64_Ehdr);
+    uint64_t data_offset = text_offset + object->text_size;
+    uint64_t rela_offset = align_up(data_offset + object->data_size, 8);
+    uint64_t rela_size = (uint64_t)object->reloc_count * sizeof(Elf64_Rela);
+    uint64_t symtab_offset = rela_offset + rela_size;
+    uint64_t symtab_size = (uint64_t)symbols.count * sizeof(Elf64_Sym);
+    uint64_t strtab_offset = symtab_offset + symtab_size;
+
+    add_program_sections(headers, &names, object, bases, text_offset, data_offset);
+    headers[RELA] = section_header(add_string(&names, ".rela.text"), SHT_RELA, SHF_INFO_LINK, 0, rela_offset,
+                                   rela_size, 8);
+    headers[RELA].sh_link = SYMTAB;
+    headers[RELA].sh_info = TEXT;
+    headers[RELA].sh_entsize = sizeof(Elf64_Rela);
+    headers[SYMTAB] = section_header(add_string(&names, ".symtab"), SHT_SYMTAB, 0, 0, symtab_offset, symtab_size, 8);
+    headers[SYMTAB].sh_link = STRTAB;
+    headers[SYMTAB].sh_info = symbols.first_global;
+    headers[SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+    headers[STRTAB] = section_header(add_string(&names, ".strtab"), SHT_STRTAB, 0, 0, strtab_offset,
+                                     symbols.names.length, 1);
+    uint64_t shstrtab_offset = strtab_offset + symbols.names.length;
+    uint32_t shstrtab_name = add_string(&names, ".shstrtab");
+    // Marks the stack as not executable.
+    uint32_t note_name = add_string(&names, ".note.GNU-stack");
+    headers[SHSTRTAB] = section_header(shstrtab_name, SHT_STRTAB, 0, 0, shstrtab_offset, names.length, 1);
+    uint64_t headers_offset = align_up(shstrtab_offset + names.length, 8);
+    headers[NOTE] = section_header(note_name, SHT_PROGBITS, 0, 0, headers_offset, 0, 1);
+
+    Elf64_Ehdr header;
+    init_header(&header, ET_REL);
+    header.e_shoff = headers_offset;
+    header.e_shnum = SECTION_HEADERS;
+    header.e_shstrndx = SHSTRTAB;
+
+    uint64_t position = 0;
+    put(out, &position, &header, sizeof(header));
+    put(out, &position, object->text, object->text_size);
+    put(out, &position, object->data, object->data_size);
+    pad_to(out, &position, rela_offset);
+    for (uint32_t i = 0; i < object->reloc_count; i++) {
+        const ObjectReloc* reloc = &object->relocs[i];
+        Elf64_Rela rela;
+        rela.r_offset = reloc->offset;
+        rela.r_info = ELF64_R_INFO(symbols.index[reloc->symbol], reloc->kind == RELOC_PC32 ? R_X86_64_PC32 : R_X86_64_32S);
+        rela.r_addend = reloc->addend;
+        put(out, &position, &rela, sizeof(rela));
+    }
+    put(out, &position, symbols.entries, symtab_size);
+    put(out, &position, symbols.names.data, symbols.names.length);
+    put(out, &position, names.data, names.length);
+    pad_to(out, &position, headers_offset);
+    put(out, &position, headers, sizeof(headers));
+
+    emit_free(&names);
+    free_symbol_table(&symbols);
+}
+
+// Applies the relocations to a copy of .text for the given section
+// addresses.
+static uint8_t* relocate_text(const ObjectFile* object, const uint64_t bases[SECTION_COUNT]) {
+    uint8_t* text = (uint8_t*)malloc(object->text_size ? object->text_size : 1);
+    if (!text) {
+        fprintf(stderr, "Error: Out of memory linking\n");
+        exit(1);
+    }
+    memcpy(text, object->text, object->text_size);
+    object_relocate(object, text, bases);
+    return text;
+}
+
+void elf_write_executable(const ObjectFile* object, Emitter* out) {
+    int64_t entry = object_find_symbol(object, symbol_intern("_start", 6));
+    if (entry < 0 || object->symbols[entry].section != SECTION_TEXT) {
+        fprintf(stderr, "Error: Undefined symbol '_start'\n");
+        exit(1);
+    }
+
+    enum { TEXT_SEGMENT, DATA_SEGMENT, STACK_SEGMENT, SEGMENTS };
+    uint64_t text_offset = align_up(sizeof(Elf64_Ehdr) + SEGMENTS * sizeof(Elf64_Phdr), 16);
+    uint64_t data_offset = align_up(text_offset + object->text_size, 8);
+    uint64_t bases[SECTION_COUNT];
+    bases[SECTION_TEXT] = EXECUTABLE_BASE + text_offset;
+    // The data segment starts on a new page, at the same offset in the page
+    // as in the file.
+    bases[SECTION_DATA] = align_up(bases[SECTION_TEXT] + object->text_size, PAGE_SIZE) + data_offset % PAGE_SIZE;
+    bases[SECTION_BSS] = bases[SECTION_DATA] + align_up(object->data_size, 8);
+
+    uint8_t* text = relocate_text(object, bases);
+    SymbolTable symbols;
+    build_symbol_table(object, bases, &symbols);
+
+    enum { TEXT = 1, DATA, BSS, SYMTAB, STRTAB, SHSTRTAB, SECTION_HEADERS };
+    Elf64_Shdr headers[SECTION_HEADERS];
+    memset(headers, 0, sizeof(headers));
+    Emitter names;
+    emit_init(&names, -1);
+    emit_char(&names, '\0');
+    add_program_sections(headers, &names, object, bases, text_offset, data_offset);
+    uint64_t symtab_offset = align_up(data_offset + object->data_size, 8);
+    uint64_t symtab_size = (uint64_t)symbols.count * sizeof(Elf64_Sym);
+    uint64_t strtab_offset = symtab_offset + symtab_size;
+    headers[SYMTAB] = section_header(add_string(&names, ".symtab"), SHT_SYMTAB, 0, 0, symtab_offset, symtab_size, 8);
+    headers[SYMTAB].sh_link = STRTAB;
+    headers[SYMTAB].sh_info = symbols.first_global;
+    headers[SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+    headers[STRTAB] = section_header(add_string(&names, ".strtab"), SHT_STRTAB, 0, 0, strtab_offset,
+                                     symbols.names.length, 1);
+    uint64_t shstrtab_offset = strtab_offset + symbols.names.length;
+    uint32_t shstrtab_name = add_string(&names, ".shstrtab");
+    headers[SHSTRTAB] = section_header(shstrtab_name, SHT_STRTAB, 0, 0, shstrtab_offset, names.length, 1);
+    uint64_t headers_offset = align_up(shstrtab_offset + names.length, 8);
+
+    Elf64_Phdr segments[SEGMENTS];
+    memset(segments, 0, sizeof(segments));
+    segments[TEXT_SEGMENT].p_type = PT_LOAD;
+    segments[TEXT_SEGMENT].p_flags = PF_R | PF_X;
+    segments[TEXT_SEGMENT].p_vaddr = EXECUTABLE_BASE;
+    segments[TEXT_SEGMENT].p_paddr = EXECUTABLE_BASE;
+    segments[TEXT_SEGMENT].p_filesz = text_offset + object->text_size;
+    segments[TEXT_SEGMENT].p_memsz = text_offset + object->text_size;
+    segments[TEXT_SEGMENT].p_align = PAGE_SIZE;
+    segments[DATA_SEGMENT].p_type = PT_LOAD;
+    segments[DATA_SEGMENT].p_flags = PF_R | PF_W;
+    segments[DATA_SEGMENT].p_offset = data_offset;
+    segments[DATA_SEGMENT].p_vaddr = bases[SECTION_DATA];
+    segments[DATA_SEGMENT].p_paddr = bases[SECTION_DATA];
+    segments[DATA_SEGMENT].p_filesz = object->data_size;
+    segments[DATA_SEGMENT].p_memsz = bases[SECTION_BSS] + object->bss_size - bases[SECTION_DATA];
+    segments[DATA_SEGMENT].p_align = PAGE_SIZE;
+    segments[STACK_SEGMENT].p_type = PT_GNU_STACK;
+    segments[STACK_SEGMENT].p_flags = PF_R | PF_W;
+
+    Elf64_Ehdr header;
+    init_header(&header, ET_EXEC);
+    header.e_entry = bases[SECTION_TEXT] + object->symbols[entry].offset;
+    header.e_phoff = sizeof(Elf64_Ehdr);
+    header.e_phentsize = sizeof(Elf64_Phdr);
+    header.e_phnum = SEGMENTS;
+    header.e_shoff = headers_offset;
+    header.e_shnum = SECTION_HEADERS;
+    header.e_shstrndx = SHSTRTAB;
+
+    uint64_t position = 0;
+    put(out, &position, &header, sizeof(header));
+    put(out, &position, segments, sizeof(segments));
+    pad_to(out, &position, text_offset);
+    put(out, &position, text, object->text_size);
+    pad_to(out, &position, data_offset);
+    put(out, &position, object->data, object->data_size);
+    pad_to(out, &position, symtab_offset);
+    put(out, &position, symbols.entries, symtab_size);
+    put(out, &position, symbols.names.data, symbols.names.length);
+    put(out, &position, names.data, names.length);
+    pad_to(out, &position, headers_offset);
+    put(out, &position, headers, sizeof(headers));
+
+    emit_free(&names);
+    free_symbol_table(&symbols);
+    free(text);
+}
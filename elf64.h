@@ -0,0 +1,15 @@
+#ifndef ELF64_H
+#define ELF64_H
+
+#include "object.h"
+#include "emit.h"
+
+// Writes `object` as an ELF64 relocatable object for x86-64 Linux, to be
+// linked by ld like the output of nasm.
+void elf_write_object(const ObjectFile* object, Emitter* out);
+
+// Links `object` on its own into a static executable that starts at
+// _start. Every symbol it refers to must be defined.
+void elf_write_executable(const ObjectFile* object, Emitter* out);
+
+#endif // ELF64_H
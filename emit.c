@@ -0,0 +1,198 @@
+#include "emit.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define EMIT_BUFFER_SIZE (256 * 1024)
+
+void emit_init(Emitter* emitter, int fd) {
+    emitter->capacity = EMIT_BUFFER_SIZE;
+    emitter->data = (char*)malloc(emitter->capacity);
+    if (!emitter->data) {
+        fprintf(stderr, "Error: Out of memory allocating output buffer\n");
+        exit(1);
+    }
+    emitter->length = 0;
+    emitter->fd = fd;
+    emitter->comments = 1;
+    emitter->error = 0;
+    emitter->bytes_written = 0;
+}
+
+static void write_all(Emitter* emitter, const char* data, size_t length) {
+    while (length > 0 && !emitter->error) {
+        ssize_t written = write(emitter->fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            emitter->error = errno;
+            return;
+        }
+        data += written;
+        length -= (size_t)written;
+        emitter->bytes_written += (size_t)written;
+    }
+}
+
+int emit_flush(Emitter* emitter) {
+    if (emitter->fd >= 0) {
+        write_all(emitter, emitter->data, emitter->length);
+        emitter->length = 0;
+    }
+    if (emitter->error) {
+        errno = emitter->error;
+        return -1;
+    }
+    return 0;
+}
+
+void emit_free(Emitter* emitter) {
+    free(emitter->data);
+    emitter->data = NULL;
+    emitter->length = 0;
+    emitter->capacity = 0;
+}
+
+// Makes room for `length` more bytes, either by writing the buffer out or,
+// for in-memory emitters, by growing it.
+static void reserve(Emitter* emitter, size_t length) {
+    if (emitter->capacity - emitter->length >= length) return;
+    if (emitter->fd >= 0) {
+        emit_flush(emitter);
+        if (emitter->capacity >= length) return;
+    }
+    size_t capacity = emitter->capacity;
+    while (capacity - emitter->length < length) capacity *= 2;
+    char* data = (char*)realloc(emitter->data, capacity);
+    if (!data) {
+        fprintf(stderr, "Error: Out of memory growing output buffer to %zu bytes\n", capacity);
+        exit(1);
+    }
+    emitter->data = data;
+    emitter->capacity = capacity;
+}
+
+void emit_bytes(Emitter* emitter, const char* text, size_t length) {
+    reserve(emitter, length);
+    memcpy(emitter->data + emitter->length, text, length);
+    emitter->length += length;
+}
+
+void emit_text(Emitter* emitter, const char* text) {
+    emit_bytes(emitter, text, strlen(text));
+}
+
+void emit_char(Emitter* emitter, char c) {
+    reserve(emitter, 1);
+    emitter->data[emitter->length++] = c;
+}
+
+void emit_int(Emitter* emitter, int64_t value) {
+    char digits[20];
+    size_t count = 0;
+    // Negate in unsigned arithmetic so INT64_MIN does not overflow.
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+
+    reserve(emitter, count + 1);
+    char* out = emitter->data + emitter->length;
+    if (value < 0) *out++ = '-';
+    while (count) *out++ = digits[--count];
+    emitter->length = (size_t)(out - emitter->data);
+}
+
+void emit_begin(Emitter* emitter, const char* mnemonic) {
+    emit_bytes(emitter, "  ", 2);
+    emit_text(emitter, mnemonic);
+    emit_char(emitter, ' ');
+}
+
+void emit_end(Emitter* emitter) {
+    emit_char(emitter, '\n');
+}
+
+void emit_operand_separator(Emitter* emitter) {
+    emit_bytes(emitter, ", ", 2);
+}
+
+void emit_symbol_address(Emitter* emitter, const char* name, const char* index) {
+    emit_bytes(emitter, "[rel ", 5);
+    emit_text(emitter, name);
+    if (index) {
+        emit_bytes(emitter, " + ", 3);
+        emit_text(emitter, index);
+        emit_bytes(emitter, "*8", 2);
+    }
+    emit_char(emitter, ']');
+}
+
+void emit_note(Emitter* emitter, const char* text) {
+    if (!emitter->comments) return;
+    emit_bytes(emitter, "  ; ", 4);
+    emit_text(emitter, text);
+}
+
+void emit_op(Emitter* emitter, const char* mnemonic) {
+    emit_bytes(emitter, "  ", 2);
+    emit_text(emitter, mnemonic);
+    emit_char(emitter, '\n');
+}
+
+void emit_op1(Emitter* emitter, const char* mnemonic, const char* operand) {
+    emit_begin(emitter, mnemonic);
+    emit_text(emitter, operand);
+    emit_end(emitter);
+}
+
+void emit_op2(Emitter* emitter, const char* mnemonic, const char* dst, const char* src) {
+    emit_begin(emitter, mnemonic);
+    emit_text(emitter, dst);
+    emit_operand_separator(emitter);
+    emit_text(emitter, src);
+    emit_end(emitter);
+}
+
+void emit_op_imm(Emitter* emitter, const char* mnemonic, const char* dst, int64_t value) {
+    emit_begin(emitter, mnemonic);
+    emit_text(emitter, dst);
+    emit_operand_separator(emitter);
+    emit_int(emitter, value);
+    emit_end(emitter);
+}
+
+void emit_jump(Emitter* emitter, const char* mnemonic, const char* prefix, int label) {
+    emit_begin(emitter, mnemonic);
+    emit_text(emitter, prefix);
+    emit_int(emitter, label);
+    emit_end(emitter);
+}
+
+void emit_label(Emitter* emitter, const char* name) {
+    emit_text(emitter, name);
+    emit_bytes(emitter, ":\n", 2);
+}
+
+void emit_numbered_label(Emitter* emitter, const char* prefix, int label) {
+    emit_text(emitter, prefix);
+    emit_int(emitter, label);
+    emit_bytes(emitter, ":\n", 2);
+}
+
+void emit_directive(Emitter* emitter, const char* directive, const char* argument) {
+    emit_text(emitter, directive);
+    emit_char(emitter, ' ');
+    emit_text(emitter, argument);
+    emit_char(emitter, '\n');
+}
+
+void emit_comment(Emitter* emitter, const char* text, const char* name) {
+    if (!emitter->comments) return;
+    emit_bytes(emitter, "; ", 2);
+    emit_text(emitter, text);
+    if (name) emit_text(emitter, name);
+    emit_char(emitter, '\n');
+}
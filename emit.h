@@ -0,0 +1,57 @@
+#ifndef EMIT_H
+#define EMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Output buffer for generated assembly. Text is appended with the routines
+// below instead of formatted with fprintf; the buffer is written to `fd` in
+// large chunks as it fills. With fd < 0 the buffer only grows and nothing is
+// written, which lets callers build text in memory.
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    int fd;
+    int comments;    // Emit "; ..." annotations; off with --no-comments
+    int error;       // errno of the first failed write, or 0
+    size_t bytes_written;
+} Emitter;
+
+void emit_init(Emitter* emitter, int fd);
+// Writes out any buffered text. Returns 0, or -1 with errno set if any
+// write since emit_init failed.
+int emit_flush(Emitter* emitter);
+void emit_free(Emitter* emitter);
+
+// Raw appends.
+void emit_bytes(Emitter* emitter, const char* text, size_t length);
+void emit_text(Emitter* emitter, const char* text);
+void emit_char(Emitter* emitter, char c);
+void emit_int(Emitter* emitter, int64_t value);
+
+// Instructions are written as "  <mnemonic> <operands>\n". The operands
+// between emit_begin and emit_end are appended with the raw routines or the
+// operand helpers.
+void emit_begin(Emitter* emitter, const char* mnemonic);
+void emit_end(Emitter* emitter);
+void emit_operand_separator(Emitter* emitter);                            // ", "
+void emit_symbol_address(Emitter* emitter, const char* name, const char* index); // [rel name + index*8]
+void emit_note(Emitter* emitter, const char* text);                       // trailing "  ; text"
+
+// Whole-line shortcuts for the common instruction shapes.
+void emit_op(Emitter* emitter, const char* mnemonic);
+void emit_op1(Emitter* emitter, const char* mnemonic, const char* operand);
+void emit_op2(Emitter* emitter, const char* mnemonic, const char* dst, const char* src);
+void emit_op_imm(Emitter* emitter, const char* mnemonic, const char* dst, int64_t value);
+void emit_jump(Emitter* emitter, const char* mnemonic, const char* prefix, int label);
+
+// Labels and directives.
+void emit_label(Emitter* emitter, const char* name);                 // name:
+void emit_numbered_label(Emitter* emitter, const char* prefix, int label); // prefix<label>:
+void emit_directive(Emitter* emitter, const char* directive, const char* argument);
+
+// "; text name\n" when comments are enabled; `name` may be NULL.
+void emit_comment(Emitter* emitter, const char* text, const char* name);
+
+#endif // EMIT_H
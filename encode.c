@@ -0,0 +1,474 @@
+#include "encode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Instructions are encoded one at a time into a small buffer. A field that
+// refers to a local label or a symbol is left zero and recorded; once every
+// instruction's position is known, label displacements are filled in and
+// symbol references become relocations. Jumps to labels start out in
+// their short form and are widened, a pass at a time, until every short
+// displacement fits.
+
+typedef enum {
+    FIXUP_NONE,
+    FIXUP_LABEL8,
+    FIXUP_LABEL32,
+    FIXUP_PC32,  // RIP-relative reference to a symbol
+    FIXUP_ABS32, // Absolute address of a symbol, with an index register
+} FixupKind;
+
+typedef struct {
+    uint8_t bytes[16];
+    uint8_t length;
+    uint8_t fixup;  // FixupKind
+    uint8_t field;  // Offset of the fixed-up field in `bytes`
+    uint32_t target; // Label number or object symbol index
+} Encoding;
+
+static ObjectFile* object;
+
+static int fits_int8(int64_t value) {
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+static int fits_int32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static void put(Encoding* e, uint8_t byte) {
+    e->bytes[e->length++] = byte;
+}
+
+static void put_bytes(Encoding* e, uint64_t value, int count) {
+    for (int i = 0; i < count; i++) put(e, (uint8_t)(value >> (8 * i)));
+}
+
+// Records a 4-byte field at the current position, to be fixed up.
+static void put_fixup(Encoding* e, FixupKind kind, uint32_t target) {
+    e->fixup = (uint8_t)kind;
+    e->field = e->length;
+    e->target = target;
+    put_bytes(e, 0, 4);
+}
+
+static int is_memory(const MOperand* operand) {
+    return operand->kind == MOPERAND_STACK || operand->kind == MOPERAND_ADDRESS ||
+           operand->kind == MOPERAND_GLOBAL || operand->kind == MOPERAND_STRING;
+}
+
+// spl, bpl, sil and dil are only reachable with a REX prefix.
+static int needs_rex(const MOperand* operand) {
+    return operand->kind == MOPERAND_REG && operand->width == 1 && operand->reg >= REG_RSP && operand->reg <= REG_RDI;
+}
+
+static void unsupported(const MInstr* instr) {
+    fprintf(stderr, "Error: Cannot encode instruction with opcode %d and %d operands\n", instr->op,
+            instr->operand_count);
+    exit(1);
+}
+
+Symbol encode_string_name(uint32_t index) {
+    char name[24];
+    int length = snprintf(name, sizeof(name), "str_%u", index);
+    return symbol_intern(name, (size_t)length);
+}
+
+// ModRM, SIB and displacement for [base + index*scale + disp].
+static void put_base_index(Encoding* e, int reg, MachineReg base, MachineReg index, int scale, int64_t disp) {
+    if (base == REG_NONE) {
+        fprintf(stderr, "Error: Cannot encode a memory operand without a base register\n");
+        exit(1);
+    }
+    int mod = disp == 0 && (base & 7) != REG_RBP ? 0 : (fits_int8(disp) ? 1 : 2);
+    if (index != REG_NONE || (base & 7) == REG_RSP) {
+        int scale_bits = scale == 8 ? 3 : (scale == 4 ? 2 : (scale == 2 ? 1 : 0));
+        put(e, (uint8_t)(mod << 6 | (reg & 7) << 3 | 4));
+        put(e, (uint8_t)(scale_bits << 6 | ((index != REG_NONE ? index : REG_RSP) & 7) << 3 | (base & 7)));
+    } else {
+        put(e, (uint8_t)(mod << 6 | (reg & 7) << 3 | (base & 7)));
+    }
+    if (mod == 1) put_bytes(e, (uint64_t)disp, 1);
+    if (mod == 2) put_bytes(e, (uint64_t)disp, 4);
+}
+
+// Prefixes, opcode and ModRM for an instruction of operand size `width`
+// whose ModRM reg field is `reg`, a register or an opcode extension, and
+// whose r/m operand is `rm`.
+static void put_rm(Encoding* e, int width, const uint8_t* opcode, int opcode_length, int reg, int force_rex,
+                   const MOperand* rm) {
+    if (width == 2) put(e, 0x66);
+    uint8_t rex = 0x40;
+    if (width == 8) rex |= 8;
+    if (reg & 8) rex |= 4;
+    if (rm->kind == MOPERAND_REG || rm->kind == MOPERAND_STACK) {
+        if (rm->reg & 8) rex |= 1;
+    } else if (rm->kind == MOPERAND_ADDRESS) {
+        if (rm->reg != REG_NONE && (rm->reg & 8)) rex |= 1;
+        if (rm->index != REG_NONE && (rm->index & 8)) rex |= 2;
+    } else if (rm->kind == MOPERAND_GLOBAL) {
+        if (rm->reg != REG_NONE && (rm->reg & 8)) rex |= 2;
+    }
+    if (rex != 0x40 || force_rex || needs_rex(rm)) put(e, rex);
+    for (int i = 0; i < opcode_length; i++) put(e, opcode[i]);
+
+    switch (rm->kind) {
+        case MOPERAND_REG:
+            put(e, (uint8_t)(0xc0 | (reg & 7) << 3 | (rm->reg & 7)));
+            break;
+        case MOPERAND_STACK:
+            put_base_index(e, reg, (MachineReg)rm->reg, REG_NONE, 1, rm->value);
+            break;
+        case MOPERAND_ADDRESS:
+            put_base_index(e, reg, (MachineReg)rm->reg, (MachineReg)rm->index, rm->scale, rm->value);
+            break;
+        case MOPERAND_GLOBAL:
+            if (rm->reg == REG_NONE) {
+                put(e, (uint8_t)((reg & 7) << 3 | 5)); // [rip + disp32]
+                put_fixup(e, FIXUP_PC32, object_symbol(object, (Symbol)rm->value));
+            } else {
+                // RIP-relative addressing takes no index: [index*8 + disp32]
+                put(e, (uint8_t)((reg & 7) << 3 | 4));
+                put(e, (uint8_t)(3 << 6 | (rm->reg & 7) << 3 | 5));
+                put_fixup(e, FIXUP_ABS32, object_symbol(object, (Symbol)rm->value));
+            }
+            break;
+        case MOPERAND_STRING:
+            put(e, (uint8_t)((reg & 7) << 3 | 5));
+            put_fixup(e, FIXUP_PC32, object_symbol(object, encode_string_name((uint32_t)rm->value)));
+            break;
+        default:
+            fprintf(stderr, "Error: Cannot encode operand kind %d as r/m\n", rm->kind);
+            exit(1);
+    }
+}
+
+static void put_rm1(Encoding* e, int width, uint8_t opcode, int reg, const MOperand* rm) {
+    put_rm(e, width, &opcode, 1, reg, 0, rm);
+}
+
+// Register operands set the operation's size; otherwise the memory
+// operand's width does.
+static int operation_width(const MInstr* instr) {
+    for (int i = 0; i < instr->operand_count; i++) {
+        if (instr->operands[i].kind == MOPERAND_REG) return instr->operands[i].width;
+    }
+    for (int i = 0; i < instr->operand_count; i++) {
+        if (is_memory(&instr->operands[i])) return instr->operands[i].width;
+    }
+    return 8;
+}
+
+static void put_immediate(Encoding* e, int width, int64_t value) {
+    put_bytes(e, (uint64_t)value, width == 8 ? 4 : width);
+}
+
+// mov r, imm with the shortest encoding of the same value: a sign-extended
+// imm32, a zero-extending 32-bit mov, or the full 64-bit immediate.
+static void encode_load_immediate(Encoding* e, const MOperand* reg, int64_t value) {
+    int r = reg->reg;
+    if (reg->width == 8 && fits_int32(value)) {
+        put_rm1(e, 8, 0xc7, 0, reg);
+        put_bytes(e, (uint64_t)value, 4);
+        return;
+    }
+    int wide = reg->width == 8 && (value < 0 || value > UINT32_MAX);
+    if (reg->width == 2) put(e, 0x66);
+    if (wide || (r & 8) || needs_rex(reg)) put(e, (uint8_t)(0x40 | (wide ? 8 : 0) | (r & 8 ? 1 : 0)));
+    put(e, (uint8_t)((reg->width == 1 ? 0xb0 : 0xb8) + (r & 7)));
+    put_bytes(e, (uint64_t)value, wide ? 8 : (reg->width == 8 ? 4 : reg->width));
+}
+
+static void encode_mov(Encoding* e, const MInstr* instr) {
+    const MOperand* dst = &instr->operands[0];
+    const MOperand* src = &instr->operands[1];
+    if (dst->kind == MOPERAND_REG && src->kind == MOPERAND_IMM) {
+        encode_load_immediate(e, dst, src->value);
+    } else if (src->kind == MOPERAND_REG) {
+        put_rm(e, src->width, (const uint8_t*)(src->width == 1 ? "\x88" : "\x89"), 1, src->reg, needs_rex(src), dst);
+    } else if (dst->kind == MOPERAND_REG && is_memory(src)) {
+        put_rm(e, dst->width, (const uint8_t*)(dst->width == 1 ? "\x8a" : "\x8b"), 1, dst->reg, needs_rex(dst), src);
+    } else if (is_memory(dst) && src->kind == MOPERAND_IMM && fits_int32(src->value)) {
+        put_rm1(e, dst->width, dst->width == 1 ? 0xc6 : 0xc7, 0, dst);
+        put_immediate(e, dst->width, src->value);
+    } else {
+        unsupported(instr);
+    }
+}
+
+// add, or, and, sub, xor and cmp share their encodings, told apart by
+// `group` in the ModRM reg field or the opcode.
+static void encode_alu(Encoding* e, const MInstr* instr, int group) {
+    const MOperand* dst = &instr->operands[0];
+    const MOperand* src = &instr->operands[1];
+    int width = operation_width(instr);
+    if (src->kind == MOPERAND_IMM && fits_int32(src->value)) {
+        if (fits_int8(src->value)) {
+            put_rm1(e, width, 0x83, group, dst);
+            put_bytes(e, (uint64_t)src->value, 1);
+        } else {
+            put_rm1(e, width, 0x81, group, dst);
+            put_bytes(e, (uint64_t)src->value, 4);
+        }
+    } else if (src->kind == MOPERAND_REG) {
+        put_rm1(e, width, (uint8_t)(group << 3 | 1), src->reg, dst);
+    } else if (dst->kind == MOPERAND_REG && is_memory(src)) {
+        put_rm1(e, width, (uint8_t)(group << 3 | 3), dst->reg, src);
+    } else {
+        unsupported(instr);
+    }
+}
+
+// Single-operand instructions of the F7 group: mul, imul, neg, idiv.
+static void encode_unary(Encoding* e, const MInstr* instr, int extension) {
+    put_rm1(e, operation_width(instr), 0xf7, extension, &instr->operands[0]);
+}
+
+static void encode_shift(Encoding* e, const MInstr* instr, int extension) {
+    const MOperand* dst = &instr->operands[0];
+    const MOperand* count = &instr->operands[1];
+    if (count->kind == MOPERAND_REG && count->reg == REG_RCX) {
+        put_rm1(e, dst->width, 0xd3, extension, dst);
+    } else if (count->kind == MOPERAND_IMM && count->value == 1) {
+        put_rm1(e, dst->width, 0xd1, extension, dst);
+    } else if (count->kind == MOPERAND_IMM) {
+        put_rm1(e, dst->width, 0xc1, extension, dst);
+        put_bytes(e, (uint64_t)count->value, 1);
+    } else {
+        unsupported(instr);
+    }
+}
+
+static void encode_imul(Encoding* e, const MInstr* instr) {
+    const MOperand* a = &instr->operands[0];
+    // imul reg, imm is NASM shorthand for imul reg, reg, imm.
+    const MOperand* source = &instr->operands[instr->operand_count == 3 ? 1 : 0];
+    const MOperand* multiplier = &instr->operands[instr->operand_count - 1];
+    if (instr->operand_count == 1) {
+        encode_unary(e, instr, 5);
+    } else if (a->kind == MOPERAND_REG && multiplier->kind == MOPERAND_IMM) {
+        if (fits_int8(multiplier->value)) {
+            put_rm1(e, a->width, 0x6b, a->reg, source);
+            put_bytes(e, (uint64_t)multiplier->value, 1);
+        } else {
+            put_rm1(e, a->width, 0x69, a->reg, source);
+            put_bytes(e, (uint64_t)multiplier->value, 4);
+        }
+    } else if (instr->operand_count == 2 && a->kind == MOPERAND_REG) {
+        put_rm(e, a->width, (const uint8_t*)"\x0f\xaf", 2, a->reg, 0, multiplier);
+    } else {
+        unsupported(instr);
+    }
+}
+
+// Jumps and calls to a label or a function; `near` selects rel32 for a
+// label that is out of reach of rel8.
+static void encode_branch(Encoding* e, const MInstr* instr, int near) {
+    const MOperand* target = &instr->operands[0];
+    int label = target->kind == MOPERAND_LABEL;
+    if (!label && target->kind != MOPERAND_FUNCTION) unsupported(instr);
+    uint32_t destination = label ? (uint32_t)target->value : object_symbol(object, (Symbol)target->value);
+    if (instr->op == M_CALL) {
+        put(e, 0xe8);
+    } else if (label && !near) {
+        put(e, (uint8_t)(instr->op == M_JMP ? 0xeb : 0x70 + instr->cond));
+        e->fixup = FIXUP_LABEL8;
+        e->field = e->length;
+        e->target = destination;
+        put(e, 0);
+        return;
+    } else if (instr->op == M_JMP) {
+        put(e, 0xe9);
+    } else {
+        put(e, 0x0f);
+        put(e, (uint8_t)(0x80 + instr->cond));
+    }
+    put_fixup(e, label ? FIXUP_LABEL32 : FIXUP_PC32, destination);
+}
+
+static void encode_push_pop(Encoding* e, const MInstr* instr) {
+    const MOperand* operand = &instr->operands[0];
+    if (operand->kind == MOPERAND_REG) {
+        if (operand->reg & 8) put(e, 0x41);
+        put(e, (uint8_t)((instr->op == M_PUSH ? 0x50 : 0x58) + (operand->reg & 7)));
+    } else if (instr->op == M_PUSH && operand->kind == MOPERAND_IMM && fits_int32(operand->value)) {
+        put(e, fits_int8(operand->value) ? 0x6a : 0x68);
+        put_bytes(e, (uint64_t)operand->value, fits_int8(operand->value) ? 1 : 4);
+    } else if (instr->op == M_PUSH && is_memory(operand)) {
+        put_rm1(e, 4, 0xff, 6, operand); // 64-bit without REX.W
+    } else {
+        unsupported(instr);
+    }
+}
+
+static void encode_instr(Encoding* e, const MInstr* instr, int near) {
+    memset(e, 0, sizeof(*e));
+    const MOperand* a = &instr->operands[0];
+    const MOperand* b = &instr->operands[1];
+    switch (instr->op) {
+        case M_NOP:
+        case M_LABEL:
+            break;
+        case M_MOV:
+            encode_mov(e, instr);
+            break;
+        case M_MOVZX:
+            put_rm(e, a->width, (const uint8_t*)(b->width == 1 ? "\x0f\xb6" : "\x0f\xb7"), 2, a->reg, 0, b);
+            break;
+        case M_LEA:
+            put_rm1(e, a->width, 0x8d, a->reg, b);
+            break;
+        case M_ADD:
+            encode_alu(e, instr, 0);
+            break;
+        case M_AND:
+            encode_alu(e, instr, 4);
+            break;
+        case M_SUB:
+            encode_alu(e, instr, 5);
+            break;
+        case M_XOR:
+            encode_alu(e, instr, 6);
+            break;
+        case M_CMP:
+            encode_alu(e, instr, 7);
+            break;
+        case M_TEST:
+            if (b->kind == MOPERAND_REG) {
+                put_rm1(e, b->width, 0x85, b->reg, a);
+            } else if (b->kind == MOPERAND_IMM && fits_int32(b->value)) {
+                put_rm1(e, operation_width(instr), 0xf7, 0, a);
+                put_bytes(e, (uint64_t)b->value, 4);
+            } else {
+                unsupported(instr);
+            }
+            break;
+        case M_IMUL:
+            encode_imul(e, instr);
+            break;
+        case M_MUL:
+            encode_unary(e, instr, 4);
+            break;
+        case M_NEG:
+            encode_unary(e, instr, 3);
+            break;
+        case M_IDIV:
+            encode_unary(e, instr, 7);
+            break;
+        case M_CQO:
+            put(e, 0x48);
+            put(e, 0x99);
+            break;
+        case M_SHL:
+            encode_shift(e, instr, 4);
+            break;
+        case M_SHR:
+            encode_shift(e, instr, 5);
+            break;
+        case M_SAR:
+            encode_shift(e, instr, 7);
+            break;
+        case M_SETCC: {
+            uint8_t opcode[2] = { 0x0f, (uint8_t)(0x90 + instr->cond) };
+            put_rm(e, 1, opcode, 2, 0, 0, a);
+            break;
+        }
+        case M_CMOVCC: {
+            uint8_t opcode[2] = { 0x0f, (uint8_t)(0x40 + instr->cond) };
+            put_rm(e, a->width, opcode, 2, a->reg, 0, b);
+            break;
+        }
+        case M_JMP:
+        case M_JCC:
+        case M_CALL:
+            encode_branch(e, instr, near);
+            break;
+        case M_RET:
+            put(e, 0xc3);
+            break;
+        case M_PUSH:
+        case M_POP:
+            encode_push_pop(e, instr);
+            break;
+        case M_SYSCALL:
+            put(e, 0x0f);
+            put(e, 0x05);
+            break;
+        default:
+            unsupported(instr);
+    }
+}
+
+static void* allocate(size_t count, size_t size) {
+    void* memory = calloc(count ? count : 1, size);
+    if (!memory) {
+        fprintf(stderr, "Error: Out of memory encoding instructions\n");
+        exit(1);
+    }
+    return memory;
+}
+
+void encode_function(ObjectFile* target, const MachineFunction* function) {
+    object = target;
+    uint32_t count = function->count;
+    Encoding* encodings = (Encoding*)allocate(count, sizeof(Encoding));
+    uint8_t* near = (uint8_t*)allocate(count, sizeof(uint8_t));
+    uint64_t* offsets = (uint64_t*)allocate(count, sizeof(uint64_t));
+    uint64_t* labels = (uint64_t*)allocate(function->label_count, sizeof(uint64_t));
+    for (uint32_t i = 0; i < count; i++) encode_instr(&encodings[i], &function->code[i], 0);
+
+    uint64_t size;
+    for (;;) {
+        size = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            offsets[i] = size;
+            if (function->code[i].op == M_LABEL) labels[function->code[i].operands[0].value] = size;
+            size += encodings[i].length;
+        }
+        int widened = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            const Encoding* e = &encodings[i];
+            if (e->fixup != FIXUP_LABEL8) continue;
+            int64_t displacement = (int64_t)labels[e->target] - (int64_t)(offsets[i] + e->length);
+            if (fits_int8(displacement)) continue;
+            near[i] = 1;
+            encode_instr(&encodings[i], &function->code[i], 1);
+            widened = 1;
+        }
+        if (!widened) break;
+    }
+
+    Symbol name = function->is_entry ? symbol_intern("_start", 6) : function->name;
+    uint32_t symbol = object_define(object, name, SECTION_TEXT, size, 1);
+    object->symbols[symbol].function = 1;
+    uint64_t base = object->text_size;
+    for (uint32_t i = 0; i < count; i++) {
+        Encoding* e = &encodings[i];
+        int64_t end = (int64_t)(offsets[i] + e->length);
+        switch (e->fixup) {
+            case FIXUP_LABEL8:
+                e->bytes[e->field] = (uint8_t)((int64_t)labels[e->target] - end);
+                break;
+            case FIXUP_LABEL32: {
+                int64_t displacement = (int64_t)labels[e->target] - end;
+                for (int k = 0; k < 4; k++) e->bytes[e->field + k] = (uint8_t)(displacement >> (8 * k));
+                break;
+            }
+            case FIXUP_PC32:
+                // The displacement is from the end of the instruction, which
+                // an immediate may follow.
+                object_add_reloc(object, base + offsets[i] + e->field, e->target, RELOC_PC32,
+                                 (int64_t)e->field - e->length);
+                break;
+            case FIXUP_ABS32:
+                object_add_reloc(object, base + offsets[i] + e->field, e->target, RELOC_ABS32, 0);
+                break;
+        }
+        object_append(object, SECTION_TEXT, e->bytes, e->length);
+    }
+
+    free(encodings);
+    free(near);
+    free(offsets);
+    free(labels);
+}
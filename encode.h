@@ -0,0 +1,15 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include "machine.h"
+#include "object.h"
+
+// The name string literal `index` has in the output: str_<index>.
+Symbol encode_string_name(uint32_t index);
+
+// Appends the machine code for `function` to the object's .text and
+// defines its symbol there. Local jumps take the 2-byte form whenever the
+// target is in reach; references to symbols become relocations.
+void encode_function(ObjectFile* object, const MachineFunction* function);
+
+#endif // ENCODE_H
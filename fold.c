@@ -0,0 +1,483 @@
+#include "fold.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Wegman-Zadeck sparse conditional constant propagation, extended to the
+// scalar globals a function reads and writes with load/store. Every
+// register and every tracked global at each block boundary holds a lattice
+// value; blocks are only evaluated once an executable edge reaches them,
+// so code behind a constant condition never lowers a value to VARYING.
+//
+// Globals are zero at program start, so the entry function begins with
+// every tracked global known to be 0; other functions know nothing on
+// entry. A call makes every global its callee may store (transitively)
+// VARYING. Calls to functions not defined in the program cannot reach the
+// globals, which are never exported.
+
+typedef enum {
+    LATTICE_UNKNOWN,  // No value seen yet
+    LATTICE_CONSTANT,
+    LATTICE_VARYING,
+} LatticeState;
+
+typedef struct {
+    uint8_t state;
+    int64_t value; // LATTICE_CONSTANT
+} LatticeValue;
+
+// Above this many block-boundary entries (blocks x tracked globals) a
+// function only propagates globals within each block.
+#define FOLD_MAX_BOUNDARY_VALUES (1u << 20)
+
+static const LatticeValue unknown = { LATTICE_UNKNOWN, 0 };
+static const LatticeValue varying = { LATTICE_VARYING, 0 };
+
+static LatticeValue constant(int64_t value) {
+    LatticeValue result = { LATTICE_CONSTANT, value };
+    return result;
+}
+
+static LatticeValue meet(LatticeValue a, LatticeValue b) {
+    if (a.state == LATTICE_UNKNOWN) return b;
+    if (b.state == LATTICE_UNKNOWN) return a;
+    if (a.state == LATTICE_CONSTANT && b.state == LATTICE_CONSTANT && a.value == b.value) return a;
+    return varying;
+}
+
+static int same_value(LatticeValue a, LatticeValue b) {
+    return a.state == b.state && (a.state != LATTICE_CONSTANT || a.value == b.value);
+}
+
+int fold_binary(IrOp op, int64_t left, int64_t right, int64_t* result) {
+    // Arithmetic goes through uint64_t so overflow wraps instead of being
+    // undefined.
+    uint64_t l = (uint64_t)left;
+    uint64_t r = (uint64_t)right;
+    switch (op) {
+        case IR_EQ: *result = left == right; return 1;
+        case IR_NE: *result = left != right; return 1;
+        case IR_LT: *result = left < right; return 1;
+        case IR_GT: *result = left > right; return 1;
+        case IR_LE: *result = left <= right; return 1;
+        case IR_GE: *result = left >= right; return 1;
+        case IR_ADD: *result = (int64_t)(l + r); return 1;
+        case IR_SUB: *result = (int64_t)(l - r); return 1;
+        case IR_MUL: *result = (int64_t)(l * r); return 1;
+        case IR_DIV:
+        case IR_MOD:
+            if (right == 0 || (left == INT64_MIN && right == -1)) return 0; // idiv traps
+            *result = op == IR_DIV ? left / right : left % right;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Folds an AST expression built from literals and binary operators.
+// Returns 0 if it contains anything else or would trap.
+static int fold_expression(const AST* ast, NodeIndex node, int64_t* result) {
+    switch (ast_kind(ast, node)) {
+        case NODE_NUMBER_LITERAL:
+        case NODE_ASCII_LITERAL:
+            *result = ast_literal_value(ast, node);
+            return 1;
+        case NODE_BINARY_EXPRESSION: {
+            // IR binary opcodes share BinaryOperator's numbering.
+            int64_t left, right;
+            return fold_expression(ast, ast_lhs(ast, node), &left) &&
+                   fold_expression(ast, ast_rhs(ast, node), &right) &&
+                   fold_binary((IrOp)ast_operator(ast, node), left, right, result);
+        }
+        default:
+            return 0;
+    }
+}
+
+int64_t fold_array_size(const AST* ast, NodeIndex declaration) {
+    NodeIndex size = ast_var_size(ast, declaration);
+    if (size == AST_NONE) return 1;
+    int64_t elements;
+    if (!fold_expression(ast, size, &elements)) {
+        fprintf(stderr, "Error: Size of array '%s' is not a constant\n", symbol_name(ast_lhs(ast, declaration)));
+        exit(1);
+    }
+    if (elements > IR_MAX_GLOBAL_ELEMENTS) {
+        fprintf(stderr, "Error: Array '%s' is too large\n", symbol_name(ast_lhs(ast, declaration)));
+        exit(1);
+    }
+    return elements > 1 ? elements : 1;
+}
+
+static void* allocate(size_t count, size_t size) {
+    void* memory = calloc(count ? count : 1, size);
+    if (!memory) {
+        fprintf(stderr, "Error: Out of memory during constant folding\n");
+        exit(1);
+    }
+    return memory;
+}
+
+// Globals each function may store, directly or through the functions it
+// calls; computed on first use.
+typedef struct {
+    uint32_t* globals;
+    uint32_t count;
+    int computed;
+} StoreSet;
+
+static IrProgram* program;
+static StoreSet* store_sets;   // Indexed like program->functions
+static uint8_t* indexed;       // Globals accessed as arrays; never tracked
+static uint32_t* global_stamp; // Scratch for computing store sets
+static uint32_t* function_stamp;
+static uint32_t stamp;
+
+// State of the function being analyzed.
+static IrFunction* function;
+static LatticeValue* reg_values;
+static int32_t* slot_of;    // Global index -> tracked slot, or -1
+static uint32_t* tracked;   // Tracked slot -> global index
+static uint32_t tracked_count;
+static LatticeValue* block_out; // block * tracked_count + slot; NULL when block-local
+static uint8_t* reached;
+static uint8_t* edges;      // Executable out-edges: bit 0 to target, bit 1 to other
+static int changed;
+
+static uint32_t global_id(Symbol name) {
+    return (uint32_t)(ir_find_global(program, name) - program->globals);
+}
+
+static const StoreSet* callee_stores(Symbol callee) {
+    IrFunction* target = ir_find_function(program, callee);
+    if (!target) return NULL;
+    uint32_t root = (uint32_t)(target - program->functions);
+    StoreSet* set = &store_sets[root];
+    if (set->computed) return set;
+    set->computed = 1;
+
+    stamp++;
+    uint32_t capacity = 0;
+    uint32_t* stack = (uint32_t*)allocate(program->function_count, sizeof(uint32_t));
+    uint32_t depth = 0;
+    stack[depth++] = root;
+    function_stamp[root] = stamp;
+    while (depth) {
+        const IrFunction* current = &program->functions[stack[--depth]];
+        for (uint32_t b = 0; b < current->block_count; b++) {
+            const IrBlock* block = &current->blocks[b];
+            for (uint32_t i = 0; i < block->count; i++) {
+                const IrInstr* instr = &block->instrs[i];
+                if (instr->op == IR_STORE || instr->op == IR_STORE_ELEM) {
+                    uint32_t id = global_id(instr->symbol);
+                    if (global_stamp[id] == stamp) continue;
+                    global_stamp[id] = stamp;
+                    if (set->count == capacity) {
+                        capacity = capacity ? capacity * 2 : 8;
+                        set->globals = (uint32_t*)realloc(set->globals, capacity * sizeof(uint32_t));
+                        if (!set->globals) {
+                            fprintf(stderr, "Error: Out of memory during constant folding\n");
+                            exit(1);
+                        }
+                    }
+                    set->globals[set->count++] = id;
+                } else if (instr->op == IR_CALL) {
+                    IrFunction* next = ir_find_function(program, instr->symbol);
+                    if (!next) continue;
+                    uint32_t index = (uint32_t)(next - program->functions);
+                    if (function_stamp[index] == stamp) continue;
+                    function_stamp[index] = stamp;
+                    stack[depth++] = index;
+                }
+            }
+        }
+    }
+    free(stack);
+    return set;
+}
+
+static LatticeValue operand_lattice(IrOperand operand) {
+    switch (operand.kind) {
+        case IR_OPERAND_IMM:
+            return constant(operand.value);
+        case IR_OPERAND_REG:
+            return reg_values[operand.value];
+        default:
+            return varying;
+    }
+}
+
+static void set_reg(IrReg reg, LatticeValue value) {
+    LatticeValue lowered = meet(reg_values[reg], value);
+    if (!same_value(lowered, reg_values[reg])) {
+        reg_values[reg] = lowered;
+        changed = 1;
+    }
+}
+
+static LatticeValue evaluate_binary(const IrInstr* instr) {
+    LatticeValue left = operand_lattice(instr->a);
+    LatticeValue right = operand_lattice(instr->b);
+    if (instr->op == IR_MUL && ((left.state == LATTICE_CONSTANT && left.value == 0) ||
+                                (right.state == LATTICE_CONSTANT && right.value == 0))) {
+        return constant(0);
+    }
+    if (instr->op == IR_MOD && right.state == LATTICE_CONSTANT && right.value == 1) return constant(0);
+    if (left.state == LATTICE_UNKNOWN || right.state == LATTICE_UNKNOWN) return unknown;
+    if (left.state != LATTICE_CONSTANT || right.state != LATTICE_CONSTANT) return varying;
+    int64_t result;
+    return fold_binary((IrOp)instr->op, left.value, right.value, &result) ? constant(result) : varying;
+}
+
+// Applies one instruction to the values of the tracked globals in `state`.
+static void transfer(const IrInstr* instr, LatticeValue* state) {
+    switch (instr->op) {
+        case IR_MOV:
+            set_reg(instr->dst, operand_lattice(instr->a));
+            break;
+        case IR_LOAD: {
+            int32_t slot = slot_of[global_id(instr->symbol)];
+            set_reg(instr->dst, slot >= 0 ? state[slot] : varying);
+            break;
+        }
+        case IR_STORE: {
+            int32_t slot = slot_of[global_id(instr->symbol)];
+            if (slot >= 0) state[slot] = operand_lattice(instr->a);
+            break;
+        }
+        case IR_CALL: {
+            const StoreSet* stores = callee_stores(instr->symbol);
+            for (uint32_t i = 0; stores && i < stores->count; i++) {
+                int32_t slot = slot_of[stores->globals[i]];
+                if (slot >= 0) state[slot] = varying;
+            }
+            set_reg(instr->dst, varying);
+            break;
+        }
+        case IR_LOAD_ELEM:
+        case IR_ADDR:
+        case IR_PARAM:
+            set_reg(instr->dst, varying);
+            break;
+        default:
+            if (instr->op <= IR_MOD) set_reg(instr->dst, evaluate_binary(instr));
+            break;
+    }
+}
+
+// Marks the edges a terminator can take and the blocks they reach.
+static void mark_edges(uint32_t b, const IrInstr* terminator) {
+    uint8_t taken = 0;
+    if (terminator->op == IR_JUMP) {
+        taken = 1;
+    } else if (terminator->op == IR_BRANCH) {
+        LatticeValue condition = operand_lattice(terminator->a);
+        if (condition.state == LATTICE_CONSTANT) {
+            taken = condition.value ? 1 : 2;
+        } else if (condition.state == LATTICE_VARYING) {
+            taken = 3;
+        }
+    }
+    if ((edges[b] | taken) == edges[b]) return;
+    edges[b] |= taken;
+    changed = 1;
+    if (taken & 1) reached[terminator->target] = 1;
+    if (taken & 2) reached[terminator->other] = 1;
+}
+
+static int edge_executable(uint32_t from, uint32_t to) {
+    const IrBlock* block = &function->blocks[from];
+    if (!ir_block_terminated(block)) return 0;
+    const IrInstr* terminator = &block->instrs[block->count - 1];
+    return ((edges[from] & 1) && terminator->target == to) ||
+           ((edges[from] & 2) && terminator->op == IR_BRANCH && terminator->other == to);
+}
+
+// The values of the tracked globals on entry to block `b`.
+static void block_entry_state(uint32_t b, LatticeValue* state) {
+    LatticeValue initial = function->is_entry ? constant(0) : varying;
+    for (uint32_t s = 0; s < tracked_count; s++) {
+        state[s] = b == 0 ? initial : (block_out ? unknown : varying);
+    }
+    if (!block_out) return;
+    const IrBlock* block = &function->blocks[b];
+    for (uint32_t p = 0; p < block->pred_count; p++) {
+        uint32_t pred = block->preds[p];
+        if (!reached[pred] || !edge_executable(pred, b)) continue;
+        const LatticeValue* out = block_out + (size_t)pred * tracked_count;
+        for (uint32_t s = 0; s < tracked_count; s++) {
+            state[s] = meet(state[s], out[s]);
+        }
+    }
+}
+
+static void track_globals(void) {
+    tracked_count = 0;
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        const IrBlock* block = &function->blocks[b];
+        for (uint32_t i = 0; i < block->count; i++) {
+            const IrInstr* instr = &block->instrs[i];
+            if (instr->op != IR_LOAD && instr->op != IR_STORE) continue;
+            uint32_t id = global_id(instr->symbol);
+            if (indexed[id] || slot_of[id] >= 0) continue;
+            slot_of[id] = (int32_t)tracked_count;
+            tracked[tracked_count++] = id;
+        }
+    }
+}
+
+static void analyze_function(void) {
+    uint32_t blocks = function->block_count;
+    block_out = NULL;
+    if ((uint64_t)blocks * tracked_count <= FOLD_MAX_BOUNDARY_VALUES) {
+        block_out = (LatticeValue*)allocate((size_t)blocks * tracked_count, sizeof(LatticeValue));
+    }
+    LatticeValue* state = (LatticeValue*)allocate(tracked_count, sizeof(LatticeValue));
+
+    reached[0] = 1;
+    changed = 1;
+    while (changed) {
+        changed = 0;
+        for (uint32_t b = 0; b < blocks; b++) {
+            if (!reached[b]) continue;
+            const IrBlock* block = &function->blocks[b];
+            block_entry_state(b, state);
+            for (uint32_t i = 0; i < block->count; i++) {
+                transfer(&block->instrs[i], state);
+            }
+            if (ir_block_terminated(block)) mark_edges(b, &block->instrs[block->count - 1]);
+            if (!block_out) continue;
+            LatticeValue* out = block_out + (size_t)b * tracked_count;
+            for (uint32_t s = 0; s < tracked_count; s++) {
+                if (!same_value(out[s], state[s])) {
+                    out[s] = state[s];
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    free(state);
+    free(block_out);
+    block_out = NULL;
+}
+
+static void substitute(IrOperand* operand) {
+    if (operand->kind == IR_OPERAND_REG && reg_values[operand->value].state == LATTICE_CONSTANT) {
+        *operand = ir_imm(reg_values[operand->value].value);
+    }
+}
+
+static int is_immediate(IrOperand operand, int64_t value) {
+    return operand.kind == IR_OPERAND_IMM && operand.value == value;
+}
+
+// Turns x + 0, 0 + x, x - 0, x * 1, 1 * x and x / 1 into a move of x.
+static void simplify_identity(IrInstr* instr) {
+    IrOperand kept;
+    if ((instr->op == IR_ADD || instr->op == IR_SUB) && is_immediate(instr->b, 0)) {
+        kept = instr->a;
+    } else if ((instr->op == IR_MUL || instr->op == IR_DIV) && is_immediate(instr->b, 1)) {
+        kept = instr->a;
+    } else if ((instr->op == IR_ADD && is_immediate(instr->a, 0)) ||
+               (instr->op == IR_MUL && is_immediate(instr->a, 1))) {
+        kept = instr->b;
+    } else {
+        return;
+    }
+    instr->op = IR_MOV;
+    instr->a = kept;
+    instr->b = ir_none();
+}
+
+// Replaces constant registers by their values and removes the instructions
+// that computed them.
+static uint32_t rewrite_function(void) {
+    uint32_t removed = 0;
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        IrBlock* block = &function->blocks[b];
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < block->count; i++) {
+            IrInstr instr = block->instrs[i];
+            substitute(&instr.a);
+            substitute(&instr.b);
+            if (instr.op == IR_CALL) {
+                for (uint32_t arg = 0; arg < instr.other; arg++) {
+                    substitute(&function->args[instr.target + arg]);
+                }
+            } else if (instr.dst != IR_NO_REG && reg_values[instr.dst].state == LATTICE_CONSTANT) {
+                removed++;
+                continue;
+            }
+            if (instr.op == IR_BRANCH && instr.a.kind == IR_OPERAND_IMM) {
+                instr.op = IR_JUMP;
+                if (!instr.a.value) instr.target = instr.other;
+                instr.a = ir_none();
+                instr.other = 0;
+            }
+            simplify_identity(&instr);
+            block->instrs[kept++] = instr;
+        }
+        block->count = kept;
+    }
+    ir_compute_predecessors(function);
+    return removed;
+}
+
+uint32_t fold_constants(IrProgram* ir) {
+    program = ir;
+    uint32_t globals = program->global_count;
+    store_sets = (StoreSet*)allocate(program->function_count, sizeof(StoreSet));
+    indexed = (uint8_t*)allocate(globals, sizeof(uint8_t));
+    global_stamp = (uint32_t*)allocate(globals, sizeof(uint32_t));
+    function_stamp = (uint32_t*)allocate(program->function_count, sizeof(uint32_t));
+    stamp = 0;
+    slot_of = (int32_t*)allocate(globals, sizeof(int32_t));
+    tracked = (uint32_t*)allocate(globals, sizeof(uint32_t));
+    memset(slot_of, 0xff, (globals ? globals : 1) * sizeof(int32_t));
+
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        const IrFunction* current = &program->functions[f];
+        for (uint32_t b = 0; b < current->block_count; b++) {
+            const IrBlock* block = &current->blocks[b];
+            for (uint32_t i = 0; i < block->count; i++) {
+                if (block->instrs[i].op == IR_LOAD_ELEM || block->instrs[i].op == IR_STORE_ELEM) {
+                    indexed[global_id(block->instrs[i].symbol)] = 1;
+                }
+            }
+        }
+    }
+
+    uint32_t removed = 0;
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        function = &program->functions[f];
+        if (!function->block_count) continue;
+        reg_values = (LatticeValue*)allocate(function->reg_count, sizeof(LatticeValue));
+        reached = (uint8_t*)allocate(function->block_count, sizeof(uint8_t));
+        edges = (uint8_t*)allocate(function->block_count, sizeof(uint8_t));
+
+        track_globals();
+        analyze_function();
+        removed += rewrite_function();
+
+        for (uint32_t s = 0; s < tracked_count; s++) {
+            slot_of[tracked[s]] = -1;
+        }
+        free(reg_values);
+        free(reached);
+        free(edges);
+    }
+
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        free(store_sets[f].globals);
+    }
+    free(store_sets);
+    free(indexed);
+    free(global_stamp);
+    free(function_stamp);
+    free(slot_of);
+    free(tracked);
+    function = NULL;
+    program = NULL;
+    return removed;
+}
@@ -0,0 +1,27 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stdint.h>
+#include "ast.h"
+#include "ir.h"
+
+// Evaluates a binary IR opcode on constants with the target's semantics:
+// 64-bit two's complement wrap-around, comparisons yielding 0 or 1, and
+// truncating division. Returns 0 where the machine would trap (division by
+// zero, INT64_MIN / -1); such operations are left for run time.
+int fold_binary(IrOp op, int64_t left, int64_t right, int64_t* result);
+
+// The number of elements of the array a VAR_DECLARATION declares: its size
+// expression, made of literals and binary operators, folded with
+// fold_binary. A missing or non-positive size means one element. Exits
+// with an error if the size is not a constant or exceeds
+// IR_MAX_GLOBAL_ELEMENTS.
+int64_t fold_array_size(const AST* ast, NodeIndex declaration);
+
+// Sparse conditional constant propagation over every function: registers
+// and scalar globals with a known value are replaced by immediates,
+// instructions computing them are deleted and branches on constants become
+// jumps. Returns the number of instructions removed.
+uint32_t fold_constants(IrProgram* program);
+
+#endif // FOLD_H
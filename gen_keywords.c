@@ -0,0 +1,98 @@
+// Generates keyword_table.h: a perfect hash over the language keywords.
+//
+//   gcc -o gen_keywords gen_keywords.c && ./gen_keywords > keyword_table.h
+//
+// The hash looks only at the first byte, the last byte and the length of an
+// identifier, so classifying one costs a couple of table lookups plus a
+// single length-checked compare against the candidate slot. To add a keyword,
+// append it to `keywords` below and regenerate.
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    const char* text;
+    const char* token;
+} Keyword;
+
+static const Keyword keywords[] = {
+    { "var", "TOKEN_KEYWORD_VAR" },
+    { "func", "TOKEN_KEYWORD_FUNC" },
+    { "return", "TOKEN_KEYWORD_RETURN" },
+    { "for", "TOKEN_KEYWORD_FOR" },
+    { "while", "TOKEN_KEYWORD_WHILE" },
+    { "import", "TOKEN_KEYWORD_IMPORT" },
+    { "as", "TOKEN_KEYWORD_AS" },
+    { "from", "TOKEN_KEYWORD_FROM" },
+};
+
+#define KEYWORD_COUNT (int)(sizeof(keywords) / sizeof(keywords[0]))
+#define MAX_TABLE_BITS 8
+
+static unsigned hash(const char* text, int length, unsigned first_mul, unsigned last_mul, int bits) {
+    unsigned h = (unsigned char)text[0] * first_mul + (unsigned char)text[length - 1] * last_mul + (unsigned)length;
+    return h & ((1u << bits) - 1);
+}
+
+// Finds the smallest table and multipliers for which every keyword lands in
+// its own slot.
+static int search(unsigned* first_mul, unsigned* last_mul, int* bits) {
+    for (int b = 1; b <= MAX_TABLE_BITS; b++) {
+        if ((1 << b) < KEYWORD_COUNT) continue;
+        for (unsigned f = 1; f < 64; f++) {
+            for (unsigned l = 1; l < 64; l++) {
+                unsigned char used[1 << MAX_TABLE_BITS] = { 0 };
+                int ok = 1;
+                for (int i = 0; i < KEYWORD_COUNT && ok; i++) {
+                    unsigned h = hash(keywords[i].text, (int)strlen(keywords[i].text), f, l, b);
+                    if (used[h]) ok = 0;
+                    used[h] = 1;
+                }
+                if (ok) {
+                    *first_mul = f;
+                    *last_mul = l;
+                    *bits = b;
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    unsigned first_mul, last_mul;
+    int bits;
+    if (!search(&first_mul, &last_mul, &bits)) {
+        fprintf(stderr, "gen_keywords: no perfect hash found, raise MAX_TABLE_BITS\n");
+        return 1;
+    }
+
+    int min_length = 1 << 30, max_length = 0;
+    const Keyword* slots[1 << MAX_TABLE_BITS] = { 0 };
+    for (int i = 0; i < KEYWORD_COUNT; i++) {
+        int length = (int)strlen(keywords[i].text);
+        if (length < min_length) min_length = length;
+        if (length > max_length) max_length = length;
+        slots[hash(keywords[i].text, length, first_mul, last_mul, bits)] = &keywords[i];
+    }
+
+    printf("// Generated by gen_keywords.c -- do not edit.\n");
+    printf("#ifndef KEYWORD_TABLE_H\n#define KEYWORD_TABLE_H\n\n");
+    printf("#define KEYWORD_MIN_LENGTH %d\n", min_length);
+    printf("#define KEYWORD_MAX_LENGTH %d\n", max_length);
+    printf("#define KEYWORD_HASH(text, length) \\\n");
+    printf("    (((unsigned char)(text)[0] * %uu + (unsigned char)(text)[(length) - 1] * %uu + (unsigned)(length)) & %uu)\n\n",
+           first_mul, last_mul, (1u << bits) - 1);
+    printf("typedef struct {\n    const char* text;\n    size_t length;\n    TokenType type;\n} KeywordSlot;\n\n");
+    printf("static const KeywordSlot keyword_slots[%d] = {\n", 1 << bits);
+    for (int i = 0; i < (1 << bits); i++) {
+        if (slots[i]) {
+            printf("    { \"%s\", %d, %s },\n", slots[i]->text, (int)strlen(slots[i]->text), slots[i]->token);
+        } else {
+            printf("    { \"\", 0, TOKEN_IDENTIFIER },\n");
+        }
+    }
+    printf("};\n\n#endif // KEYWORD_TABLE_H\n");
+    return 0;
+}
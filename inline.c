@@ -0,0 +1,335 @@
+#include "inline.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Inlining runs bottom-up over the call graph. Tarjan's algorithm finds its
+// strongly connected components, completing each one after every component
+// it calls, so a callee has been inlined into by the time its size decides
+// whether it is inlined itself. A function in a component with others, or
+// one calling itself, is recursive and never inlined.
+//
+// The benefit of inlining a call is what the call costs on top of the
+// callee's body: the call, return and frame, a move per argument, and for
+// each constant argument the folding it is likely to enable.
+//
+// An inlined call splits its block in two, with a copy of the callee's
+// blocks in between using fresh registers. Each PARAM becomes a move from
+// the argument, and each RET a move to the call's result and a jump to the
+// second half.
+
+#define CALL_BENEFIT 4
+#define ARGUMENT_BENEFIT 1
+#define CONSTANT_BENEFIT 2
+
+static void* allocate(size_t count, size_t size) {
+    void* memory = calloc(count ? count : 1, size);
+    if (!memory) {
+        fprintf(stderr, "Error: Out of memory during inlining\n");
+        exit(1);
+    }
+    return memory;
+}
+
+static IrProgram* program;
+static uint32_t size_budget;
+static FILE* report;
+static uint32_t* edge_start;  // Function -> its first edge; one past the last is edge_start[f + 1]
+static uint32_t* edges;       // Callee of each call to a defined function
+static uint8_t* recursive;
+static uint32_t* sizes;       // Function -> instructions other than PARAM,
+                              // updated once calls are inlined into it
+
+static uint32_t function_id(const IrFunction* function) {
+    return (uint32_t)(function - program->functions);
+}
+
+static const char* function_name(const IrFunction* function) {
+    return function->is_entry ? "_start" : symbol_name(function->name);
+}
+
+static uint32_t function_size(const IrFunction* function) {
+    uint32_t size = 0;
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        const IrBlock* block = &function->blocks[b];
+        for (uint32_t i = 0; i < block->count; i++) {
+            if (block->instrs[i].op != IR_PARAM) size++;
+        }
+    }
+    return size;
+}
+
+static void build_call_graph(void) {
+    edge_start = (uint32_t*)allocate(program->function_count + 1, sizeof(uint32_t));
+    uint32_t count = 0;
+    // The first pass counts the edges, the second records them.
+    for (int pass = 0; pass < 2; pass++) {
+        count = 0;
+        for (uint32_t f = 0; f < program->function_count; f++) {
+            const IrFunction* function = &program->functions[f];
+            edge_start[f] = count;
+            for (uint32_t b = 0; b < function->block_count; b++) {
+                const IrBlock* block = &function->blocks[b];
+                for (uint32_t i = 0; i < block->count; i++) {
+                    if (block->instrs[i].op != IR_CALL) continue;
+                    const IrFunction* callee = ir_find_function(program, block->instrs[i].symbol);
+                    if (!callee) continue;
+                    if (pass) edges[count] = function_id(callee);
+                    count++;
+                }
+            }
+        }
+        if (!pass) edges = (uint32_t*)allocate(count, sizeof(uint32_t));
+    }
+    edge_start[program->function_count] = count;
+}
+
+// Tarjan's algorithm without recursion, so long call chains cannot
+// overflow the stack. Fills `order` with every function, callees' components
+// first, and marks the recursive functions.
+static void order_call_graph(uint32_t* order) {
+    uint32_t n = program->function_count;
+    uint32_t* visit = (uint32_t*)allocate(n, sizeof(uint32_t)); // 0 if not visited yet
+    uint32_t* low = (uint32_t*)allocate(n, sizeof(uint32_t));
+    uint32_t* next_edge = (uint32_t*)allocate(n, sizeof(uint32_t));
+    uint32_t* path = (uint32_t*)allocate(n, sizeof(uint32_t));  // Depth-first search path
+    uint32_t* stack = (uint32_t*)allocate(n, sizeof(uint32_t)); // Functions not in a component yet
+    uint8_t* on_stack = (uint8_t*)allocate(n, sizeof(uint8_t));
+    uint32_t visits = 0;
+    uint32_t stack_count = 0;
+    uint32_t ordered = 0;
+
+    for (uint32_t root = 0; root < n; root++) {
+        if (visit[root]) continue;
+        uint32_t depth = 0;
+        uint32_t f = root;
+        for (;;) {
+            if (!visit[f]) {
+                visit[f] = low[f] = ++visits;
+                next_edge[f] = edge_start[f];
+                stack[stack_count++] = f;
+                on_stack[f] = 1;
+                path[depth++] = f;
+            }
+            f = path[depth - 1];
+            if (next_edge[f] < edge_start[f + 1]) {
+                uint32_t callee = edges[next_edge[f]++];
+                if (callee == f) recursive[f] = 1;
+                if (!visit[callee]) {
+                    f = callee;
+                } else if (on_stack[callee] && visit[callee] < low[f]) {
+                    low[f] = visit[callee];
+                }
+                continue;
+            }
+
+            depth--;
+            if (depth && low[f] < low[path[depth - 1]]) low[path[depth - 1]] = low[f];
+            if (low[f] == visit[f]) {
+                uint32_t start = stack_count;
+                while (stack[--start] != f) {}
+                for (uint32_t i = start; i < stack_count; i++) {
+                    on_stack[stack[i]] = 0;
+                    if (stack_count - start > 1) recursive[stack[i]] = 1;
+                    order[ordered++] = stack[i];
+                }
+                stack_count = start;
+            }
+            if (!depth) break;
+            f = path[depth - 1];
+        }
+    }
+    free(visit);
+    free(low);
+    free(next_edge);
+    free(path);
+    free(stack);
+    free(on_stack);
+}
+
+static int should_inline(const IrFunction* caller, const IrInstr* call) {
+    const IrFunction* callee = ir_find_function(program, call->symbol);
+    if (!callee) return 0; // Built-in
+    uint32_t benefit = CALL_BENEFIT + ARGUMENT_BENEFIT * call->other;
+    for (uint32_t i = 0; i < call->other; i++) {
+        if (caller->args[call->target + i].kind == IR_OPERAND_IMM) benefit += CONSTANT_BENEFIT;
+    }
+    uint32_t size = sizes[function_id(callee)];
+    int inline_it = 0;
+    const char* verdict;
+    if (recursive[function_id(callee)]) {
+        verdict = "not inlined, recursive";
+    } else if (size > size_budget + benefit) {
+        verdict = "not inlined, too large";
+    } else {
+        verdict = "inlined";
+        inline_it = 1;
+    }
+    if (report) {
+        fprintf(report, "Inline %s into %s: size %u, benefit %u, %s\n", function_name(callee), function_name(caller),
+                size, benefit, verdict);
+    }
+    return inline_it;
+}
+
+static IrOperand rename_operand(IrOperand operand, const IrReg* regs) {
+    if (operand.kind == IR_OPERAND_REG) operand.value = regs[operand.value];
+    return operand;
+}
+
+static void append_copy(IrFunction* function, uint32_t block, const IrInstr* instr) {
+    *ir_append(function, block, (IrOp)instr->op) = *instr;
+}
+
+// Ends `block` with a jump to a copy of the callee's blocks; returns the
+// block the caller continues in after the call.
+static uint32_t inline_call(IrFunction* caller, uint32_t block, const IrInstr* call) {
+    const IrFunction* callee = ir_find_function(program, call->symbol);
+    uint32_t base = caller->block_count;
+    uint32_t after = base + callee->block_count;
+    IrReg* regs = (IrReg*)allocate(callee->reg_count, sizeof(IrReg));
+    for (IrReg r = 1; r < callee->reg_count; r++) regs[r] = ir_new_reg(caller, (IrType)callee->reg_types[r]);
+
+    ir_append(caller, block, IR_JUMP)->target = base;
+    for (uint32_t b = 0; b < callee->block_count; b++) {
+        uint32_t copy = ir_add_block(caller);
+        const IrBlock* source = &callee->blocks[b];
+        for (uint32_t i = 0; i < source->count; i++) {
+            IrInstr instr = source->instrs[i];
+            instr.dst = regs[instr.dst];
+            instr.a = rename_operand(instr.a, regs);
+            instr.b = rename_operand(instr.b, regs);
+            switch (instr.op) {
+                case IR_PARAM:
+                    // A parameter the call passes no argument for is 0.
+                    instr.op = IR_MOV;
+                    instr.a = instr.target < call->other ? caller->args[call->target + instr.target] : ir_imm(0);
+                    instr.target = 0;
+                    break;
+                case IR_CALL: {
+                    uint32_t first_arg = caller->arg_count;
+                    for (uint32_t k = 0; k < instr.other; k++) {
+                        ir_add_arg(caller, rename_operand(callee->args[instr.target + k], regs));
+                    }
+                    instr.target = first_arg;
+                    break;
+                }
+                case IR_BRANCH:
+                    instr.other += base;
+                    instr.target += base;
+                    break;
+                case IR_JUMP:
+                    instr.target += base;
+                    break;
+                case IR_RET: {
+                    IrInstr* result = ir_append(caller, copy, IR_MOV);
+                    result->dst = call->dst;
+                    result->type = call->type;
+                    result->a = instr.a.kind == IR_OPERAND_NONE ? ir_imm(0) : instr.a;
+                    memset(&instr, 0, sizeof(instr));
+                    instr.op = IR_JUMP;
+                    instr.target = after;
+                    break;
+                }
+                default:
+                    break;
+            }
+            append_copy(caller, copy, &instr);
+        }
+    }
+    ir_add_block(caller);
+    free(regs);
+    return after;
+}
+
+static uint32_t inline_calls(IrFunction* caller) {
+    uint32_t call_count = 0;
+    for (uint32_t b = 0; b < caller->block_count; b++) {
+        const IrBlock* block = &caller->blocks[b];
+        for (uint32_t i = 0; i < block->count; i++) {
+            if (block->instrs[i].op == IR_CALL) call_count++;
+        }
+    }
+    if (!call_count) return 0;
+
+    // Decisions are made up front, since they fix where each of the
+    // caller's blocks starts in the new numbering.
+    uint8_t* inlined = (uint8_t*)allocate(call_count, sizeof(uint8_t));
+    uint32_t* first = (uint32_t*)allocate(caller->block_count, sizeof(uint32_t));
+    uint32_t block_count = 0;
+    uint32_t inlined_count = 0;
+    uint32_t call = 0;
+    for (uint32_t b = 0; b < caller->block_count; b++) {
+        const IrBlock* block = &caller->blocks[b];
+        first[b] = block_count++;
+        for (uint32_t i = 0; i < block->count; i++) {
+            if (block->instrs[i].op != IR_CALL) continue;
+            inlined[call] = (uint8_t)should_inline(caller, &block->instrs[i]);
+            if (inlined[call]) {
+                block_count += ir_find_function(program, block->instrs[i].symbol)->block_count + 1;
+                inlined_count++;
+            }
+            call++;
+        }
+    }
+
+    if (inlined_count) {
+        IrBlock* blocks = caller->blocks;
+        uint32_t old_count = caller->block_count;
+        caller->blocks = NULL;
+        caller->block_count = 0;
+        caller->block_capacity = 0;
+        call = 0;
+        for (uint32_t b = 0; b < old_count; b++) {
+            uint32_t current = ir_add_block(caller);
+            for (uint32_t i = 0; i < blocks[b].count; i++) {
+                IrInstr instr = blocks[b].instrs[i];
+                if (instr.op == IR_CALL && inlined[call++]) {
+                    current = inline_call(caller, current, &instr);
+                    continue;
+                }
+                if (instr.op == IR_JUMP || instr.op == IR_BRANCH) instr.target = first[instr.target];
+                if (instr.op == IR_BRANCH) instr.other = first[instr.other];
+                append_copy(caller, current, &instr);
+            }
+            free(blocks[b].instrs);
+            free(blocks[b].preds);
+        }
+        free(blocks);
+        ir_compute_predecessors(caller);
+    }
+    free(inlined);
+    free(first);
+    return inlined_count;
+}
+
+uint32_t inline_functions(IrProgram* ir, uint32_t budget, FILE* stream) {
+    program = ir;
+    size_budget = budget;
+    report = stream;
+    uint32_t n = program->function_count;
+    recursive = (uint8_t*)allocate(n, sizeof(uint8_t));
+    sizes = (uint32_t*)allocate(n, sizeof(uint32_t));
+    uint32_t* order = (uint32_t*)allocate(n, sizeof(uint32_t));
+    build_call_graph();
+    order_call_graph(order);
+    for (uint32_t f = 0; f < n; f++) sizes[f] = function_size(&program->functions[f]);
+
+    uint32_t inlined = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        IrFunction* function = &program->functions[order[i]];
+        inlined += inline_calls(function);
+        sizes[order[i]] = function_size(function);
+    }
+
+    free(order);
+    free(edge_start);
+    free(edges);
+    free(recursive);
+    free(sizes);
+    edge_start = NULL;
+    edges = NULL;
+    recursive = NULL;
+    sizes = NULL;
+    program = NULL;
+    return inlined;
+}
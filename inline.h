@@ -0,0 +1,19 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "ir.h"
+
+// Default for --inline-budget.
+#define INLINE_DEFAULT_BUDGET 12
+
+// Replaces calls to small non-recursive functions by a copy of their body.
+// A call is inlined if the callee's size in IR instructions, less the
+// benefit of removing the call, is at most `budget`; see inline.c. Callees
+// are inlined into before their callers, so sizes include what was inlined
+// into them. Each decision is written to `report` unless it is NULL.
+// Returns the number of calls inlined.
+uint32_t inline_functions(IrProgram* program, uint32_t budget, FILE* report);
+
+#endif // INLINE_H
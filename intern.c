@@ -0,0 +1,137 @@
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_SLOTS 1024
+#define INITIAL_ARENA_SIZE (16 * 1024)
+
+typedef struct {
+    size_t offset; // Start of the name in the arena
+    uint32_t length;
+    uint32_t hash;
+} SymbolEntry;
+
+// Open-addressed hash table of symbol IDs over a contiguous string arena.
+// Entry 0 is reserved so that SYMBOL_NONE never names anything.
+typedef struct {
+    SymbolEntry* entries;
+    uint32_t count;
+    uint32_t entry_capacity;
+
+    Symbol* slots; // SYMBOL_NONE marks an empty slot
+    uint32_t slot_mask;
+
+    char* arena;
+    size_t arena_used;
+    size_t arena_capacity;
+} SymbolTable;
+
+static SymbolTable table;
+
+static uint32_t hash_bytes(const char* text, size_t length) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void table_init(void) {
+    table.entry_capacity = INITIAL_SLOTS / 2;
+    table.entries = (SymbolEntry*)malloc(table.entry_capacity * sizeof(SymbolEntry));
+    table.count = 1;
+
+    table.slots = (Symbol*)calloc(INITIAL_SLOTS, sizeof(Symbol));
+    table.slot_mask = INITIAL_SLOTS - 1;
+
+    table.arena_capacity = INITIAL_ARENA_SIZE;
+    table.arena = (char*)malloc(table.arena_capacity);
+    table.arena[0] = '\0';
+    table.arena_used = 1;
+
+    table.entries[0].offset = 0;
+    table.entries[0].length = 0;
+    table.entries[0].hash = 0;
+}
+
+// Doubles the slot array and reinserts every symbol using its cached hash.
+static void grow_slots(void) {
+    uint32_t capacity = (table.slot_mask + 1) * 2;
+    Symbol* slots = (Symbol*)calloc(capacity, sizeof(Symbol));
+    for (Symbol symbol = 1; symbol < table.count; symbol++) {
+        uint32_t index = table.entries[symbol].hash & (capacity - 1);
+        while (slots[index] != SYMBOL_NONE) {
+            index = (index + 1) & (capacity - 1);
+        }
+        slots[index] = symbol;
+    }
+    free(table.slots);
+    table.slots = slots;
+    table.slot_mask = capacity - 1;
+}
+
+Symbol symbol_intern(const char* text, size_t length) {
+    if (!table.entries) {
+        table_init();
+    }
+
+    uint32_t hash = hash_bytes(text, length);
+    uint32_t index = hash & table.slot_mask;
+    for (;;) {
+        Symbol symbol = table.slots[index];
+        if (symbol == SYMBOL_NONE) break;
+        const SymbolEntry* entry = &table.entries[symbol];
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(table.arena + entry->offset, text, length) == 0) {
+            return symbol;
+        }
+        index = (index + 1) & table.slot_mask;
+    }
+
+    if (table.arena_used + length + 1 > table.arena_capacity) {
+        while (table.arena_used + length + 1 > table.arena_capacity) {
+            table.arena_capacity *= 2;
+        }
+        table.arena = (char*)realloc(table.arena, table.arena_capacity);
+    }
+    if (table.count == table.entry_capacity) {
+        table.entry_capacity *= 2;
+        table.entries = (SymbolEntry*)realloc(table.entries, table.entry_capacity * sizeof(SymbolEntry));
+    }
+
+    Symbol symbol = table.count++;
+    SymbolEntry* entry = &table.entries[symbol];
+    entry->offset = table.arena_used;
+    entry->length = (uint32_t)length;
+    entry->hash = hash;
+    memcpy(table.arena + table.arena_used, text, length);
+    table.arena[table.arena_used + length] = '\0';
+    table.arena_used += length + 1;
+
+    table.slots[index] = symbol;
+    // Keep the load factor under one half.
+    if (table.count * 2 > table.slot_mask + 1) {
+        grow_slots();
+    }
+    return symbol;
+}
+
+const char* symbol_name(Symbol symbol) {
+    return table.arena + table.entries[symbol].offset;
+}
+
+size_t symbol_length(Symbol symbol) {
+    return table.entries[symbol].length;
+}
+
+uint32_t symbol_count(void) {
+    return table.entries ? table.count - 1 : 0;
+}
+
+void symbol_table_free(void) {
+    free(table.entries);
+    free(table.slots);
+    free(table.arena);
+    memset(&table, 0, sizeof(table));
+}
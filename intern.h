@@ -0,0 +1,24 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Interned identifier names. Every distinct name gets a stable 32-bit ID, so
+// names can be compared with == and stored in four bytes. The text lives in
+// one contiguous, NUL-separated arena owned by the global table.
+typedef uint32_t Symbol;
+
+#define SYMBOL_NONE 0
+
+Symbol symbol_intern(const char* text, size_t length);
+
+// The returned pointer is NUL-terminated but only valid until the next call
+// to symbol_intern, which may move the arena.
+const char* symbol_name(Symbol symbol);
+size_t symbol_length(Symbol symbol);
+uint32_t symbol_count(void);
+
+void symbol_table_free(void);
+
+#endif // INTERN_H
@@ -0,0 +1,278 @@
+#include "interpret.h"
+#include "runtime.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The registers of every active call are on one stack: a call's frame
+// starts at the caller's argument registers, so arguments are never
+// copied. With GCC and Clang each handler ends with its own indirect jump
+// to the next one (computed goto), which predicts far better than the one
+// shared jump of a switch; other compilers get the switch.
+
+#if defined(__GNUC__)
+#define THREADED_DISPATCH 1
+#endif
+
+#define STACK_MIN_SLOTS (1u << 16)
+#define STACK_MAX_SLOTS (1u << 28)
+#define FRAMES_MIN (1u << 10)
+#define FRAMES_MAX (1u << 24)
+
+typedef struct {
+    const uint32_t* return_ip;
+    uint32_t base;  // Of the caller's frame
+    uint32_t dst;   // Caller's register receiving the result
+} Frame;
+
+// State of the run; set by interpret.
+static int64_t* stack;
+static uint32_t stack_capacity;
+static Frame* frames;
+static uint32_t frame_count;
+static uint32_t frame_capacity;
+
+static void* grow(void* array, uint32_t* capacity, uint32_t needed, uint32_t limit, size_t element_size) {
+    if (needed > limit) {
+        fprintf(stderr, "Error: Stack overflow\n");
+        exit(1);
+    }
+    uint32_t new_capacity = *capacity;
+    while (new_capacity < needed) new_capacity *= 2;
+    if (new_capacity > limit) new_capacity = limit;
+    void* resized = realloc(array, (size_t)new_capacity * element_size);
+    if (!resized) {
+        fprintf(stderr, "Error: Out of memory growing the stack\n");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return resized;
+}
+
+static void reserve_stack(uint32_t needed) {
+    if (needed > stack_capacity) {
+        stack = (int64_t*)grow(stack, &stack_capacity, needed, STACK_MAX_SLOTS, sizeof(int64_t));
+    }
+}
+
+// Division by zero and INT64_MIN / -1 trap in native code; they end the
+// program with the same signal here.
+static void division_trap(void) {
+    raise(SIGFPE);
+    abort();
+}
+
+// As in native code, an index out of bounds writes out pending output and
+// ends the program with status 1.
+static void index_out_of_bounds(const BytecodeGlobal* array, int64_t index) {
+    runtime_flush();
+    fprintf(stderr, "Error: Index %lld is out of bounds for '%s' of size %u\n", (long long)index,
+            symbol_name(array->name), array->size);
+    exit(1);
+}
+
+// Operands of the current instruction.
+#define U(n) (ip[n])
+#define R(n) (r[ip[n]])
+#define IMM(n) ((int64_t)(int32_t)ip[n])
+
+// Signed arithmetic wraps around, as in the native code.
+#define WRAP(x, op, y) ((int64_t)((uint64_t)(x) op (uint64_t)(y)))
+
+#ifdef THREADED_DISPATCH
+#define CASE(op) label_##op
+#define DISPATCH() goto *dispatch[*ip]
+#else
+#define CASE(op) case op
+#define DISPATCH() continue
+#endif
+
+// Not wrapped in do-while, where the switch's continue would not reach the
+// loop.
+#define NEXT(length) { ip += (length); DISPATCH(); }
+#define JUMP(target) { ip = code + (target); DISPATCH(); }
+
+#define ARITHMETIC(op, expression) \
+    CASE(op): R(1) = (expression); NEXT(4)
+
+#define BRANCH(op, compare, right) \
+    CASE(op): if (R(1) compare (right)) JUMP(U(3)); NEXT(4)
+
+int64_t interpret(const Bytecode* program) {
+#ifdef THREADED_DISPATCH
+    static void* const dispatch[OP_COUNT] = {
+        [OP_EQ] = &&label_OP_EQ,
+        [OP_NE] = &&label_OP_NE,
+        [OP_LT] = &&label_OP_LT,
+        [OP_GT] = &&label_OP_GT,
+        [OP_LE] = &&label_OP_LE,
+        [OP_GE] = &&label_OP_GE,
+        [OP_ADD] = &&label_OP_ADD,
+        [OP_SUB] = &&label_OP_SUB,
+        [OP_MUL] = &&label_OP_MUL,
+        [OP_DIV] = &&label_OP_DIV,
+        [OP_MOD] = &&label_OP_MOD,
+        [OP_JEQ] = &&label_OP_JEQ,
+        [OP_JNE] = &&label_OP_JNE,
+        [OP_JLT] = &&label_OP_JLT,
+        [OP_JGT] = &&label_OP_JGT,
+        [OP_JLE] = &&label_OP_JLE,
+        [OP_JGE] = &&label_OP_JGE,
+        [OP_JEQI] = &&label_OP_JEQI,
+        [OP_JNEI] = &&label_OP_JNEI,
+        [OP_JLTI] = &&label_OP_JLTI,
+        [OP_JGTI] = &&label_OP_JGTI,
+        [OP_JLEI] = &&label_OP_JLEI,
+        [OP_JGEI] = &&label_OP_JGEI,
+        [OP_ADDI] = &&label_OP_ADDI,
+        [OP_SUBI] = &&label_OP_SUBI,
+        [OP_MULI] = &&label_OP_MULI,
+        [OP_MOV] = &&label_OP_MOV,
+        [OP_LOADI] = &&label_OP_LOADI,
+        [OP_LOADK] = &&label_OP_LOADK,
+        [OP_GET] = &&label_OP_GET,
+        [OP_SET] = &&label_OP_SET,
+        [OP_GETE] = &&label_OP_GETE,
+        [OP_SETE] = &&label_OP_SETE,
+        [OP_JMP] = &&label_OP_JMP,
+        [OP_JZ] = &&label_OP_JZ,
+        [OP_JNZ] = &&label_OP_JNZ,
+        [OP_CALL] = &&label_OP_CALL,
+        [OP_TAILCALL] = &&label_OP_TAILCALL,
+        [OP_PRINTLN] = &&label_OP_PRINTLN,
+        [OP_RET] = &&label_OP_RET,
+        [OP_RET0] = &&label_OP_RET0,
+    };
+#endif
+
+    const uint32_t* code = program->code;
+    const int64_t* constants = program->constants;
+    const BytecodeFunction* functions = program->functions;
+    int64_t* globals = (int64_t*)calloc(program->slot_count ? program->slot_count : 1, sizeof(int64_t));
+    stack_capacity = STACK_MIN_SLOTS;
+    stack = (int64_t*)malloc(stack_capacity * sizeof(int64_t));
+    frame_capacity = FRAMES_MIN;
+    frame_count = 0;
+    frames = (Frame*)malloc(frame_capacity * sizeof(Frame));
+    if (!globals || !stack || !frames) {
+        fprintf(stderr, "Error: Out of memory starting the interpreter\n");
+        exit(1);
+    }
+    reserve_stack(functions[0].frame_size);
+
+    uint32_t base = 0;
+    int64_t* r = stack;
+    const uint32_t* ip = code + functions[0].entry;
+    int64_t result;
+
+#ifdef THREADED_DISPATCH
+    DISPATCH();
+#else
+    for (;;) switch (*ip) {
+#endif
+    ARITHMETIC(OP_EQ, R(2) == R(3));
+    ARITHMETIC(OP_NE, R(2) != R(3));
+    ARITHMETIC(OP_LT, R(2) < R(3));
+    ARITHMETIC(OP_GT, R(2) > R(3));
+    ARITHMETIC(OP_LE, R(2) <= R(3));
+    ARITHMETIC(OP_GE, R(2) >= R(3));
+    ARITHMETIC(OP_ADD, WRAP(R(2), +, R(3)));
+    ARITHMETIC(OP_SUB, WRAP(R(2), -, R(3)));
+    ARITHMETIC(OP_MUL, WRAP(R(2), *, R(3)));
+    CASE(OP_DIV): {
+        int64_t dividend = R(2), divisor = R(3);
+        if (divisor == 0 || (divisor == -1 && dividend == INT64_MIN)) division_trap();
+        R(1) = dividend / divisor;
+        NEXT(4);
+    }
+    CASE(OP_MOD): {
+        int64_t dividend = R(2), divisor = R(3);
+        if (divisor == 0 || (divisor == -1 && dividend == INT64_MIN)) division_trap();
+        R(1) = dividend % divisor;
+        NEXT(4);
+    }
+    BRANCH(OP_JEQ, ==, R(2));
+    BRANCH(OP_JNE, !=, R(2));
+    BRANCH(OP_JLT, <, R(2));
+    BRANCH(OP_JGT, >, R(2));
+    BRANCH(OP_JLE, <=, R(2));
+    BRANCH(OP_JGE, >=, R(2));
+    BRANCH(OP_JEQI, ==, IMM(2));
+    BRANCH(OP_JNEI, !=, IMM(2));
+    BRANCH(OP_JLTI, <, IMM(2));
+    BRANCH(OP_JGTI, >, IMM(2));
+    BRANCH(OP_JLEI, <=, IMM(2));
+    BRANCH(OP_JGEI, >=, IMM(2));
+    ARITHMETIC(OP_ADDI, WRAP(R(2), +, IMM(3)));
+    ARITHMETIC(OP_SUBI, WRAP(R(2), -, IMM(3)));
+    ARITHMETIC(OP_MULI, WRAP(R(2), *, IMM(3)));
+    CASE(OP_MOV): R(1) = R(2); NEXT(3);
+    CASE(OP_LOADI): R(1) = IMM(2); NEXT(3);
+    CASE(OP_LOADK): R(1) = constants[U(2)]; NEXT(3);
+    CASE(OP_GET): R(1) = globals[U(2)]; NEXT(3);
+    CASE(OP_SET): globals[U(1)] = R(2); NEXT(3);
+    CASE(OP_GETE): {
+        const BytecodeGlobal* array = &program->globals[U(3)];
+        if ((uint64_t)R(2) >= array->size) index_out_of_bounds(array, R(2));
+        R(1) = globals[array->slot + R(2)];
+        NEXT(4);
+    }
+    CASE(OP_SETE): {
+        const BytecodeGlobal* array = &program->globals[U(1)];
+        if ((uint64_t)R(2) >= array->size) index_out_of_bounds(array, R(2));
+        globals[array->slot + R(2)] = R(3);
+        NEXT(4);
+    }
+    CASE(OP_JMP): JUMP(U(1));
+    CASE(OP_JZ): if (!R(1)) JUMP(U(2)); NEXT(3);
+    CASE(OP_JNZ): if (R(1)) JUMP(U(2)); NEXT(3);
+    CASE(OP_CALL): {
+        const BytecodeFunction* callee = &functions[U(2)];
+        if (frame_count == frame_capacity) {
+            frames = (Frame*)grow(frames, &frame_capacity, frame_count + 1, FRAMES_MAX, sizeof(Frame));
+        }
+        Frame* frame = &frames[frame_count++];
+        frame->return_ip = ip + 5;
+        frame->base = base;
+        frame->dst = U(1);
+        base += U(3);
+        reserve_stack(base + callee->frame_size);
+        r = stack + base;
+        for (uint32_t i = U(4); i < callee->param_count; i++) r[i] = 0;
+        JUMP(callee->entry);
+    }
+    CASE(OP_TAILCALL): {
+        const BytecodeFunction* callee = &functions[U(1)];
+        uint32_t count = U(3);
+        memmove(r, r + U(2), count * sizeof(int64_t));
+        reserve_stack(base + callee->frame_size);
+        r = stack + base;
+        for (uint32_t i = count; i < callee->param_count; i++) r[i] = 0;
+        JUMP(callee->entry);
+    }
+    CASE(OP_PRINTLN): R(1) = runtime_println(R(2)); NEXT(3);
+    CASE(OP_RET0):
+        result = 0;
+        goto return_result;
+    CASE(OP_RET):
+        result = R(1);
+    return_result:
+        if (frame_count) {
+            const Frame* frame = &frames[--frame_count];
+            base = frame->base;
+            r = stack + base;
+            r[frame->dst] = result;
+            ip = frame->return_ip;
+            DISPATCH();
+        }
+        free(globals);
+        free(stack);
+        free(frames);
+        stack = NULL;
+        frames = NULL;
+        return result;
+#ifndef THREADED_DISPATCH
+    }
+#endif
+}
@@ -0,0 +1,12 @@
+#ifndef INTERPRET_H
+#define INTERPRET_H
+
+#include <stdint.h>
+#include "bytecode.h"
+
+// Runs the top-level code of `program` and returns the status it exits
+// with. println writes through runtime_println; the caller flushes the
+// output with runtime_flush.
+int64_t interpret(const Bytecode* program);
+
+#endif // INTERPRET_H
@@ -0,0 +1,503 @@
+#include "ir.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every array in the IR is a growable heap array; ir_program_free releases
+// them all. Instruction arrays are per block so passes can insert and delete
+// without shifting the whole function.
+
+#define IR_MIN_CAPACITY 8
+
+// Makes room for `needed` elements, doubling the capacity as required.
+static void* reserve_array(void* array, uint32_t* capacity, uint32_t needed, size_t element_size) {
+    if (needed <= *capacity) return array;
+    uint32_t new_capacity = *capacity ? *capacity : IR_MIN_CAPACITY;
+    while (new_capacity < needed) new_capacity *= 2;
+    void* resized = realloc(array, (size_t)new_capacity * element_size);
+    if (!resized) {
+        fprintf(stderr, "Error: Out of memory growing the IR\n");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return resized;
+}
+
+void ir_program_init(IrProgram* program) {
+    memset(program, 0, sizeof(*program));
+}
+
+static void free_function(IrFunction* function) {
+    for (uint32_t i = 0; i < function->block_count; i++) {
+        free(function->blocks[i].instrs);
+        free(function->blocks[i].preds);
+    }
+    free(function->blocks);
+    free(function->params);
+    free(function->reg_types);
+    free(function->args);
+}
+
+void ir_program_free(IrProgram* program) {
+    for (uint32_t i = 0; i < program->function_count; i++) {
+        free_function(&program->functions[i]);
+    }
+    free(program->functions);
+    free(program->function_index);
+    free(program->globals);
+    free(program->global_index);
+    free((void*)program->strings);
+    memset(program, 0, sizeof(*program));
+}
+
+// Symbol-indexed lookup tables grow to cover `name`, with new entries zero.
+static uint32_t* reserve_index(uint32_t* index, uint32_t* size, Symbol name) {
+    if (name < *size) return index;
+    uint32_t old_size = *size;
+    index = (uint32_t*)reserve_array(index, size, name + 1, sizeof(uint32_t));
+    memset(index + old_size, 0, (*size - old_size) * sizeof(uint32_t));
+    return index;
+}
+
+IrFunction* ir_add_function(IrProgram* program, Symbol name, int is_entry) {
+    program->functions = (IrFunction*)reserve_array(program->functions, &program->function_capacity,
+                                                    program->function_count + 1, sizeof(IrFunction));
+    IrFunction* function = &program->functions[program->function_count++];
+    memset(function, 0, sizeof(*function));
+    function->name = name;
+    function->is_entry = is_entry;
+    function->reg_count = 1; // Register 0 is IR_NO_REG
+    function->reg_types = (uint8_t*)reserve_array(NULL, &function->reg_capacity, 1, sizeof(uint8_t));
+    function->reg_types[0] = IR_TYPE_VOID;
+    if (name != SYMBOL_NONE) {
+        program->function_index = reserve_index(program->function_index, &program->function_index_size, name);
+        // A redefinition keeps the first function's name binding
+        if (!program->function_index[name]) program->function_index[name] = program->function_count;
+    }
+    return function;
+}
+
+uint32_t ir_retain_functions(IrProgram* program, const uint8_t* keep) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < program->function_count; i++) {
+        if (keep[i]) {
+            program->functions[kept++] = program->functions[i];
+        } else {
+            free_function(&program->functions[i]);
+        }
+    }
+    uint32_t removed = program->function_count - kept;
+    program->function_count = kept;
+    if (program->function_index) memset(program->function_index, 0, program->function_index_size * sizeof(uint32_t));
+    for (uint32_t i = 0; i < kept; i++) {
+        Symbol name = program->functions[i].name;
+        if (name != SYMBOL_NONE && !program->function_index[name]) program->function_index[name] = i + 1;
+    }
+    return removed;
+}
+
+uint32_t ir_retain_globals(IrProgram* program, const uint8_t* keep) {
+    uint32_t kept = 0;
+    if (program->global_index) memset(program->global_index, 0, program->global_index_size * sizeof(uint32_t));
+    for (uint32_t i = 0; i < program->global_count; i++) {
+        if (!keep[i]) continue;
+        program->globals[kept] = program->globals[i];
+        program->global_index[program->globals[kept].name] = kept + 1;
+        kept++;
+    }
+    uint32_t removed = program->global_count - kept;
+    program->global_count = kept;
+    return removed;
+}
+
+IrFunction* ir_find_function(const IrProgram* program, Symbol name) {
+    if (name >= program->function_index_size || !program->function_index[name]) return NULL;
+    return &program->functions[program->function_index[name] - 1];
+}
+
+IrGlobal* ir_find_global(const IrProgram* program, Symbol name) {
+    if (name >= program->global_index_size || !program->global_index[name]) return NULL;
+    return &program->globals[program->global_index[name] - 1];
+}
+
+int ir_index_in_bounds(const IrProgram* program, const IrInstr* instr) {
+    const IrGlobal* global = ir_find_global(program, instr->symbol);
+    return instr->a.kind == IR_OPERAND_IMM && global && instr->a.value >= 0 && instr->a.value < global->size;
+}
+
+void ir_declare_global(IrProgram* program, Symbol name, int64_t size) {
+    program->global_index = reserve_index(program->global_index, &program->global_index_size, name);
+    uint32_t index = program->global_index[name];
+    if (index) {
+        IrGlobal* global = &program->globals[index - 1];
+        if (size > global->size) global->size = size;
+        return;
+    }
+    program->globals = (IrGlobal*)reserve_array(program->globals, &program->global_capacity,
+                                                program->global_count + 1, sizeof(IrGlobal));
+    program->globals[program->global_count].name = name;
+    program->globals[program->global_count].size = size;
+    program->global_index[name] = ++program->global_count;
+}
+
+uint32_t ir_add_string(IrProgram* program, const char* text) {
+    program->strings = (const char**)reserve_array((void*)program->strings, &program->string_capacity,
+                                                   program->string_count + 1, sizeof(const char*));
+    program->strings[program->string_count] = text;
+    return program->string_count++;
+}
+
+uint32_t ir_add_block(IrFunction* function) {
+    function->blocks = (IrBlock*)reserve_array(function->blocks, &function->block_capacity,
+                                               function->block_count + 1, sizeof(IrBlock));
+    memset(&function->blocks[function->block_count], 0, sizeof(IrBlock));
+    return function->block_count++;
+}
+
+IrReg ir_new_reg(IrFunction* function, IrType type) {
+    function->reg_types = (uint8_t*)reserve_array(function->reg_types, &function->reg_capacity,
+                                                  function->reg_count + 1, sizeof(uint8_t));
+    function->reg_types[function->reg_count] = (uint8_t)type;
+    return function->reg_count++;
+}
+
+IrInstr* ir_append(IrFunction* function, uint32_t block_id, IrOp op) {
+    IrBlock* block = &function->blocks[block_id];
+    block->instrs = (IrInstr*)reserve_array(block->instrs, &block->capacity, block->count + 1, sizeof(IrInstr));
+    IrInstr* instr = &block->instrs[block->count++];
+    memset(instr, 0, sizeof(*instr));
+    instr->op = (uint8_t)op;
+    instr->type = IR_TYPE_VOID;
+    return instr;
+}
+
+uint32_t ir_add_arg(IrFunction* function, IrOperand arg) {
+    function->args = (IrOperand*)reserve_array(function->args, &function->arg_capacity,
+                                               function->arg_count + 1, sizeof(IrOperand));
+    function->args[function->arg_count] = arg;
+    return function->arg_count++;
+}
+
+IrOperand ir_reg(IrReg reg) {
+    IrOperand operand = { IR_OPERAND_REG, reg };
+    return operand;
+}
+
+IrOperand ir_imm(int64_t value) {
+    IrOperand operand = { IR_OPERAND_IMM, value };
+    return operand;
+}
+
+IrOperand ir_none(void) {
+    IrOperand operand = { IR_OPERAND_NONE, 0 };
+    return operand;
+}
+
+uint32_t ir_retain_blocks(IrFunction* function, const uint8_t* keep) {
+    uint32_t* renumber = (uint32_t*)malloc((function->block_count ? function->block_count : 1) * sizeof(uint32_t));
+    if (!renumber) {
+        fprintf(stderr, "Error: Out of memory removing blocks\n");
+        exit(1);
+    }
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < function->block_count; i++) {
+        if (keep[i]) {
+            renumber[i] = kept;
+            function->blocks[kept++] = function->blocks[i];
+        } else {
+            free(function->blocks[i].instrs);
+            free(function->blocks[i].preds);
+        }
+    }
+    for (uint32_t i = 0; i < kept; i++) {
+        IrBlock* block = &function->blocks[i];
+        if (!ir_block_terminated(block)) continue;
+        IrInstr* last = &block->instrs[block->count - 1];
+        if (last->op == IR_JUMP || last->op == IR_BRANCH) last->target = renumber[last->target];
+        if (last->op == IR_BRANCH) last->other = renumber[last->other];
+    }
+    uint32_t removed = function->block_count - kept;
+    function->block_count = kept;
+    free(renumber);
+    ir_compute_predecessors(function);
+    return removed;
+}
+
+void ir_reorder_blocks(IrFunction* function, const uint32_t* order, uint32_t count) {
+    uint32_t* renumber = (uint32_t*)malloc((function->block_count ? function->block_count : 1) * sizeof(uint32_t));
+    uint8_t* listed = (uint8_t*)calloc(function->block_count ? function->block_count : 1, sizeof(uint8_t));
+    IrBlock* blocks = (IrBlock*)malloc((count ? count : 1) * sizeof(IrBlock));
+    if (!renumber || !listed || !blocks) {
+        fprintf(stderr, "Error: Out of memory reordering blocks\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        renumber[order[i]] = i;
+        listed[order[i]] = 1;
+        blocks[i] = function->blocks[order[i]];
+    }
+    for (uint32_t i = 0; i < function->block_count; i++) {
+        if (listed[i]) continue;
+        free(function->blocks[i].instrs);
+        free(function->blocks[i].preds);
+    }
+    memcpy(function->blocks, blocks, count * sizeof(IrBlock));
+    function->block_count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        IrBlock* block = &function->blocks[i];
+        if (!ir_block_terminated(block)) continue;
+        IrInstr* last = &block->instrs[block->count - 1];
+        if (last->op == IR_JUMP || last->op == IR_BRANCH) last->target = renumber[last->target];
+        if (last->op == IR_BRANCH) last->other = renumber[last->other];
+    }
+    free(renumber);
+    free(listed);
+    free(blocks);
+    ir_compute_predecessors(function);
+}
+
+int ir_is_terminator(IrOp op) {
+    return op == IR_JUMP || op == IR_BRANCH || op == IR_RET;
+}
+
+int ir_has_dst(IrOp op) {
+    switch (op) {
+        case IR_STORE:
+        case IR_STORE_ELEM:
+        case IR_JUMP:
+        case IR_BRANCH:
+        case IR_RET:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+int ir_block_terminated(const IrBlock* block) {
+    return block->count > 0 && ir_is_terminator((IrOp)block->instrs[block->count - 1].op);
+}
+
+uint32_t ir_successors(const IrBlock* block, uint32_t succs[2]) {
+    if (!ir_block_terminated(block)) return 0;
+    const IrInstr* last = &block->instrs[block->count - 1];
+    switch (last->op) {
+        case IR_JUMP:
+            succs[0] = last->target;
+            return 1;
+        case IR_BRANCH:
+            succs[0] = last->target;
+            if (last->other == last->target) return 1;
+            succs[1] = last->other;
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+void ir_compute_predecessors(IrFunction* function) {
+    // Predecessors are counted first so each list is sized exactly; sizing
+    // them all to the block count takes quadratic memory.
+    for (uint32_t i = 0; i < function->block_count; i++) {
+        function->blocks[i].pred_count = 0;
+    }
+    for (uint32_t i = 0; i < function->block_count; i++) {
+        uint32_t succs[2];
+        uint32_t count = ir_successors(&function->blocks[i], succs);
+        for (uint32_t s = 0; s < count; s++) function->blocks[succs[s]].pred_count++;
+    }
+    for (uint32_t i = 0; i < function->block_count; i++) {
+        IrBlock* block = &function->blocks[i];
+        free(block->preds);
+        block->preds = block->pred_count ? (uint32_t*)malloc(block->pred_count * sizeof(uint32_t)) : NULL;
+        if (block->pred_count && !block->preds) {
+            fprintf(stderr, "Error: Out of memory growing the IR\n");
+            exit(1);
+        }
+        block->pred_count = 0;
+    }
+    for (uint32_t i = 0; i < function->block_count; i++) {
+        uint32_t succs[2];
+        uint32_t count = ir_successors(&function->blocks[i], succs);
+        for (uint32_t s = 0; s < count; s++) {
+            IrBlock* succ = &function->blocks[succs[s]];
+            succ->preds[succ->pred_count++] = i;
+        }
+    }
+}
+
+void ir_for_each_use(const IrFunction* function, const IrInstr* instr, IrUseVisitor visit, void* context) {
+    if (instr->a.kind == IR_OPERAND_REG) visit((IrReg)instr->a.value, context);
+    if (instr->b.kind == IR_OPERAND_REG) visit((IrReg)instr->b.value, context);
+    if (instr->op == IR_CALL) {
+        for (uint32_t i = 0; i < instr->other; i++) {
+            const IrOperand* arg = &function->args[instr->target + i];
+            if (arg->kind == IR_OPERAND_REG) visit((IrReg)arg->value, context);
+        }
+    }
+}
+
+const char* ir_op_name(IrOp op) {
+    static const char* names[] = {
+        [IR_EQ] = "eq",
+        [IR_NE] = "ne",
+        [IR_LT] = "lt",
+        [IR_GT] = "gt",
+        [IR_LE] = "le",
+        [IR_GE] = "ge",
+        [IR_ADD] = "add",
+        [IR_SUB] = "sub",
+        [IR_MUL] = "mul",
+        [IR_DIV] = "div",
+        [IR_MOD] = "mod",
+        [IR_MOV] = "mov",
+        [IR_LOAD] = "load",
+        [IR_STORE] = "store",
+        [IR_LOAD_ELEM] = "load_elem",
+        [IR_STORE_ELEM] = "store_elem",
+        [IR_ADDR] = "addr",
+        [IR_PARAM] = "param",
+        [IR_CALL] = "call",
+        [IR_JUMP] = "jump",
+        [IR_BRANCH] = "branch",
+        [IR_RET] = "ret",
+    };
+    return names[op];
+}
+
+static void print_operand(Emitter* out, IrOperand operand) {
+    switch (operand.kind) {
+        case IR_OPERAND_REG:
+            emit_char(out, '%');
+            emit_int(out, operand.value);
+            break;
+        case IR_OPERAND_IMM:
+            emit_int(out, operand.value);
+            break;
+        case IR_OPERAND_NONE:
+            break;
+    }
+}
+
+static void print_block_ref(Emitter* out, uint32_t block) {
+    emit_text(out, "bb");
+    emit_int(out, block);
+}
+
+static void print_instr(Emitter* out, const IrFunction* function, const IrInstr* instr) {
+    emit_text(out, "  ");
+    if (instr->dst != IR_NO_REG) {
+        print_operand(out, ir_reg(instr->dst));
+        emit_text(out, instr->type == IR_TYPE_PTR ? ":ptr = " : " = ");
+    }
+    emit_text(out, ir_op_name((IrOp)instr->op));
+    switch (instr->op) {
+        case IR_LOAD:
+        case IR_STORE:
+        case IR_LOAD_ELEM:
+        case IR_STORE_ELEM:
+        case IR_CALL:
+            emit_text(out, " @");
+            emit_text(out, symbol_name(instr->symbol));
+            break;
+        case IR_ADDR:
+            emit_text(out, " str");
+            emit_int(out, instr->target);
+            break;
+        case IR_PARAM:
+            emit_char(out, ' ');
+            emit_int(out, instr->target);
+            break;
+        case IR_JUMP:
+            emit_char(out, ' ');
+            print_block_ref(out, instr->target);
+            break;
+        default:
+            break;
+    }
+    if (instr->op == IR_CALL) {
+        emit_char(out, '(');
+        for (uint32_t i = 0; i < instr->other; i++) {
+            if (i) emit_text(out, ", ");
+            print_operand(out, function->args[instr->target + i]);
+        }
+        emit_char(out, ')');
+    }
+    if (instr->op == IR_LOAD_ELEM || instr->op == IR_STORE_ELEM) {
+        emit_char(out, '[');
+        print_operand(out, instr->a);
+        emit_char(out, ']');
+        if (instr->op == IR_STORE_ELEM) {
+            emit_text(out, ", ");
+            print_operand(out, instr->b);
+        }
+    } else if (instr->op == IR_STORE) {
+        emit_text(out, ", ");
+        print_operand(out, instr->a);
+    } else if (instr->a.kind != IR_OPERAND_NONE) {
+        emit_char(out, ' ');
+        print_operand(out, instr->a);
+        if (instr->b.kind != IR_OPERAND_NONE) {
+            emit_text(out, ", ");
+            print_operand(out, instr->b);
+        }
+    }
+    if (instr->op == IR_BRANCH) {
+        emit_text(out, ", ");
+        print_block_ref(out, instr->target);
+        emit_text(out, ", ");
+        print_block_ref(out, instr->other);
+    }
+    emit_char(out, '\n');
+}
+
+static void print_function(Emitter* out, const IrFunction* function) {
+    emit_text(out, "function ");
+    emit_text(out, function->is_entry ? "_start" : symbol_name(function->name));
+    emit_char(out, '(');
+    for (uint32_t i = 0; i < function->param_count; i++) {
+        if (i) emit_text(out, ", ");
+        emit_text(out, symbol_name(function->params[i]));
+    }
+    emit_text(out, ") {\n");
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        const IrBlock* block = &function->blocks[b];
+        print_block_ref(out, b);
+        emit_char(out, ':');
+        if (block->pred_count) {
+            emit_text(out, "  ; preds: ");
+            for (uint32_t p = 0; p < block->pred_count; p++) {
+                if (p) emit_text(out, ", ");
+                print_block_ref(out, block->preds[p]);
+            }
+        }
+        emit_char(out, '\n');
+        for (uint32_t i = 0; i < block->count; i++) {
+            print_instr(out, function, &block->instrs[i]);
+        }
+    }
+    emit_text(out, "}\n");
+}
+
+void ir_print(const IrProgram* program, Emitter* out) {
+    for (uint32_t i = 0; i < program->global_count; i++) {
+        emit_text(out, "global @");
+        emit_text(out, symbol_name(program->globals[i].name));
+        if (program->globals[i].size > 1) {
+            emit_char(out, '[');
+            emit_int(out, program->globals[i].size);
+            emit_char(out, ']');
+        }
+        emit_char(out, '\n');
+    }
+    for (uint32_t i = 0; i < program->string_count; i++) {
+        emit_text(out, "string str");
+        emit_int(out, i);
+        emit_text(out, " \"");
+        emit_text(out, program->strings[i]);
+        emit_text(out, "\"\n");
+    }
+    for (uint32_t i = 0; i < program->function_count; i++) {
+        emit_char(out, '\n');
+        print_function(out, &program->functions[i]);
+    }
+}
@@ -0,0 +1,204 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "intern.h"
+#include "emit.h"
+
+// Linear three-address IR. Each function is a list of basic blocks; each
+// block is a list of instructions ending in exactly one terminator (jump,
+// branch or return). Values live in an unbounded set of virtual registers,
+// numbered from 1 per function. Temporaries are assigned once; parameters
+// and scalar variables declared inside a function are registers too, and
+// are assigned by every store to them. Other variables are globals in
+// memory and are accessed with explicit load/store instructions.
+
+typedef uint32_t IrReg;
+
+#define IR_NO_REG 0
+
+typedef enum {
+    IR_TYPE_VOID,
+    IR_TYPE_I64,
+    IR_TYPE_PTR, // Address of a string literal
+} IrType;
+
+typedef enum {
+    IR_OPERAND_NONE,
+    IR_OPERAND_REG,
+    IR_OPERAND_IMM,
+} IrOperandKind;
+
+// A source operand: a virtual register or a 64-bit immediate.
+typedef struct {
+    IrOperandKind kind;
+    int64_t value; // Register number or immediate value
+} IrOperand;
+
+// Instruction operands by opcode:
+//
+//   op            dst     a        b        symbol   target         other
+//   MOV           result  value    -        -        -              -
+//   ADD .. MOD    result  left     right    -        -              -
+//   EQ .. GE      result  left     right    -        -              -
+//   LOAD          result  -        -        global   -              -
+//   STORE         -       value    -        global   -              -
+//   LOAD_ELEM     result  index    -        global   -              -
+//   STORE_ELEM    -       index    value    global   -              -
+//   ADDR          result  -        -        -        string index   -
+//   PARAM         result  -        -        -        param index    -
+//   CALL          result  -        -        callee   first arg      arg count
+//   JUMP          -       -        -        -        block          -
+//   BRANCH        -       cond     -        -        block if != 0  block if 0
+//   RET           -       value?   -        -        -              -
+//
+// An element index outside its global's size ends the program with status
+// 1, so LOAD_ELEM and STORE_ELEM are only removable when their index is a
+// constant known to be in bounds; see ir_index_in_bounds.
+//
+// The binary opcodes follow the order of BinaryOperator in ast.h.
+typedef enum {
+    IR_EQ,
+    IR_NE,
+    IR_LT,
+    IR_GT,
+    IR_LE,
+    IR_GE,
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_MOD,
+    IR_MOV,
+    IR_LOAD,
+    IR_STORE,
+    IR_LOAD_ELEM,
+    IR_STORE_ELEM,
+    IR_ADDR,
+    IR_PARAM, // Only at the start of the entry block, in parameter order
+    IR_CALL,
+    IR_JUMP,
+    IR_BRANCH,
+    IR_RET,
+} IrOp;
+
+typedef struct {
+    uint8_t op;
+    uint8_t type; // IrType of dst
+    IrReg dst;
+    IrOperand a;
+    IrOperand b;
+    Symbol symbol;
+    uint32_t target;
+    uint32_t other;
+} IrInstr;
+
+typedef struct {
+    IrInstr* instrs;
+    uint32_t count;
+    uint32_t capacity;
+    // Filled in by ir_compute_predecessors.
+    uint32_t* preds;
+    uint32_t pred_count;
+} IrBlock;
+
+typedef struct {
+    Symbol name;
+    int is_entry; // The program's top-level code; becomes _start
+    Symbol* params;
+    uint32_t param_count;
+
+    IrBlock* blocks; // blocks[0] is the entry block
+    uint32_t block_count;
+    uint32_t block_capacity;
+
+    uint32_t reg_count; // Registers are 1 .. reg_count - 1
+    uint32_t reg_capacity;
+    uint8_t* reg_types;
+
+    IrOperand* args; // Call arguments; see IR_CALL
+    uint32_t arg_count;
+    uint32_t arg_capacity;
+} IrFunction;
+
+typedef struct {
+    Symbol name;
+    int64_t size; // Elements of 8 bytes
+} IrGlobal;
+
+// The most elements all globals may hold together (512 MB). Generated code
+// addresses them with 32-bit absolute displacements, and --run maps them
+// with MAP_32BIT, which only has a 1 GB window to place them in.
+#define IR_MAX_GLOBAL_ELEMENTS ((int64_t)1 << 26)
+
+typedef struct {
+    IrFunction* functions; // functions[0] is the entry function
+    uint32_t function_count;
+    uint32_t function_capacity;
+    uint32_t* function_index; // Symbol -> functions index + 1, or 0
+    uint32_t function_index_size;
+
+    IrGlobal* globals;
+    uint32_t global_count;
+    uint32_t global_capacity;
+    uint32_t* global_index; // Symbol -> globals index + 1, or 0
+    uint32_t global_index_size;
+
+    const char** strings; // String literal contents, owned by the AST arena
+    uint32_t string_count;
+    uint32_t string_capacity;
+} IrProgram;
+
+void ir_program_init(IrProgram* program);
+void ir_program_free(IrProgram* program);
+
+IrFunction* ir_add_function(IrProgram* program, Symbol name, int is_entry);
+// Declares a global, growing it to at least `size` elements.
+void ir_declare_global(IrProgram* program, Symbol name, int64_t size);
+uint32_t ir_add_string(IrProgram* program, const char* text);
+// NULL if no function or global has that name.
+IrFunction* ir_find_function(const IrProgram* program, Symbol name);
+IrGlobal* ir_find_global(const IrProgram* program, Symbol name);
+// Whether a LOAD_ELEM or STORE_ELEM has a constant index within its global,
+// so it needs no bounds check.
+int ir_index_in_bounds(const IrProgram* program, const IrInstr* instr);
+
+// Delete every function, global or block whose `keep` entry is 0, keeping
+// the order of the rest. Names are re-indexed, and jump targets renumbered
+// for blocks; nothing may still refer to a deleted entry. Each returns how
+// many entries it deleted.
+uint32_t ir_retain_functions(IrProgram* program, const uint8_t* keep);
+uint32_t ir_retain_globals(IrProgram* program, const uint8_t* keep);
+uint32_t ir_retain_blocks(IrFunction* function, const uint8_t* keep);
+// Puts the blocks in the order listed in `order`, deleting any not listed.
+// Jump targets are renumbered and predecessors recomputed; order[0] must
+// be 0 and nothing may jump to a deleted block.
+void ir_reorder_blocks(IrFunction* function, const uint32_t* order, uint32_t count);
+
+uint32_t ir_add_block(IrFunction* function);
+IrReg ir_new_reg(IrFunction* function, IrType type);
+IrInstr* ir_append(IrFunction* function, uint32_t block, IrOp op);
+uint32_t ir_add_arg(IrFunction* function, IrOperand arg);
+
+IrOperand ir_reg(IrReg reg);
+IrOperand ir_imm(int64_t value);
+IrOperand ir_none(void);
+
+int ir_is_terminator(IrOp op);
+int ir_has_dst(IrOp op);
+// Whether the block ends in a terminator.
+int ir_block_terminated(const IrBlock* block);
+// Writes the successors of `block` to `succs`; returns how many (0-2).
+uint32_t ir_successors(const IrBlock* block, uint32_t succs[2]);
+void ir_compute_predecessors(IrFunction* function);
+
+// Calls `visit` on each register operand read by `instr`, including call
+// arguments.
+typedef void (*IrUseVisitor)(IrReg reg, void* context);
+void ir_for_each_use(const IrFunction* function, const IrInstr* instr, IrUseVisitor visit, void* context);
+
+const char* ir_op_name(IrOp op);
+void ir_print(const IrProgram* program, Emitter* emitter);
+
+#endif // IR_H
@@ -0,0 +1,133 @@
+#define _DEFAULT_SOURCE // For MAP_ANONYMOUS and MAP_32BIT
+#include "jit.h"
+#include "runtime.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// The object is laid out in one mapping as the executable writer lays it
+// out in a file: .text, then .data on the next page, then .bss. Each
+// undefined symbol becomes a stub at the end of .text that jumps to the
+// host function bound to it, so the code can reach it with a rel32 call
+// wherever the transpiler itself is loaded.
+
+#define STUB_SIZE 14 // jmp [rel .+6], then the 8-byte address
+
+static void host_exit(int64_t status) {
+    runtime_flush();
+    exit((int)status);
+}
+
+static void host_index_error(void) {
+    runtime_flush();
+    fputs(RUNTIME_INDEX_MESSAGE, stderr);
+    exit(1);
+}
+
+// Host functions in Builtin order.
+static int64_t (* const host_builtins[BUILTIN_COUNT])(int64_t) = {
+    runtime_println,
+};
+
+static uint64_t host_address(Symbol name) {
+    const char* text = symbol_name(name);
+    if (strcmp(text, RUNTIME_EXIT) == 0) return (uint64_t)(uintptr_t)host_exit;
+    if (strcmp(text, RUNTIME_INDEX_ERROR) == 0) return (uint64_t)(uintptr_t)host_index_error;
+    int builtin = runtime_find_builtin_symbol(name);
+    if (builtin < 0) {
+        fprintf(stderr, "Error: Undefined symbol '%s'\n", text);
+        exit(1);
+    }
+    return (uint64_t)(uintptr_t)host_builtins[builtin];
+}
+
+static void add_stubs(ObjectFile* object) {
+    uint32_t count = object->symbol_count;
+    for (uint32_t i = 0; i < count; i++) {
+        if (object->symbols[i].section != SECTION_UNDEFINED) continue;
+        uint64_t address = host_address(object->symbols[i].name);
+        uint8_t stub[STUB_SIZE] = { 0xff, 0x25 };
+        for (int k = 0; k < 8; k++) stub[6 + k] = (uint8_t)(address >> (8 * k));
+        object_define(object, object->symbols[i].name, SECTION_TEXT, STUB_SIZE, 0);
+        object_append(object, SECTION_TEXT, stub, STUB_SIZE);
+    }
+}
+
+// _start expects rsp to be 16-byte aligned, as at process entry, but is
+// called from C with a return address pushed. The trampoline drops 8 more
+// bytes and jumps to it; returns the trampoline's offset in .text.
+static uint64_t add_trampoline(ObjectFile* object) {
+    int64_t start = object_find_symbol(object, symbol_intern("_start", 6));
+    if (start < 0 || object->symbols[start].section != SECTION_TEXT) {
+        fprintf(stderr, "Error: Undefined symbol '_start'\n");
+        exit(1);
+    }
+    static const uint8_t trampoline[] = { 0x48, 0x83, 0xec, 0x08, 0xe9, 0, 0, 0, 0 }; // sub rsp, 8; jmp _start
+    uint64_t offset = object->text_size;
+    object_append(object, SECTION_TEXT, trampoline, sizeof(trampoline));
+    object_add_reloc(object, offset + 5, (uint32_t)start, RELOC_PC32, -4);
+    return offset;
+}
+
+// Lists the functions for perf, which reads the map of a process that ran
+// code it cannot find in any mapped file.
+static void write_perf_map(const ObjectFile* object, uint64_t text_base) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%ld.map", (long)getpid());
+    FILE* map = fopen(path, "w");
+    if (!map) {
+        perror("Error writing perf map");
+        return;
+    }
+    for (uint32_t i = 0; i < object->symbol_count; i++) {
+        const ObjectSymbol* symbol = &object->symbols[i];
+        if (!symbol->function) continue;
+        fprintf(map, "%" PRIx64 " %" PRIx64 " %s\n", text_base + symbol->offset, symbol->size,
+                symbol_name(symbol->name));
+    }
+    fclose(map);
+}
+
+static int needs_low_addresses(const ObjectFile* object) {
+    for (uint32_t i = 0; i < object->reloc_count; i++) {
+        if (object->relocs[i].kind == RELOC_ABS32) return 1;
+    }
+    return 0;
+}
+
+void jit_run(ObjectFile* object) {
+    add_stubs(object);
+    uint64_t trampoline = add_trampoline(object);
+
+    uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t text_pages = (object->text_size + page_size - 1) & ~(page_size - 1);
+    uint64_t data_size = (object->data_size + 7) & ~(uint64_t)7;
+    uint64_t size = text_pages + data_size + object->bss_size;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    // Indexed globals are addressed with 32-bit absolute displacements.
+    if (needs_low_addresses(object)) flags |= MAP_32BIT;
+    uint8_t* memory = (uint8_t*)mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (memory == MAP_FAILED) {
+        perror("Error mapping code");
+        exit(1);
+    }
+
+    uint64_t base = (uint64_t)(uintptr_t)memory;
+    uint64_t bases[SECTION_COUNT] = { base, base + text_pages, base + text_pages + data_size };
+    memcpy(memory, object->text, object->text_size);
+    if (object->data_size) memcpy(memory + text_pages, object->data, object->data_size);
+    object_relocate(object, memory, bases);
+    if (text_pages && mprotect(memory, (size_t)text_pages, PROT_READ | PROT_EXEC) != 0) {
+        perror("Error mapping code");
+        exit(1);
+    }
+    write_perf_map(object, base);
+
+    fflush(stdout);
+    void (*start)(void) = (void (*)(void))(uintptr_t)(base + trampoline);
+    start();
+    abort(); // _start exits
+}
@@ -0,0 +1,12 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "object.h"
+
+// Loads `object` into executable memory and runs its _start in this
+// process. Calls to builtins are bound to functions of the transpiler, and
+// a perf map is written to /tmp/perf-<pid>.map first. The program ends by
+// exiting the process with its exit code, so this does not return.
+void jit_run(ObjectFile* object);
+
+#endif // JIT_H
@@ -0,0 +1,51 @@
+// Generated by gen_keywords.c -- do not edit.
+#ifndef KEYWORD_TABLE_H
+#define KEYWORD_TABLE_H
+
+#define KEYWORD_MIN_LENGTH 2
+#define KEYWORD_MAX_LENGTH 6
+#define KEYWORD_HASH(text, length) \
+    (((unsigned char)(text)[0] * 1u + (unsigned char)(text)[(length) - 1] * 1u + (unsigned)(length)) & 31u)
+
+typedef struct {
+    const char* text;
+    size_t length;
+    TokenType type;
+} KeywordSlot;
+
+static const KeywordSlot keyword_slots[32] = {
+    { "", 0, TOKEN_IDENTIFIER },
+    { "while", 5, TOKEN_KEYWORD_WHILE },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "import", 6, TOKEN_KEYWORD_IMPORT },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "return", 6, TOKEN_KEYWORD_RETURN },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "var", 3, TOKEN_KEYWORD_VAR },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "func", 4, TOKEN_KEYWORD_FUNC },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "as", 2, TOKEN_KEYWORD_AS },
+    { "from", 4, TOKEN_KEYWORD_FROM },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "for", 3, TOKEN_KEYWORD_FOR },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+    { "", 0, TOKEN_IDENTIFIER },
+};
+
+#endif // KEYWORD_TABLE_H
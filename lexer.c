@@ -1,27 +1,45 @@
 #include "lexer.h"
+#include "keyword_table.h"
+#include "runtime.h"
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <stdio.h>
 
-static Token create_token(TokenType type, const char* value, int length, int line, int column) {
+// Tokens are views into the source buffer; nothing is copied or allocated here.
+static Token create_token(TokenType type, const char* start, size_t length) {
     Token token;
     token.type = type;
-    token.value = (char*)malloc(length + 1);
-    strncpy(token.value, value, length);
-    token.value[length] = '\0';
-    token.line = line;
-    token.column = column;
+    token.start = start;
+    token.length = length;
+    token.symbol = SYMBOL_NONE;
     return token;
 }
 
-static void advance(Lexer* lexer) {
-    if (lexer->source[lexer->position] == '\n') {
-        lexer->line++;
-        lexer->column = 0;
-    } else {
-        lexer->column++;
+// Character classes for the scanning loops. One table lookup replaces the
+// isspace/isalpha/isalnum calls and lets each loop consume a whole run.
+enum {
+    CHAR_SPACE = 1 << 0,
+    CHAR_NEWLINE = 1 << 1,
+    CHAR_IDENT_START = 1 << 2,
+    CHAR_IDENT = 1 << 3,
+    CHAR_DIGIT = 1 << 4,
+};
+
+static unsigned char char_class[256];
+
+static void init_char_class(void) {
+    if (char_class[(unsigned char)'_']) return;
+    for (int c = 0; c < 256; c++) {
+        unsigned char flags = 0;
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f') flags |= CHAR_SPACE;
+        if (c == '\n') flags |= CHAR_SPACE | CHAR_NEWLINE;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') flags |= CHAR_IDENT_START | CHAR_IDENT;
+        if (c >= '0' && c <= '9') flags |= CHAR_DIGIT | CHAR_IDENT;
+        char_class[c] = flags;
     }
+}
+
+static void advance(Lexer* lexer) {
     lexer->position++;
 }
 
@@ -29,42 +47,115 @@ static char peek(Lexer* lexer) {
     return lexer->source[lexer->position];
 }
 
+// The buffer is NUL-terminated at source[length], so looking one byte past
+// any non-NUL character never reads out of bounds.
 static char peek_next(Lexer* lexer) {
-    if (lexer->position + 1 < strlen(lexer->source)) {
+    if (lexer->position < lexer->length) {
         return lexer->source[lexer->position + 1];
     }
     return '\0';
 }
 
+// Consumes a run of bytes of the given class.
+static void skip_class(Lexer* lexer, unsigned char flags) {
+    const unsigned char* p = (const unsigned char*)lexer->source + lexer->position;
+    const unsigned char* start = p;
+    while (char_class[*p] & flags) p++;
+    lexer->position += (size_t)(p - start);
+}
+
 static void skip_whitespace(Lexer* lexer) {
-    while (isspace(peek(lexer))) {
-        advance(lexer);
-    }
+    skip_class(lexer, CHAR_SPACE);
 }
 
-Lexer* lexer_new(const char* source) {
+// Skips to the newline ending a '//' comment (or to the end of the source).
+static void skip_comment(Lexer* lexer) {
+    const char* p = lexer->source + lexer->position;
+    const char* end = memchr(p, '\n', lexer->length - lexer->position);
+    if (!end) end = lexer->source + lexer->length;
+    lexer->position += (size_t)(end - p);
+}
+
+// Names the generated code defines itself: the runtime's, and the entry
+// point. A program using one would clash with them when linked.
+static int is_reserved(const char* value, size_t length) {
+    size_t prefix = sizeof(RUNTIME_PREFIX) - 1;
+    if (length >= prefix && memcmp(value, RUNTIME_PREFIX, prefix) == 0) return 1;
+    return length == 6 && memcmp(value, "_start", 6) == 0;
+}
+
+// Keyword lookup through the generated perfect hash: one hash, one compare.
+static TokenType classify_identifier(const char* value, size_t length) {
+    if (length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH) return TOKEN_IDENTIFIER;
+    const KeywordSlot* slot = &keyword_slots[KEYWORD_HASH(value, length)];
+    if (slot->length == length && memcmp(slot->text, value, length) == 0) return slot->type;
+    return TOKEN_IDENTIFIER;
+}
+
+Lexer* lexer_new(const char* source, size_t length) {
+    init_char_class();
     Lexer* lexer = (Lexer*)malloc(sizeof(Lexer));
     lexer->source = source;
+    lexer->length = length;
     lexer->position = 0;
-    lexer->line = 1;
-    lexer->column = 0;
+    lexer->line_starts = NULL;
+    lexer->line_count = 0;
     lexer->current_token.type = TOKEN_EOF; // Initialize to EOF
-    lexer->current_token.value = NULL;
+    lexer->current_token.start = source;
+    lexer->current_token.length = 0;
     return lexer;
 }
 
 void lexer_free(Lexer* lexer) {
-    if (lexer->current_token.value) {
-        free(lexer->current_token.value);
-    }
+    free(lexer->line_starts);
     free(lexer);
 }
 
-void token_free(Token* token) {
-    if (token->value) {
-        free(token->value);
-        token->value = NULL;
+// Records the offset at which every line starts. Only diagnostics need line
+// numbers, so this runs the first time one is printed rather than tracking
+// lines while scanning.
+static void build_line_starts(Lexer* lexer) {
+    size_t capacity = 1024;
+    size_t count = 0;
+    size_t* starts = (size_t*)malloc(capacity * sizeof(size_t));
+    starts[count++] = 0;
+
+    const char* p = lexer->source;
+    const char* end = lexer->source + lexer->length;
+    while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        p++;
+        if (count == capacity) {
+            capacity *= 2;
+            starts = (size_t*)realloc(starts, capacity * sizeof(size_t));
+        }
+        starts[count++] = (size_t)(p - lexer->source);
     }
+
+    lexer->line_starts = starts;
+    lexer->line_count = count;
+}
+
+SourceLocation lexer_location(Lexer* lexer, size_t offset) {
+    if (!lexer->line_starts) {
+        build_line_starts(lexer);
+    }
+
+    // Find the last line starting at or before offset.
+    size_t low = 0;
+    size_t high = lexer->line_count;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (lexer->line_starts[mid] <= offset) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    SourceLocation location;
+    location.line = low + 1;
+    location.column = offset - lexer->line_starts[low];
+    return location;
 }
 
 Token lexer_next_token(Lexer* lexer) {
@@ -72,15 +163,13 @@ Token lexer_next_token(Lexer* lexer) {
         skip_whitespace(lexer);
 
         if (peek(lexer) == '\0') {
-            return create_token(TOKEN_EOF, "", 0, lexer->line, lexer->column);
+            return create_token(TOKEN_EOF, lexer->source + lexer->position, 0);
         }
 
         // Check for comments
         if (peek(lexer) == '/' && peek_next(lexer) == '/') {
             // It's a comment, consume until newline or EOF
-            while (peek(lexer) != '\n' && peek(lexer) != '\0') {
-                advance(lexer);
-            }
+            skip_comment(lexer);
             // If it was a newline, skip_whitespace in the next iteration will handle it.
             // If it was EOF, the EOF check at the beginning of the loop will handle it.
             continue; // Restart loop to find the next token
@@ -90,37 +179,33 @@ Token lexer_next_token(Lexer* lexer) {
         break; // Exit loop and proceed to tokenization
     }
 
-    int start_pos = lexer->position;
-    int start_column = lexer->column;
+    size_t start_pos = lexer->position;
 
     char current_char = peek(lexer);
 
-    if (isalpha(current_char) || current_char == '_') {
-        while (isalnum(peek(lexer)) || peek(lexer) == '_') {
-            advance(lexer);
-        }
-        int length = lexer->position - start_pos;
+    if (char_class[(unsigned char)current_char] & CHAR_IDENT_START) {
+        skip_class(lexer, CHAR_IDENT);
+        size_t length = lexer->position - start_pos;
         const char* value = lexer->source + start_pos;
-        if (strncmp(value, "return", length) == 0) return create_token(TOKEN_KEYWORD_RETURN, value, length, lexer->line, start_column);
-        if (strncmp(value, "for", length) == 0) return create_token(TOKEN_KEYWORD_FOR, value, length, lexer->line, start_column);
-        if (strncmp(value, "while", length) == 0) return create_token(TOKEN_KEYWORD_WHILE, value, length, lexer->line, start_column);
-        if (strncmp(value, "import", length) == 0) return create_token(TOKEN_KEYWORD_IMPORT, value, length, lexer->line, start_column);
-        if (strncmp(value, "as", length) == 0) return create_token(TOKEN_KEYWORD_AS, value, length, lexer->line, start_column);
-        if (strncmp(value, "from", length) == 0) return create_token(TOKEN_KEYWORD_FROM, value, length, lexer->line, start_column);
-        if (strncmp(value, "func", length) == 0) return create_token(TOKEN_KEYWORD_FUNC, value, length, lexer->line, start_column);
-        if (strncmp(value, "var", length) == 0) return create_token(TOKEN_KEYWORD_VAR, value, length, lexer->line, start_column);
-        return create_token(TOKEN_IDENTIFIER, value, length, lexer->line, start_column);
+        Token token = create_token(classify_identifier(value, length), value, length);
+        if (token.type == TOKEN_IDENTIFIER) {
+            if (is_reserved(value, length)) {
+                SourceLocation location = lexer_location(lexer, start_pos);
+                fprintf(stderr, "Error: Name '%.*s' is reserved at line %zu, column %zu\n", (int)length, value, location.line, location.column);
+                exit(1);
+            }
+            token.symbol = symbol_intern(value, length);
+        }
+        return token;
     }
 
-    if (isdigit(current_char)) {
-        while (isdigit(peek(lexer))) {
-            advance(lexer);
-        }
-        if (peek(lexer) == 'a' && (peek_next(lexer) == ' ' || peek_next(lexer) == '\n' || peek_next(lexer) == '\0' || !isalnum(peek_next(lexer)))) {
+    if (char_class[(unsigned char)current_char] & CHAR_DIGIT) {
+        skip_class(lexer, CHAR_DIGIT);
+        if (peek(lexer) == 'a' && !(char_class[(unsigned char)peek_next(lexer)] & CHAR_IDENT)) {
             advance(lexer); // consume 'a'
-            return create_token(TOKEN_ASCII_LITERAL, lexer->source + start_pos, lexer->position - start_pos, lexer->line, start_column);
+            return create_token(TOKEN_ASCII_LITERAL, lexer->source + start_pos, lexer->position - start_pos);
         }
-        return create_token(TOKEN_NUMBER, lexer->source + start_pos, lexer->position - start_pos, lexer->line, start_column);
+        return create_token(TOKEN_NUMBER, lexer->source + start_pos, lexer->position - start_pos);
     }
 
     if (current_char == '"') {
@@ -130,10 +215,11 @@ Token lexer_next_token(Lexer* lexer) {
             advance(lexer);
         }
         if (peek(lexer) == '\0') {
-            fprintf(stderr, "Error: Unterminated string literal at line %d, column %d\n", lexer->line, start_column);
+            SourceLocation location = lexer_location(lexer, start_pos - 1);
+            fprintf(stderr, "Error: Unterminated string literal at line %zu, column %zu\n", location.line, location.column);
             exit(1);
         }
-        Token token = create_token(TOKEN_STRING_LITERAL, lexer->source + start_pos, lexer->position - start_pos, lexer->line, start_column);
+        Token token = create_token(TOKEN_STRING_LITERAL, lexer->source + start_pos, lexer->position - start_pos);
         advance(lexer); // consume '"'
         return token;
     }
@@ -143,44 +229,45 @@ Token lexer_next_token(Lexer* lexer) {
         case '=': 
             if (peek(lexer) == '=') {
                 advance(lexer);
-                return create_token(TOKEN_EQ, "==", 2, lexer->line, start_column);
+                return create_token(TOKEN_EQ, lexer->source + start_pos, 2);
             }
-            return create_token(TOKEN_ASSIGN, "=", 1, lexer->line, start_column);
+            return create_token(TOKEN_ASSIGN, lexer->source + start_pos, 1);
         case '!':
             if (peek(lexer) == '=') {
                 advance(lexer);
-                return create_token(TOKEN_NEQ, "!=", 2, lexer->line, start_column);
+                return create_token(TOKEN_NEQ, lexer->source + start_pos, 2);
             }
             break; // Handle error or single '!' if needed
         case '<':
             if (peek(lexer) == '=') {
                 advance(lexer);
-                return create_token(TOKEN_LE, "<=", 2, lexer->line, start_column);
+                return create_token(TOKEN_LE, lexer->source + start_pos, 2);
             }
-            return create_token(TOKEN_LT, "<", 1, lexer->line, start_column);
+            return create_token(TOKEN_LT, lexer->source + start_pos, 1);
         case '>':
             if (peek(lexer) == '=') {
                 advance(lexer);
-                return create_token(TOKEN_GE, ">=", 2, lexer->line, start_column);
+                return create_token(TOKEN_GE, lexer->source + start_pos, 2);
             }
-            return create_token(TOKEN_GT, ">", 1, lexer->line, start_column);
-        case '(': return create_token(TOKEN_LPAREN, "(", 1, lexer->line, start_column);
-        case ')': return create_token(TOKEN_RPAREN, ")", 1, lexer->line, start_column);
-        case '{': return create_token(TOKEN_LBRACE, "{", 1, lexer->line, start_column);
-        case '}': return create_token(TOKEN_RBRACE, "}", 1, lexer->line, start_column);
-        case '[': return create_token(TOKEN_LBRACKET, "[", 1, lexer->line, start_column);
-        case ']': return create_token(TOKEN_RBRACKET, "]", 1, lexer->line, start_column);
-        case ',': return create_token(TOKEN_COMMA, ",", 1, lexer->line, start_column);
-        case ';': return create_token(TOKEN_SEMICOLON, ";", 1, lexer->line, start_column);
-        case '.': return create_token(TOKEN_DOT, ".", 1, lexer->line, start_column);
-        case '+': return create_token(TOKEN_PLUS, "+", 1, lexer->line, start_column);
-        case '-': return create_token(TOKEN_MINUS, "-", 1, lexer->line, start_column);
-        case '*': return create_token(TOKEN_MULTIPLY, "*", 1, lexer->line, start_column);
-        case '/': return create_token(TOKEN_DIVIDE, "/", 1, lexer->line, start_column);
-        case '%': return create_token(TOKEN_MODULO, "%", 1, lexer->line, start_column);
+            return create_token(TOKEN_GT, lexer->source + start_pos, 1);
+        case '(': return create_token(TOKEN_LPAREN, lexer->source + start_pos, 1);
+        case ')': return create_token(TOKEN_RPAREN, lexer->source + start_pos, 1);
+        case '{': return create_token(TOKEN_LBRACE, lexer->source + start_pos, 1);
+        case '}': return create_token(TOKEN_RBRACE, lexer->source + start_pos, 1);
+        case '[': return create_token(TOKEN_LBRACKET, lexer->source + start_pos, 1);
+        case ']': return create_token(TOKEN_RBRACKET, lexer->source + start_pos, 1);
+        case ',': return create_token(TOKEN_COMMA, lexer->source + start_pos, 1);
+        case ';': return create_token(TOKEN_SEMICOLON, lexer->source + start_pos, 1);
+        case '.': return create_token(TOKEN_DOT, lexer->source + start_pos, 1);
+        case '+': return create_token(TOKEN_PLUS, lexer->source + start_pos, 1);
+        case '-': return create_token(TOKEN_MINUS, lexer->source + start_pos, 1);
+        case '*': return create_token(TOKEN_MULTIPLY, lexer->source + start_pos, 1);
+        case '/': return create_token(TOKEN_DIVIDE, lexer->source + start_pos, 1);
+        case '%': return create_token(TOKEN_MODULO, lexer->source + start_pos, 1);
     }
 
-    fprintf(stderr, "Error: Unexpected character '%c' at line %d, column %d\n", current_char, lexer->line, start_column);
+    SourceLocation location = lexer_location(lexer, start_pos);
+    fprintf(stderr, "Error: Unexpected character '%c' at line %zu, column %zu\n", current_char, location.line, location.column);
     exit(1);
 }
 
@@ -1,6 +1,9 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <stddef.h>
+#include "intern.h"
+
 typedef enum {
     TOKEN_EOF = 0,
     TOKEN_IDENTIFIER,
@@ -38,25 +41,39 @@ typedef enum {
     TOKEN_MODULO,
 } TokenType;
 
+// A token is a view into the lexer's source buffer: `start` is not
+// NUL-terminated, use `length`. The source must outlive its tokens.
+// Tokens carry no line/column; `start - source` is their byte offset,
+// which lexer_location turns into a position for diagnostics.
+// Identifiers are interned as they are scanned; `symbol` is SYMBOL_NONE for
+// every other token type.
 typedef struct {
     TokenType type;
-    char* value;
-    int line;
-    int column;
+    const char* start;
+    size_t length;
+    Symbol symbol;
 } Token;
 
+typedef struct {
+    size_t line;   // 1-based
+    size_t column; // 0-based byte offset within the line
+} SourceLocation;
+
+// `source` must be NUL-terminated at source[length]; the scanners use the
+// terminator as a sentinel instead of bounds-checking every byte.
 typedef struct {
     const char* source;
-    int position;
-    int line;
-    int column;
+    size_t length;
+    size_t position;
+    size_t* line_starts; // Built on first use by lexer_location
+    size_t line_count;
     Token current_token;
 } Lexer;
 
-Lexer* lexer_new(const char* source);
+Lexer* lexer_new(const char* source, size_t length);
 void lexer_free(Lexer* lexer);
 Token lexer_next_token(Lexer* lexer);
-void token_free(Token* token);
+SourceLocation lexer_location(Lexer* lexer, size_t offset);
 
 #endif // LEXER_H
 
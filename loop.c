@@ -0,0 +1,857 @@
+#include "loop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Loops are found as natural loops: an edge to a block that dominates its
+// source is a back edge, and the loop of a header is every block that
+// reaches one of its back edges without passing through the header.
+// Dominators come from Cooper, Harvey and Kennedy's iterative algorithm.
+// Loops sharing a header are merged, and loops are optimized innermost
+// first, each in three steps:
+//
+// 1. Promotion: a global the loop stores to, and accesses only as a
+//    scalar, is loaded into a register in the preheader and stored back on
+//    every exit, so the loop's loads and stores become moves. Top-level
+//    loop counters are globals, and this keeps them in registers. Loops
+//    calling a function of the program are left alone, as it may access
+//    any global.
+// 2. Invariant code motion: a computation whose operands the loop does not
+//    change is moved to the preheader. Only instructions that cannot trap
+//    are moved, since the preheader runs even when the loop body does not.
+// 3. Rotation: a header that tests the condition and branches out of the
+//    loop is copied to the end of the preheader, as a guard, and to the end
+//    of the latch, so each iteration runs one conditional branch at its
+//    bottom instead of a jump back to a test at the top.
+//
+// New blocks are laid out next to the block they belong to when the
+// function is done, so preheaders fall through into their loops.
+
+#define NO_LOOP UINT32_MAX
+#define NO_BLOCK UINT32_MAX
+
+// Rotation leaves two copies of the header, so only small ones qualify.
+#define ROTATE_MAX_INSTRUCTIONS 16
+
+// How the loop being optimized accesses a global.
+#define ACCESS_LOAD 1
+#define ACCESS_STORE 2
+#define ACCESS_LOAD_ELEM 4
+#define ACCESS_STORE_ELEM 8
+
+typedef struct {
+    uint32_t header;
+    uint32_t* blocks; // Ascending, then blocks added by inner loops
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t parent;  // Innermost enclosing loop, or NO_LOOP
+} Loop;
+
+static void* allocate(size_t count, size_t size) {
+    void* memory = calloc(count ? count : 1, size);
+    if (!memory) {
+        fprintf(stderr, "Error: Out of memory optimizing loops\n");
+        exit(1);
+    }
+    return memory;
+}
+
+// Resizes an array from `old_count` to `new_count` elements, zeroing the
+// new ones.
+static void* resize(void* array, uint32_t old_count, uint32_t new_count, size_t size) {
+    char* resized = (char*)realloc(array, (new_count ? new_count : 1) * size);
+    if (!resized) {
+        fprintf(stderr, "Error: Out of memory optimizing loops\n");
+        exit(1);
+    }
+    if (new_count > old_count) memset(resized + old_count * size, 0, (new_count - old_count) * size);
+    return resized;
+}
+
+static IrProgram* program;
+static IrFunction* function;
+static LoopStats* stats;
+
+static Loop* loops;
+static uint32_t loop_count;
+static uint32_t stamp;
+
+// Per block. The placement lists hold block + 1, with 0 ending them.
+static uint32_t block_capacity;
+static uint32_t* in_loop;       // Stamp of the loop being optimized if the block is in it
+static uint32_t* exit_mark;     // Stamp if already listed as an exit of that loop
+static uint8_t* dead;           // Header left unreachable by rotation
+static uint32_t* placed_before; // New blocks to lay out before this one
+static uint32_t* placed_after;  // New blocks to lay out after this one
+static uint32_t* next_placed;
+
+// Per register
+static uint32_t reg_capacity;
+static uint32_t* use_counts;
+static uint32_t* def_counts;
+static uint32_t* defined_in_loop; // Stamp if the loop being optimized defines it
+
+// Per global
+static uint32_t* global_stamp;
+static uint8_t* global_access; // ACCESS_* bits, valid if global_stamp is current
+static uint32_t* touched;      // Globals the loop being optimized accesses
+static uint32_t touched_count;
+
+// Blocks where a promoted global is stored back.
+static uint32_t* exits;
+static uint32_t exit_count;
+static uint32_t exit_capacity;
+
+static void grow_block_arrays(void) {
+    if (function->block_count <= block_capacity) return;
+    uint32_t capacity = block_capacity ? block_capacity : 64;
+    while (capacity < function->block_count) capacity *= 2;
+    in_loop = (uint32_t*)resize(in_loop, block_capacity, capacity, sizeof(uint32_t));
+    exit_mark = (uint32_t*)resize(exit_mark, block_capacity, capacity, sizeof(uint32_t));
+    dead = (uint8_t*)resize(dead, block_capacity, capacity, sizeof(uint8_t));
+    placed_before = (uint32_t*)resize(placed_before, block_capacity, capacity, sizeof(uint32_t));
+    placed_after = (uint32_t*)resize(placed_after, block_capacity, capacity, sizeof(uint32_t));
+    next_placed = (uint32_t*)resize(next_placed, block_capacity, capacity, sizeof(uint32_t));
+    block_capacity = capacity;
+}
+
+static void grow_reg_arrays(void) {
+    if (function->reg_count <= reg_capacity) return;
+    uint32_t capacity = reg_capacity ? reg_capacity : 64;
+    while (capacity < function->reg_count) capacity *= 2;
+    use_counts = (uint32_t*)resize(use_counts, reg_capacity, capacity, sizeof(uint32_t));
+    def_counts = (uint32_t*)resize(def_counts, reg_capacity, capacity, sizeof(uint32_t));
+    defined_in_loop = (uint32_t*)resize(defined_in_loop, reg_capacity, capacity, sizeof(uint32_t));
+    reg_capacity = capacity;
+}
+
+static uint32_t add_block(void) {
+    uint32_t block = ir_add_block(function);
+    grow_block_arrays();
+    return block;
+}
+
+static IrReg add_reg(void) {
+    IrReg reg = ir_new_reg(function, IR_TYPE_I64);
+    grow_reg_arrays();
+    return reg;
+}
+
+static uint32_t global_id(Symbol name) {
+    return (uint32_t)(ir_find_global(program, name) - program->globals);
+}
+
+static void count_use(IrReg reg, void* context) {
+    use_counts[reg] += *(const int*)context;
+}
+
+static void count_instr(const IrInstr* instr, int delta) {
+    ir_for_each_use(function, instr, count_use, &delta);
+    if (ir_has_dst((IrOp)instr->op) && instr->dst != IR_NO_REG) def_counts[instr->dst] += delta;
+}
+
+static uint32_t replace_operand(IrOperand* operand, IrReg from, IrReg to) {
+    if (operand->kind != IR_OPERAND_REG || operand->value != from) return 0;
+    operand->value = to;
+    return 1;
+}
+
+// Replaces reads of `from` by `to` if `to` is not IR_NO_REG; returns how
+// many reads of `from` there are.
+static uint32_t replace_uses(IrInstr* instr, IrReg from, IrReg to) {
+    IrReg target = to != IR_NO_REG ? to : from;
+    uint32_t count = replace_operand(&instr->a, from, target) + replace_operand(&instr->b, from, target);
+    if (instr->op == IR_CALL) {
+        for (uint32_t i = 0; i < instr->other; i++) {
+            count += replace_operand(&function->args[instr->target + i], from, target);
+        }
+    }
+    return count;
+}
+
+static int writes(const IrInstr* instr, IrReg reg) {
+    return ir_has_dst((IrOp)instr->op) && instr->dst == reg;
+}
+
+static void add_pred(uint32_t b, uint32_t pred) {
+    IrBlock* block = &function->blocks[b];
+    block->preds = (uint32_t*)resize(block->preds, block->pred_count, block->pred_count + 1, sizeof(uint32_t));
+    block->preds[block->pred_count++] = pred;
+}
+
+static void remove_pred(uint32_t b, uint32_t pred) {
+    IrBlock* block = &function->blocks[b];
+    for (uint32_t i = 0; i < block->pred_count; i++) {
+        if (block->preds[i] == pred) {
+            block->preds[i] = block->preds[--block->pred_count];
+            return;
+        }
+    }
+}
+
+// Makes the edges from `from` to `old_target` lead to `new_target`.
+static void redirect(uint32_t from, uint32_t old_target, uint32_t new_target) {
+    IrBlock* block = &function->blocks[from];
+    uint32_t succs[2];
+    uint32_t count = ir_successors(block, succs);
+    for (uint32_t s = 0; s < count; s++) remove_pred(succs[s], from);
+    IrInstr* last = &block->instrs[block->count - 1];
+    if (last->target == old_target) last->target = new_target;
+    if (last->op == IR_BRANCH && last->other == old_target) last->other = new_target;
+    count = ir_successors(block, succs);
+    for (uint32_t s = 0; s < count; s++) add_pred(succs[s], from);
+}
+
+static IrInstr* insert_before_terminator(uint32_t b, const IrInstr* instr) {
+    ir_append(function, b, (IrOp)instr->op);
+    IrBlock* block = &function->blocks[b];
+    block->instrs[block->count - 1] = block->instrs[block->count - 2];
+    block->instrs[block->count - 2] = *instr;
+    count_instr(instr, 1);
+    return &block->instrs[block->count - 2];
+}
+
+static void insert_at_start(uint32_t b, const IrInstr* instr) {
+    ir_append(function, b, (IrOp)instr->op);
+    IrBlock* block = &function->blocks[b];
+    memmove(block->instrs + 1, block->instrs, (block->count - 1) * sizeof(IrInstr));
+    block->instrs[0] = *instr;
+    count_instr(instr, 1);
+}
+
+static void place(uint32_t* list, uint32_t anchor, uint32_t block) {
+    next_placed[block] = list[anchor];
+    list[anchor] = block + 1;
+}
+
+static void add_to_loop(uint32_t l, uint32_t block) {
+    Loop* loop = &loops[l];
+    if (loop->count == loop->capacity) {
+        uint32_t capacity = loop->capacity ? loop->capacity * 2 : 8;
+        loop->blocks = (uint32_t*)resize(loop->blocks, loop->capacity, capacity, sizeof(uint32_t));
+        loop->capacity = capacity;
+    }
+    loop->blocks[loop->count++] = block;
+}
+
+static int loop_contains(uint32_t l, uint32_t block) {
+    for (uint32_t i = 0; i < loops[l].count; i++) {
+        if (loops[l].blocks[i] == block) return 1;
+    }
+    return 0;
+}
+
+static int compare_blocks(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_edges(const void* a, const void* b) {
+    return compare_blocks((const uint32_t*)a + 1, (const uint32_t*)b + 1);
+}
+
+static int compare_loop_sizes(const void* a, const void* b) {
+    const Loop* x = (const Loop*)a;
+    const Loop* y = (const Loop*)b;
+    if (x->count != y->count) return x->count < y->count ? -1 : 1;
+    return compare_blocks(&x->header, &y->header);
+}
+
+static uint32_t intersect(const uint32_t* idom, const uint32_t* number, uint32_t a, uint32_t b) {
+    while (a != b) {
+        while (number[a] > number[b]) a = idom[a];
+        while (number[b] > number[a]) b = idom[b];
+    }
+    return a;
+}
+
+static void find_loops(void) {
+    uint32_t n = function->block_count;
+    uint32_t* order = (uint32_t*)allocate(n, sizeof(uint32_t));  // Reverse postorder
+    uint32_t* number = (uint32_t*)allocate(n, sizeof(uint32_t)); // Position in it + 1, 0 if unreachable
+    uint32_t* idom = (uint32_t*)allocate(n, sizeof(uint32_t));
+    uint32_t* stack = (uint32_t*)allocate(n, sizeof(uint32_t));
+    uint8_t* next_succ = (uint8_t*)allocate(n, sizeof(uint8_t));
+    uint32_t reached = 0;
+
+    uint32_t depth = 0;
+    stack[depth++] = 0;
+    number[0] = 1;
+    while (depth) {
+        uint32_t b = stack[depth - 1];
+        uint32_t succs[2];
+        uint32_t count = ir_successors(&function->blocks[b], succs);
+        if (next_succ[b] < count) {
+            uint32_t s = succs[next_succ[b]++];
+            if (!number[s]) {
+                number[s] = 1;
+                stack[depth++] = s;
+            }
+            continue;
+        }
+        depth--;
+        order[reached++] = b;
+    }
+    for (uint32_t i = 0; i < reached / 2; i++) {
+        uint32_t swap = order[i];
+        order[i] = order[reached - 1 - i];
+        order[reached - 1 - i] = swap;
+    }
+    for (uint32_t i = 0; i < reached; i++) number[order[i]] = i + 1;
+
+    for (uint32_t b = 0; b < n; b++) idom[b] = NO_BLOCK;
+    idom[0] = 0;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (uint32_t i = 1; i < reached; i++) {
+            uint32_t b = order[i];
+            const IrBlock* block = &function->blocks[b];
+            uint32_t dominator = NO_BLOCK;
+            for (uint32_t p = 0; p < block->pred_count; p++) {
+                uint32_t pred = block->preds[p];
+                if (!number[pred] || idom[pred] == NO_BLOCK) continue;
+                dominator = dominator == NO_BLOCK ? pred : intersect(idom, number, pred, dominator);
+            }
+            if (idom[b] != dominator) {
+                idom[b] = dominator;
+                changed = 1;
+            }
+        }
+    }
+
+    // Numbering the dominator tree in depth-first order makes dominance a
+    // range check: a dominates b if b's interval lies within a's.
+    uint32_t* first_child = (uint32_t*)allocate(n, sizeof(uint32_t)); // Block + 1, or 0
+    uint32_t* next_sibling = (uint32_t*)allocate(n, sizeof(uint32_t));
+    uint32_t* enter = (uint32_t*)allocate(n, sizeof(uint32_t));
+    uint32_t* leave = (uint32_t*)allocate(n, sizeof(uint32_t));
+    for (uint32_t i = reached; i-- > 1;) {
+        uint32_t b = order[i];
+        next_sibling[b] = first_child[idom[b]];
+        first_child[idom[b]] = b + 1;
+    }
+    uint32_t clock = 0;
+    depth = 0;
+    stack[depth++] = 0;
+    enter[0] = clock++;
+    while (depth) {
+        uint32_t b = stack[depth - 1];
+        if (first_child[b]) {
+            uint32_t child = first_child[b] - 1;
+            first_child[b] = next_sibling[child];
+            enter[child] = clock++;
+            stack[depth++] = child;
+        } else {
+            leave[b] = clock++;
+            depth--;
+        }
+    }
+
+    // Back edges as (latch, header) pairs, grouped by header.
+    uint32_t* edges = NULL;
+    uint32_t edge_count = 0;
+    uint32_t edge_capacity = 0;
+    for (uint32_t i = 0; i < reached; i++) {
+        uint32_t b = order[i];
+        uint32_t succs[2];
+        uint32_t count = ir_successors(&function->blocks[b], succs);
+        for (uint32_t s = 0; s < count; s++) {
+            uint32_t h = succs[s];
+            if (enter[h] > enter[b] || leave[b] > leave[h]) continue;
+            if (edge_count == edge_capacity) {
+                uint32_t capacity = edge_capacity ? edge_capacity * 2 : 16;
+                edges = (uint32_t*)resize(edges, 2 * edge_capacity, 2 * capacity, sizeof(uint32_t));
+                edge_capacity = capacity;
+            }
+            edges[2 * edge_count] = b;
+            edges[2 * edge_count + 1] = h;
+            edge_count++;
+        }
+    }
+    if (edge_count) qsort(edges, edge_count, 2 * sizeof(uint32_t), compare_edges);
+
+    loops = (Loop*)allocate(edge_count, sizeof(Loop));
+    loop_count = 0;
+    for (uint32_t e = 0; e < edge_count;) {
+        uint32_t header = edges[2 * e + 1];
+        Loop* loop = &loops[loop_count++];
+        loop->header = header;
+        loop->parent = NO_LOOP;
+        stamp++;
+        in_loop[header] = stamp;
+        add_to_loop((uint32_t)(loop - loops), header);
+        depth = 0;
+        for (; e < edge_count && edges[2 * e + 1] == header; e++) {
+            uint32_t latch = edges[2 * e];
+            if (in_loop[latch] == stamp) continue;
+            in_loop[latch] = stamp;
+            stack[depth++] = latch;
+        }
+        while (depth) {
+            uint32_t b = stack[--depth];
+            add_to_loop((uint32_t)(loop - loops), b);
+            const IrBlock* block = &function->blocks[b];
+            for (uint32_t p = 0; p < block->pred_count; p++) {
+                uint32_t pred = block->preds[p];
+                if (!number[pred] || in_loop[pred] == stamp) continue;
+                in_loop[pred] = stamp;
+                stack[depth++] = pred;
+            }
+        }
+        qsort(loop->blocks, loop->count, sizeof(uint32_t), compare_blocks);
+    }
+
+    // Smaller loops first; a loop's parent is the smallest one containing
+    // it. Each block remembers the innermost loop seen so far, and the
+    // outermost ancestor of that loop is contained in the current one.
+    qsort(loops, loop_count, sizeof(Loop), compare_loop_sizes);
+    uint32_t* innermost = (uint32_t*)allocate(n, sizeof(uint32_t)); // Loop + 1, or 0
+    for (uint32_t l = 0; l < loop_count; l++) {
+        for (uint32_t i = 0; i < loops[l].count; i++) {
+            uint32_t b = loops[l].blocks[i];
+            if (!innermost[b]) {
+                innermost[b] = l + 1;
+                continue;
+            }
+            uint32_t outer = innermost[b] - 1;
+            while (loops[outer].parent != NO_LOOP) outer = loops[outer].parent;
+            if (outer != l) loops[outer].parent = l;
+        }
+    }
+
+    free(order);
+    free(number);
+    free(idom);
+    free(stack);
+    free(next_succ);
+    free(first_child);
+    free(next_sibling);
+    free(enter);
+    free(leave);
+    free(edges);
+    free(innermost);
+}
+
+// Returns the block that enters the loop, creating one if the header has
+// several predecessors outside the loop or the one it has may branch
+// elsewhere. NO_BLOCK if the loop cannot have one.
+static uint32_t make_preheader(uint32_t l) {
+    uint32_t header = loops[l].header;
+    if (header == 0) return NO_BLOCK; // Would have to become the entry block
+    const IrBlock* block = &function->blocks[header];
+    uint32_t* outside = (uint32_t*)allocate(block->pred_count, sizeof(uint32_t));
+    uint32_t outside_count = 0;
+    for (uint32_t p = 0; p < block->pred_count; p++) {
+        if (in_loop[block->preds[p]] != stamp) outside[outside_count++] = block->preds[p];
+    }
+    uint32_t preheader = NO_BLOCK;
+    if (outside_count == 1) {
+        const IrBlock* pred = &function->blocks[outside[0]];
+        if (pred->instrs[pred->count - 1].op == IR_JUMP) preheader = outside[0];
+    }
+    if (outside_count && preheader == NO_BLOCK) {
+        preheader = add_block();
+        ir_append(function, preheader, IR_JUMP)->target = header;
+        add_pred(header, preheader);
+        for (uint32_t p = 0; p < outside_count; p++) redirect(outside[p], header, preheader);
+        place(placed_before, header, preheader);
+        for (uint32_t outer = loops[l].parent; outer != NO_LOOP; outer = loops[outer].parent) {
+            add_to_loop(outer, preheader);
+        }
+    }
+    free(outside);
+    return preheader;
+}
+
+// Records what the loop defines and which globals it accesses how;
+// returns whether it calls a function of the program.
+static int scan_loop(uint32_t l) {
+    int calls = 0;
+    touched_count = 0;
+    for (uint32_t i = 0; i < loops[l].count; i++) {
+        const IrBlock* block = &function->blocks[loops[l].blocks[i]];
+        for (uint32_t k = 0; k < block->count; k++) {
+            const IrInstr* instr = &block->instrs[k];
+            if (ir_has_dst((IrOp)instr->op)) defined_in_loop[instr->dst] = stamp;
+            uint8_t access = 0;
+            switch (instr->op) {
+                case IR_LOAD: access = ACCESS_LOAD; break;
+                case IR_STORE: access = ACCESS_STORE; break;
+                case IR_LOAD_ELEM: access = ACCESS_LOAD_ELEM; break;
+                case IR_STORE_ELEM: access = ACCESS_STORE_ELEM; break;
+                case IR_CALL:
+                    if (ir_find_function(program, instr->symbol)) calls = 1;
+                    break;
+                default:
+                    break;
+            }
+            if (!access) continue;
+            uint32_t global = global_id(instr->symbol);
+            if (global_stamp[global] != stamp) {
+                global_stamp[global] = stamp;
+                global_access[global] = 0;
+                touched[touched_count++] = global;
+            }
+            global_access[global] |= access;
+        }
+    }
+    return calls;
+}
+
+static void add_exit(uint32_t block) {
+    if (exit_count == exit_capacity) {
+        uint32_t capacity = exit_capacity ? exit_capacity * 2 : 16;
+        exits = (uint32_t*)resize(exits, exit_capacity, capacity, sizeof(uint32_t));
+        exit_capacity = capacity;
+    }
+    exits[exit_count++] = block;
+}
+
+// Lists where values leaving the loop are stored back: blocks returning
+// from inside it, and the targets of its exit edges. An exit target that
+// can also be reached from outside the loop gets a block of its own on
+// the exit edge.
+static void find_exits(uint32_t l) {
+    exit_count = 0;
+    for (uint32_t i = 0; i < loops[l].count; i++) {
+        uint32_t b = loops[l].blocks[i];
+        const IrBlock* block = &function->blocks[b];
+        if (!block->count) continue;
+        if (block->instrs[block->count - 1].op == IR_RET) {
+            add_exit(b);
+            continue;
+        }
+        uint32_t succs[2];
+        uint32_t count = ir_successors(block, succs);
+        for (uint32_t s = 0; s < count; s++) {
+            uint32_t target = succs[s];
+            if (in_loop[target] == stamp || exit_mark[target] == stamp) continue;
+            const IrBlock* exit = &function->blocks[target];
+            int dedicated = 1;
+            for (uint32_t p = 0; p < exit->pred_count && dedicated; p++) {
+                dedicated = in_loop[exit->preds[p]] == stamp;
+            }
+            if (dedicated) {
+                exit_mark[target] = stamp;
+                add_exit(target);
+                continue;
+            }
+            uint32_t edge = add_block();
+            ir_append(function, edge, IR_JUMP)->target = target;
+            add_pred(target, edge);
+            redirect(b, target, edge);
+            place(placed_after, b, edge);
+            for (uint32_t outer = loops[l].parent; outer != NO_LOOP; outer = loops[outer].parent) {
+                if (loop_contains(outer, target)) add_to_loop(outer, edge);
+            }
+            exit_mark[edge] = stamp;
+            add_exit(edge);
+        }
+    }
+}
+
+// Cleans up the moves promotion leaves: a copy of `reg` read later in the
+// same block is replaced by `reg` itself, and a value computed only to be
+// moved into `reg` is computed into it directly.
+static void coalesce(uint32_t l, IrReg reg) {
+    for (uint32_t i = 0; i < loops[l].count; i++) {
+        IrBlock* block = &function->blocks[loops[l].blocks[i]];
+        uint32_t kept = 0;
+        for (uint32_t k = 0; k < block->count; k++) {
+            IrInstr instr = block->instrs[k];
+            IrReg copy = instr.dst;
+            if (instr.op == IR_MOV && instr.a.kind == IR_OPERAND_REG && (IrReg)instr.a.value == reg && copy != reg &&
+                def_counts[copy] == 1 && use_counts[copy]) {
+                // Every read of the copy must follow in this block, before
+                // `reg` changes.
+                uint32_t seen = 0;
+                uint32_t last = k;
+                for (uint32_t j = k + 1; j < block->count && seen < use_counts[copy]; j++) {
+                    uint32_t reads = replace_uses(&block->instrs[j], copy, IR_NO_REG);
+                    seen += reads;
+                    if (reads) last = j;
+                    if (seen < use_counts[copy] && writes(&block->instrs[j], reg)) break;
+                }
+                if (seen == use_counts[copy]) {
+                    for (uint32_t j = k + 1; j <= last; j++) replace_uses(&block->instrs[j], copy, reg);
+                    use_counts[reg] += seen;
+                    use_counts[copy] = 0;
+                    count_instr(&instr, -1);
+                    continue;
+                }
+            }
+            if (instr.op == IR_MOV && instr.dst == reg && instr.a.kind == IR_OPERAND_REG) {
+                IrReg value = (IrReg)instr.a.value;
+                if (value != reg && def_counts[value] == 1 && use_counts[value] == 1) {
+                    uint32_t j = kept;
+                    while (j-- > 0) {
+                        IrInstr* earlier = &block->instrs[j];
+                        if (writes(earlier, value) || writes(earlier, reg) || replace_uses(earlier, reg, IR_NO_REG)) break;
+                    }
+                    if (j < kept && writes(&block->instrs[j], value) && block->instrs[j].op != IR_PARAM) {
+                        block->instrs[j].dst = reg;
+                        block->instrs[j].type = IR_TYPE_I64;
+                        def_counts[value] = 0;
+                        use_counts[value] = 0;
+                        continue;
+                    }
+                }
+            }
+            block->instrs[kept++] = instr;
+        }
+        block->count = kept;
+    }
+}
+
+static void promote_globals(uint32_t l, uint32_t preheader) {
+    int found_exits = 0;
+    for (uint32_t t = 0; t < touched_count; t++) {
+        uint32_t global = touched[t];
+        if (!(global_access[global] & ACCESS_STORE) || (global_access[global] & (ACCESS_LOAD_ELEM | ACCESS_STORE_ELEM))) {
+            continue;
+        }
+        if (!found_exits) {
+            find_exits(l);
+            found_exits = 1;
+        }
+        Symbol name = program->globals[global].name;
+        IrReg reg = add_reg();
+        defined_in_loop[reg] = stamp;
+        IrInstr load = { IR_LOAD, IR_TYPE_I64, reg, { IR_OPERAND_NONE, 0 }, { IR_OPERAND_NONE, 0 }, name, 0, 0 };
+        insert_before_terminator(preheader, &load);
+        for (uint32_t i = 0; i < loops[l].count; i++) {
+            IrBlock* block = &function->blocks[loops[l].blocks[i]];
+            for (uint32_t k = 0; k < block->count; k++) {
+                IrInstr* instr = &block->instrs[k];
+                if ((instr->op != IR_LOAD && instr->op != IR_STORE) || instr->symbol != name) continue;
+                count_instr(instr, -1);
+                if (instr->op == IR_LOAD) {
+                    instr->a = ir_reg(reg);
+                } else {
+                    instr->dst = reg;
+                    instr->type = IR_TYPE_I64;
+                }
+                instr->op = IR_MOV;
+                instr->symbol = SYMBOL_NONE;
+                count_instr(instr, 1);
+            }
+        }
+        IrInstr store = { IR_STORE, IR_TYPE_VOID, IR_NO_REG, { IR_OPERAND_REG, reg }, { IR_OPERAND_NONE, 0 }, name, 0, 0 };
+        for (uint32_t e = 0; e < exit_count; e++) {
+            const IrBlock* exit = &function->blocks[exits[e]];
+            if (exit->instrs[exit->count - 1].op == IR_RET && in_loop[exits[e]] == stamp) {
+                insert_before_terminator(exits[e], &store);
+            } else {
+                insert_at_start(exits[e], &store);
+            }
+        }
+        coalesce(l, reg);
+        stats->promoted++;
+    }
+}
+
+static int is_invariant(const IrInstr* instr, int calls) {
+    switch (instr->op) {
+        case IR_DIV:
+        case IR_MOD:
+            // Moving a division that may trap could make it trap when the
+            // loop would not have run it.
+            if (instr->b.kind != IR_OPERAND_IMM || instr->b.value == 0 || instr->b.value == -1) return 0;
+            break;
+        case IR_LOAD: {
+            if (calls) return 0;
+            uint32_t global = global_id(instr->symbol);
+            if (global_access[global] & (ACCESS_STORE | ACCESS_STORE_ELEM)) return 0;
+            break;
+        }
+        case IR_ADDR:
+        case IR_MOV:
+            break;
+        default:
+            if (instr->op > IR_MOD) return 0;
+            break;
+    }
+    if (def_counts[instr->dst] != 1) return 0;
+    if (instr->a.kind == IR_OPERAND_REG && defined_in_loop[instr->a.value] == stamp) return 0;
+    if (instr->b.kind == IR_OPERAND_REG && defined_in_loop[instr->b.value] == stamp) return 0;
+    return 1;
+}
+
+static void hoist_invariants(uint32_t l, uint32_t preheader, int calls) {
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (uint32_t i = 0; i < loops[l].count; i++) {
+            uint32_t b = loops[l].blocks[i];
+            uint32_t kept = 0;
+            for (uint32_t k = 0; k < function->blocks[b].count; k++) {
+                IrInstr instr = function->blocks[b].instrs[k];
+                if (is_invariant(&instr, calls)) {
+                    count_instr(&instr, -1);
+                    insert_before_terminator(preheader, &instr);
+                    defined_in_loop[instr.dst] = 0;
+                    stats->hoisted++;
+                    changed = 1;
+                    continue;
+                }
+                function->blocks[b].instrs[kept++] = instr;
+            }
+            function->blocks[b].count = kept;
+        }
+    }
+}
+
+// Replaces the jump ending `block` by a copy of the header. Registers only
+// used within the header get fresh ones in the copy.
+static void copy_header(uint32_t header, uint32_t block, const IrReg* local, uint32_t local_count) {
+    IrReg* fresh = (IrReg*)allocate(local_count, sizeof(IrReg));
+    for (uint32_t r = 0; r < local_count; r++) fresh[r] = add_reg();
+    function->blocks[block].count--;
+    remove_pred(header, block);
+    for (uint32_t k = 0; k < function->blocks[header].count; k++) {
+        IrInstr copy = function->blocks[header].instrs[k];
+        for (uint32_t r = 0; r < local_count; r++) {
+            if (writes(&copy, local[r])) copy.dst = fresh[r];
+            replace_operand(&copy.a, local[r], fresh[r]);
+            replace_operand(&copy.b, local[r], fresh[r]);
+        }
+        if (copy.op == IR_CALL) {
+            uint32_t first_arg = function->arg_count;
+            for (uint32_t a = 0; a < copy.other; a++) {
+                IrOperand arg = function->args[copy.target + a];
+                for (uint32_t r = 0; r < local_count; r++) replace_operand(&arg, local[r], fresh[r]);
+                ir_add_arg(function, arg);
+            }
+            copy.target = first_arg;
+        }
+        *ir_append(function, block, (IrOp)copy.op) = copy;
+        count_instr(&copy, 1);
+    }
+    uint32_t succs[2];
+    uint32_t count = ir_successors(&function->blocks[block], succs);
+    for (uint32_t s = 0; s < count; s++) add_pred(succs[s], block);
+    free(fresh);
+}
+
+static void rotate_loop(uint32_t l, uint32_t preheader) {
+    uint32_t header = loops[l].header;
+    const IrBlock* block = &function->blocks[header];
+    if (block->count > ROTATE_MAX_INSTRUCTIONS) return;
+    const IrInstr* last = &block->instrs[block->count - 1];
+    if (last->op != IR_BRANCH || (in_loop[last->target] == stamp) == (in_loop[last->other] == stamp)) return;
+    uint32_t latch = NO_BLOCK;
+    for (uint32_t p = 0; p < block->pred_count; p++) {
+        if (in_loop[block->preds[p]] != stamp) continue;
+        if (latch != NO_BLOCK) return;
+        latch = block->preds[p];
+    }
+    if (latch == NO_BLOCK || latch == header) return;
+    const IrBlock* latch_block = &function->blocks[latch];
+    if (latch_block->instrs[latch_block->count - 1].op != IR_JUMP) return;
+
+    IrReg* local = (IrReg*)allocate(block->count, sizeof(IrReg));
+    uint32_t local_count = 0;
+    for (uint32_t k = 0; k < block->count; k++) {
+        IrReg reg = block->instrs[k].dst;
+        if (!ir_has_dst((IrOp)block->instrs[k].op) || def_counts[reg] != 1) continue;
+        uint32_t reads = 0;
+        for (uint32_t j = 0; j < block->count; j++) reads += replace_uses(&block->instrs[j], reg, IR_NO_REG);
+        if (reads == use_counts[reg]) local[local_count++] = reg;
+    }
+    copy_header(header, preheader, local, local_count);
+    copy_header(header, latch, local, local_count);
+    free(local);
+
+    IrBlock* removed = &function->blocks[header];
+    uint32_t succs[2];
+    uint32_t count = ir_successors(removed, succs);
+    for (uint32_t s = 0; s < count; s++) remove_pred(succs[s], header);
+    for (uint32_t k = 0; k < removed->count; k++) count_instr(&removed->instrs[k], -1);
+    removed->count = 0;
+    removed->pred_count = 0;
+    dead[header] = 1;
+    stats->rotated++;
+}
+
+static void lay_out(uint32_t block, uint32_t* order, uint32_t* count) {
+    for (uint32_t b = placed_before[block]; b; b = next_placed[b - 1]) lay_out(b - 1, order, count);
+    if (!dead[block]) order[(*count)++] = block;
+    for (uint32_t b = placed_after[block]; b; b = next_placed[b - 1]) lay_out(b - 1, order, count);
+}
+
+static void optimize_function(void) {
+    block_capacity = 0;
+    reg_capacity = 0;
+    grow_block_arrays();
+    find_loops();
+    if (loop_count) {
+        grow_reg_arrays();
+        for (uint32_t b = 0; b < function->block_count; b++) {
+            const IrBlock* block = &function->blocks[b];
+            for (uint32_t i = 0; i < block->count; i++) count_instr(&block->instrs[i], 1);
+        }
+        uint32_t original_count = function->block_count;
+        for (uint32_t l = 0; l < loop_count; l++) {
+            stamp++;
+            for (uint32_t i = 0; i < loops[l].count; i++) in_loop[loops[l].blocks[i]] = stamp;
+            uint32_t preheader = make_preheader(l);
+            if (preheader == NO_BLOCK) continue;
+            stats->loops++;
+            int calls = scan_loop(l);
+            if (!calls) promote_globals(l, preheader);
+            hoist_invariants(l, preheader, calls);
+            rotate_loop(l, preheader);
+        }
+        uint32_t dead_count = 0;
+        for (uint32_t b = 0; b < function->block_count; b++) dead_count += dead[b];
+        if (dead_count || function->block_count != original_count) {
+            uint32_t* order = (uint32_t*)allocate(function->block_count, sizeof(uint32_t));
+            uint32_t count = 0;
+            for (uint32_t b = 0; b < original_count; b++) lay_out(b, order, &count);
+            ir_reorder_blocks(function, order, count);
+            free(order);
+        }
+    }
+    for (uint32_t l = 0; l < loop_count; l++) free(loops[l].blocks);
+    free(loops);
+    free(in_loop);
+    free(exit_mark);
+    free(dead);
+    free(placed_before);
+    free(placed_after);
+    free(next_placed);
+    free(use_counts);
+    free(def_counts);
+    free(defined_in_loop);
+    loops = NULL;
+    in_loop = exit_mark = placed_before = placed_after = next_placed = NULL;
+    dead = NULL;
+    use_counts = def_counts = defined_in_loop = NULL;
+}
+
+void optimize_loops(IrProgram* ir, LoopStats* loop_stats) {
+    program = ir;
+    stats = loop_stats;
+    global_stamp = (uint32_t*)allocate(program->global_count, sizeof(uint32_t));
+    global_access = (uint8_t*)allocate(program->global_count, sizeof(uint8_t));
+    touched = (uint32_t*)allocate(program->global_count, sizeof(uint32_t));
+    stamp = 0;
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        function = &program->functions[f];
+        if (function->block_count > 1) optimize_function();
+    }
+    free(global_stamp);
+    free(global_access);
+    free(touched);
+    free(exits);
+    global_stamp = NULL;
+    global_access = NULL;
+    touched = NULL;
+    exits = NULL;
+    exit_count = 0;
+    exit_capacity = 0;
+    function = NULL;
+    program = NULL;
+}
@@ -0,0 +1,21 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdint.h>
+#include "ir.h"
+
+typedef struct {
+    uint32_t loops;
+    uint32_t hoisted;  // Loop-invariant instructions moved to a preheader
+    uint32_t promoted; // Globals kept in a register through a loop
+    uint32_t rotated;
+} LoopStats;
+
+// Optimizes the natural loops of every function, innermost first. Each
+// loop gets a preheader; globals the loop stores to are kept in registers
+// while it runs, loop-invariant computations are moved to the preheader,
+// and the loop is rotated so its condition is tested at the bottom. Adds
+// the counts to `stats`.
+void optimize_loops(IrProgram* program, LoopStats* stats);
+
+#endif // LOOP_H
@@ -0,0 +1,504 @@
+#include "lower.h"
+#include "fold.h"
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// State of the function being lowered; set by lower_function_body.
+static const AST* ast;
+static IrProgram* program;
+static IrFunction* function;
+static uint32_t current_block;
+
+// Inside functions, parameters and scalar variables are registers. The
+// bindings in scope are kept in a table indexed by Symbol and cleared per
+// function. Names used as arrays anywhere in the program stay globals.
+static IrReg* local_regs;       // Symbol -> register, or IR_NO_REG
+static uint32_t local_capacity;
+static Symbol* bound;           // Symbols with a binding, to clear them
+static uint32_t bound_count;
+static uint8_t* indexed;        // Symbol -> used as an array
+static uint32_t indexed_size;
+static uint8_t* declared;       // Symbol -> declared as a function
+static uint32_t declared_size;
+// Set while lowering an expression that assigns to a variable inside it;
+// reads of locals are then copied so they see the value at that point.
+static int copy_local_reads;
+
+static IrOperand lower_expression(NodeIndex node);
+static void lower_statement(NodeIndex node);
+
+// Appends to the current block. Code following a return is unreachable but
+// still lowered, into a fresh block with no predecessors.
+static IrInstr* append(IrOp op) {
+    if (ir_block_terminated(&function->blocks[current_block])) {
+        current_block = ir_add_block(function);
+    }
+    return ir_append(function, current_block, op);
+}
+
+static IrReg append_value(IrOp op, IrType type, IrInstr** instr) {
+    IrReg dst = ir_new_reg(function, type);
+    *instr = append(op);
+    (*instr)->dst = dst;
+    (*instr)->type = (uint8_t)type;
+    return dst;
+}
+
+static void append_jump(uint32_t target) {
+    append(IR_JUMP)->target = target;
+}
+
+// Ends the current block with a branch on `condition` and continues in
+// neither successor; the caller switches to the block it fills next.
+static void append_branch(IrOperand condition, uint32_t if_true, uint32_t if_false) {
+    IrInstr* instr = append(IR_BRANCH);
+    instr->a = condition;
+    instr->target = if_true;
+    instr->other = if_false;
+}
+
+static Symbol identifier_symbol(NodeIndex node) {
+    if (ast_kind(ast, node) != NODE_IDENTIFIER) {
+        fprintf(stderr, "Error: Expected an identifier, found node type %d\n", ast_kind(ast, node));
+        exit(1);
+    }
+    return ast_lhs(ast, node);
+}
+
+static IrReg local_reg(Symbol name) {
+    return name < local_capacity ? local_regs[name] : IR_NO_REG;
+}
+
+static int is_indexed(Symbol name) {
+    return name < indexed_size && indexed[name];
+}
+
+static int is_function(Symbol name) {
+    return name < declared_size && declared[name];
+}
+
+// Sets table[name], growing the table to cover it.
+static void mark_symbol(uint8_t** table, uint32_t* table_size, Symbol name) {
+    if (name >= *table_size) {
+        uint32_t size = *table_size ? *table_size : 64;
+        while (size <= name) size *= 2;
+        *table = (uint8_t*)realloc(*table, size);
+        if (!*table) {
+            fprintf(stderr, "Error: Out of memory lowering the program\n");
+            exit(1);
+        }
+        memset(*table + *table_size, 0, size - *table_size);
+        *table_size = size;
+    }
+    (*table)[name] = 1;
+}
+
+static IrReg bind_local(Symbol name) {
+    if (local_reg(name) != IR_NO_REG) return local_reg(name);
+    if (name >= local_capacity) {
+        uint32_t capacity = local_capacity ? local_capacity : 64;
+        while (capacity <= name) capacity *= 2;
+        local_regs = (IrReg*)realloc(local_regs, capacity * sizeof(IrReg));
+        bound = (Symbol*)realloc(bound, capacity * sizeof(Symbol));
+        if (!local_regs || !bound) {
+            fprintf(stderr, "Error: Out of memory binding local variables\n");
+            exit(1);
+        }
+        for (uint32_t i = local_capacity; i < capacity; i++) local_regs[i] = IR_NO_REG;
+        local_capacity = capacity;
+    }
+    local_regs[name] = ir_new_reg(function, IR_TYPE_I64);
+    bound[bound_count++] = name;
+    return local_regs[name];
+}
+
+static void clear_locals(void) {
+    for (uint32_t i = 0; i < bound_count; i++) local_regs[bound[i]] = IR_NO_REG;
+    bound_count = 0;
+}
+
+// A subtree's nodes directly precede its root, and the first child of
+// every expression is created first.
+static NodeIndex subtree_start(NodeIndex node) {
+    for (;;) {
+        switch (ast_kind(ast, node)) {
+            case NODE_ASSIGN_EXPRESSION:
+            case NODE_CALL_EXPRESSION:
+            case NODE_BINARY_EXPRESSION:
+            case NODE_INDEX_EXPRESSION:
+                node = ast_lhs(ast, node);
+                break;
+            default:
+                return node;
+        }
+    }
+}
+
+// Lowers a whole expression, noting whether an assignment is nested in it.
+static IrOperand lower_full_expression(NodeIndex node) {
+    int saved = copy_local_reads;
+    copy_local_reads = 0;
+    if (bound_count) {
+        for (NodeIndex i = subtree_start(node); i < node && !copy_local_reads; i++) {
+            if (ast_kind(ast, i) == NODE_ASSIGN_EXPRESSION) copy_local_reads = 1;
+        }
+    }
+    IrOperand value = lower_expression(node);
+    copy_local_reads = saved;
+    return value;
+}
+
+static void append_move(IrReg dst, IrOperand value) {
+    IrInstr* instr = append(IR_MOV);
+    instr->dst = dst;
+    instr->type = IR_TYPE_I64;
+    instr->a = value;
+}
+
+static IrOperand lower_identifier(NodeIndex node) {
+    Symbol name = ast_lhs(ast, node);
+    IrReg local = local_reg(name);
+    if (local != IR_NO_REG) {
+        if (!copy_local_reads) return ir_reg(local);
+        IrReg copy = ir_new_reg(function, IR_TYPE_I64);
+        append_move(copy, ir_reg(local));
+        return ir_reg(copy);
+    }
+    ir_declare_global(program, name, 1);
+    IrInstr* instr;
+    IrReg dst = append_value(IR_LOAD, IR_TYPE_I64, &instr);
+    instr->symbol = name;
+    return ir_reg(dst);
+}
+
+static IrOperand lower_string_literal(NodeIndex node) {
+    IrInstr* instr;
+    IrReg dst = append_value(IR_ADDR, IR_TYPE_PTR, &instr);
+    instr->target = ir_add_string(program, ast_string(ast, node));
+    return ir_reg(dst);
+}
+
+static IrOperand lower_binary_expression(NodeIndex node) {
+    IrOperand left = lower_expression(ast_lhs(ast, node));
+    IrOperand right = lower_expression(ast_rhs(ast, node));
+    IrInstr* instr;
+    // IR binary opcodes share BinaryOperator's numbering.
+    IrReg dst = append_value((IrOp)ast_operator(ast, node), IR_TYPE_I64, &instr);
+    instr->a = left;
+    instr->b = right;
+    return ir_reg(dst);
+}
+
+static IrOperand lower_assign_expression(NodeIndex node) {
+    NodeIndex target = ast_lhs(ast, node);
+    IrOperand value = lower_expression(ast_rhs(ast, node));
+    if (ast_kind(ast, target) == NODE_IDENTIFIER && local_reg(ast_lhs(ast, target)) != IR_NO_REG) {
+        append_move(local_reg(ast_lhs(ast, target)), value);
+    } else if (ast_kind(ast, target) == NODE_IDENTIFIER) {
+        ir_declare_global(program, ast_lhs(ast, target), 1);
+        IrInstr* instr = append(IR_STORE);
+        instr->symbol = ast_lhs(ast, target);
+        instr->a = value;
+    } else if (ast_kind(ast, target) == NODE_INDEX_EXPRESSION) {
+        Symbol array = identifier_symbol(ast_lhs(ast, target));
+        ir_declare_global(program, array, 1);
+        IrOperand index = lower_expression(ast_rhs(ast, target));
+        IrInstr* instr = append(IR_STORE_ELEM);
+        instr->symbol = array;
+        instr->a = index;
+        instr->b = value;
+    } else {
+        fprintf(stderr, "Error: Invalid assignment target (node type %d)\n", ast_kind(ast, target));
+        exit(1);
+    }
+    return value;
+}
+
+static IrOperand lower_index_expression(NodeIndex node) {
+    Symbol array = identifier_symbol(ast_lhs(ast, node));
+    ir_declare_global(program, array, 1);
+    IrOperand index = lower_expression(ast_rhs(ast, node));
+    IrInstr* instr;
+    IrReg dst = append_value(IR_LOAD_ELEM, IR_TYPE_I64, &instr);
+    instr->symbol = array;
+    instr->a = index;
+    return ir_reg(dst);
+}
+
+static IrOperand lower_call_expression(NodeIndex node) {
+    Symbol callee = identifier_symbol(ast_lhs(ast, node));
+    NodeList arguments = ast_call_arguments(ast, node);
+    if (!is_function(callee)) {
+        // A builtin is called through the symbol the runtime defines it as
+        int builtin = runtime_find_builtin(callee);
+        if (builtin < 0) {
+            fprintf(stderr, "Error: Undefined function '%s'\n", symbol_name(callee));
+            exit(1);
+        }
+        callee = runtime_builtin_symbol((Builtin)builtin);
+    }
+
+    // Arguments are evaluated left to right before the call; their operands
+    // are collected first so nested calls do not interleave in `args`.
+    IrOperand* values = (IrOperand*)malloc((arguments.count ? arguments.count : 1) * sizeof(IrOperand));
+    for (uint32_t i = 0; i < arguments.count; i++) {
+        values[i] = lower_expression(arguments.items[i]);
+    }
+    uint32_t first_arg = function->arg_count;
+    for (uint32_t i = 0; i < arguments.count; i++) {
+        ir_add_arg(function, values[i]);
+    }
+    free(values);
+
+    IrInstr* instr;
+    IrReg dst = append_value(IR_CALL, IR_TYPE_I64, &instr);
+    instr->symbol = callee;
+    instr->target = first_arg;
+    instr->other = arguments.count;
+    return ir_reg(dst);
+}
+
+static IrOperand lower_expression(NodeIndex node) {
+    switch (ast_kind(ast, node)) {
+        case NODE_IDENTIFIER:
+            return lower_identifier(node);
+        case NODE_NUMBER_LITERAL:
+        case NODE_ASCII_LITERAL:
+            return ir_imm(ast_literal_value(ast, node));
+        case NODE_STRING_LITERAL:
+            return lower_string_literal(node);
+        case NODE_ASSIGN_EXPRESSION:
+            return lower_assign_expression(node);
+        case NODE_CALL_EXPRESSION:
+            return lower_call_expression(node);
+        case NODE_BINARY_EXPRESSION:
+            return lower_binary_expression(node);
+        case NODE_INDEX_EXPRESSION:
+            return lower_index_expression(node);
+        default:
+            fprintf(stderr, "Error: Unknown expression node type %d\n", ast_kind(ast, node));
+            exit(1);
+    }
+}
+
+static void lower_var_declaration(NodeIndex node) {
+    Symbol name = ast_lhs(ast, node);
+    NodeIndex size = ast_var_size(ast, node);
+    NodeIndex value = ast_var_value(ast, node);
+    // A scalar declared in a function is local to it, and starts at 0 like
+    // a global would.
+    if (!function->is_entry && size == AST_NONE && !is_indexed(name)) {
+        IrOperand operand = value != AST_NONE ? lower_full_expression(value) : ir_imm(0);
+        append_move(bind_local(name), operand);
+        return;
+    }
+
+    ir_declare_global(program, name, fold_array_size(ast, node));
+
+    if (value != AST_NONE) {
+        IrOperand operand = lower_full_expression(value);
+        IrInstr* instr = append(IR_STORE);
+        instr->symbol = name;
+        instr->a = operand;
+    }
+}
+
+static void lower_block(NodeIndex node) {
+    NodeList statements = ast_statements(ast, node);
+    for (uint32_t i = 0; i < statements.count; i++) {
+        lower_statement(statements.items[i]);
+    }
+}
+
+static void lower_return_statement(NodeIndex node) {
+    IrOperand value = ir_none();
+    if (ast_lhs(ast, node) != AST_NONE) {
+        value = lower_full_expression(ast_lhs(ast, node));
+    }
+    append(IR_RET)->a = value;
+}
+
+//   cond: branch condition, body, exit
+//   body: ...; jump cond
+//   exit:
+static void lower_while_loop(NodeIndex node) {
+    uint32_t cond = ir_add_block(function);
+    uint32_t body = ir_add_block(function);
+    uint32_t exit_block = ir_add_block(function);
+
+    append_jump(cond);
+    current_block = cond;
+    append_branch(lower_full_expression(ast_lhs(ast, node)), body, exit_block);
+
+    current_block = body;
+    lower_block(ast_rhs(ast, node));
+    append_jump(cond);
+
+    current_block = exit_block;
+}
+
+//   init; jump cond
+//   cond: branch condition, body, exit   (jump body without a condition)
+//   body: ...; jump step
+//   step: increment; jump cond
+//   exit:
+static void lower_for_loop(NodeIndex node) {
+    NodeIndex init = ast_for_init(ast, node);
+    NodeIndex condition = ast_for_condition(ast, node);
+    NodeIndex increment = ast_for_increment(ast, node);
+
+    if (init != AST_NONE) {
+        if (ast_kind(ast, init) == NODE_VAR_DECLARATION) {
+            lower_var_declaration(init);
+        } else {
+            lower_full_expression(init);
+        }
+    }
+
+    uint32_t cond = ir_add_block(function);
+    uint32_t body = ir_add_block(function);
+    uint32_t step = ir_add_block(function);
+    uint32_t exit_block = ir_add_block(function);
+
+    append_jump(cond);
+    current_block = cond;
+    if (condition != AST_NONE) {
+        append_branch(lower_full_expression(condition), body, exit_block);
+    } else {
+        append_jump(body);
+    }
+
+    current_block = body;
+    lower_block(ast_rhs(ast, node));
+    append_jump(step);
+
+    current_block = step;
+    if (increment != AST_NONE) {
+        lower_full_expression(increment);
+    }
+    append_jump(cond);
+
+    current_block = exit_block;
+}
+
+static void lower_statement(NodeIndex node) {
+    switch (ast_kind(ast, node)) {
+        case NODE_VAR_DECLARATION:
+            lower_var_declaration(node);
+            break;
+        case NODE_FUNCTION_DECLARATION:
+            // Lowered separately by lower_program
+            break;
+        case NODE_RETURN_STATEMENT:
+            lower_return_statement(node);
+            break;
+        case NODE_EXPRESSION_STATEMENT:
+            lower_full_expression(ast_lhs(ast, node));
+            break;
+        case NODE_BLOCK_STATEMENT:
+            lower_block(node);
+            break;
+        case NODE_FOR_LOOP:
+            lower_for_loop(node);
+            break;
+        case NODE_WHILE_LOOP:
+            lower_while_loop(node);
+            break;
+        case NODE_IMPORT_STATEMENT:
+            // Imports are not implemented; they produce no code.
+            break;
+        default:
+            fprintf(stderr, "Error: Unknown statement node type %d\n", ast_kind(ast, node));
+            exit(1);
+    }
+}
+
+// Lowers `body` (a PROGRAM or BLOCK_STATEMENT) into `function`, ending with
+// an implicit return if control can fall off the end.
+static void lower_function_body(IrFunction* target, NodeIndex body) {
+    function = target;
+    current_block = ir_add_block(function);
+    // Every parameter is received before any is copied to its variable.
+    IrReg first_param = function->reg_count;
+    for (uint32_t i = 0; i < function->param_count; i++) {
+        IrInstr* instr;
+        append_value(IR_PARAM, IR_TYPE_I64, &instr);
+        instr->target = i;
+    }
+    for (uint32_t i = 0; i < function->param_count; i++) {
+        Symbol name = function->params[i];
+        if (!is_indexed(name)) {
+            append_move(bind_local(name), ir_reg(first_param + i));
+        } else {
+            // A name used as an array anywhere stays a global
+            ir_declare_global(program, name, 1);
+            IrInstr* store = append(IR_STORE);
+            store->symbol = name;
+            store->a = ir_reg(first_param + i);
+        }
+    }
+    if (body != AST_NONE) {
+        lower_block(body);
+    }
+    if (!ir_block_terminated(&function->blocks[current_block])) {
+        append(IR_RET)->a = ir_none();
+    }
+    ir_compute_predecessors(function);
+    clear_locals();
+}
+
+void lower_program(const AST* tree, IrProgram* ir) {
+    ast = tree;
+    program = ir;
+
+    for (NodeIndex node = 1; node < ast->node_count; node++) {
+        if (ast_kind(ast, node) == NODE_FUNCTION_DECLARATION) {
+            mark_symbol(&declared, &declared_size, ast_lhs(ast, node));
+            continue;
+        }
+        if (ast_kind(ast, node) != NODE_INDEX_EXPRESSION) continue;
+        NodeIndex array = ast_lhs(ast, node);
+        if (ast_kind(ast, array) != NODE_IDENTIFIER) continue;
+        mark_symbol(&indexed, &indexed_size, ast_lhs(ast, array));
+    }
+
+    lower_function_body(ir_add_function(program, SYMBOL_NONE, 1), ast->root);
+
+    // Children precede parents in the node columns, so this finds nested
+    // declarations too.
+    for (NodeIndex node = 1; node < ast->node_count; node++) {
+        if (ast_kind(ast, node) != NODE_FUNCTION_DECLARATION) continue;
+        IrFunction* lowered = ir_add_function(program, ast_lhs(ast, node), 0);
+        NodeList parameters = ast_function_parameters(ast, node);
+        lowered->param_count = parameters.count;
+        lowered->params = (Symbol*)malloc((parameters.count ? parameters.count : 1) * sizeof(Symbol));
+        for (uint32_t i = 0; i < parameters.count; i++) {
+            lowered->params[i] = ast_lhs(ast, parameters.items[i]);
+        }
+        lower_function_body(lowered, ast_function_body(ast, node));
+    }
+
+    int64_t elements = 0;
+    for (uint32_t i = 0; i < program->global_count; i++) {
+        elements += program->globals[i].size;
+        if (elements > IR_MAX_GLOBAL_ELEMENTS) {
+            fprintf(stderr, "Error: Array '%s' is too large\n", symbol_name(program->globals[i].name));
+            exit(1);
+        }
+    }
+
+    free(local_regs);
+    free(bound);
+    free(indexed);
+    free(declared);
+    local_regs = NULL;
+    bound = NULL;
+    indexed = NULL;
+    declared = NULL;
+    local_capacity = 0;
+    indexed_size = 0;
+    declared_size = 0;
+    function = NULL;
+}
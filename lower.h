@@ -0,0 +1,12 @@
+#ifndef LOWER_H
+#define LOWER_H
+
+#include "ast.h"
+#include "ir.h"
+
+// Translates the whole tree into `program`, which must be freshly
+// initialized. Top-level statements become the entry function; every
+// function declaration, wherever it appears, becomes its own IR function.
+void lower_program(const AST* ast, IrProgram* program);
+
+#endif // LOWER_H
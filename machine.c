@@ -0,0 +1,269 @@
+#include "machine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void machine_init(MachineFunction* function, Symbol name, int is_entry, uint32_t label_count) {
+    memset(function, 0, sizeof(*function));
+    function->name = name;
+    function->is_entry = is_entry;
+    function->label_count = label_count;
+}
+
+void machine_free(MachineFunction* function) {
+    free(function->code);
+    function->code = NULL;
+    function->count = 0;
+    function->capacity = 0;
+}
+
+uint32_t machine_new_label(MachineFunction* function) {
+    return function->label_count++;
+}
+
+MOperand mreg(MachineReg reg, int width) {
+    MOperand operand = { MOPERAND_REG, (uint8_t)reg, (uint8_t)width, REG_NONE, 0, 0 };
+    return operand;
+}
+
+MOperand mreg64(MachineReg reg) {
+    return mreg(reg, 8);
+}
+
+MOperand mimm(int64_t value) {
+    MOperand operand = { MOPERAND_IMM, REG_NONE, 8, REG_NONE, 0, value };
+    return operand;
+}
+
+MOperand mstack(MachineReg base, int64_t offset) {
+    MOperand operand = { MOPERAND_STACK, (uint8_t)base, 8, REG_NONE, 0, offset };
+    return operand;
+}
+
+MOperand maddress(MachineReg base, MachineReg index, int scale, int64_t offset) {
+    MOperand operand = { MOPERAND_ADDRESS, (uint8_t)base, 8, (uint8_t)index, (uint8_t)scale, offset };
+    return operand;
+}
+
+MOperand mglobal(Symbol name, MachineReg index) {
+    MOperand operand = { MOPERAND_GLOBAL, (uint8_t)index, 8, REG_NONE, 0, name };
+    return operand;
+}
+
+MOperand mstring(uint32_t index) {
+    MOperand operand = { MOPERAND_STRING, REG_NONE, 8, REG_NONE, 0, index };
+    return operand;
+}
+
+MOperand mlabel(uint32_t label) {
+    MOperand operand = { MOPERAND_LABEL, REG_NONE, 8, REG_NONE, 0, label };
+    return operand;
+}
+
+MOperand mfunction(Symbol name) {
+    MOperand operand = { MOPERAND_FUNCTION, REG_NONE, 8, REG_NONE, 0, name };
+    return operand;
+}
+
+int moperand_equal(const MOperand* a, const MOperand* b) {
+    return a->kind == b->kind && a->reg == b->reg && a->width == b->width && a->index == b->index &&
+           a->scale == b->scale && a->value == b->value;
+}
+
+int moperand_is_memory(const MOperand* operand) {
+    return operand->kind == MOPERAND_STACK || operand->kind == MOPERAND_GLOBAL;
+}
+
+int moperand_is_reg(const MOperand* operand, MachineReg reg) {
+    return operand->kind == MOPERAND_REG && operand->reg == reg;
+}
+
+MInstr* machine_emit0(MachineFunction* function, MOpcode op) {
+    if (function->count == function->capacity) {
+        uint32_t capacity = function->capacity ? function->capacity * 2 : 64;
+        MInstr* code = (MInstr*)realloc(function->code, capacity * sizeof(MInstr));
+        if (!code) {
+            fprintf(stderr, "Error: Out of memory generating code\n");
+            exit(1);
+        }
+        function->code = code;
+        function->capacity = capacity;
+    }
+    MInstr* instr = &function->code[function->count++];
+    memset(instr, 0, sizeof(*instr));
+    instr->op = (uint8_t)op;
+    return instr;
+}
+
+MInstr* machine_emit1(MachineFunction* function, MOpcode op, MOperand a) {
+    MInstr* instr = machine_emit0(function, op);
+    instr->operands[0] = a;
+    instr->operand_count = 1;
+    return instr;
+}
+
+MInstr* machine_emit2(MachineFunction* function, MOpcode op, MOperand a, MOperand b) {
+    MInstr* instr = machine_emit1(function, op, a);
+    instr->operands[1] = b;
+    instr->operand_count = 2;
+    return instr;
+}
+
+MInstr* machine_emit3(MachineFunction* function, MOpcode op, MOperand a, MOperand b, MOperand c) {
+    MInstr* instr = machine_emit2(function, op, a, b);
+    instr->operands[2] = c;
+    instr->operand_count = 3;
+    return instr;
+}
+
+MInstr* machine_label(MachineFunction* function, uint32_t label) {
+    return machine_emit1(function, M_LABEL, mlabel(label));
+}
+
+MInstr* machine_jcc(MachineFunction* function, Condition cond, uint32_t label) {
+    MInstr* instr = machine_emit1(function, M_JCC, mlabel(label));
+    instr->cond = (uint8_t)cond;
+    return instr;
+}
+
+MInstr* machine_setcc(MachineFunction* function, Condition cond, MachineReg reg) {
+    MInstr* instr = machine_emit1(function, M_SETCC, mreg(reg, 1));
+    instr->cond = (uint8_t)cond;
+    return instr;
+}
+
+static const char* register_name(MachineReg reg, int width) {
+    static const char* names[16][4] = {
+        { "rax", "eax", "ax", "al" },       { "rcx", "ecx", "cx", "cl" },
+        { "rdx", "edx", "dx", "dl" },       { "rbx", "ebx", "bx", "bl" },
+        { "rsp", "esp", "sp", "spl" },      { "rbp", "ebp", "bp", "bpl" },
+        { "rsi", "esi", "si", "sil" },      { "rdi", "edi", "di", "dil" },
+        { "r8", "r8d", "r8w", "r8b" },      { "r9", "r9d", "r9w", "r9b" },
+        { "r10", "r10d", "r10w", "r10b" },  { "r11", "r11d", "r11w", "r11b" },
+        { "r12", "r12d", "r12w", "r12b" },  { "r13", "r13d", "r13w", "r13b" },
+        { "r14", "r14d", "r14w", "r14b" },  { "r15", "r15d", "r15w", "r15b" },
+    };
+    return names[reg][width == 8 ? 0 : (width == 4 ? 1 : (width == 2 ? 2 : 3))];
+}
+
+static const char* size_name(int width) {
+    return width == 8 ? "qword " : (width == 4 ? "dword " : (width == 2 ? "word " : "byte "));
+}
+
+static const char* mnemonic(const MInstr* instr) {
+    static const char* mnemonics[] = {
+        [M_MOV] = "mov",   [M_MOVZX] = "movzx", [M_LEA] = "lea",   [M_ADD] = "add",
+        [M_SUB] = "sub",   [M_IMUL] = "imul",   [M_IDIV] = "idiv", [M_CQO] = "cqo",
+        [M_NEG] = "neg",   [M_AND] = "and",     [M_XOR] = "xor",   [M_SHL] = "shl",
+        [M_SHR] = "shr",   [M_SAR] = "sar",     [M_CMP] = "cmp",   [M_TEST] = "test",
+        [M_JMP] = "jmp",   [M_CALL] = "call",   [M_RET] = "ret",   [M_PUSH] = "push",
+        [M_POP] = "pop",   [M_SYSCALL] = "syscall", [M_MUL] = "mul",
+    };
+    static const char* cmovcc[] = {
+        "cmovo", "cmovno", "cmovb", "cmovae", "cmove", "cmovne", "cmovbe", "cmova",
+        "cmovs", "cmovns", "cmovp", "cmovnp", "cmovl", "cmovge", "cmovle", "cmovg",
+    };
+    static const char* setcc[] = {
+        "seto", "setno", "setb", "setae", "sete", "setne", "setbe", "seta",
+        "sets", "setns", "setp", "setnp", "setl", "setge", "setle", "setg",
+    };
+    static const char* jcc[] = {
+        "jo", "jno", "jb", "jae", "je", "jne", "jbe", "ja",
+        "js", "jns", "jp", "jnp", "jl", "jge", "jle", "jg",
+    };
+    if (instr->op == M_SETCC) return setcc[instr->cond];
+    if (instr->op == M_JCC) return jcc[instr->cond];
+    if (instr->op == M_CMOVCC) return cmovcc[instr->cond];
+    return mnemonics[instr->op];
+}
+
+static void print_operand(Emitter* out, const MOperand* operand, int size_prefix) {
+    switch (operand->kind) {
+        case MOPERAND_REG:
+            emit_text(out, register_name((MachineReg)operand->reg, operand->width));
+            break;
+        case MOPERAND_IMM:
+            emit_int(out, operand->value);
+            break;
+        case MOPERAND_STACK:
+            if (size_prefix) emit_text(out, size_name(operand->width));
+            emit_char(out, '[');
+            emit_text(out, register_name((MachineReg)operand->reg, 8));
+            emit_text(out, operand->value < 0 ? " - " : " + ");
+            emit_int(out, operand->value < 0 ? -operand->value : operand->value);
+            emit_char(out, ']');
+            break;
+        case MOPERAND_ADDRESS:
+            if (size_prefix) emit_text(out, size_name(operand->width));
+            emit_char(out, '[');
+            emit_text(out, register_name((MachineReg)operand->reg, 8));
+            if (operand->index != REG_NONE) {
+                emit_text(out, " + ");
+                emit_text(out, register_name((MachineReg)operand->index, 8));
+                emit_char(out, '*');
+                emit_int(out, operand->scale);
+            }
+            if (operand->value) {
+                emit_text(out, operand->value < 0 ? " - " : " + ");
+                emit_int(out, operand->value < 0 ? -operand->value : operand->value);
+            }
+            emit_char(out, ']');
+            break;
+        case MOPERAND_GLOBAL:
+            if (size_prefix) emit_text(out, size_name(operand->width));
+            emit_symbol_address(out, symbol_name((Symbol)operand->value),
+                                operand->reg == REG_NONE ? NULL : register_name((MachineReg)operand->reg, 8));
+            break;
+        case MOPERAND_STRING:
+            emit_text(out, "[rel str_");
+            emit_int(out, operand->value);
+            emit_char(out, ']');
+            break;
+        case MOPERAND_LABEL:
+            emit_text(out, ".bb");
+            emit_int(out, operand->value);
+            break;
+        case MOPERAND_FUNCTION:
+            emit_text(out, symbol_name((Symbol)operand->value));
+            break;
+    }
+}
+
+static void print_instr(Emitter* out, const MInstr* instr) {
+    if (instr->op == M_LABEL) {
+        emit_numbered_label(out, ".bb", (int)instr->operands[0].value);
+        return;
+    }
+    if (instr->operand_count == 0 && !instr->note) {
+        emit_op(out, mnemonic(instr));
+        return;
+    }
+    emit_begin(out, mnemonic(instr));
+    // Memory operands need an explicit size unless a register gives it;
+    // movzx reads a narrower one than its register.
+    int size_prefix = 1;
+    for (int i = 0; i < instr->operand_count; i++) {
+        if (instr->operands[i].kind == MOPERAND_REG && instr->op != M_MOVZX) size_prefix = 0;
+    }
+    for (int i = 0; i < instr->operand_count; i++) {
+        const MOperand* operand = &instr->operands[i];
+        if (i) emit_operand_separator(out);
+        // A 64-bit immediate that does not fit imm32 selects mov r64, imm64
+        if (operand->kind == MOPERAND_IMM && instr->op == M_MOV &&
+            (operand->value < INT32_MIN || operand->value > UINT32_MAX)) {
+            emit_text(out, "qword ");
+        }
+        print_operand(out, operand, size_prefix);
+    }
+    if (instr->note) emit_note(out, instr->note);
+    emit_end(out);
+}
+
+void machine_print(const MachineFunction* function, Emitter* out) {
+    const char* name = function->is_entry ? "_start" : symbol_name(function->name);
+    emit_directive(out, "global", name);
+    emit_label(out, name);
+    for (uint32_t i = 0; i < function->count; i++) {
+        if (function->code[i].op != M_NOP) print_instr(out, &function->code[i]);
+    }
+}
@@ -0,0 +1,153 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stdint.h>
+#include "intern.h"
+#include "emit.h"
+
+// x86-64 instructions as data. The code generator builds one instruction
+// list per function; passes such as the peephole optimizer rewrite it, and
+// machine_print writes it out as NASM text.
+
+// Registers in hardware encoding order.
+typedef enum {
+    REG_RAX,
+    REG_RCX,
+    REG_RDX,
+    REG_RBX,
+    REG_RSP,
+    REG_RBP,
+    REG_RSI,
+    REG_RDI,
+    REG_R8,
+    REG_R9,
+    REG_R10,
+    REG_R11,
+    REG_R12,
+    REG_R13,
+    REG_R14,
+    REG_R15,
+    REG_NONE = 0xff,
+} MachineReg;
+
+// Condition codes in hardware encoding order; flipping bit 0 negates one.
+typedef enum {
+    COND_O,
+    COND_NO,
+    COND_B,
+    COND_AE,
+    COND_E,
+    COND_NE,
+    COND_BE,
+    COND_A,
+    COND_S,
+    COND_NS,
+    COND_P,
+    COND_NP,
+    COND_L,
+    COND_GE,
+    COND_LE,
+    COND_G,
+} Condition;
+
+#define CONDITION_NEGATE(cond) ((Condition)((cond) ^ 1))
+
+typedef enum {
+    MOPERAND_NONE,
+    MOPERAND_REG,      // reg, width
+    MOPERAND_IMM,      // value
+    MOPERAND_STACK,    // [reg + value], of `width` bytes
+    MOPERAND_ADDRESS,  // [reg + index*scale + value], for lea and movzx
+    MOPERAND_GLOBAL,   // qword [rel symbol + reg*8]; value = Symbol, reg = index or REG_NONE
+    MOPERAND_STRING,   // [rel str_<value>]
+    MOPERAND_LABEL,    // Local label number `value`
+    MOPERAND_FUNCTION, // Call target; value = Symbol
+} MOperandKind;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t reg;
+    uint8_t width; // Register or memory width in bytes: 8, 4, 2 or 1
+    uint8_t index; // MOPERAND_ADDRESS: index register and its scale
+    uint8_t scale;
+    int64_t value;
+} MOperand;
+
+typedef enum {
+    M_NOP, // Deleted instruction; not printed
+    M_LABEL,
+    M_MOV,
+    M_MOVZX,
+    M_LEA,
+    M_ADD,
+    M_SUB,
+    M_IMUL, // Two or three operands, or one for rdx:rax = rax * operand
+    M_IDIV,
+    M_CQO,
+    M_NEG,
+    M_AND,
+    M_XOR,
+    M_SHL,
+    M_SHR,
+    M_SAR,
+    M_CMP,
+    M_TEST,
+    M_SETCC,
+    M_JMP,
+    M_JCC,
+    M_CALL,
+    M_RET,
+    M_PUSH,
+    M_POP,
+    M_SYSCALL,
+    M_MUL,    // rdx:rax = rax * operand, unsigned
+    M_CMOVCC,
+} MOpcode;
+
+typedef struct {
+    uint8_t op;
+    uint8_t cond; // Condition for M_SETCC, M_JCC and M_CMOVCC
+    uint8_t operand_count;
+    MOperand operands[3];
+    const char* note; // Static annotation printed as a comment, or NULL
+} MInstr;
+
+typedef struct {
+    Symbol name;
+    int is_entry; // Printed as _start
+    MInstr* code;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t label_count; // Local labels are numbered 0 .. label_count - 1
+} MachineFunction;
+
+void machine_init(MachineFunction* function, Symbol name, int is_entry, uint32_t label_count);
+void machine_free(MachineFunction* function);
+uint32_t machine_new_label(MachineFunction* function);
+
+MOperand mreg(MachineReg reg, int width);
+MOperand mreg64(MachineReg reg);
+MOperand mimm(int64_t value);
+MOperand mstack(MachineReg base, int64_t offset);
+MOperand maddress(MachineReg base, MachineReg index, int scale, int64_t offset);
+MOperand mglobal(Symbol name, MachineReg index);
+MOperand mstring(uint32_t index);
+MOperand mlabel(uint32_t label);
+MOperand mfunction(Symbol name);
+
+int moperand_equal(const MOperand* a, const MOperand* b);
+int moperand_is_memory(const MOperand* operand);
+int moperand_is_reg(const MOperand* operand, MachineReg reg);
+
+MInstr* machine_emit0(MachineFunction* function, MOpcode op);
+MInstr* machine_emit1(MachineFunction* function, MOpcode op, MOperand a);
+MInstr* machine_emit2(MachineFunction* function, MOpcode op, MOperand a, MOperand b);
+MInstr* machine_emit3(MachineFunction* function, MOpcode op, MOperand a, MOperand b, MOperand c);
+MInstr* machine_label(MachineFunction* function, uint32_t label);
+MInstr* machine_jcc(MachineFunction* function, Condition cond, uint32_t label);
+MInstr* machine_setcc(MachineFunction* function, Condition cond, MachineReg reg);
+
+// Writes "global <name>", the function label and its instructions.
+void machine_print(const MachineFunction* function, Emitter* emitter);
+
+#endif // MACHINE_H
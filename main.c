@@ -1,58 +1,301 @@
+#define _DEFAULT_SOURCE // For mkstemp and fchmod
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "source.h"
+#include "intern.h"
+#include "arena.h"
 #include "lexer.h"
 #include "parser.h"
+#include "emit.h"
+#include "ir.h"
+#include "lower.h"
+#include "fold.h"
+#include "inline.h"
+#include "tail.h"
+#include "dce.h"
+#include "loop.h"
 #include "codegen.h"
+#include "peephole.h"
+#include "object.h"
+#include "elf64.h"
+#include "jit.h"
+#include "bytecode.h"
+#include "interpret.h"
+#include "runtime.h"
+
+typedef enum {
+    EMIT_ASM, // NASM text in output.asm
+    EMIT_OBJ, // ELF object in output.o, linked with the runtime library
+    EMIT_EXE, // Executable in output, with the runtime built in
+} EmitKind;
+
+static const char* const output_paths[] = { "output.asm", "output.o", "output" };
+
+// Output is written to a temporary file next to the output path and renamed
+// over it once complete. The code generators and writers exit on errors;
+// the temporary file is then removed, so no partial output is left behind.
+static char temp_path[32];
+
+static void remove_temp_output(void) {
+    if (temp_path[0]) unlink(temp_path);
+}
+
+static int open_temp_output(int executable) {
+    snprintf(temp_path, sizeof(temp_path), "output.XXXXXX");
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        temp_path[0] = '\0';
+        return -1;
+    }
+    atexit(remove_temp_output);
+    mode_t mask = umask(0);
+    umask(mask);
+    if (fchmod(fd, (executable ? 0755 : 0644) & ~mask) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void print_usage(const char* program_name) {
+    fprintf(stderr, "Usage: %s [-O0|-O1] [--stats] [--no-comments] [--emit-ir] [--emit-bytecode]\n"
+            "       [--emit=asm|obj|exe] [--run] [--interpret]\n"
+            "       [--inline-budget=N] [--inline-report]\n"
+            "       <input_file.manu | ->\n", program_name);
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <input_file.manu>\n", argv[0]);
+    const char* input_path = NULL;
+    int print_stats = 0;
+    int emit_comments = 1;
+    int emit_ir = 0;
+    int optimize = 1;
+    long inline_budget = INLINE_DEFAULT_BUDGET;
+    int inline_report = 0;
+    EmitKind emit_kind = EMIT_ASM;
+    int run = 0;
+    int interpret_program = 0;
+    int emit_bytecode = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            print_stats = 1;
+        } else if (strcmp(argv[i], "--no-comments") == 0) {
+            emit_comments = 0;
+        } else if (strncmp(argv[i], "-O", 2) == 0 && argv[i][2] >= '0' && argv[i][2] <= '9' && !argv[i][3]) {
+            optimize = argv[i][2] - '0';
+        } else if (strcmp(argv[i], "--emit-ir") == 0) {
+            emit_ir = 1;
+        } else if (strcmp(argv[i], "--emit=asm") == 0) {
+            emit_kind = EMIT_ASM;
+        } else if (strcmp(argv[i], "--emit=obj") == 0) {
+            emit_kind = EMIT_OBJ;
+        } else if (strcmp(argv[i], "--emit=exe") == 0) {
+            emit_kind = EMIT_EXE;
+        } else if (strcmp(argv[i], "--run") == 0) {
+            run = 1;
+        } else if (strcmp(argv[i], "--interpret") == 0) {
+            interpret_program = 1;
+        } else if (strcmp(argv[i], "--emit-bytecode") == 0) {
+            emit_bytecode = 1;
+        } else if (strncmp(argv[i], "--inline-budget=", 16) == 0) {
+            char* end;
+            inline_budget = strtol(argv[i] + 16, &end, 10);
+            if (end == argv[i] + 16 || *end || inline_budget < 0 || inline_budget > 1000000) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--inline-report") == 0) {
+            inline_report = 1;
+        } else if (!input_path) {
+            input_path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!input_path) {
+        print_usage(argv[0]);
         return 1;
     }
 
-    FILE* fp = fopen(argv[1], "r");
-    if (fp == NULL) {
+    SourceBuffer source;
+    if (source_open(&source, input_path) != 0) {
         perror("Error opening input file");
         return 1;
     }
 
-    fseek(fp, 0, SEEK_END);
-    long fsize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    Arena arena;
+    arena_init(&arena);
 
-    char* source = malloc(fsize + 1);
-    fread(source, 1, fsize, fp);
-    fclose(fp);
-    source[fsize] = 0;
+    Lexer* lexer = lexer_new(source.data, source.length);
+    AST ast;
+    ast_init(&ast, &arena);
+    Parser* parser = parser_new(lexer, &ast);
+    parse_program(parser);
+
+    if (print_stats) {
+        size_t ast_bytes = ast_memory_used(&ast);
+        fprintf(stderr, "AST: %u nodes, %u extra slots, %zu bytes (%.1f bytes/node)\n",
+                ast.node_count, ast.extra_count, ast_bytes,
+                ast.node_count ? (double)ast_bytes / ast.node_count : 0.0);
+        fprintf(stderr, "AST arena: %zu bytes used, %zu bytes reserved in %zu blocks\n",
+                arena.bytes_used, arena.bytes_reserved, arena.block_count);
+        fprintf(stderr, "Symbols: %u interned\n", symbol_count());
+    }
+
+    if (interpret_program || emit_bytecode) {
+        Bytecode bytecode;
+        bytecode_compile(&ast, &bytecode);
+        if (print_stats) {
+            fprintf(stderr, "Bytecode: %u words, %u constants, %u functions, %u global slots\n",
+                    bytecode.code_count, bytecode.constant_count, bytecode.function_count, bytecode.slot_count);
+        }
+        if (emit_bytecode) {
+            Emitter dump;
+            emit_init(&dump, STDOUT_FILENO);
+            bytecode_print(&bytecode, &dump);
+            emit_flush(&dump);
+            emit_free(&dump);
+        }
+        if (interpret_program) {
+            int64_t status = interpret(&bytecode);
+            runtime_flush();
+            bytecode_free(&bytecode);
+            lexer_free(lexer);
+            parser_free(parser);
+            ast_free(&ast);
+            arena_free(&arena);
+            source_close(&source);
+            symbol_table_free();
+            // The low byte, as the exit system call keeps it.
+            return (int)(status & 0xff);
+        }
+        bytecode_free(&bytecode);
+    }
 
-    Lexer* lexer = lexer_new(source);
-    Parser* parser = parser_new(lexer);
-    Program* program = parse_program(parser);
+    IrProgram program;
+    ir_program_init(&program);
+    lower_program(&ast, &program);
 
-    FILE* output_fp = fopen("output.asm", "w");
-    if (output_fp == NULL) {
+    if (optimize >= 1) {
+        uint32_t tail_calls = eliminate_tail_recursion(&program);
+        uint32_t folded = fold_constants(&program);
+        uint32_t inlined = inline_functions(&program, (uint32_t)inline_budget, inline_report ? stderr : NULL);
+        // Arguments now flow into the inlined bodies.
+        if (inlined) folded += fold_constants(&program);
+        DeadCodeStats dead = { 0, 0, 0, 0 };
+        eliminate_dead_code(&program, &dead);
+        LoopStats loops = { 0, 0, 0, 0 };
+        optimize_loops(&program, &loops);
+        // Promotion leaves stores after loops that may be dead.
+        if (loops.promoted) eliminate_dead_code(&program, &dead);
+        if (print_stats) {
+            fprintf(stderr, "Tail recursion: %u calls turned into loops\n", tail_calls);
+            fprintf(stderr, "Inlining: %u calls inlined\n", inlined);
+            fprintf(stderr, "Constant folding: %u instructions removed\n", folded);
+            fprintf(stderr, "Loops: %u optimized, %u instructions hoisted, %u globals promoted, %u rotated\n",
+                    loops.loops, loops.hoisted, loops.promoted, loops.rotated);
+            fprintf(stderr, "Dead code: %u functions, %u blocks, %u stores, %u instructions removed\n",
+                    dead.functions, dead.blocks, dead.stores, dead.instructions);
+        }
+    }
+
+    if (emit_ir) {
+        Emitter ir_dump;
+        emit_init(&ir_dump, STDOUT_FILENO);
+        ir_print(&program, &ir_dump);
+        emit_flush(&ir_dump);
+        emit_free(&ir_dump);
+    }
+
+    if (run) {
+        ObjectFile object;
+        object_init(&object);
+        generate_object(&program, &object, optimize, 0);
+        if (print_stats) {
+            fprintf(stderr, "Output: %llu bytes of code\n", (unsigned long long)object.text_size);
+            if (optimize >= 1) peephole_print_stats(stderr);
+        }
+        ir_program_free(&program);
+        lexer_free(lexer);
+        parser_free(parser);
+        ast_free(&ast);
+        arena_free(&arena);
+        source_close(&source);
+        // The symbol table outlives the compiler; the object refers to it.
+        jit_run(&object);
+    }
+
+    const char* output_path = output_paths[emit_kind];
+    int output_fd = open_temp_output(emit_kind == EMIT_EXE);
+    if (output_fd < 0) {
         perror("Error opening output file");
+        ir_program_free(&program);
         lexer_free(lexer);
         parser_free(parser);
-        ast_node_free((ASTNode*)program);
-        free(source);
+        ast_free(&ast);
+        arena_free(&arena);
+        source_close(&source);
+        symbol_table_free();
         return 1;
     }
 
-    generate_assembly(program, output_fp);
+    Emitter emitter;
+    emit_init(&emitter, output_fd);
+    emitter.comments = emit_comments;
+    if (emit_kind == EMIT_ASM) {
+        generate_assembly(&program, &emitter, optimize);
+    } else {
+        ObjectFile object;
+        object_init(&object);
+        generate_object(&program, &object, optimize, emit_kind == EMIT_EXE);
+        if (emit_kind == EMIT_EXE) {
+            elf_write_executable(&object, &emitter);
+        } else {
+            elf_write_object(&object, &emitter);
+        }
+        object_free(&object);
+    }
 
-    fclose(output_fp);
+    int status = 0;
+    if (emit_flush(&emitter) != 0 || close(output_fd) != 0) {
+        perror("Error writing output file");
+        status = 1;
+    } else if (rename(temp_path, output_path) != 0) {
+        perror("Error writing output file");
+        status = 1;
+    } else {
+        temp_path[0] = '\0';
+    }
+    if (print_stats) {
+        fprintf(stderr, "Output: %zu bytes\n", emitter.bytes_written);
+        if (optimize >= 1) peephole_print_stats(stderr);
+    }
+    emit_free(&emitter);
 
+    ir_program_free(&program);
     lexer_free(lexer);
     parser_free(parser);
-    ast_node_free((ASTNode*)program);
-    free(source);
+    ast_free(&ast);
+    arena_free(&arena);
+    source_close(&source);
+    symbol_table_free();
+
+    if (status != 0) {
+        return status;
+    }
 
-    printf("Transpilation successful! Assembly code written to output.asm\n");
+    if (emit_kind == EMIT_ASM) {
+        printf("Transpilation successful! Assembly code written to output.asm\n");
+    } else {
+        printf("Compilation successful! %s written to %s\n",
+               emit_kind == EMIT_EXE ? "Executable" : "Object file", output_path);
+    }
 
     return 0;
 }
-
-
@@ -0,0 +1,126 @@
+#include "object.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void* grow(void* array, uint64_t* capacity, uint64_t needed, size_t element_size) {
+    if (needed <= *capacity) return array;
+    uint64_t new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < needed) new_capacity *= 2;
+    void* resized = realloc(array, (size_t)(new_capacity * element_size));
+    if (!resized) {
+        fprintf(stderr, "Error: Out of memory building the object file\n");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return resized;
+}
+
+static void* grow32(void* array, uint32_t* capacity, uint32_t needed, size_t element_size) {
+    uint64_t wide = *capacity;
+    array = grow(array, &wide, needed, element_size);
+    *capacity = (uint32_t)wide;
+    return array;
+}
+
+void object_init(ObjectFile* object) {
+    memset(object, 0, sizeof(*object));
+}
+
+void object_free(ObjectFile* object) {
+    free(object->text);
+    free(object->data);
+    free(object->symbols);
+    free(object->symbol_index);
+    free(object->relocs);
+    memset(object, 0, sizeof(*object));
+}
+
+uint32_t object_symbol(ObjectFile* object, Symbol name) {
+    if (name >= object->symbol_index_size) {
+        uint32_t old_size = object->symbol_index_size;
+        object->symbol_index = (uint32_t*)grow32(object->symbol_index, &object->symbol_index_size, name + 1,
+                                                 sizeof(uint32_t));
+        memset(object->symbol_index + old_size, 0, (object->symbol_index_size - old_size) * sizeof(uint32_t));
+    }
+    if (object->symbol_index[name]) return object->symbol_index[name] - 1;
+
+    object->symbols = (ObjectSymbol*)grow32(object->symbols, &object->symbol_capacity, object->symbol_count + 1,
+                                            sizeof(ObjectSymbol));
+    ObjectSymbol* symbol = &object->symbols[object->symbol_count];
+    memset(symbol, 0, sizeof(*symbol));
+    symbol->name = name;
+    symbol->section = SECTION_UNDEFINED;
+    symbol->global = 1;
+    object->symbol_index[name] = ++object->symbol_count;
+    return object->symbol_count - 1;
+}
+
+int64_t object_find_symbol(const ObjectFile* object, Symbol name) {
+    if (name >= object->symbol_index_size || !object->symbol_index[name]) return -1;
+    return (int64_t)object->symbol_index[name] - 1;
+}
+
+uint32_t object_define(ObjectFile* object, Symbol name, ObjectSection section, uint64_t size, int global) {
+    uint32_t index = object_symbol(object, name);
+    ObjectSymbol* symbol = &object->symbols[index];
+    if (symbol->section != SECTION_UNDEFINED) {
+        fprintf(stderr, "Error: Symbol '%s' is defined twice\n", symbol_name(name));
+        exit(1);
+    }
+    symbol->section = (uint8_t)section;
+    symbol->global = (uint8_t)global;
+    symbol->size = size;
+    if (section == SECTION_TEXT) {
+        symbol->offset = object->text_size;
+    } else if (section == SECTION_DATA) {
+        symbol->offset = object->data_size;
+    } else {
+        object->bss_size = (object->bss_size + 7) & ~(uint64_t)7;
+        symbol->offset = object->bss_size;
+        object->bss_size += size;
+    }
+    return index;
+}
+
+void object_append(ObjectFile* object, ObjectSection section, const void* bytes, uint64_t count) {
+    if (section == SECTION_TEXT) {
+        object->text = (uint8_t*)grow(object->text, &object->text_capacity, object->text_size + count, 1);
+        memcpy(object->text + object->text_size, bytes, (size_t)count);
+        object->text_size += count;
+    } else if (section == SECTION_DATA) {
+        object->data = (uint8_t*)grow(object->data, &object->data_capacity, object->data_size + count, 1);
+        memcpy(object->data + object->data_size, bytes, (size_t)count);
+        object->data_size += count;
+    } else {
+        object->bss_size += count;
+    }
+}
+
+void object_add_reloc(ObjectFile* object, uint64_t offset, uint32_t symbol, ObjectRelocKind kind, int64_t addend) {
+    object->relocs = (ObjectReloc*)grow32(object->relocs, &object->reloc_capacity, object->reloc_count + 1,
+                                          sizeof(ObjectReloc));
+    ObjectReloc* reloc = &object->relocs[object->reloc_count++];
+    reloc->offset = offset;
+    reloc->symbol = symbol;
+    reloc->kind = (uint8_t)kind;
+    reloc->addend = addend;
+}
+
+void object_relocate(const ObjectFile* object, uint8_t* text, const uint64_t bases[SECTION_COUNT]) {
+    for (uint32_t i = 0; i < object->reloc_count; i++) {
+        const ObjectReloc* reloc = &object->relocs[i];
+        const ObjectSymbol* symbol = &object->symbols[reloc->symbol];
+        if (symbol->section == SECTION_UNDEFINED) {
+            fprintf(stderr, "Error: Undefined symbol '%s'\n", symbol_name(symbol->name));
+            exit(1);
+        }
+        int64_t value = (int64_t)(bases[symbol->section] + symbol->offset) + reloc->addend;
+        if (reloc->kind == RELOC_PC32) value -= (int64_t)(bases[SECTION_TEXT] + reloc->offset);
+        if (value < INT32_MIN || value > INT32_MAX) {
+            fprintf(stderr, "Error: Reference to '%s' is out of range\n", symbol_name(symbol->name));
+            exit(1);
+        }
+        for (int k = 0; k < 4; k++) text[reloc->offset + k] = (uint8_t)((uint64_t)value >> (8 * k));
+    }
+}
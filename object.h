@@ -0,0 +1,79 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdint.h>
+#include "intern.h"
+
+// Machine code and data in memory, on their way to an ELF file. Symbols are
+// interned names; each one referenced or defined gets an entry, and those
+// never defined are left for the linker. Relocations are all in .text.
+
+typedef enum {
+    SECTION_TEXT,
+    SECTION_DATA,
+    SECTION_BSS,
+    SECTION_COUNT,
+    SECTION_UNDEFINED = SECTION_COUNT,
+} ObjectSection;
+
+typedef struct {
+    Symbol name;
+    uint8_t section; // ObjectSection
+    uint8_t global;  // Visible to other objects
+    uint8_t function;
+    uint64_t offset; // In its section
+    uint64_t size;
+} ObjectSymbol;
+
+typedef enum {
+    RELOC_PC32,  // 32-bit displacement from the end of the field, less the addend
+    RELOC_ABS32, // Sign-extended 32-bit absolute address
+} ObjectRelocKind;
+
+typedef struct {
+    uint64_t offset;  // Of the 4-byte field in .text
+    uint32_t symbol;  // Index into symbols
+    uint8_t kind;     // ObjectRelocKind
+    int64_t addend;
+} ObjectReloc;
+
+typedef struct {
+    uint8_t* text;
+    uint64_t text_size;
+    uint64_t text_capacity;
+    uint8_t* data;
+    uint64_t data_size;
+    uint64_t data_capacity;
+    uint64_t bss_size;
+
+    ObjectSymbol* symbols;
+    uint32_t symbol_count;
+    uint32_t symbol_capacity;
+    uint32_t* symbol_index; // Symbol -> symbols index + 1, or 0
+    uint32_t symbol_index_size;
+
+    ObjectReloc* relocs;
+    uint32_t reloc_count;
+    uint32_t reloc_capacity;
+} ObjectFile;
+
+void object_init(ObjectFile* object);
+void object_free(ObjectFile* object);
+
+// The index of the symbol called `name`, added undefined if it is new.
+uint32_t object_symbol(ObjectFile* object, Symbol name);
+// The index of the symbol called `name`, or -1 if there is none.
+int64_t object_find_symbol(const ObjectFile* object, Symbol name);
+// Defines `name` at the current end of `section`; .bss symbols reserve
+// `size` bytes there, 8-byte aligned. Returns the symbol's index.
+uint32_t object_define(ObjectFile* object, Symbol name, ObjectSection section, uint64_t size, int global);
+
+void object_append(ObjectFile* object, ObjectSection section, const void* bytes, uint64_t count);
+void object_add_reloc(ObjectFile* object, uint64_t offset, uint32_t symbol, ObjectRelocKind kind, int64_t addend);
+
+// Applies the relocations to `text`, a copy of .text, with each section
+// loaded at address `bases[section]`. Every symbol referred to must be
+// defined.
+void object_relocate(const ObjectFile* object, uint8_t* text, const uint64_t bases[SECTION_COUNT]);
+
+#endif // OBJECT_H
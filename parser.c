@@ -1,48 +1,69 @@
-#include <string.h> // For strdup
 #include "parser.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-// Ensure string.h is definitely at the top or very early
 
 static void next_token(Parser* parser) {
-    token_free(&parser->current_token);
     parser->current_token = parser->peek_token;
     parser->peek_token = lexer_next_token(parser->lexer);
 }
 
-Parser* parser_new(Lexer* lexer) {
+Parser* parser_new(Lexer* lexer, AST* ast) {
     Parser* parser = (Parser*)malloc(sizeof(Parser));
     parser->lexer = lexer;
-    parser->current_token.value = NULL;
-    parser->peek_token.value = NULL;
+    parser->ast = ast;
+    parser->current_token = (Token){0};
+    parser->peek_token = (Token){0};
     next_token(parser);
     next_token(parser);
     return parser;
 }
 
 void parser_free(Parser* parser) {
-    token_free(&parser->current_token);
-    token_free(&parser->peek_token);
     free(parser);
 }
 
-static ASTNode* parse_statement(Parser* parser);
-static ASTNode* parse_expression(Parser* parser, int precedence);
+static SourceLocation current_location(Parser* parser) {
+    return lexer_location(parser->lexer, (size_t)(parser->current_token.start - parser->lexer->source));
+}
+
+static void report_error(Parser* parser, const char* message) {
+    SourceLocation location = current_location(parser);
+    fprintf(stderr, "%s at line %zu, column %zu\n", message, location.line, location.column);
+}
 
-static ASTNode* parse_identifier(Parser* parser) {
-    return (ASTNode*)identifier_new(parser->current_token.value);
+static NodeIndex parse_statement(Parser* parser);
+static NodeIndex parse_expression(Parser* parser, int precedence);
+
+// Decodes the decimal digits of a literal token. Returns -1 if the value
+// exceeds `max`.
+static int parse_integer(const char* digits, size_t length, int64_t max, int64_t* value) {
+    int64_t result = 0;
+    for (size_t i = 0; i < length; i++) {
+        int64_t digit = digits[i] - '0';
+        if (result > (max - digit) / 10) {
+            return -1;
+        }
+        result = result * 10 + digit;
+    }
+    *value = result;
+    return 0;
 }
 
-static ASTNode* parse_var_declaration(Parser* parser) {
+static NodeIndex parse_identifier(Parser* parser) {
+    return identifier_new(parser->ast, parser->current_token.symbol);
+}
+
+static NodeIndex parse_var_declaration(Parser* parser) {
     next_token(parser); // consume TOKEN_KEYWORD_VAR
 
     if (parser->current_token.type != TOKEN_IDENTIFIER) {
-        fprintf(stderr, "Expected identifier after 'var' at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        return NULL;
+        report_error(parser, "Expected identifier after 'var'");
+        return AST_NONE;
     }
 
-    char* name = strdup(parser->current_token.value);
-    ASTNode* size = NULL;
+    Token name = parser->current_token;
+    NodeIndex size = AST_NONE;
 
     next_token(parser); // consume identifier
 
@@ -50,318 +71,297 @@ static ASTNode* parse_var_declaration(Parser* parser) {
         next_token(parser); // consume '['
         if (parser->current_token.type == TOKEN_RBRACKET) {
             // Empty size, e.g., x[]
-            size = NULL; // Or a specific node type for empty size if needed later
+            size = AST_NONE; // Or a specific node type for empty size if needed later
         } else {
             size = parse_expression(parser, 0);
-            if (!size) { // Error during size expression parsing
-                free(name);
-                return NULL; // Error already printed by parse_expression
+            if (size == AST_NONE) { // Error during size expression parsing
+                return AST_NONE; // Error already printed by parse_expression
             }
         }
         if (parser->current_token.type != TOKEN_RBRACKET) {
-            fprintf(stderr, "Expected ']' after size in variable declaration at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-            if (size) ast_node_free(size);
-            free(name);
-            return NULL;
+            report_error(parser, "Expected ']' after size in variable declaration");
+            return AST_NONE;
         }
         next_token(parser); // consume ']'
     }
 
     if (parser->current_token.type != TOKEN_ASSIGN) {
-        fprintf(stderr, "Expected '=' in variable declaration at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        free(name);
-        return NULL;
+        report_error(parser, "Expected '=' in variable declaration");
+        return AST_NONE;
     }
 
     next_token(parser); // consume '='
 
-    ASTNode* value = parse_expression(parser, 0);
+    NodeIndex value = parse_expression(parser, 0);
 
     if (parser->current_token.type == TOKEN_SEMICOLON) {
         next_token(parser); // consume semicolon
     }
 
-    return (ASTNode*)var_declaration_new(name, size, value);
+    return var_declaration_new(parser->ast, name.symbol, size, value);
 }
 
-static ASTNode* parse_expression_statement(Parser* parser) {
-    ASTNode* expression = parse_expression(parser, 0);
-    ExpressionStatement* stmt = expression_statement_new(expression);
+static NodeIndex parse_expression_statement(Parser* parser) {
+    NodeIndex expression = parse_expression(parser, 0);
+    NodeIndex stmt = expression_statement_new(parser->ast, expression);
 
     if (parser->current_token.type == TOKEN_SEMICOLON) {
         next_token(parser); // consume semicolon
     }
 
-    return (ASTNode*)stmt;
+    return stmt;
 }
 
-static ASTNode* parse_block_statement(Parser* parser) {
-    BlockStatement* block = block_statement_new(NULL);
+static NodeIndex parse_block_statement(Parser* parser) {
     next_token(parser); // consume '{'
 
-    ASTNode* head = NULL;
-    ASTNode* current = NULL;
+    uint32_t statements = ast_list_begin(parser->ast);
 
     while (parser->current_token.type != TOKEN_RBRACE && parser->current_token.type != TOKEN_EOF) {
-        ASTNode* stmt = parse_statement(parser);
-        if (stmt) {
-            if (head == NULL) {
-                head = stmt;
-                current = stmt;
-            } else {
-                current->next = stmt;
-                current = stmt;
-            }
+        NodeIndex stmt = parse_statement(parser);
+        if (stmt != AST_NONE) {
+            ast_list_push(parser->ast, stmt);
         } else {
-            // If parse_statement returns NULL, it means an error occurred.
+            // If parse_statement returns AST_NONE, it means an error occurred.
             // parse_statement's default case (if hit) should have consumed the token.
-            // If a specific parse_X_statement returned NULL without consuming the problematic token,
+            // If a specific parse_X_statement returned AST_NONE without consuming the problematic token,
             // this next_token call ensures progress.
-            fprintf(stderr, "Error in block: Problem parsing statement starting near token '%s' (type %d) at line %d, column %d. Attempting to recover by skipping token.\n", parser->current_token.value, parser->current_token.type, parser->current_token.line, parser->current_token.column);
+            SourceLocation location = current_location(parser);
+            fprintf(stderr, "Error in block: Problem parsing statement starting near token '%.*s' (type %d) at line %zu, column %zu. Attempting to recover by skipping token.\n", (int)parser->current_token.length, parser->current_token.start, parser->current_token.type, location.line, location.column);
             next_token(parser); // Ensure progress
         }
     }
 
     if (parser->current_token.type != TOKEN_RBRACE) {
-        fprintf(stderr, "Expected '}' after block statement at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        return NULL;
+        report_error(parser, "Expected '}' after block statement");
+        ast_list_discard(parser->ast, statements);
+        return AST_NONE;
     }
     next_token(parser); // consume '}'
 
-    block->statements = head;
-    return (ASTNode*)block;
+    return block_statement_new(parser->ast, statements);
 }
 
-static ASTNode* parse_function_declaration(Parser* parser) {
+static NodeIndex parse_function_declaration(Parser* parser) {
     next_token(parser); // consume 'func'
 
     if (parser->current_token.type != TOKEN_IDENTIFIER) {
-        fprintf(stderr, "Expected function name after 'func' at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        return NULL;
+        report_error(parser, "Expected function name after 'func'");
+        return AST_NONE;
     }
-    char* name = strdup(parser->current_token.value);
+    Token name = parser->current_token;
     next_token(parser); // consume function name
 
     if (parser->current_token.type != TOKEN_LPAREN) {
-        fprintf(stderr, "Expected '(' after function name at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        free(name);
-        return NULL;
+        report_error(parser, "Expected '(' after function name");
+        return AST_NONE;
     }
     next_token(parser); // consume '('
 
-    ASTNode* parameters = NULL;
-    ASTNode* head = NULL;
-    ASTNode* current = NULL;
+    uint32_t parameters = ast_list_begin(parser->ast);
 
     while (parser->current_token.type != TOKEN_RPAREN && parser->current_token.type != TOKEN_EOF) {
         if (parser->current_token.type == TOKEN_IDENTIFIER) {
-            ASTNode* param = (ASTNode*)identifier_new(parser->current_token.value);
-            if (head == NULL) {
-                head = param;
-                current = param;
-            } else {
-                current->next = param;
-                current = param;
-            }
+            ast_list_push(parser->ast, identifier_new(parser->ast, parser->current_token.symbol));
             next_token(parser); // consume identifier
             if (parser->current_token.type == TOKEN_COMMA) {
                 next_token(parser); // consume comma
             }
         } else {
-            fprintf(stderr, "Expected identifier or ')' in function parameters at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-            free(name);
-            return NULL;
+            report_error(parser, "Expected identifier or ')' in function parameters");
+            ast_list_discard(parser->ast, parameters);
+            return AST_NONE;
         }
     }
-    parameters = head;
 
     if (parser->current_token.type != TOKEN_RPAREN) {
-        fprintf(stderr, "Expected ')' after function parameters at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        free(name);
-        return NULL;
+        report_error(parser, "Expected ')' after function parameters");
+        ast_list_discard(parser->ast, parameters);
+        return AST_NONE;
     }
     next_token(parser); // consume ')'
 
     if (parser->current_token.type != TOKEN_LBRACE) {
-        fprintf(stderr, "Expected '{' before function body at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        free(name);
-        return NULL;
+        report_error(parser, "Expected '{' before function body");
+        ast_list_discard(parser->ast, parameters);
+        return AST_NONE;
     }
 
-    ASTNode* body = parse_block_statement(parser);
+    NodeIndex body = parse_block_statement(parser);
 
-    return (ASTNode*)function_declaration_new(name, parameters, body);
+    return function_declaration_new(parser->ast, name.symbol, parameters, body);
 }
 
-static ASTNode* parse_return_statement(Parser* parser) {
+static NodeIndex parse_return_statement(Parser* parser) {
     next_token(parser); // consume 'return'
 
-    ASTNode* return_value = parse_expression(parser, 0);
+    NodeIndex return_value = AST_NONE;
+    if (parser->current_token.type != TOKEN_SEMICOLON) {
+        return_value = parse_expression(parser, 0);
+    }
 
     if (parser->current_token.type == TOKEN_SEMICOLON) {
         next_token(parser); // consume semicolon
     }
 
-    return (ASTNode*)return_statement_new(return_value);
+    return return_statement_new(parser->ast, return_value);
 }
 
-static ASTNode* parse_while_loop(Parser* parser) {
+static NodeIndex parse_while_loop(Parser* parser) {
     next_token(parser); // consume 'while'
 
     if (parser->current_token.type != TOKEN_LPAREN) {
-        fprintf(stderr, "Expected '(' after 'while' at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        return NULL;
+        report_error(parser, "Expected '(' after 'while'");
+        return AST_NONE;
     }
     next_token(parser); // consume '('
 
-    ASTNode* condition = parse_expression(parser, 0);
+    NodeIndex condition = parse_expression(parser, 0);
 
     if (parser->current_token.type != TOKEN_RPAREN) {
-        fprintf(stderr, "Expected ')' after while condition at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        return NULL;
+        report_error(parser, "Expected ')' after while condition");
+        return AST_NONE;
     }
     next_token(parser); // consume ')'
 
     if (parser->current_token.type != TOKEN_LBRACE) {
-        fprintf(stderr, "Expected '{' after while condition at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        return NULL;
+        report_error(parser, "Expected '{' after while condition");
+        return AST_NONE;
     }
 
-    ASTNode* body = parse_block_statement(parser);
+    NodeIndex body = parse_block_statement(parser);
 
-    return (ASTNode*)while_loop_new(condition, body);
+    return while_loop_new(parser->ast, condition, body);
 }
 
-static ASTNode* parse_for_loop(Parser* parser) {
+static NodeIndex parse_for_loop(Parser* parser) {
     next_token(parser); // consume 'for'
 
     if (parser->current_token.type != TOKEN_LPAREN) {
-        fprintf(stderr, "Expected '(' after 'for' at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        return NULL;
+        report_error(parser, "Expected '(' after 'for'");
+        return AST_NONE;
     }
     next_token(parser); // consume '('
 
-    ASTNode* init = parse_expression(parser, 0);
+    // The initializer may declare the loop variable: for (var i[] = 0, ...)
+    NodeIndex init;
+    if (parser->current_token.type == TOKEN_KEYWORD_VAR) {
+        init = parse_var_declaration(parser);
+    } else {
+        init = parse_expression(parser, 0);
+    }
 
     if (parser->current_token.type != TOKEN_COMMA) {
-        fprintf(stderr, "Expected ',' after for loop initializer at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        return NULL;
+        report_error(parser, "Expected ',' after for loop initializer");
+        return AST_NONE;
     }
     next_token(parser); // consume ','
 
-    ASTNode* condition = parse_expression(parser, 0);
+    NodeIndex condition = parse_expression(parser, 0);
 
     if (parser->current_token.type != TOKEN_COMMA) {
-        fprintf(stderr, "Expected ',' after for loop condition at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        return NULL;
+        report_error(parser, "Expected ',' after for loop condition");
+        return AST_NONE;
     }
     next_token(parser); // consume ','
 
-    ASTNode* increment = parse_expression(parser, 0);
+    NodeIndex increment = parse_expression(parser, 0);
 
     if (parser->current_token.type != TOKEN_RPAREN) {
-        fprintf(stderr, "Expected ')' after for loop incrementer at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        return NULL;
+        report_error(parser, "Expected ')' after for loop incrementer");
+        return AST_NONE;
     }
     next_token(parser); // consume ')'
 
     if (parser->current_token.type != TOKEN_LBRACE) {
-        fprintf(stderr, "Expected '{' after for loop at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        return NULL;
+        report_error(parser, "Expected '{' after for loop");
+        return AST_NONE;
     }
 
-    ASTNode* body = parse_block_statement(parser);
+    NodeIndex body = parse_block_statement(parser);
 
-    return (ASTNode*)for_loop_new(init, condition, increment, body);
+    return for_loop_new(parser->ast, init, condition, increment, body);
 }
 
-static ASTNode* parse_import_statement(Parser* parser) {
+static NodeIndex parse_import_statement(Parser* parser) {
     next_token(parser); // consume 'import'
 
     if (parser->current_token.type == TOKEN_STRING_LITERAL) {
-        char* path = strdup(parser->current_token.value);
+        Token path = parser->current_token;
         next_token(parser); // consume string literal
 
         if (parser->current_token.type != TOKEN_KEYWORD_AS) {
-            fprintf(stderr, "Expected 'as' after import path at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-            free(path);
-            return NULL;
+            report_error(parser, "Expected 'as' after import path");
+            return AST_NONE;
         }
         next_token(parser); // consume 'as'
 
         if (parser->current_token.type != TOKEN_IDENTIFIER) {
-            fprintf(stderr, "Expected identifier for alias at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-            free(path);
-            return NULL;
+            report_error(parser, "Expected identifier for alias");
+            return AST_NONE;
         }
-        char* alias = strdup(parser->current_token.value);
+        Token alias = parser->current_token;
         next_token(parser); // consume alias
 
         if (parser->current_token.type == TOKEN_SEMICOLON) {
             next_token(parser); // consume semicolon
         }
 
-        return (ASTNode*)import_statement_new(IMPORT_TYPE_ALIAS, path, alias, NULL);
+        return import_statement_new(parser->ast, IMPORT_TYPE_ALIAS, path.start, path.length, alias.symbol, ast_list_begin(parser->ast));
     } else if (parser->current_token.type == TOKEN_LBRACE) {
         next_token(parser); // consume '{'
 
-        ASTNode* imports = NULL;
-        ASTNode* head = NULL;
-        ASTNode* current = NULL;
+        uint32_t imports = ast_list_begin(parser->ast);
 
         while (parser->current_token.type != TOKEN_RBRACE && parser->current_token.type != TOKEN_EOF) {
             if (parser->current_token.type == TOKEN_IDENTIFIER) {
-                ASTNode* import_item = (ASTNode*)identifier_new(parser->current_token.value);
-                if (head == NULL) {
-                    head = import_item;
-                    current = import_item;
-                } else {
-                    current->next = import_item;
-                    current = import_item;
-                }
+                ast_list_push(parser->ast, identifier_new(parser->ast, parser->current_token.symbol));
                 next_token(parser); // consume identifier
                 if (parser->current_token.type == TOKEN_COMMA) {
                     next_token(parser); // consume comma
                 }
             } else {
-                fprintf(stderr, "Expected identifier or '}' in destructured imports at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-                return NULL;
+                report_error(parser, "Expected identifier or '}' in destructured imports");
+                ast_list_discard(parser->ast, imports);
+                return AST_NONE;
             }
         }
-        imports = head;
 
         if (parser->current_token.type != TOKEN_RBRACE) {
-            fprintf(stderr, "Expected '}' after destructured imports at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-            return NULL;
+            report_error(parser, "Expected '}' after destructured imports");
+            ast_list_discard(parser->ast, imports);
+            return AST_NONE;
         }
         next_token(parser); // consume '}'
 
         if (parser->current_token.type != TOKEN_KEYWORD_FROM) {
-            fprintf(stderr, "Expected 'from' after destructured imports at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-            return NULL;
+            report_error(parser, "Expected 'from' after destructured imports");
+            ast_list_discard(parser->ast, imports);
+            return AST_NONE;
         }
         next_token(parser); // consume 'from'
 
         if (parser->current_token.type != TOKEN_STRING_LITERAL) {
-            fprintf(stderr, "Expected string literal for path at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-            return NULL;
+            report_error(parser, "Expected string literal for path");
+            ast_list_discard(parser->ast, imports);
+            return AST_NONE;
         }
-        char* path = strdup(parser->current_token.value);
+        Token path = parser->current_token;
         next_token(parser); // consume string literal
 
         if (parser->current_token.type == TOKEN_SEMICOLON) {
             next_token(parser); // consume semicolon
         }
 
-        return (ASTNode*)import_statement_new(IMPORT_TYPE_DESTRUCTURED, path, NULL, imports);
+        return import_statement_new(parser->ast, IMPORT_TYPE_DESTRUCTURED, path.start, path.length, SYMBOL_NONE, imports);
     } else {
-        fprintf(stderr, "Invalid import statement at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        return NULL;
+        report_error(parser, "Invalid import statement");
+        return AST_NONE;
     }
 }
 
-static ASTNode* parse_statement(Parser* parser) {
-    ASTNode* stmt = NULL;
+static NodeIndex parse_statement(Parser* parser) {
+    NodeIndex stmt = AST_NONE;
     switch (parser->current_token.type) {
         case TOKEN_KEYWORD_VAR:
             stmt = parse_var_declaration(parser);
@@ -387,77 +387,105 @@ static ASTNode* parse_statement(Parser* parser) {
         case TOKEN_KEYWORD_FUNC:
             stmt = parse_function_declaration(parser);
             break;
-        default:
-            fprintf(stderr, "Unexpected token at start of statement: %s (type %d) at line %d, column %d\n", parser->current_token.value, parser->current_token.type, parser->current_token.line, parser->current_token.column);
+        default: {
+            SourceLocation location = current_location(parser);
+            fprintf(stderr, "Unexpected token at start of statement: %.*s (type %d) at line %zu, column %zu\n", (int)parser->current_token.length, parser->current_token.start, parser->current_token.type, location.line, location.column);
             // Consume the unexpected token to avoid infinite loop
             next_token(parser);
-            return NULL;
+            return AST_NONE;
+        }
     }
     return stmt;
 }
 
+// Binding power of a token in infix/postfix position; 0 ends an expression.
+// Assignment binds loosest and is right-associative; calls and indexing
+// bind tightest.
 static int get_precedence(TokenType type) {
     switch (type) {
+        case TOKEN_ASSIGN:
+            return 1;
         case TOKEN_EQ:
         case TOKEN_NEQ:
-            return 1;
+            return 2;
         case TOKEN_LT:
         case TOKEN_GT:
         case TOKEN_LE:
         case TOKEN_GE:
-            return 2;
+            return 3;
         case TOKEN_PLUS:
         case TOKEN_MINUS:
-            return 3;
+            return 4;
         case TOKEN_MULTIPLY:
         case TOKEN_DIVIDE:
         case TOKEN_MODULO:
-            return 4;
+            return 5;
+        case TOKEN_LPAREN:
+        case TOKEN_LBRACKET:
+            return 6;
         default:
             return 0;
     }
 }
 
-static ASTNode* parse_prefix_expression(Parser* parser) {
-    ASTNode* node = NULL;
+static NodeIndex parse_prefix_expression(Parser* parser) {
+    NodeIndex node = AST_NONE;
     switch (parser->current_token.type) {
         case TOKEN_IDENTIFIER:
             node = parse_identifier(parser);
             next_token(parser); // Consume identifier
             break;
-        case TOKEN_NUMBER:
-            node = (ASTNode*)number_literal_new(parser->current_token.value);
+        case TOKEN_NUMBER: {
+            int64_t value;
+            if (parse_integer(parser->current_token.start, parser->current_token.length, INT64_MAX, &value) != 0) {
+                report_error(parser, "Integer literal out of range");
+                return AST_NONE;
+            }
+            node = number_literal_new(parser->ast, value);
             next_token(parser); // Consume number
             break;
-        case TOKEN_ASCII_LITERAL:
-            node = (ASTNode*)ascii_literal_new(parser->current_token.value);
+        }
+        case TOKEN_ASCII_LITERAL: {
+            // The token is the character code followed by 'a', e.g. 65a
+            int64_t value;
+            if (parse_integer(parser->current_token.start, parser->current_token.length - 1, 255, &value) != 0) {
+                report_error(parser, "ASCII literal out of range (0-255)");
+                return AST_NONE;
+            }
+            node = ascii_literal_new(parser->ast, value);
             next_token(parser); // Consume ASCII literal
             break;
+        }
         case TOKEN_STRING_LITERAL:
-            node = (ASTNode*)string_literal_new(parser->current_token.value);
+            node = string_literal_new(parser->ast, parser->current_token.start, parser->current_token.length);
             next_token(parser); // Consume string literal
             break;
         case TOKEN_LPAREN:
             next_token(parser); // consume '('
             node = parse_expression(parser, 0);
             if (parser->current_token.type != TOKEN_RPAREN) {
-                fprintf(stderr, "Expected ')' at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-                return NULL;
+                report_error(parser, "Expected ')'");
+                return AST_NONE;
             }
             next_token(parser); // consume ')'
             break;
-        default:
-            fprintf(stderr, "Unexpected token in expression: %s (type %d) at line %d, column %d\n", parser->current_token.value, parser->current_token.type, parser->current_token.line, parser->current_token.column);
-            return NULL;
+        default: {
+            SourceLocation location = current_location(parser);
+            fprintf(stderr, "Unexpected token in expression: %.*s (type %d) at line %zu, column %zu\n", (int)parser->current_token.length, parser->current_token.start, parser->current_token.type, location.line, location.column);
+            return AST_NONE;
+        }
     }
     return node;
 }
 
-static ASTNode* parse_infix_expression(Parser* parser, ASTNode* left) {
+static NodeIndex parse_infix_expression(Parser* parser, NodeIndex left) {
     TokenType operator = parser->current_token.type;
     int precedence = get_precedence(operator);
     next_token(parser); // consume operator
-    ASTNode* right = parse_expression(parser, precedence);
+    NodeIndex right = parse_expression(parser, precedence);
+    if (right == AST_NONE) {
+        return AST_NONE;
+    }
 
     BinaryOperator op;
     switch (operator) {
@@ -475,68 +503,66 @@ static ASTNode* parse_infix_expression(Parser* parser, ASTNode* left) {
         default: fprintf(stderr, "Invalid binary operator\n"); exit(1);
     }
 
-    return (ASTNode*)binary_expression_new(left, op, right);
+    return binary_expression_new(parser->ast, left, op, right);
 }
 
-static ASTNode* parse_call_expression(Parser* parser, ASTNode* function) {
+static NodeIndex parse_call_expression(Parser* parser, NodeIndex function) {
     next_token(parser); // consume '('
 
-    ASTNode* arguments = NULL;
-    ASTNode* head = NULL;
-    ASTNode* current = NULL;
+    uint32_t arguments = ast_list_begin(parser->ast);
 
     while (parser->current_token.type != TOKEN_RPAREN && parser->current_token.type != TOKEN_EOF) {
-        ASTNode* arg = parse_expression(parser, 0);
-        if (arg) {
-            if (head == NULL) {
-                head = arg;
-                current = arg;
-            } else {
-                current->next = arg;
-                current = arg;
-            }
+        NodeIndex arg = parse_expression(parser, 0);
+        if (arg == AST_NONE) {
+            ast_list_discard(parser->ast, arguments);
+            return AST_NONE;
         }
+        ast_list_push(parser->ast, arg);
         if (parser->current_token.type == TOKEN_COMMA) {
             next_token(parser); // consume comma
         }
     }
-    arguments = head;
 
     if (parser->current_token.type != TOKEN_RPAREN) {
-        fprintf(stderr, "Expected ')' after call arguments at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        return NULL;
+        report_error(parser, "Expected ')' after call arguments");
+        ast_list_discard(parser->ast, arguments);
+        return AST_NONE;
     }
     next_token(parser); // consume ')'
 
-    return (ASTNode*)call_expression_new(function, arguments);
+    return call_expression_new(parser->ast, function, arguments);
 }
 
-static ASTNode* parse_index_expression(Parser* parser, ASTNode* array) {
+static NodeIndex parse_index_expression(Parser* parser, NodeIndex array) {
     next_token(parser); // consume '['
-    ASTNode* index = parse_expression(parser, 0);
+    NodeIndex index = parse_expression(parser, 0);
 
     if (parser->current_token.type != TOKEN_RBRACKET) {
-        fprintf(stderr, "Expected ']' after index at line %d, column %d\n", parser->current_token.line, parser->current_token.column);
-        return NULL;
+        report_error(parser, "Expected ']' after index");
+        return AST_NONE;
     }
     next_token(parser); // consume ']'
 
-    return (ASTNode*)index_expression_new(array, index);
+    return index_expression_new(parser->ast, array, index);
 }
 
-static ASTNode* parse_expression(Parser* parser, int precedence) {
-    ASTNode* left_expr = parse_prefix_expression(parser);
+static NodeIndex parse_expression(Parser* parser, int precedence) {
+    NodeIndex left_expr = parse_prefix_expression(parser);
 
-    while (parser->peek_token.type != TOKEN_EOF && parser->peek_token.type != TOKEN_SEMICOLON && precedence < get_precedence(parser->peek_token.type)) {
-        next_token(parser);
+    // The prefix parser has already consumed its tokens, so the operator (if
+    // any) is the current token.
+    while (left_expr != AST_NONE && precedence < get_precedence(parser->current_token.type)) {
         if (parser->current_token.type == TOKEN_LPAREN) {
             left_expr = parse_call_expression(parser, left_expr);
         } else if (parser->current_token.type == TOKEN_LBRACKET) {
             left_expr = parse_index_expression(parser, left_expr);
         } else if (parser->current_token.type == TOKEN_ASSIGN) {
             next_token(parser); // consume '='
-            ASTNode* value = parse_expression(parser, 0);
-            left_expr = (ASTNode*)assign_expression_new(left_expr, value);
+            NodeIndex value = parse_expression(parser, 0);
+            if (value == AST_NONE) {
+                return AST_NONE;
+            }
+            left_expr = assign_expression_new(parser->ast, left_expr, value);
         } else {
             left_expr = parse_infix_expression(parser, left_expr);
         }
@@ -545,33 +571,24 @@ static ASTNode* parse_expression(Parser* parser, int precedence) {
     return left_expr;
 }
 
-Program* parse_program(Parser* parser) {
-    Program* program = program_new();
-    ASTNode* head = NULL;
-    ASTNode* current = NULL;
+NodeIndex parse_program(Parser* parser) {
+    uint32_t statements = ast_list_begin(parser->ast);
 
     while (parser->current_token.type != TOKEN_EOF) {
-        ASTNode* stmt = parse_statement(parser);
-        if (stmt) {
-            if (head == NULL) {
-                head = stmt;
-                current = stmt;
-            } else {
-                current->next = stmt;
-                current = stmt;
-            }
+        NodeIndex stmt = parse_statement(parser);
+        if (stmt != AST_NONE) {
+            ast_list_push(parser->ast, stmt);
         } else {
-            // If parse_statement returns NULL, it means an error occurred.
+            // If parse_statement returns AST_NONE, it means an error occurred.
             // parse_statement's default case (if hit) should have consumed the token.
-            // If a specific parse_X_statement returned NULL without consuming the problematic token,
+            // If a specific parse_X_statement returned AST_NONE without consuming the problematic token,
             // this next_token call ensures progress.
-            fprintf(stderr, "Error in program: Problem parsing statement starting near token '%s' (type %d) at line %d, column %d. Attempting to recover by skipping token.\n", parser->current_token.value, parser->current_token.type, parser->current_token.line, parser->current_token.column);
+            SourceLocation location = current_location(parser);
+            fprintf(stderr, "Error in program: Problem parsing statement starting near token '%.*s' (type %d) at line %zu, column %zu. Attempting to recover by skipping token.\n", (int)parser->current_token.length, parser->current_token.start, parser->current_token.type, location.line, location.column);
             next_token(parser); // Ensure progress
         }
     }
 
-    program->statements = head;
-    return program;
+    parser->ast->root = program_new(parser->ast, statements);
+    return parser->ast->root;
 }
-
-
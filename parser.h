@@ -6,14 +6,13 @@
 
 typedef struct {
     Lexer* lexer;
+    AST* ast; // The tree being built; parse_program sets ast->root
     Token current_token;
     Token peek_token;
 } Parser;
 
-Parser* parser_new(Lexer* lexer);
+Parser* parser_new(Lexer* lexer, AST* ast);
 void parser_free(Parser* parser);
-Program* parse_program(Parser* parser);
+NodeIndex parse_program(Parser* parser);
 
 #endif // PARSER_H
-
-
@@ -0,0 +1,295 @@
+#include "peephole.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The function being optimized, with the position of every local label and
+// the number of jumps referring to it.
+typedef struct {
+    MInstr* code;
+    uint32_t count;
+    uint32_t label_count;
+    uint32_t* label_position; // UINT32_MAX if the label was deleted
+    uint32_t* label_uses;
+} Window;
+
+// A rule looks at the instructions starting at `i`. It returns -1 if it
+// does not match, else rewrites them and returns how many it deleted.
+typedef int (*RuleFunction)(Window* window, uint32_t i);
+
+typedef struct {
+    const char* name;
+    RuleFunction apply;
+    uint32_t applied;
+    uint32_t removed;
+} PeepholeRule;
+
+#define NO_POSITION UINT32_MAX
+
+static int is_jump(const MInstr* instr) {
+    return (instr->op == M_JMP || instr->op == M_JCC) && instr->operands[0].kind == MOPERAND_LABEL;
+}
+
+static uint32_t jump_target(const MInstr* instr) {
+    return (uint32_t)instr->operands[0].value;
+}
+
+// The next instruction after `i` that has not been deleted, or count.
+static uint32_t next_instr(const Window* window, uint32_t i) {
+    for (i++; i < window->count && window->code[i].op == M_NOP; i++) {
+    }
+    return i;
+}
+
+static void delete_instr(Window* window, uint32_t i) {
+    MInstr* instr = &window->code[i];
+    if (is_jump(instr)) window->label_uses[jump_target(instr)]--;
+    if (instr->op == M_LABEL) window->label_position[instr->operands[0].value] = NO_POSITION;
+    instr->op = M_NOP;
+}
+
+static void retarget(Window* window, MInstr* jump, uint32_t label) {
+    window->label_uses[jump_target(jump)]--;
+    window->label_uses[label]++;
+    jump->operands[0].value = label;
+}
+
+static int is_reg64(const MOperand* operand) {
+    return operand->kind == MOPERAND_REG && operand->width == 8;
+}
+
+// Whether label `label` is among the labels directly following `i`.
+static int falls_through_to(const Window* window, uint32_t i, uint32_t label) {
+    for (uint32_t j = next_instr(window, i); j < window->count && window->code[j].op == M_LABEL;
+         j = next_instr(window, j)) {
+        if ((uint32_t)window->code[j].operands[0].value == label) return 1;
+    }
+    return 0;
+}
+
+// mov r, r
+static int rule_self_move(Window* window, uint32_t i) {
+    const MInstr* instr = &window->code[i];
+    if (instr->op != M_MOV || !is_reg64(&instr->operands[0]) ||
+        !moperand_equal(&instr->operands[0], &instr->operands[1])) {
+        return -1;
+    }
+    delete_instr(window, i);
+    return 1;
+}
+
+// mov a, b; mov b, a  ->  mov a, b
+static int rule_move_back(Window* window, uint32_t i) {
+    const MInstr* first = &window->code[i];
+    uint32_t j = next_instr(window, i);
+    if (first->op != M_MOV || j >= window->count) return -1;
+    const MInstr* second = &window->code[j];
+    if (second->op != M_MOV || first->operands[0].width != 8 || second->operands[0].width != 8 ||
+        !moperand_equal(&first->operands[0], &second->operands[1]) ||
+        !moperand_equal(&first->operands[1], &second->operands[0])) {
+        return -1;
+    }
+    delete_instr(window, j);
+    return 1;
+}
+
+// mov [m], r; mov r2, [m]  ->  mov [m], r; mov r2, r
+static int rule_store_load(Window* window, uint32_t i) {
+    const MInstr* store = &window->code[i];
+    uint32_t j = next_instr(window, i);
+    if (store->op != M_MOV || !moperand_is_memory(&store->operands[0]) || !is_reg64(&store->operands[1]) ||
+        j >= window->count) {
+        return -1;
+    }
+    MInstr* load = &window->code[j];
+    if (load->op != M_MOV || !is_reg64(&load->operands[0]) || !moperand_equal(&load->operands[1], &store->operands[0])) {
+        return -1;
+    }
+    if (moperand_equal(&load->operands[0], &store->operands[1])) {
+        delete_instr(window, j);
+        return 1;
+    }
+    load->operands[1] = store->operands[1];
+    return 0;
+}
+
+// push x; pop x  ->  (nothing)     push x; pop y  ->  mov y, x
+static int rule_push_pop(Window* window, uint32_t i) {
+    MInstr* push = &window->code[i];
+    uint32_t j = next_instr(window, i);
+    if (push->op != M_PUSH || j >= window->count || window->code[j].op != M_POP) return -1;
+    const MOperand* source = &push->operands[0];
+    const MOperand* destination = &window->code[j].operands[0];
+    if (moperand_equal(source, destination)) {
+        delete_instr(window, i);
+        delete_instr(window, j);
+        return 2;
+    }
+    if (moperand_is_memory(source) && moperand_is_memory(destination)) return -1;
+    MOperand from = *source;
+    *push = window->code[j];
+    push->op = M_MOV;
+    push->operand_count = 2;
+    push->operands[1] = from;
+    delete_instr(window, j);
+    return 1;
+}
+
+// cmp r, 0  ->  test r, r (same flags, shorter encoding)
+static int rule_compare_zero(Window* window, uint32_t i) {
+    MInstr* instr = &window->code[i];
+    if (instr->op != M_CMP || instr->operands[0].kind != MOPERAND_REG ||
+        instr->operands[1].kind != MOPERAND_IMM || instr->operands[1].value != 0) {
+        return -1;
+    }
+    instr->op = M_TEST;
+    instr->operands[1] = instr->operands[0];
+    return 0;
+}
+
+// jmp L; L:  ->  L:
+static int rule_jump_to_next(Window* window, uint32_t i) {
+    const MInstr* jump = &window->code[i];
+    if (!is_jump(jump) || !falls_through_to(window, i, jump_target(jump))) return -1;
+    delete_instr(window, i);
+    return 1;
+}
+
+// jcc L1; jmp L2; L1:  ->  jncc L2; L1:
+static int rule_jump_over_jump(Window* window, uint32_t i) {
+    MInstr* branch = &window->code[i];
+    uint32_t j = next_instr(window, i);
+    if (branch->op != M_JCC || !is_jump(branch) || j >= window->count) return -1;
+    const MInstr* jump = &window->code[j];
+    if (jump->op != M_JMP || !is_jump(jump) || !falls_through_to(window, j, jump_target(branch))) return -1;
+    branch->cond = (uint8_t)CONDITION_NEGATE((Condition)branch->cond);
+    retarget(window, branch, jump_target(jump));
+    delete_instr(window, j);
+    return 1;
+}
+
+// The label an unconditional jump at `label` leads to, or `label` itself.
+static uint32_t first_jump_from(const Window* window, uint32_t label) {
+    uint32_t position = window->label_position[label];
+    if (position == NO_POSITION) return label;
+    uint32_t j = position;
+    while (j < window->count && (window->code[j].op == M_LABEL || window->code[j].op == M_NOP)) j++;
+    if (j < window->count && window->code[j].op == M_JMP && is_jump(&window->code[j])) {
+        return jump_target(&window->code[j]);
+    }
+    return label;
+}
+
+// jmp L1 ... L1: jmp L2  ->  jmp L2 ... L1: jmp L2
+static int rule_jump_chain(Window* window, uint32_t i) {
+    MInstr* jump = &window->code[i];
+    if (!is_jump(jump)) return -1;
+    uint32_t start = jump_target(jump);
+    uint32_t target = start;
+    // Follow a bounded number of hops; a cycle of jumps is left alone.
+    for (int hops = 0; hops < 8; hops++) {
+        uint32_t next = first_jump_from(window, target);
+        if (next == target) break;
+        if (next == start) return -1;
+        target = next;
+    }
+    if (target == start || first_jump_from(window, target) != target) return -1;
+    retarget(window, jump, target);
+    return 0;
+}
+
+// Code after jmp or ret up to the next label some jump refers to.
+static int rule_unreachable(Window* window, uint32_t i) {
+    const MInstr* instr = &window->code[i];
+    if (instr->op != M_JMP && instr->op != M_RET) return -1;
+    int removed = 0;
+    for (uint32_t j = next_instr(window, i); j < window->count; j = next_instr(window, j)) {
+        const MInstr* dead = &window->code[j];
+        if (dead->op == M_LABEL && window->label_uses[dead->operands[0].value]) break;
+        if (dead->op != M_LABEL) removed++;
+        delete_instr(window, j);
+    }
+    return removed ? removed : -1;
+}
+
+// A label no jump refers to; not counted, as it is not an instruction.
+static int rule_unused_label(Window* window, uint32_t i) {
+    const MInstr* instr = &window->code[i];
+    if (instr->op != M_LABEL || window->label_uses[instr->operands[0].value]) return -1;
+    delete_instr(window, i);
+    return 0;
+}
+
+// Add new patterns here; they are tried in order at every position.
+static PeepholeRule rules[] = {
+    { "self-move", rule_self_move, 0, 0 },
+    { "move-back", rule_move_back, 0, 0 },
+    { "store-load", rule_store_load, 0, 0 },
+    { "push-pop", rule_push_pop, 0, 0 },
+    { "compare-zero", rule_compare_zero, 0, 0 },
+    { "jump-to-next", rule_jump_to_next, 0, 0 },
+    { "jump-over-jump", rule_jump_over_jump, 0, 0 },
+    { "jump-chain", rule_jump_chain, 0, 0 },
+    { "unreachable", rule_unreachable, 0, 0 },
+    { "unused-label", rule_unused_label, 0, 0 },
+};
+
+#define RULE_COUNT (sizeof(rules) / sizeof(rules[0]))
+
+static void index_labels(Window* window) {
+    for (uint32_t label = 0; label < window->label_count; label++) {
+        window->label_position[label] = NO_POSITION;
+        window->label_uses[label] = 0;
+    }
+    for (uint32_t i = 0; i < window->count; i++) {
+        const MInstr* instr = &window->code[i];
+        if (instr->op == M_LABEL) {
+            window->label_position[instr->operands[0].value] = i;
+        } else if (is_jump(instr)) {
+            window->label_uses[jump_target(instr)]++;
+        }
+    }
+}
+
+void peephole_optimize(MachineFunction* function) {
+    Window window;
+    window.code = function->code;
+    window.count = function->count;
+    window.label_count = function->label_count;
+    window.label_position = (uint32_t*)malloc((function->label_count ? function->label_count : 1) * sizeof(uint32_t));
+    window.label_uses = (uint32_t*)malloc((function->label_count ? function->label_count : 1) * sizeof(uint32_t));
+    if (!window.label_position || !window.label_uses) {
+        fprintf(stderr, "Error: Out of memory in peephole optimizer\n");
+        exit(1);
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        index_labels(&window);
+        for (uint32_t i = 0; i < window.count; i++) {
+            for (uint32_t r = 0; r < RULE_COUNT && window.code[i].op != M_NOP; r++) {
+                int removed = rules[r].apply(&window, i);
+                if (removed < 0) continue;
+                rules[r].applied++;
+                rules[r].removed += (uint32_t)removed;
+                changed = 1;
+            }
+        }
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < window.count; i++) {
+        if (window.code[i].op != M_NOP) window.code[kept++] = window.code[i];
+    }
+    function->count = kept;
+    free(window.label_position);
+    free(window.label_uses);
+}
+
+void peephole_print_stats(FILE* stream) {
+    fprintf(stream, "Peephole rules:\n");
+    for (uint32_t r = 0; r < RULE_COUNT; r++) {
+        fprintf(stream, "  %-16s %u applied, %u instructions removed\n", rules[r].name, rules[r].applied,
+                rules[r].removed);
+    }
+}
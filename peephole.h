@@ -0,0 +1,16 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdio.h>
+#include "machine.h"
+
+// Pattern-driven cleanup of a function's instruction list. Rules run at
+// every position until none applies; deleted instructions become M_NOP and
+// are compacted away at the end.
+void peephole_optimize(MachineFunction* function);
+
+// Prints, per rule, how often it fired and how many instructions it removed
+// across every function optimized so far.
+void peephole_print_stats(FILE* stream);
+
+#endif // PEEPHOLE_H
@@ -0,0 +1,519 @@
+#include "regalloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Instructions are numbered in reverse postorder of the blocks, so a
+// loop's blocks come before the code after it, and every virtual register
+// gets a single live interval [start, end] covering all of its definitions
+// and uses. Most registers are temporaries used only in the block that
+// defines them; only registers with an upward-exposed use (read in a block
+// before any definition there) need dataflow liveness, which extends their
+// interval over the blocks they are live through. Intervals are then
+// allocated in order of start position (Poletto & Sarkar).
+//
+// Before allocation, a register defined once by a move from another
+// register is coalesced with it when the source is not redefined while the
+// copy is live: the two share one interval and one location, and the move
+// becomes a no-op. Promoting a global in a loop leaves such copies of its
+// register across the inner loops; allocated apart, each would need a
+// register of its own.
+
+// Bitsets over the dense liveness indices.
+typedef uint64_t Word;
+#define WORD_BITS 64
+
+typedef struct {
+    IrReg reg;
+    uint32_t start;
+    uint32_t end;
+    int crosses_call;
+} Interval;
+
+typedef struct {
+    uint32_t position;
+    IrReg copy;
+    IrReg source;
+} Copy;
+
+typedef struct {
+    const IrFunction* function;
+    uint32_t* start;
+    uint32_t* end;
+    uint8_t* seen;
+    uint32_t position;
+    // Liveness of registers with upward-exposed uses, renumbered densely.
+    uint32_t* live_index; // IrReg -> dense index + 1, or 0
+    uint32_t live_count;
+    uint32_t* defined_in; // IrReg -> last block that defined it + 1
+    uint32_t current_block;
+    Word* block_use; // Use set of current_block while solving liveness
+    Word* live_out;  // Per block, over the dense indices
+    uint32_t words;  // Words per block in live_out
+} Scan;
+
+static void* allocate(size_t count, size_t size) {
+    void* memory = calloc(count ? count : 1, size);
+    if (!memory) {
+        fprintf(stderr, "Error: Out of memory during register allocation\n");
+        exit(1);
+    }
+    return memory;
+}
+
+// Blocks in reverse postorder, then any unreachable ones.
+static uint32_t* block_order(const IrFunction* function) {
+    uint32_t n = function->block_count;
+    uint32_t* order = (uint32_t*)allocate(n, sizeof(uint32_t));
+    uint32_t* stack = (uint32_t*)allocate(n, sizeof(uint32_t));
+    uint8_t* visited = (uint8_t*)allocate(n, sizeof(uint8_t));
+    uint8_t* next_succ = (uint8_t*)allocate(n, sizeof(uint8_t));
+    uint32_t reached = 0;
+
+    uint32_t depth = 0;
+    if (n) {
+        stack[depth++] = 0;
+        visited[0] = 1;
+    }
+    while (depth) {
+        uint32_t b = stack[depth - 1];
+        uint32_t succs[2];
+        uint32_t count = ir_successors(&function->blocks[b], succs);
+        if (next_succ[b] < count) {
+            uint32_t s = succs[next_succ[b]++];
+            if (!visited[s]) {
+                visited[s] = 1;
+                stack[depth++] = s;
+            }
+            continue;
+        }
+        depth--;
+        order[reached++] = b;
+    }
+    for (uint32_t i = 0; i < reached / 2; i++) {
+        uint32_t swap = order[i];
+        order[i] = order[reached - 1 - i];
+        order[reached - 1 - i] = swap;
+    }
+    for (uint32_t b = 0; b < n; b++) {
+        if (!visited[b]) order[reached++] = b;
+    }
+
+    free(stack);
+    free(visited);
+    free(next_succ);
+    return order;
+}
+
+static void extend(Scan* scan, IrReg reg, uint32_t position) {
+    if (!scan->seen[reg]) {
+        scan->seen[reg] = 1;
+        scan->start[reg] = position;
+        scan->end[reg] = position;
+        return;
+    }
+    if (position < scan->start[reg]) scan->start[reg] = position;
+    if (position > scan->end[reg]) scan->end[reg] = position;
+}
+
+static void record_use(IrReg reg, void* context) {
+    Scan* scan = (Scan*)context;
+    extend(scan, reg, scan->position);
+    if (scan->defined_in[reg] != scan->current_block + 1 && !scan->live_index[reg]) {
+        scan->live_index[reg] = ++scan->live_count;
+    }
+}
+
+static int test_bit(const Word* set, uint32_t bit) {
+    return (set[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1;
+}
+
+static void set_bit(Word* set, uint32_t bit) {
+    set[bit / WORD_BITS] |= (Word)1 << (bit % WORD_BITS);
+}
+
+static void mark_live(IrReg reg, void* context) {
+    Scan* scan = (Scan*)context;
+    if (scan->live_index[reg] && scan->defined_in[reg] != scan->current_block + 1) {
+        set_bit(scan->block_use, scan->live_index[reg] - 1);
+    }
+}
+
+// Solves live-in/live-out for the registers in live_index and extends their
+// intervals over every block boundary they are live across.
+static void compute_liveness(Scan* scan, const uint32_t* block_start, const uint32_t* block_end) {
+    const IrFunction* function = scan->function;
+    uint32_t words = (scan->live_count + WORD_BITS - 1) / WORD_BITS;
+    uint32_t blocks = function->block_count;
+    Word* use = (Word*)allocate((size_t)blocks * words, sizeof(Word));
+    Word* def = (Word*)allocate((size_t)blocks * words, sizeof(Word));
+    Word* live_in = (Word*)allocate((size_t)blocks * words, sizeof(Word));
+    Word* live_out = (Word*)allocate((size_t)blocks * words, sizeof(Word));
+
+    for (uint32_t b = 0; b < blocks; b++) {
+        const IrBlock* block = &function->blocks[b];
+        scan->current_block = b;
+        scan->block_use = use + (size_t)b * words;
+        for (uint32_t i = 0; i < block->count; i++) {
+            const IrInstr* instr = &block->instrs[i];
+            ir_for_each_use(function, instr, mark_live, scan);
+            if (instr->dst != IR_NO_REG) {
+                scan->defined_in[instr->dst] = b + 1;
+                if (scan->live_index[instr->dst]) {
+                    set_bit(def + (size_t)b * words, scan->live_index[instr->dst] - 1);
+                }
+            }
+        }
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (uint32_t b = blocks; b-- > 0;) {
+            Word* out = live_out + (size_t)b * words;
+            uint32_t succs[2];
+            uint32_t succ_count = ir_successors(&function->blocks[b], succs);
+            for (uint32_t s = 0; s < succ_count; s++) {
+                const Word* succ_in = live_in + (size_t)succs[s] * words;
+                for (uint32_t w = 0; w < words; w++) out[w] |= succ_in[w];
+            }
+            Word* in = live_in + (size_t)b * words;
+            const Word* block_use = use + (size_t)b * words;
+            const Word* block_def = def + (size_t)b * words;
+            for (uint32_t w = 0; w < words; w++) {
+                Word updated = block_use[w] | (out[w] & ~block_def[w]);
+                if (updated != in[w]) {
+                    in[w] = updated;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    // Map dense indices back to registers.
+    IrReg* regs = (IrReg*)allocate(scan->live_count, sizeof(IrReg));
+    for (IrReg reg = 1; reg < function->reg_count; reg++) {
+        if (scan->live_index[reg]) regs[scan->live_index[reg] - 1] = reg;
+    }
+    for (uint32_t b = 0; b < blocks; b++) {
+        const Word* in = live_in + (size_t)b * words;
+        const Word* out = live_out + (size_t)b * words;
+        for (uint32_t bit = 0; bit < scan->live_count; bit++) {
+            if (test_bit(in, bit)) extend(scan, regs[bit], block_start[b]);
+            if (test_bit(out, bit)) extend(scan, regs[bit], block_end[b]);
+        }
+    }
+
+    free(regs);
+    free(use);
+    free(def);
+    free(live_in);
+    scan->live_out = live_out;
+    scan->words = words;
+}
+
+// Register `reg` stands for after coalescing.
+static IrReg find_root(const IrReg* root, IrReg reg) {
+    while (root[reg] != reg) reg = root[reg];
+    return reg;
+}
+
+// Definition or use positions of each register, in ascending order: those
+// of `reg` are positions[first[reg]] up to positions[first[reg + 1]].
+typedef struct {
+    uint32_t* first;
+    uint32_t* positions;
+    uint32_t* blocks; // Block of each position
+} Occurrences;
+
+typedef struct {
+    Occurrences* uses;
+    uint32_t* filled; // Occurrences of each register recorded, or NULL while counting
+    uint32_t position;
+    uint32_t block;
+} Collector;
+
+static void add_occurrence(Occurrences* occurrences, uint32_t* filled, IrReg reg, uint32_t position, uint32_t block) {
+    if (!filled) {
+        occurrences->first[reg + 1]++;
+        return;
+    }
+    uint32_t index = occurrences->first[reg] + filled[reg]++;
+    occurrences->positions[index] = position;
+    occurrences->blocks[index] = block;
+}
+
+static void collect_use(IrReg reg, void* context) {
+    Collector* collector = (Collector*)context;
+    add_occurrence(collector->uses, collector->filled, reg, collector->position, collector->block);
+}
+
+// Fills `defs` and `uses`, numbering blocks in `order`: one pass counts
+// the occurrences of each register, the next records them.
+static void find_occurrences(const IrFunction* function, const uint32_t* order, Occurrences* defs,
+                             Occurrences* uses) {
+    uint32_t reg_count = function->reg_count;
+    Occurrences* both[2] = { defs, uses };
+    for (int i = 0; i < 2; i++) both[i]->first = (uint32_t*)allocate((size_t)reg_count + 1, sizeof(uint32_t));
+    uint32_t* def_filled = (uint32_t*)allocate(reg_count, sizeof(uint32_t));
+    uint32_t* use_filled = (uint32_t*)allocate(reg_count, sizeof(uint32_t));
+    for (int pass = 0; pass < 2; pass++) {
+        Collector collector = { uses, pass ? use_filled : NULL, 0, 0 };
+        for (uint32_t k = 0; k < function->block_count; k++) {
+            collector.block = order[k];
+            const IrBlock* block = &function->blocks[collector.block];
+            for (uint32_t i = 0; i < block->count; i++, collector.position++) {
+                const IrInstr* instr = &block->instrs[i];
+                ir_for_each_use(function, instr, collect_use, &collector);
+                if (instr->dst != IR_NO_REG) {
+                    add_occurrence(defs, pass ? def_filled : NULL, instr->dst, collector.position, collector.block);
+                }
+            }
+        }
+        if (pass) break;
+        for (int o = 0; o < 2; o++) {
+            for (IrReg reg = 0; reg < reg_count; reg++) both[o]->first[reg + 1] += both[o]->first[reg];
+            both[o]->positions = (uint32_t*)allocate(both[o]->first[reg_count], sizeof(uint32_t));
+            both[o]->blocks = (uint32_t*)allocate(both[o]->first[reg_count], sizeof(uint32_t));
+        }
+    }
+    free(def_filled);
+    free(use_filled);
+}
+
+static void free_occurrences(Occurrences* occurrences) {
+    free(occurrences->first);
+    free(occurrences->positions);
+    free(occurrences->blocks);
+}
+
+// Index of the first occurrence of `reg` after `position`.
+static uint32_t next_occurrence(const Occurrences* occurrences, IrReg reg, uint32_t position) {
+    uint32_t low = occurrences->first[reg];
+    uint32_t high = occurrences->first[reg + 1];
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (occurrences->positions[mid] <= position) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Whether `reg` is still needed after `position`, in block `b`: it is read
+// later in the block, or live out of it. Errs towards yes when the
+// definition of `reg` follows in the same block.
+static int live_after(const Scan* scan, const Occurrences* uses, const uint32_t* block_end, IrReg reg,
+                      uint32_t position, uint32_t b) {
+    uint32_t next = next_occurrence(uses, reg, position);
+    if (next < uses->first[reg + 1] && uses->positions[next] <= block_end[b]) return 1;
+    uint32_t index = scan->live_index[reg];
+    return index && test_bit(scan->live_out + (size_t)b * scan->words, index - 1);
+}
+
+// Merges each copy into the interval of its source's root, in position
+// order so chains of copies end up on one root. The two can share a
+// location unless the source is redefined where the copy is still live;
+// only definitions inside the copy's interval can be.
+static void coalesce_copies(Scan* scan, const Copy* copies, uint32_t copy_count, const Occurrences* defs,
+                            const Occurrences* uses, const uint32_t* block_end, IrReg* root) {
+    for (uint32_t i = 0; i < copy_count; i++) {
+        IrReg copy = copies[i].copy;
+        IrReg source = find_root(root, copies[i].source);
+        uint32_t position = copies[i].position;
+        if (copy == source || defs->first[copy + 1] - defs->first[copy] != 1 || scan->start[copy] != position) {
+            continue;
+        }
+        int interferes = 0;
+        for (uint32_t d = next_occurrence(defs, source, position);
+             d < defs->first[source + 1] && defs->positions[d] <= scan->end[copy] && !interferes; d++) {
+            interferes = live_after(scan, uses, block_end, copy, defs->positions[d], defs->blocks[d]);
+        }
+        if (interferes) continue;
+        root[copy] = source;
+        scan->seen[copy] = 0;
+        if (scan->start[copy] < scan->start[source]) scan->start[source] = scan->start[copy];
+        if (scan->end[copy] > scan->end[source]) scan->end[source] = scan->end[copy];
+    }
+}
+
+static int compare_intervals(const void* a, const void* b) {
+    const Interval* left = (const Interval*)a;
+    const Interval* right = (const Interval*)b;
+    if (left->start != right->start) return left->start < right->start ? -1 : 1;
+    return left->reg < right->reg ? -1 : (left->reg > right->reg);
+}
+
+// Whether a call lies strictly inside (start, end): the value is needed
+// after a call that happens while it is live.
+static int crosses_call(const uint32_t* calls, uint32_t call_count, uint32_t start, uint32_t end) {
+    uint32_t low = 0;
+    uint32_t high = call_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (calls[mid] <= start) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low < call_count && calls[low] < end;
+}
+
+void regalloc_linear_scan(const IrFunction* function, const RegisterPool* pool, Allocation* allocation) {
+    uint32_t reg_count = function->reg_count;
+    Scan scan;
+    memset(&scan, 0, sizeof(scan));
+    scan.function = function;
+    scan.start = (uint32_t*)allocate(reg_count, sizeof(uint32_t));
+    scan.end = (uint32_t*)allocate(reg_count, sizeof(uint32_t));
+    scan.seen = (uint8_t*)allocate(reg_count, sizeof(uint8_t));
+    scan.live_index = (uint32_t*)allocate(reg_count, sizeof(uint32_t));
+    scan.defined_in = (uint32_t*)allocate(reg_count, sizeof(uint32_t));
+
+    uint32_t* order = block_order(function);
+    uint32_t* block_start = (uint32_t*)allocate(function->block_count, sizeof(uint32_t));
+    uint32_t* block_end = (uint32_t*)allocate(function->block_count, sizeof(uint32_t));
+    uint32_t instr_count = 0;
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        instr_count += function->blocks[b].count;
+    }
+    uint32_t* calls = (uint32_t*)allocate(instr_count, sizeof(uint32_t));
+    uint32_t call_count = 0;
+    Copy* copies = (Copy*)allocate(instr_count, sizeof(Copy));
+    uint32_t copy_count = 0;
+
+    // Number instructions, collect def/use positions and find the registers
+    // with upward-exposed uses.
+    for (uint32_t k = 0; k < function->block_count; k++) {
+        uint32_t b = order[k];
+        const IrBlock* block = &function->blocks[b];
+        scan.current_block = b;
+        block_start[b] = scan.position;
+        for (uint32_t i = 0; i < block->count; i++) {
+            const IrInstr* instr = &block->instrs[i];
+            ir_for_each_use(function, instr, record_use, &scan);
+            if (instr->dst != IR_NO_REG) {
+                extend(&scan, instr->dst, scan.position);
+                scan.defined_in[instr->dst] = b + 1;
+            }
+            if (instr->op == IR_MOV && instr->a.kind == IR_OPERAND_REG) {
+                copies[copy_count].position = scan.position;
+                copies[copy_count].copy = instr->dst;
+                copies[copy_count].source = (IrReg)instr->a.value;
+                copy_count++;
+            }
+            if (instr->op == IR_CALL) calls[call_count++] = scan.position;
+            scan.position++;
+        }
+        block_end[b] = block->count ? scan.position - 1 : scan.position;
+    }
+
+    if (scan.live_count) {
+        memset(scan.defined_in, 0, reg_count * sizeof(uint32_t));
+        compute_liveness(&scan, block_start, block_end);
+    }
+
+    Occurrences defs;
+    Occurrences uses;
+    find_occurrences(function, order, &defs, &uses);
+    IrReg* root = (IrReg*)allocate(reg_count, sizeof(IrReg));
+    for (IrReg reg = 0; reg < reg_count; reg++) root[reg] = reg;
+    coalesce_copies(&scan, copies, copy_count, &defs, &uses, block_end, root);
+
+    Interval* intervals = (Interval*)allocate(reg_count, sizeof(Interval));
+    uint32_t interval_count = 0;
+    for (IrReg reg = 1; reg < reg_count; reg++) {
+        if (!scan.seen[reg]) continue;
+        Interval* interval = &intervals[interval_count++];
+        interval->reg = reg;
+        interval->start = scan.start[reg];
+        interval->end = scan.end[reg];
+        interval->crosses_call = crosses_call(calls, call_count, interval->start, interval->end);
+    }
+    qsort(intervals, interval_count, sizeof(Interval), compare_intervals);
+
+    allocation->locations = (Location*)allocate(reg_count, sizeof(Location));
+    allocation->spill_slots = 0;
+    allocation->used_registers = 0;
+    for (IrReg reg = 0; reg < reg_count; reg++) {
+        allocation->locations[reg].reg = -1;
+        allocation->locations[reg].slot = -1;
+    }
+
+    // Active intervals, one per occupied pool register.
+    const Interval* active[REGALLOC_MAX_REGISTERS] = { 0 };
+    for (uint32_t i = 0; i < interval_count; i++) {
+        const Interval* current = &intervals[i];
+
+        // A register whose interval ends where this one starts is free: its
+        // last use and this definition are the same instruction, and the
+        // backend reads sources before writing the destination.
+        for (uint32_t r = 0; r < pool->count; r++) {
+            if (active[r] && active[r]->end <= current->start) active[r] = NULL;
+        }
+
+        int chosen = -1;
+        for (int pass = 0; pass < 2 && chosen < 0; pass++) {
+            // Values crossing calls need callee-saved registers; others try
+            // caller-saved ones first, which cost nothing to use.
+            int want_callee_saved = current->crosses_call || pass == 1;
+            for (uint32_t r = 0; r < pool->count; r++) {
+                if (!active[r] && pool->callee_saved[r] == want_callee_saved) {
+                    chosen = (int)r;
+                    break;
+                }
+            }
+            if (current->crosses_call) break;
+        }
+
+        if (chosen < 0) {
+            // Spill whichever eligible interval ends last.
+            int victim = -1;
+            for (uint32_t r = 0; r < pool->count; r++) {
+                if (current->crosses_call && !pool->callee_saved[r]) continue;
+                if (active[r] && (victim < 0 || active[r]->end > active[victim]->end)) victim = (int)r;
+            }
+            if (victim >= 0 && active[victim]->end > current->end) {
+                Location* spilled = &allocation->locations[active[victim]->reg];
+                spilled->reg = -1;
+                spilled->slot = (int32_t)allocation->spill_slots++;
+                chosen = victim;
+            } else {
+                allocation->locations[current->reg].slot = (int32_t)allocation->spill_slots++;
+                continue;
+            }
+        }
+
+        active[chosen] = current;
+        allocation->locations[current->reg].reg = (int8_t)chosen;
+        allocation->used_registers |= 1u << chosen;
+    }
+
+    for (IrReg reg = 1; reg < reg_count; reg++) {
+        if (root[reg] != reg) allocation->locations[reg] = allocation->locations[find_root(root, reg)];
+    }
+
+    free(intervals);
+    free(root);
+    free_occurrences(&defs);
+    free_occurrences(&uses);
+    free(copies);
+    free(calls);
+    free(order);
+    free(block_start);
+    free(block_end);
+    free(scan.start);
+    free(scan.end);
+    free(scan.seen);
+    free(scan.live_index);
+    free(scan.defined_in);
+    free(scan.live_out);
+}
+
+void regalloc_free(Allocation* allocation) {
+    free(allocation->locations);
+    allocation->locations = NULL;
+}
@@ -0,0 +1,34 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <stdint.h>
+#include "ir.h"
+
+// Linear-scan register allocation over an IR function. The target describes
+// its allocatable registers as a pool; the result maps every virtual
+// register to a pool index or a stack slot.
+
+#define REGALLOC_MAX_REGISTERS 16
+
+typedef struct {
+    uint32_t count;
+    // Whether each pool register survives calls. Values live across a call
+    // are only given such registers.
+    uint8_t callee_saved[REGALLOC_MAX_REGISTERS];
+} RegisterPool;
+
+typedef struct {
+    int8_t reg;   // Pool index, or -1 when spilled (or never used)
+    int32_t slot; // Stack slot when spilled, else -1
+} Location;
+
+typedef struct {
+    Location* locations;     // Indexed by IrReg
+    uint32_t spill_slots;
+    uint32_t used_registers; // Bit i set if pool register i is assigned
+} Allocation;
+
+void regalloc_linear_scan(const IrFunction* function, const RegisterPool* pool, Allocation* allocation);
+void regalloc_free(Allocation* allocation);
+
+#endif // REGALLOC_H
@@ -0,0 +1,229 @@
+#include "runtime.h"
+#include "machine.h"
+#include "encode.h"
+#include <stdio.h>
+#include <string.h>
+
+// Size of the output buffer; see runtime/io.asm.
+#define OUTPUT_SIZE 65536
+
+static const char* const builtin_names[BUILTIN_COUNT] = {
+    [BUILTIN_PRINTLN] = "println",
+};
+
+int runtime_find_builtin(Symbol name) {
+    const char* text = symbol_name(name);
+    for (int i = 0; i < BUILTIN_COUNT; i++) {
+        if (strcmp(text, builtin_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+Symbol runtime_builtin_symbol(Builtin builtin) {
+    char text[64];
+    int length = snprintf(text, sizeof(text), RUNTIME_PREFIX "%s", builtin_names[builtin]);
+    return symbol_intern(text, (size_t)length);
+}
+
+int runtime_find_builtin_symbol(Symbol symbol) {
+    const char* text = symbol_name(symbol);
+    size_t prefix = sizeof(RUNTIME_PREFIX) - 1;
+    if (strncmp(text, RUNTIME_PREFIX, prefix) != 0) return -1;
+    for (int i = 0; i < BUILTIN_COUNT; i++) {
+        if (strcmp(text + prefix, builtin_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+void runtime_declare(Emitter* out, const uint8_t used[BUILTIN_COUNT]) {
+    for (int i = 0; i < BUILTIN_COUNT; i++) {
+        if (used[i]) emit_directive(out, "extern", symbol_name(runtime_builtin_symbol((Builtin)i)));
+    }
+    emit_directive(out, "extern", RUNTIME_EXIT);
+    emit_directive(out, "extern", RUNTIME_INDEX_ERROR);
+}
+
+static char output[OUTPUT_SIZE];
+static size_t output_length;
+
+void runtime_flush(void) {
+    fwrite(output, 1, output_length, stdout);
+    fflush(stdout);
+    output_length = 0;
+}
+
+int64_t runtime_println(int64_t value) {
+    if (output_length > OUTPUT_SIZE - 24) runtime_flush();
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* p = end;
+    *--p = '\n';
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    do {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) *--p = '-';
+    memcpy(output + output_length, p, (size_t)(end - p));
+    output_length += (size_t)(end - p);
+    return 0;
+}
+
+static Symbol name_of(const char* text) {
+    return symbol_intern(text, strlen(text));
+}
+
+static MOperand memory(MachineReg base, int64_t offset, int width) {
+    MOperand operand = mstack(base, offset);
+    operand.width = (uint8_t)width;
+    return operand;
+}
+
+static MOperand global(const char* name) {
+    return mglobal(name_of(name), REG_NONE);
+}
+
+static MInstr* emit_cond(MachineFunction* f, MOpcode op, Condition cond, MOperand a, MOperand b) {
+    MInstr* instr = machine_emit2(f, op, a, b);
+    instr->cond = (uint8_t)cond;
+    return instr;
+}
+
+static void encode_and_free(ObjectFile* object, MachineFunction* f) {
+    encode_function(object, f);
+    machine_free(f);
+}
+
+// runtime/io.asm
+static void encode_io(ObjectFile* object) {
+    object_define(object, name_of("manu_output"), SECTION_BSS, OUTPUT_SIZE, 1);
+    object_define(object, name_of("manu_output_length"), SECTION_BSS, 8, 1);
+
+    MachineFunction f;
+    enum { WRITE, DONE };
+    machine_init(&f, name_of("manu_flush"), 0, 2);
+    machine_emit2(&f, M_LEA, mreg64(REG_RSI), global("manu_output"));
+    machine_emit2(&f, M_MOV, mreg64(REG_RDX), global("manu_output_length"));
+    machine_label(&f, WRITE);
+    machine_emit2(&f, M_TEST, mreg64(REG_RDX), mreg64(REG_RDX));
+    machine_jcc(&f, COND_LE, DONE);
+    machine_emit2(&f, M_MOV, mreg(REG_RAX, 4), mimm(1));
+    machine_emit2(&f, M_MOV, mreg(REG_RDI, 4), mimm(1));
+    machine_emit0(&f, M_SYSCALL);
+    machine_emit2(&f, M_CMP, mreg64(REG_RAX), mimm(-4));
+    machine_jcc(&f, COND_E, WRITE);
+    machine_emit2(&f, M_TEST, mreg64(REG_RAX), mreg64(REG_RAX));
+    machine_jcc(&f, COND_LE, DONE);
+    machine_emit2(&f, M_ADD, mreg64(REG_RSI), mreg64(REG_RAX));
+    machine_emit2(&f, M_SUB, mreg64(REG_RDX), mreg64(REG_RAX));
+    machine_emit1(&f, M_JMP, mlabel(WRITE));
+    machine_label(&f, DONE);
+    machine_emit2(&f, M_MOV, global("manu_output_length"), mimm(0));
+    machine_emit0(&f, M_RET);
+    encode_and_free(object, &f);
+
+    machine_init(&f, name_of(RUNTIME_EXIT), 0, 0);
+    machine_emit1(&f, M_PUSH, mreg64(REG_RDI));
+    machine_emit1(&f, M_CALL, mfunction(name_of("manu_flush")));
+    machine_emit1(&f, M_POP, mreg64(REG_RDI));
+    machine_emit2(&f, M_MOV, mreg(REG_RAX, 4), mimm(60));
+    machine_emit0(&f, M_SYSCALL);
+    encode_and_free(object, &f);
+
+    static const char message[] = RUNTIME_INDEX_MESSAGE;
+    object_define(object, name_of("manu_index_message"), SECTION_DATA, sizeof(message) - 1, 0);
+    object_append(object, SECTION_DATA, message, sizeof(message) - 1);
+    machine_init(&f, name_of(RUNTIME_INDEX_ERROR), 0, 0);
+    machine_emit1(&f, M_CALL, mfunction(name_of("manu_flush")));
+    machine_emit2(&f, M_MOV, mreg(REG_RAX, 4), mimm(1));
+    machine_emit2(&f, M_MOV, mreg(REG_RDI, 4), mimm(2));
+    machine_emit2(&f, M_LEA, mreg64(REG_RSI), global("manu_index_message"));
+    machine_emit2(&f, M_MOV, mreg(REG_RDX, 4), mimm((int64_t)sizeof(message) - 1));
+    machine_emit0(&f, M_SYSCALL);
+    machine_emit2(&f, M_MOV, mreg(REG_RDI, 4), mimm(1));
+    machine_emit2(&f, M_MOV, mreg(REG_RAX, 4), mimm(60));
+    machine_emit0(&f, M_SYSCALL);
+    encode_and_free(object, &f);
+}
+
+// runtime/println.asm
+static void encode_println(ObjectFile* object) {
+    object_define(object, name_of("manu_digit_pairs"), SECTION_DATA, 200, 0);
+    for (int i = 0; i < 100; i++) {
+        char pair[2] = { (char)('0' + i / 10), (char)('0' + i % 10) };
+        object_append(object, SECTION_DATA, pair, 2);
+    }
+
+    MachineFunction f;
+    enum { FORMAT, PAIR, LAST, DIGIT, SIGN, COPY, LABELS };
+    machine_init(&f, runtime_builtin_symbol(BUILTIN_PRINTLN), 0, LABELS);
+    machine_emit2(&f, M_MOV, mreg64(REG_RAX), global("manu_output_length"));
+    machine_emit2(&f, M_CMP, mreg64(REG_RAX), mimm(OUTPUT_SIZE - 24));
+    machine_jcc(&f, COND_BE, FORMAT);
+    machine_emit1(&f, M_PUSH, mreg64(REG_RDI));
+    machine_emit1(&f, M_CALL, mfunction(name_of("manu_flush")));
+    machine_emit1(&f, M_POP, mreg64(REG_RDI));
+    machine_label(&f, FORMAT);
+    machine_emit2(&f, M_MOV, mreg64(REG_RAX), mreg64(REG_RDI));
+    machine_emit1(&f, M_NEG, mreg64(REG_RAX));
+    emit_cond(&f, M_CMOVCC, COND_S, mreg64(REG_RAX), mreg64(REG_RDI));
+    machine_emit2(&f, M_LEA, mreg64(REG_RSI), mstack(REG_RSP, -8));
+    machine_emit2(&f, M_MOV, memory(REG_RSI, 0, 1), mimm(10));
+    machine_emit2(&f, M_LEA, mreg64(REG_R8), global("manu_digit_pairs"));
+    machine_emit2(&f, M_MOV, mreg64(REG_R9), mimm(0x28f5c28f5c28f5c3));
+    machine_emit2(&f, M_CMP, mreg64(REG_RAX), mimm(100));
+    machine_jcc(&f, COND_B, LAST);
+    machine_label(&f, PAIR);
+    machine_emit2(&f, M_MOV, mreg64(REG_RCX), mreg64(REG_RAX));
+    machine_emit2(&f, M_SHR, mreg64(REG_RAX), mimm(2));
+    machine_emit1(&f, M_MUL, mreg64(REG_R9));
+    machine_emit2(&f, M_SHR, mreg64(REG_RDX), mimm(2));
+    machine_emit3(&f, M_IMUL, mreg64(REG_RAX), mreg64(REG_RDX), mimm(100));
+    machine_emit2(&f, M_SUB, mreg64(REG_RCX), mreg64(REG_RAX));
+    MOperand pair = maddress(REG_R8, REG_RCX, 2, 0);
+    pair.width = 2;
+    machine_emit2(&f, M_MOVZX, mreg(REG_RCX, 4), pair);
+    machine_emit2(&f, M_SUB, mreg64(REG_RSI), mimm(2));
+    machine_emit2(&f, M_MOV, memory(REG_RSI, 0, 2), mreg(REG_RCX, 2));
+    machine_emit2(&f, M_MOV, mreg64(REG_RAX), mreg64(REG_RDX));
+    machine_emit2(&f, M_CMP, mreg64(REG_RAX), mimm(100));
+    machine_jcc(&f, COND_AE, PAIR);
+    machine_label(&f, LAST);
+    machine_emit2(&f, M_CMP, mreg64(REG_RAX), mimm(10));
+    machine_jcc(&f, COND_B, DIGIT);
+    pair = maddress(REG_R8, REG_RAX, 2, 0);
+    pair.width = 2;
+    machine_emit2(&f, M_MOVZX, mreg(REG_RCX, 4), pair);
+    machine_emit2(&f, M_SUB, mreg64(REG_RSI), mimm(2));
+    machine_emit2(&f, M_MOV, memory(REG_RSI, 0, 2), mreg(REG_RCX, 2));
+    machine_emit1(&f, M_JMP, mlabel(SIGN));
+    machine_label(&f, DIGIT);
+    machine_emit2(&f, M_ADD, mreg(REG_RAX, 4), mimm('0'));
+    machine_emit2(&f, M_SUB, mreg64(REG_RSI), mimm(1));
+    machine_emit2(&f, M_MOV, memory(REG_RSI, 0, 1), mreg(REG_RAX, 1));
+    machine_label(&f, SIGN);
+    machine_emit2(&f, M_TEST, mreg64(REG_RDI), mreg64(REG_RDI));
+    machine_jcc(&f, COND_NS, COPY);
+    machine_emit2(&f, M_SUB, mreg64(REG_RSI), mimm(1));
+    machine_emit2(&f, M_MOV, memory(REG_RSI, 0, 1), mimm('-'));
+    machine_label(&f, COPY);
+    machine_emit2(&f, M_LEA, mreg64(REG_RDX), mstack(REG_RSP, -7));
+    machine_emit2(&f, M_SUB, mreg64(REG_RDX), mreg64(REG_RSI));
+    machine_emit2(&f, M_MOV, mreg64(REG_RCX), global("manu_output_length"));
+    machine_emit2(&f, M_LEA, mreg64(REG_RDI), global("manu_output"));
+    machine_emit2(&f, M_ADD, mreg64(REG_RDI), mreg64(REG_RCX));
+    machine_emit2(&f, M_ADD, mreg64(REG_RCX), mreg64(REG_RDX));
+    machine_emit2(&f, M_MOV, global("manu_output_length"), mreg64(REG_RCX));
+    for (int offset = 0; offset < 24; offset += 8) {
+        machine_emit2(&f, M_MOV, mreg64(REG_RAX), memory(REG_RSI, offset, 8));
+        machine_emit2(&f, M_MOV, memory(REG_RDI, offset, 8), mreg64(REG_RAX));
+    }
+    machine_emit2(&f, M_XOR, mreg(REG_RAX, 4), mreg(REG_RAX, 4));
+    machine_emit0(&f, M_RET);
+    encode_and_free(object, &f);
+}
+
+void runtime_encode(ObjectFile* object, const uint8_t used[BUILTIN_COUNT]) {
+    encode_io(object);
+    if (used[BUILTIN_PRINTLN]) encode_println(object);
+}
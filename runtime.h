@@ -0,0 +1,58 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <stdint.h>
+#include "intern.h"
+#include "emit.h"
+#include "object.h"
+
+// Functions the runtime library provides to programs that call them
+// without defining them. The library is assembled separately from the
+// sources in runtime/ into libmanu.a, one object per builtin, so the
+// linker pulls in only those a program uses; see README.md.
+typedef enum {
+    BUILTIN_PRINTLN,
+    BUILTIN_COUNT,
+} Builtin;
+
+// Every symbol the runtime defines starts with RUNTIME_PREFIX, and the
+// lexer rejects names that do, so programs cannot collide with it. A
+// builtin is linked under its name with the prefix added: println is
+// manu_println.
+#define RUNTIME_PREFIX "manu_"
+
+// Exits with the status in rdi once buffered output is written. Programs
+// that use any builtin exit through it.
+#define RUNTIME_EXIT "manu_exit"
+
+// Writes out buffered output, reports an array index out of bounds on
+// stderr and exits with status 1. Compiled code jumps to a call to it when
+// a bounds check fails; it does not return.
+#define RUNTIME_INDEX_ERROR "manu_index_error"
+#define RUNTIME_INDEX_MESSAGE "Error: Index out of bounds\n"
+
+// The builtin called `name`, or -1.
+int runtime_find_builtin(Symbol name);
+
+// The symbol `builtin` is linked under, and the builtin linked under
+// `symbol`, or -1.
+Symbol runtime_builtin_symbol(Builtin builtin);
+int runtime_find_builtin_symbol(Symbol symbol);
+
+// Declares extern each builtin whose `used` entry is nonzero, RUNTIME_EXIT
+// and RUNTIME_INDEX_ERROR.
+void runtime_declare(Emitter* out, const uint8_t used[BUILTIN_COUNT]);
+
+// Adds the code and data of those builtins, RUNTIME_EXIT and
+// RUNTIME_INDEX_ERROR to `object`, for executables written without the
+// library. The code is the same as in runtime/, instruction for
+// instruction; the two are kept in step.
+void runtime_encode(ObjectFile* object, const uint8_t used[BUILTIN_COUNT]);
+
+// C versions of the builtins, for programs run inside the transpiler.
+// Output is buffered as runtime/io.asm buffers it; runtime_flush writes it
+// to stdout. Like the native builtins, runtime_println returns 0.
+int64_t runtime_println(int64_t value);
+void runtime_flush(void);
+
+#endif // RUNTIME_H
@@ -0,0 +1,70 @@
+; Output buffering shared by the builtins that write to stdout.
+;
+; Output is collected in a 64 KB buffer and written to stdout when a
+; builtin finds it too full for what it is about to add, and when the
+; program exits. Compiled programs that use any builtin exit through
+; manu_exit rather than making the exit syscall themselves.
+;
+; runtime.c encodes the same instructions for --emit=exe; change both together.
+
+OUTPUT_SIZE equ 65536
+
+global manu_output
+global manu_output_length
+global manu_flush
+global manu_exit
+global manu_index_error
+
+section .bss
+manu_output: resb OUTPUT_SIZE
+manu_output_length: resq 1
+
+section .rodata
+manu_index_message: db "Error: Index out of bounds", 10
+INDEX_MESSAGE_LENGTH equ $ - manu_index_message
+
+section .text
+
+; Writes out the buffer and empties it. A write interrupted before it
+; wrote anything is retried; after any other error the output is dropped.
+; Clobbers rax, rcx, rdx, rsi, rdi and r11.
+manu_flush:
+  lea rsi, [rel manu_output]
+  mov rdx, [rel manu_output_length]
+.write:
+  test rdx, rdx
+  jle .done
+  mov eax, 1                ; write
+  mov edi, 1                ; stdout
+  syscall
+  cmp rax, -4               ; -EINTR
+  je .write
+  test rax, rax
+  jle .done
+  add rsi, rax
+  sub rdx, rax
+  jmp .write
+.done:
+  mov qword [rel manu_output_length], 0
+  ret
+
+; Exits with the status in rdi once the buffer is written.
+manu_exit:
+  push rdi
+  call manu_flush
+  pop rdi
+  mov eax, 60               ; exit
+  syscall
+
+; Called by compiled code when an array index is out of bounds: writes out
+; the buffer, reports the error on stderr and exits with status 1.
+manu_index_error:
+  call manu_flush
+  mov eax, 1                ; write
+  mov edi, 2                ; stderr
+  lea rsi, [rel manu_index_message]
+  mov edx, INDEX_MESSAGE_LENGTH
+  syscall
+  mov edi, 1
+  mov eax, 60               ; exit
+  syscall
@@ -0,0 +1,95 @@
+; println(value): writes a signed 64-bit integer and a newline, and returns 0.
+;
+; The line is formatted right to left in the red zone, then a fixed 24
+; bytes are copied into the output buffer, which is advanced by the line's
+; length. Digits come two at a time from a table of "00".."99", and the
+; quotient by 100 from a multiplication by its reciprocal rather than div.
+; A negative value's magnitude is taken as unsigned, so INT64_MIN prints
+; correctly too. Clobbers only caller-saved registers.
+;
+; runtime.c encodes the same instructions for --emit=exe; change both together.
+
+OUTPUT_SIZE equ 65536          ; As in io.asm
+
+extern manu_output
+extern manu_output_length
+extern manu_flush
+
+global manu_println
+
+section .rodata
+manu_digit_pairs:
+    db "00010203040506070809"
+    db "10111213141516171819"
+    db "20212223242526272829"
+    db "30313233343536373839"
+    db "40414243444546474849"
+    db "50515253545556575859"
+    db "60616263646566676869"
+    db "70717273747576777879"
+    db "80818283848586878889"
+    db "90919293949596979899"
+
+section .text
+manu_println:
+  mov rax, [rel manu_output_length]
+  cmp rax, OUTPUT_SIZE - 24     ; Room for the copy
+  jbe .format
+  push rdi
+  call manu_flush
+  pop rdi
+.format:
+  mov rax, rdi
+  neg rax
+  cmovs rax, rdi                ; rax = |value|
+  lea rsi, [rsp - 8]
+  mov byte [rsi], 10
+  lea r8, [rel manu_digit_pairs]
+  mov r9, 0x28f5c28f5c28f5c3    ; 2^66 / 100, rounded up
+  cmp rax, 100
+  jb .last
+.pair:
+  mov rcx, rax
+  shr rax, 2
+  mul r9
+  shr rdx, 2                    ; rdx = rcx / 100
+  imul rax, rdx, 100
+  sub rcx, rax
+  movzx ecx, word [r8 + rcx*2]
+  sub rsi, 2
+  mov [rsi], cx
+  mov rax, rdx
+  cmp rax, 100
+  jae .pair
+.last:
+  cmp rax, 10
+  jb .digit
+  movzx ecx, word [r8 + rax*2]
+  sub rsi, 2
+  mov [rsi], cx
+  jmp .sign
+.digit:
+  add eax, '0'
+  sub rsi, 1
+  mov [rsi], al
+.sign:
+  test rdi, rdi
+  jns .copy
+  sub rsi, 1
+  mov byte [rsi], '-'
+.copy:
+  lea rdx, [rsp - 7]
+  sub rdx, rsi                  ; Length including the newline
+  mov rcx, [rel manu_output_length]
+  lea rdi, [rel manu_output]
+  add rdi, rcx
+  add rcx, rdx
+  mov [rel manu_output_length], rcx
+  mov rax, [rsi]
+  mov [rdi], rax
+  mov rax, [rsi + 8]
+  mov [rdi + 8], rax
+  mov rax, [rsi + 16]
+  mov [rdi + 16], rax
+  xor eax, eax
+  ret
@@ -0,0 +1,104 @@
+#define _DEFAULT_SOURCE // For MAP_ANONYMOUS and madvise
+#include "source.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STREAM_CHUNK_SIZE (64 * 1024)
+
+// Maps a regular file read-only. The mapping is placed inside a reservation
+// one byte larger than the file, so the byte after the last one is always
+// readable and zero: either the tail of the file's last page, which the
+// kernel zero-fills, or the anonymous page behind it.
+static int map_file(SourceBuffer* source, int fd, size_t size) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t reserved = (size + 1 + page_size - 1) & ~(page_size - 1);
+
+    char* base = mmap(NULL, reserved, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return -1;
+    if (mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        int saved_errno = errno;
+        munmap(base, reserved);
+        errno = saved_errno;
+        return -1;
+    }
+    madvise(base, size, MADV_SEQUENTIAL);
+
+    source->data = base;
+    source->length = size;
+    source->mapped_size = reserved;
+    return 0;
+}
+
+// Reads a pipe, terminal or other unmappable file to EOF.
+static int stream_file(SourceBuffer* source, int fd) {
+    size_t capacity = STREAM_CHUNK_SIZE;
+    size_t length = 0;
+    char* buffer = malloc(capacity + 1);
+    if (!buffer) return -1;
+
+    for (;;) {
+        if (length == capacity) {
+            capacity *= 2;
+            char* grown = realloc(buffer, capacity + 1);
+            if (!grown) {
+                free(buffer);
+                errno = ENOMEM;
+                return -1;
+            }
+            buffer = grown;
+        }
+        ssize_t n = read(fd, buffer + length, capacity - length);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            int saved_errno = errno;
+            free(buffer);
+            errno = saved_errno;
+            return -1;
+        }
+        length += (size_t)n;
+    }
+
+    buffer[length] = '\0';
+    source->data = buffer;
+    source->length = length;
+    source->mapped_size = 0;
+    return 0;
+}
+
+int source_open(SourceBuffer* source, const char* path) {
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    int result;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        result = map_file(source, fd, (size_t)st.st_size);
+        if (result != 0) result = stream_file(source, fd);
+    } else {
+        result = stream_file(source, fd);
+    }
+
+    if (fd != STDIN_FILENO) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    }
+    return result;
+}
+
+void source_close(SourceBuffer* source) {
+    if (source->mapped_size) {
+        munmap((void*)source->data, source->mapped_size);
+    } else {
+        free((void*)source->data);
+    }
+    source->data = NULL;
+    source->length = 0;
+    source->mapped_size = 0;
+}
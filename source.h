@@ -0,0 +1,19 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+
+// An input file's contents. Regular files are mapped read-only; pipes and
+// stdin are streamed into a heap buffer. Either way `data` is followed by a
+// NUL byte at data[length], which the lexer uses as its sentinel.
+typedef struct {
+    const char* data;
+    size_t length;
+    size_t mapped_size; // Size of the mapping, or 0 if `data` is heap memory
+} SourceBuffer;
+
+// Opens `path` ("-" for stdin). Returns 0 on success, -1 with errno set.
+int source_open(SourceBuffer* source, const char* path);
+void source_close(SourceBuffer* source);
+
+#endif // SOURCE_H
@@ -0,0 +1,111 @@
+#include "tail.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// A self tail call is a CALL to the function itself followed by a RET of
+// its result, or of nothing. The entry block is split after its PARAM
+// instructions, and each such call becomes moves of the arguments to the
+// PARAM registers and a jump to the second half. Parameters are copied to
+// their variables there, so the registers are not read anywhere else; an
+// argument that reads one is copied to a temporary before any is written.
+
+static int is_self_tail_call(const IrFunction* function, const IrBlock* block) {
+    if (block->count < 2) return 0;
+    const IrInstr* call = &block->instrs[block->count - 2];
+    const IrInstr* ret = &block->instrs[block->count - 1];
+    if (call->op != IR_CALL || call->symbol != function->name || ret->op != IR_RET) return 0;
+    return ret->a.kind == IR_OPERAND_NONE || (ret->a.kind == IR_OPERAND_REG && (IrReg)ret->a.value == call->dst);
+}
+
+// Moves the entry block's instructions after its parameters to a new block
+// placed right after it; returns the new block's number.
+static uint32_t split_entry(IrFunction* function, uint32_t param_count) {
+    uint32_t body = ir_add_block(function);
+    for (uint32_t i = param_count; i < function->blocks[0].count; i++) {
+        IrInstr instr = function->blocks[0].instrs[i];
+        *ir_append(function, body, (IrOp)instr.op) = instr;
+    }
+    function->blocks[0].count = param_count;
+    ir_append(function, 0, IR_JUMP)->target = body;
+    return body;
+}
+
+static void replace_call(IrFunction* function, uint32_t b, const IrReg* params, uint32_t param_count, uint32_t body) {
+    IrBlock* block = &function->blocks[b];
+    IrInstr call = block->instrs[block->count - 2];
+    block->count -= 2;
+
+    IrOperand* values = (IrOperand*)malloc((param_count ? param_count : 1) * sizeof(IrOperand));
+    if (!values) {
+        fprintf(stderr, "Error: Out of memory eliminating tail calls\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < param_count; i++) {
+        values[i] = i < call.other ? function->args[call.target + i] : ir_imm(0);
+        if (values[i].kind != IR_OPERAND_REG) continue;
+        for (uint32_t j = 0; j < param_count; j++) {
+            if ((IrReg)values[i].value != params[j] || j == i) continue;
+            IrInstr* copy = ir_append(function, b, IR_MOV);
+            copy->dst = ir_new_reg(function, IR_TYPE_I64);
+            copy->type = IR_TYPE_I64;
+            copy->a = values[i];
+            values[i] = ir_reg(copy->dst);
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < param_count; i++) {
+        if (values[i].kind == IR_OPERAND_REG && (IrReg)values[i].value == params[i]) continue;
+        IrInstr* move = ir_append(function, b, IR_MOV);
+        move->dst = params[i];
+        move->type = IR_TYPE_I64;
+        move->a = values[i];
+    }
+    ir_append(function, b, IR_JUMP)->target = body;
+    free(values);
+}
+
+static uint32_t eliminate_in_function(IrFunction* function) {
+    uint32_t block_count = function->block_count;
+    uint32_t calls = 0;
+    for (uint32_t b = 0; b < block_count; b++) {
+        if (is_self_tail_call(function, &function->blocks[b])) calls++;
+    }
+    if (!calls) return 0;
+
+    uint32_t param_count = 0;
+    while (param_count < function->blocks[0].count && function->blocks[0].instrs[param_count].op == IR_PARAM) {
+        param_count++;
+    }
+    IrReg* params = (IrReg*)malloc((param_count ? param_count : 1) * sizeof(IrReg));
+    uint32_t* order = (uint32_t*)malloc((block_count + 1) * sizeof(uint32_t));
+    if (!params || !order) {
+        fprintf(stderr, "Error: Out of memory eliminating tail calls\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < param_count; i++) params[i] = function->blocks[0].instrs[i].dst;
+
+    uint32_t body = split_entry(function, param_count);
+    // The entry block's calls are in the second half now.
+    for (uint32_t b = 0; b < block_count; b++) {
+        uint32_t block = b == 0 ? body : b;
+        if (is_self_tail_call(function, &function->blocks[block])) {
+            replace_call(function, block, params, param_count, body);
+        }
+    }
+
+    order[0] = 0;
+    order[1] = body;
+    for (uint32_t b = 1; b < block_count; b++) order[b + 1] = b;
+    ir_reorder_blocks(function, order, block_count + 1);
+    free(order);
+    free(params);
+    return calls;
+}
+
+uint32_t eliminate_tail_recursion(IrProgram* program) {
+    uint32_t calls = 0;
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        if (!program->functions[f].is_entry) calls += eliminate_in_function(&program->functions[f]);
+    }
+    return calls;
+}
@@ -0,0 +1,14 @@
+#ifndef TAIL_H
+#define TAIL_H
+
+#include <stdint.h>
+#include "ir.h"
+
+// Turns each call a function makes to itself whose result it returns
+// straight away into a jump back to the start of its body, with the
+// arguments assigned to the parameters. Deep self-recursion then runs as a
+// loop in one frame. Tail calls to other functions are left to the code
+// generator, which makes them jumps. Returns the number of calls replaced.
+uint32_t eliminate_tail_recursion(IrProgram* program);
+
+#endif // TAIL_H
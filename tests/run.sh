@@ -0,0 +1,138 @@
+#!/bin/sh
+# Builds the transpiler and runs each tests/*.manu program through every
+# backend, comparing stdout with the .out file next to it and the exit
+# status with the "// Expected exit status: N" line (0 if there is none):
+#
+#   asm        nasm and ld against libmanu.a (needs nasm)
+#   obj        --emit=obj, linked with ld against libmanu.a (needs nasm)
+#   exe        --emit=exe
+#   run        --run
+#   interpret  --interpret
+#
+# The native paths run at -O0 and -O1. A program with an
+# "// Expected error: TEXT" line must instead be rejected on every path,
+# with TEXT on stderr and no output file left behind.
+#
+# Usage: tests/run.sh [CC]
+
+CC=${1:-gcc}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+SOURCES="main.c source.c intern.c arena.c lexer.c parser.c ast.c ir.c lower.c tail.c fold.c inline.c dce.c
+         loop.c regalloc.c codegen.c runtime.c machine.c peephole.c encode.c object.c elf64.c jit.c
+         bytecode.c interpret.c emit.c"
+(cd "$ROOT" && $CC -std=c99 -O2 -o "$WORK/manu_transpiler" $SOURCES) || exit 1
+MANU="$WORK/manu_transpiler"
+
+if command -v nasm > /dev/null; then
+    nasm -f elf64 "$ROOT/runtime/io.asm" -o "$WORK/io.o" &&
+    nasm -f elf64 "$ROOT/runtime/println.asm" -o "$WORK/println.o" &&
+    ar rcs "$WORK/libmanu.a" "$WORK/io.o" "$WORK/println.o" || exit 1
+    LINKED="asm obj"
+else
+    echo "nasm not found: skipping the asm and obj paths"
+    LINKED=""
+fi
+
+passed=0
+failed=0
+
+# check NAME PATH EXPECTED_OUT EXPECTED_STATUS: compares $WORK/stdout and
+# $status with the expectations.
+check() {
+    if [ "$status" = "$4" ] && cmp -s "$WORK/stdout" "$3"; then
+        passed=$((passed + 1))
+    else
+        failed=$((failed + 1))
+        echo "FAIL: $2 ($1): exit status $status, expected $4"
+        diff "$3" "$WORK/stdout" | head -n 10
+    fi
+}
+
+# Builds program $1 with the given path and options into $WORK/program.
+build() {
+    path=$1
+    program=$2
+    shift 2
+    case $path in
+        asm) "$MANU" "$@" "$program" > /dev/null &&
+             nasm -f elf64 output.asm -o output.o &&
+             ld output.o "$WORK/libmanu.a" -o program ;;
+        obj) "$MANU" "$@" --emit=obj "$program" > /dev/null &&
+             ld output.o "$WORK/libmanu.a" -o program ;;
+        exe) "$MANU" "$@" --emit=exe "$program" > /dev/null && mv output program ;;
+    esac
+}
+
+# check_error NAME PATH TEXT OPTIONS...: the transpiler must fail with TEXT
+# on stderr and write no output file.
+check_error() {
+    name=$1
+    path=$2
+    text=$3
+    shift 3
+    rm -f output.asm output.o output
+    if "$MANU" "$@" > /dev/null 2> stderr; then
+        failed=$((failed + 1))
+        echo "FAIL: $name ($path): compiled, expected \"$text\""
+    elif ! grep -qF "$text" stderr; then
+        failed=$((failed + 1))
+        echo "FAIL: $name ($path): expected \"$text\", got:"
+        head -n 3 stderr
+    elif [ -e output.asm ] || [ -e output.o ] || [ -e output ]; then
+        failed=$((failed + 1))
+        echo "FAIL: $name ($path): left an output file behind"
+    else
+        passed=$((passed + 1))
+    fi
+}
+
+cd "$WORK" || exit 1
+for program in "$ROOT"/tests/*.manu; do
+    name=$(basename "$program" .manu)
+    error=$(sed -n 's|^// Expected error: ||p' "$program")
+    if [ -n "$error" ]; then
+        for level in -O0 -O1; do
+            check_error "$name" "asm $level" "$error" $level "$program"
+            check_error "$name" "obj $level" "$error" $level --emit=obj "$program"
+            check_error "$name" "exe $level" "$error" $level --emit=exe "$program"
+            check_error "$name" "run $level" "$error" $level --run "$program"
+        done
+        check_error "$name" "interpret" "$error" --interpret "$program"
+        continue
+    fi
+    expected="$ROOT/tests/$name.out"
+    expected_status=$(sed -n 's|^// Expected exit status: \([0-9]*\)$|\1|p' "$program")
+    expected_status=${expected_status:-0}
+
+    for level in -O0 -O1; do
+        for path in $LINKED exe; do
+            rm -f program
+            if ! build $path "$program" $level; then
+                failed=$((failed + 1))
+                echo "FAIL: $name ($path $level): build failed"
+                continue
+            fi
+            ./program > stdout 2> /dev/null
+            status=$?
+            check "$path $level" "$name" "$expected" "$expected_status"
+        done
+
+        # --run writes /tmp/perf-<pid>.map; remove it once the run is over
+        "$MANU" $level --run "$program" > stdout 2> /dev/null &
+        pid=$!
+        wait $pid
+        status=$?
+        rm -f "/tmp/perf-$pid.map"
+        check "run $level" "$name" "$expected" "$expected_status"
+    done
+
+    "$MANU" --interpret "$program" > stdout 2> /dev/null
+    status=$?
+    check "interpret" "$name" "$expected" "$expected_status"
+done
+
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]